@@ -0,0 +1,335 @@
+// archive_bench.cpp - Throughput benchmarks for the codec, create, extract,
+// open/list and self-extracting paths.
+//
+// Corpora are generated from fixed seeds on first use, so runs are
+// comparable across machines and commits. Use
+//   archive_bench --benchmark_out=bench.json --benchmark_out_format=json
+// (or the run_benchmarks target) to record results.
+
+#include <benchmark/benchmark.h>
+#include "Archive.h"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Scale factor for corpus sizes, from ARCHIVE_BENCH_SCALE (default 1)
+double corpusScale() {
+    static const double scale = [] {
+        const char* value = std::getenv("ARCHIVE_BENCH_SCALE");
+        double parsed = value ? std::atof(value) : 1.0;
+        return parsed > 0 ? parsed : 1.0;
+    }();
+    return scale;
+}
+
+size_t scaled(size_t bytes) {
+    return static_cast<size_t>(static_cast<double>(bytes) * corpusScale());
+}
+
+// Starts a peak RSS measurement for one benchmark. Only Linux can reset the
+// high-water mark (VmHWM, through /proc/self/clear_refs); elsewhere the peak
+// covers the whole process so far. Returns true if it was reset.
+bool resetPeakRss() {
+#ifdef __linux__
+    std::ofstream clear("/proc/self/clear_refs");
+    return static_cast<bool>(clear << "5" << std::flush);
+#else
+    return false;
+#endif
+}
+
+double peakRssMegabytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters{};
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return static_cast<double>(counters.PeakWorkingSetSize) / (1024.0 * 1024.0);
+#else
+#ifdef __linux__
+    // ru_maxrss is not reset by clear_refs, VmHWM is
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::atof(line.c_str() + 6) / 1024.0;
+        }
+    }
+#endif
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<double>(usage.ru_maxrss) / (1024.0 * 1024.0);
+#else
+    return static_cast<double>(usage.ru_maxrss) / 1024.0;
+#endif
+#endif
+}
+
+// Text built from a small vocabulary, compresses roughly like source code
+std::vector<char> makeText(size_t size, uint32_t seed) {
+    static const char* words[] = {"archive", "entry", "header", "compress", "stream", "buffer",
+                                  "return", "const", "size_t", "std::vector", "if", "for",
+                                  "while", "{", "}", "(", ");", "=", "0", "1", "\n", "    "};
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<size_t> pick(0, sizeof(words) / sizeof(words[0]) - 1);
+    std::vector<char> data;
+    data.reserve(size + 16);
+    while (data.size() < size) {
+        const char* word = words[pick(rng)];
+        data.insert(data.end(), word, word + std::char_traits<char>::length(word));
+        data.push_back(' ');
+    }
+    data.resize(size);
+    return data;
+}
+
+std::vector<char> makeRandom(size_t size, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<char> data(size);
+    for (auto& byte : data) {
+        byte = static_cast<char>(rng());
+    }
+    return data;
+}
+
+void writeFile(const fs::path& path, const std::vector<char>& data) {
+    fs::create_directories(path.parent_path());
+    std::ofstream out(path, std::ios::binary);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+// Temporarily discards std::cout, which Archive uses for status messages
+class QuietOutput {
+public:
+    QuietOutput() : saved(std::cout.rdbuf(sink.rdbuf())) {}
+    ~QuietOutput() { std::cout.rdbuf(saved); }
+
+private:
+    std::ostringstream sink;
+    std::streambuf* saved;
+};
+
+struct Corpus {
+    std::vector<fs::path> files;
+    uint64_t totalBytes = 0;
+    fs::path archivePath;
+};
+
+fs::path benchRoot() {
+    static const fs::path root = fs::temp_directory_path() / "archive_bench";
+    return root;
+}
+
+enum CorpusKind { TinyFiles, HugeFiles, Incompressible, Text };
+
+const char* corpusName(int kind) {
+    switch (kind) {
+    case TinyFiles: return "tiny_files";
+    case HugeFiles: return "huge_files";
+    case Incompressible: return "incompressible";
+    default: return "text";
+    }
+}
+
+// Builds (once) the files of a corpus and an archive containing them
+const Corpus& corpus(int kind) {
+    static std::map<int, Corpus> cache;
+    auto it = cache.find(kind);
+    if (it != cache.end()) {
+        return it->second;
+    }
+
+    Corpus c;
+    fs::path dir = benchRoot() / corpusName(kind);
+    fs::remove_all(dir);
+    auto add = [&](const fs::path& path, const std::vector<char>& data) {
+        writeFile(path, data);
+        c.files.push_back(path);
+        c.totalBytes += data.size();
+    };
+
+    switch (kind) {
+    case TinyFiles: {
+        size_t count = scaled(5000);
+        for (size_t i = 0; i < count; ++i) {
+            fs::path path = dir / ("d" + std::to_string(i % 50)) / ("f" + std::to_string(i) + ".txt");
+            add(path, makeText(64 + (i * 37) % 2048, static_cast<uint32_t>(i)));
+        }
+        break;
+    }
+    case HugeFiles:
+        for (uint32_t i = 0; i < 2; ++i) {
+            auto data = makeText(scaled(32u << 20), 1000 + i);
+            auto noise = makeRandom(data.size() / 8, 2000 + i);
+            std::copy(noise.begin(), noise.end(), data.begin() + static_cast<std::ptrdiff_t>(data.size() / 2));
+            add(dir / ("huge" + std::to_string(i) + ".bin"), data);
+        }
+        break;
+    case Incompressible:
+        for (uint32_t i = 0; i < 4; ++i) {
+            add(dir / ("random" + std::to_string(i) + ".bin"), makeRandom(scaled(4u << 20), 3000 + i));
+        }
+        break;
+    default:
+        for (uint32_t i = 0; i < 16; ++i) {
+            add(dir / ("text" + std::to_string(i) + ".txt"), makeText(scaled(1u << 20), 4000 + i));
+        }
+        break;
+    }
+
+    c.archivePath = benchRoot() / (std::string(corpusName(kind)) + ".arc");
+    {
+        QuietOutput quiet;
+        Archive(c.archivePath.string()).create(c.files);
+    }
+    return cache.emplace(kind, std::move(c)).first->second;
+}
+
+// peakReset says whether resetPeakRss() succeeded before the timed loop;
+// if not, the column is named for what it measures, the process peak
+void reportCounters(benchmark::State& state, uint64_t bytes, uint64_t files, bool peakReset) {
+    if (bytes > 0) {
+        state.SetBytesProcessed(static_cast<int64_t>(bytes) * state.iterations());
+    }
+    if (files > 0) {
+        state.counters["files/s"] = benchmark::Counter(static_cast<double>(files) * state.iterations(),
+                                                       benchmark::Counter::kIsRate);
+    }
+    state.counters[peakReset ? "peak_rss_mb" : "process_peak_rss_mb"] = peakRssMegabytes();
+}
+
+// ---------------------------------------------------------------------------
+
+void BM_CompressData(benchmark::State& state) {
+    const bool incompressible = state.range(0) != 0;
+    const auto level = static_cast<CompressionType>(state.range(1));
+    const auto input = incompressible ? makeRandom(scaled(8u << 20), 7) : makeText(scaled(8u << 20), 7);
+
+    size_t compressedSize = 0;
+    const bool peakReset = resetPeakRss();
+    for (auto _ : state) {
+        auto output = Archive::compressData(input, level);
+        compressedSize = output.size();
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.SetLabel(incompressible ? "incompressible" : "text");
+    state.counters["ratio"] = static_cast<double>(input.size()) / static_cast<double>(std::max<size_t>(compressedSize, 1));
+    reportCounters(state, input.size(), 0, peakReset);
+}
+BENCHMARK(BM_CompressData)
+    ->ArgsProduct({{0, 1},
+                   {static_cast<int>(CompressionType::Fastest), static_cast<int>(CompressionType::Fast),
+                    static_cast<int>(CompressionType::Normal), static_cast<int>(CompressionType::Best)}})
+    ->Unit(benchmark::kMillisecond);
+
+void BM_Create(benchmark::State& state) {
+    const Corpus& c = corpus(static_cast<int>(state.range(0)));
+    const std::string target = (benchRoot() / "create_out.arc").string();
+    const bool peakReset = resetPeakRss();
+    for (auto _ : state) {
+        QuietOutput quiet;
+        Archive archive(target);
+        archive.create(c.files);
+    }
+    fs::remove(target);
+    state.SetLabel(corpusName(static_cast<int>(state.range(0))));
+    reportCounters(state, c.totalBytes, c.files.size(), peakReset);
+}
+BENCHMARK(BM_Create)->DenseRange(TinyFiles, Text)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_Extract(benchmark::State& state) {
+    const Corpus& c = corpus(static_cast<int>(state.range(0)));
+    const fs::path outDir = benchRoot() / "extract_out";
+    Archive archive(c.archivePath.string());
+    const bool peakReset = resetPeakRss();
+    for (auto _ : state) {
+        state.PauseTiming();
+        fs::remove_all(outDir);
+        state.ResumeTiming();
+        QuietOutput quiet;
+        archive.extract(outDir.string());
+    }
+    fs::remove_all(outDir);
+    state.SetLabel(corpusName(static_cast<int>(state.range(0))));
+    reportCounters(state, c.totalBytes, c.files.size(), peakReset);
+}
+BENCHMARK(BM_Extract)->DenseRange(TinyFiles, Text)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Opening with the persisted index (range 0) or by scanning entry headers
+// after the index trailer has been cut off (range 1)
+void BM_Open(benchmark::State& state) {
+    const Corpus& c = corpus(TinyFiles);
+    fs::path path = c.archivePath;
+    if (state.range(0) != 0) {
+        path = benchRoot() / "tiny_files_noindex.arc";
+        fs::copy_file(c.archivePath, path, fs::copy_options::overwrite_existing);
+        fs::resize_file(path, fs::file_size(path) - 1);
+    }
+    const bool peakReset = resetPeakRss();
+    for (auto _ : state) {
+        Archive archive(path.string());
+        benchmark::DoNotOptimize(archive.getEntries().size());
+    }
+    state.SetLabel(state.range(0) != 0 ? "header_scan" : "index");
+    reportCounters(state, 0, c.files.size(), peakReset);
+}
+BENCHMARK(BM_Open)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+void BM_ListPrefix(benchmark::State& state) {
+    const Corpus& c = corpus(TinyFiles);
+    Archive archive(c.archivePath.string());
+    uint64_t listed = 0;
+    const bool peakReset = resetPeakRss();
+    for (auto _ : state) {
+        auto entries = archive.listPrefix("d17");
+        listed = entries.size();
+        benchmark::DoNotOptimize(entries.data());
+    }
+    reportCounters(state, 0, listed, peakReset);
+}
+BENCHMARK(BM_ListPrefix)->Unit(benchmark::kMicrosecond);
+
+void BM_CreateSelfExtracting(benchmark::State& state) {
+    const Corpus& c = corpus(Text);
+    const std::string target = (benchRoot() / "sfx_out.bin").string();
+    const bool peakReset = resetPeakRss();
+    for (auto _ : state) {
+        QuietOutput quiet;
+        Archive archive((benchRoot() / "sfx_temp.arc").string());
+        archive.createSelfExtracting(c.files, target, CompressionType::Normal);
+    }
+    fs::remove(target);
+    reportCounters(state, c.totalBytes, c.files.size(), peakReset);
+}
+BENCHMARK(BM_CreateSelfExtracting)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+} // namespace
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    std::error_code ec;
+    fs::remove_all(benchRoot(), ec);
+    return 0;
+}
@@ -0,0 +1,22 @@
+# Writes a C++ source file that defines a byte array with the contents of a
+# file. Run in script mode:
+#   cmake -DINPUT=<file> -DOUTPUT=<source> -DSYMBOL=<name> -P EmbedFile.cmake
+# The source defines `const unsigned char <SYMBOL>[]` and
+# `const size_t <SYMBOL>_SIZE`.
+
+file(READ "${INPUT}" content HEX)
+string(LENGTH "${content}" hexLength)
+math(EXPR size "${hexLength} / 2")
+
+# Two hex digits per byte, 32 bytes per line
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${content}")
+string(REGEX REPLACE "((0x[0-9a-f][0-9a-f],){32})" "\\1\n" bytes "${bytes}")
+
+file(WRITE "${OUTPUT}.tmp"
+    "// Generated from ${INPUT} by EmbedFile.cmake - do not edit\n"
+    "#include <cstddef>\n\n"
+    "extern const unsigned char ${SYMBOL}[] = {\n${bytes}\n};\n"
+    "extern const size_t ${SYMBOL}_SIZE = ${size};\n")
+# Only touch the output when it changes, so dependents are not rebuilt needlessly
+configure_file("${OUTPUT}.tmp" "${OUTPUT}" COPYONLY)
+file(REMOVE "${OUTPUT}.tmp")
@@ -1,5 +1,7 @@
 #include <iostream>
+#include <fstream>
 #include <filesystem>
+#include <algorithm>
 #include "Archive.h"
 #include "ArchiveConsole.h"
 #include "Version.h"
@@ -17,7 +19,7 @@ void printUsage(const char* programName) {
               << "Commands:\n"
               << "  create   - Create a new archive: " << programName << " create <archive_name> <file1> [file2 ...]\n"
               << "  extract  - Extract an archive: " << programName << " extract <archive_name> [output_directory]\n"
-              << "  list     - List archive contents: " << programName << " list <archive_name>\n"
+              << "  list     - List archive contents: " << programName << " list <archive_name> [prefix]\n"
               << "  add      - Add files to archive: " << programName << " add <archive_name> <file1> [file2 ...]\n"
               << "  selfext  - Create self-extracting executable: " << programName << " selfext <output.exe> <file1> [file2 ...]\n"
               << "  version  - Show version information\n\n"
@@ -31,7 +33,10 @@ void printUsage(const char* programName) {
               << "  --args <args>      Arguments for the command (e.g., '/i installer.msi /quiet')\n"
               << "  --silent           Run command without showing window\n"
               << "  --no-wait          Don't wait for command completion\n"
-              << "  --workdir <dir>    Working directory for command (default: extraction dir)\n\n"
+              << "  --workdir <dir>    Working directory for command (default: extraction dir)\n"
+              << "  --run-in-place     Start the command once its launch files are extracted\n"
+              << "  --launch-list <f>  Archive paths the command needs to start, one per line\n"
+              << "                     (record one with <output.exe> --profile-launch <f>)\n\n"
               << "MSI Installer Examples:\n"
               << "  " << programName << " selfext installer.exe --exec msiexec --args \"/i installer.msi /quiet\" installer.msi\n"
               << "  " << programName << " selfext setup.exe --exec msiexec --args \"/i setup.msi\" --silent setup.msi\n";
@@ -106,6 +111,21 @@ int main(int argc, char* argv[]) {
                     autoExec.waitForCompletion = false;
                 } else if (arg == "--workdir" && i + 1 < argc) {
                     autoExec.workingDir = argv[++i];
+                } else if (arg == "--run-in-place") {
+                    autoExec.runInPlace = true;
+                } else if (arg == "--launch-list" && i + 1 < argc) {
+                    std::ifstream list(argv[++i]);
+                    if (!list) {
+                        std::cerr << "Error: Cannot read launch list: " << argv[i] << "\n";
+                        return 1;
+                    }
+                    std::string name;
+                    while (std::getline(list, name)) {
+                        if (!name.empty()) {
+                            autoExec.launchEntries.push_back(name);
+                        }
+                    }
+                    autoExec.runInPlace = true;
                 } else {
                     fs::path inputPath = makeAbsolute(arg);
                     if (!fs::exists(inputPath)) {
@@ -219,15 +239,16 @@ int main(int argc, char* argv[]) {
                 archive.extract(outputDir.string());
             }
             else if (command == "list") {
-                auto files = archive.getFileList();
+                std::string prefix = argc > 3 ? argv[3] : "";
+                const auto files = archive.listPrefix(prefix);
                 std::cout << "Archive contents (" << files.size() << " files):\n";
                 std::cout << std::string(60, '-') << "\n";
                 std::cout << "Name                                              Size      Compressed\n";
                 std::cout << std::string(60, '-') << "\n";
                 
                 for (const auto& file : files) {
-                    printf("%-48s %10llu %10llu\n", 
-                           file.name.c_str(), 
+                    printf("%-48.*s %10llu %10llu\n", 
+                           static_cast<int>(file.name.size()), file.name.data(), 
                            static_cast<unsigned long long>(file.originalSize),
                            static_cast<unsigned long long>(file.compressedSize));
                 }
@@ -2,74 +2,900 @@
 
 #include "Archive.h"
 #include "ArchiveFormat.h"
+#include "ArchiveProgress.h"
+#include "ArchiveStats.h"
+#include "CancellationToken.h"
+#include "EntryScheduler.h"
+#include "EmbeddedStub.h"
+#include "ExtractEngine.h"
+#include "FileIO.h"
+#include "Sha256.h"
 #include <iostream>
 #include <fstream>
 #include <filesystem>
 #include <algorithm>
+#include <cctype>
 #include <zlib.h>
 #include <ctime>
 #include <array>
+#include <atomic>
 #include <stdexcept>
 #include <cstdlib>
 #include <sstream>
 #include <cstring>
+#include <unordered_set>
+#include <functional>
+#include <memory>
+#include <random>
+#include <thread>
+#include <tuple>
 
 namespace fs = std::filesystem;
 
-// Helper function to make paths relative and convert to archive format
-std::string makeArchivePath(const std::filesystem::path& file, const std::filesystem::path& basePath = {}) {
-    std::string result;
-    if (basePath.empty()) {
-        result = file.filename().string();
+// Maps input files to archive paths relative to their common parent
+// directory. Everything is computed lexically, so no filesystem calls are
+// made no matter how many files there are.
+class ArchivePathMapper {
+public:
+    explicit ArchivePathMapper(const std::vector<fs::path>& files) {
+        // A single file is stored under its filename only
+        if (files.size() < 2) {
+            return;
+        }
+
+        basePath = directoryOf(files[0]);
+        for (const auto& file : files) {
+            if (basePath.empty()) {
+                break;
+            }
+            std::string dir = directoryOf(file);
+            size_t common = std::mismatch(basePath.begin(), basePath.end(),
+                                          dir.begin(), dir.end()).first - basePath.begin();
+            if (common == 0) {
+                basePath.clear();
+            } else if (common < basePath.size()) {
+                // Cut back to the last complete directory component
+                size_t slash = basePath.rfind('/', common - 1);
+                basePath.resize(slash == std::string::npos ? 0 : slash + 1);
+            }
+        }
+    }
+
+    // Converts a file path to its name inside the archive
+    std::string map(const fs::path& file) const {
+        std::string result;
+        if (!basePath.empty()) {
+            std::string path = normalized(file);
+            if (path.compare(0, basePath.size(), basePath) == 0) {
+                result = path.substr(basePath.size());
+            }
+        }
+        if (result.empty()) {
+            result = file.filename().string();
+        }
+        // Convert to forward slashes for cross-platform compatibility
+        std::replace(result.begin(), result.end(), '\\', '/');
+        return result;
+    }
+
+private:
+    std::string basePath; // Generic form with a trailing '/', or empty
+
+    static std::string normalized(const fs::path& file) {
+        return file.lexically_normal().generic_string();
+    }
+
+    static std::string directoryOf(const fs::path& file) {
+        std::string path = normalized(file);
+        size_t slash = path.rfind('/');
+        return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+    }
+};
+
+// Reads the data regions of a file. For files with holes, extents receives
+// the data regions and only their bytes are returned; otherwise extents is
+// left empty and the whole file is returned.
+static std::vector<char> readSourceFile(const fs::path& file, std::vector<SparseExtent>& extents,
+                                        uint64_t& fileSize) {
+    FileIO::InputFile input(file);
+    fileSize = input.size();
+    extents = input.dataExtents();
+
+    uint64_t dataSize = 0;
+    for (const auto& extent : extents) {
+        dataSize += extent.length;
+    }
+    if (dataSize == fileSize) {
+        extents.clear();
+    }
+
+    std::vector<char> buffer(static_cast<size_t>(dataSize));
+    if (extents.empty()) {
+        input.readAt(0, buffer.data(), buffer.size());
     } else {
-        result = std::filesystem::relative(file, basePath).string();
+        char* cursor = buffer.data();
+        for (const auto& extent : extents) {
+            input.readAt(extent.offset, cursor, static_cast<size_t>(extent.length));
+            cursor += extent.length;
+        }
     }
-    // Convert to forward slashes for cross-platform compatibility
-    std::replace(result.begin(), result.end(), '\\', '/');
-    return result;
+    return buffer;
 }
 
-Archive::Archive(const std::string& archName) : archiveName(archName) {
-    if (fs::exists(archName)) {
-        // Try to read existing archive
-        std::ifstream file(archName, std::ios::binary);
-        if (!file) {
-            throw std::runtime_error("Failed to open archive: " + archName);
+// Adapts an istream to the read callbacks of the ArchiveFormat decoders
+static auto streamReader(std::istream& in) {
+    return [&in](void* data, size_t size) {
+        return static_cast<bool>(in.read(static_cast<char*>(data), static_cast<std::streamsize>(size)));
+    };
+}
+
+// Finds the end of a payload followed by an entry descriptor by inflating
+// it, then reads the descriptor into header and adds its size to size
+static bool skipDescriptorPayload(std::istream& in, EntryHeader& header, uint64_t& size) {
+    z_stream strm = {};
+    if (inflateInit(&strm) != Z_OK) {
+        return false;
+    }
+    std::vector<char> input(64 * 1024);
+    std::vector<char> output(256 * 1024);
+    uint64_t consumed = 0;
+    int status = Z_OK;
+    while (status == Z_OK) {
+        if (strm.avail_in == 0) {
+            in.read(input.data(), static_cast<std::streamsize>(input.size()));
+            strm.next_in = reinterpret_cast<Bytef*>(input.data());
+            strm.avail_in = static_cast<uInt>(in.gcount());
+            consumed += strm.avail_in;
+            if (strm.avail_in == 0) {
+                break;
+            }
         }
+        strm.next_out = reinterpret_cast<Bytef*>(output.data());
+        strm.avail_out = static_cast<uInt>(output.size());
+        status = inflate(&strm, Z_NO_FLUSH);
+    }
+    const uInt unused = strm.avail_in;
+    inflateEnd(&strm);
+    if (status != Z_STREAM_END) {
+        return false;
+    }
+    in.clear();
+    in.seekg(-static_cast<std::streamoff>(unused), std::ios::cur);
+    consumed -= unused;
+    return ArchiveFormat::readEntryDescriptor(streamReader(in), header, size) &&
+           header.compressedSize == consumed;
+}
+
+// Forwards to another stream buffer and counts the bytes written, so that
+// tellp works on a pipe
+class CountingBuffer : public std::streambuf {
+public:
+    explicit CountingBuffer(std::streambuf* target) : target(target) {}
 
-        // Read and verify archive header
-        FileHeader header;
-        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
-            header.signature != SIGNATURE) {
-            throw std::runtime_error("Invalid archive format");
+protected:
+    int_type overflow(int_type c) override {
+        if (traits_type::eq_int_type(c, traits_type::eof())) {
+            return traits_type::not_eof(c);
         }
+        if (traits_type::eq_int_type(target->sputc(traits_type::to_char_type(c)), traits_type::eof())) {
+            return traits_type::eof();
+        }
+        ++count;
+        return c;
+    }
 
-        // Read file entries
-        while (file) {
-            if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
-                break;
+    std::streamsize xsputn(const char* data, std::streamsize size) override {
+        std::streamsize written = target->sputn(data, size);
+        count += static_cast<uint64_t>(written);
+        return written;
+    }
 
-            if (header.signature != SIGNATURE)
-                break;
+    pos_type seekoff(off_type offset, std::ios::seekdir dir, std::ios::openmode which) override {
+        if (offset == 0 && dir == std::ios::cur && (which & std::ios::out)) {
+            return pos_type(static_cast<off_type>(count));
+        }
+        return pos_type(off_type(-1));
+    }
+
+    int sync() override { return target->pubsync(); }
+
+private:
+    std::streambuf* target;
+    uint64_t count = 0;
+};
+
+static void writeArchiveHeader(std::ostream& archive) {
+    uint8_t prefix[ENTRY_PREFIX_SIZE];
+    archive.write(reinterpret_cast<const char*>(prefix),
+                  static_cast<std::streamsize>(ArchiveFormat::encodeArchiveHeader(prefix)));
+}
+
+// Groups durability into one fdatasync per batch of entries rather than
+// none or one per entry. entryWritten() returns true at each batch boundary,
+// once everything written so far has been flushed (and synced, if enabled).
+class SyncBatcher {
+public:
+    SyncBatcher(std::ostream& stream, fs::path path, const SyncPolicy& policy, ArchiveStats* stats,
+                CompressionController* controller = nullptr)
+        : stream(stream), path(std::move(path)), policy(policy), stats(stats), controller(controller) {}
+
+    bool entryWritten(uint64_t bytes) {
+        pendingBytes += bytes;
+        ++pendingEntries;
+        if (pendingBytes < policy.batchBytes && pendingEntries < policy.batchEntries) {
+            return false;
+        }
+        sync();
+        return true;
+    }
+
+    void sync() {
+        ArchiveStats::ScopedTimer timer(stats, StatStage::Write);
+        const auto start = std::chrono::steady_clock::now();
+        if (!stream.flush()) {
+            throw std::runtime_error("Failed to write archive: " + path.string());
+        }
+        if (policy.enabled) {
+            FileIO::syncFile(path);
+        }
+        // Buffered writes return early; this is where the sink's real speed shows
+        if (controller) {
+            controller->recordWrite(0, std::chrono::steady_clock::now() - start);
+        }
+        pendingBytes = 0;
+        pendingEntries = 0;
+    }
+
+private:
+    std::ostream& stream;
+    fs::path path;
+    SyncPolicy policy;
+    ArchiveStats* stats;
+    CompressionController* controller;
+    uint64_t pendingBytes = 0;
+    uint32_t pendingEntries = 0;
+};
+
+// Switches a deflate stream to another level between blocks. zlib may have
+// to flush what it holds first, which goes to emit through buffer.
+static void changeDeflateLevel(z_stream& strm, int level, std::vector<char>& buffer,
+                               const std::function<void(const char*, size_t)>& emit) {
+    for (;;) {
+        strm.next_out = reinterpret_cast<Bytef*>(buffer.data());
+        strm.avail_out = static_cast<uInt>(buffer.size());
+        const int status = deflateParams(&strm, level, Z_DEFAULT_STRATEGY);
+        const size_t produced = buffer.size() - strm.avail_out;
+        emit(buffer.data(), produced);
+        if (status == Z_OK) {
+            return;
+        }
+        // Z_BUF_ERROR means the flush ran out of room; retry while it progresses
+        if (status != Z_BUF_ERROR || produced == 0) {
+            throw std::runtime_error("Failed to change compression level");
+        }
+    }
+}
+
+// The create journal holds one "<end offset> <archive path>" line per entry
+// that is completely written; the archive is cut back to the last offset
+// when an interrupted create is resumed.
+static uint64_t readJournal(const fs::path& journal) {
+    std::ifstream in(journal);
+    uint64_t committed = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (in.eof()) {
+            break; // Torn last line
+        }
+        committed = std::strtoull(line.c_str(), nullptr, 10);
+    }
+    return committed;
+}
+
+// True if an extracted file is already in place: extract sets the
+// timestamp only after the data is written, so a match means it finished
+static bool isAlreadyExtracted(const fs::path& path, uint64_t originalSize, int64_t timestamp) {
+    std::error_code ec;
+    auto status = fs::status(path, ec);
+    if (ec || !fs::is_regular_file(status)) {
+        return false;
+    }
+    auto size = fs::file_size(path, ec);
+    if (ec || size != originalSize) {
+        return false;
+    }
+    auto time = fs::last_write_time(path, ec);
+    return !ec && time.time_since_epoch().count() == timestamp;
+}
+
+// Hashes the data regions of an existing file the way entries are hashed
+static bool matchesEntryData(const fs::path& path, const ExtractItem& item) {
+    FileIO::InputFile in(path);
+    std::vector<char> chunk(1 << 20);
+    Sha256 sha;
+    uLong crc = ::crc32(0L, Z_NULL, 0);
+    for (const auto& extent : item.extents) {
+        for (uint64_t done = 0; done < extent.length;) {
+            size_t size = static_cast<size_t>(std::min<uint64_t>(chunk.size(), extent.length - done));
+            in.readAt(extent.offset + done, chunk.data(), size);
+            if (item.header.hasSha256()) {
+                sha.update(chunk.data(), size);
+            } else {
+                crc = ::crc32(crc, reinterpret_cast<const Bytef*>(chunk.data()), static_cast<uInt>(size));
+            }
+            done += size;
+        }
+    }
+    if (item.header.hasSha256()) {
+        Sha256::Digest digest = sha.finish();
+        return std::memcmp(digest.data(), item.header.sha256, digest.size()) == 0;
+    }
+    return item.header.hasCrc32() && static_cast<uint32_t>(crc) == item.header.crc32;
+}
+
+// Connects the extraction engine to the archive's progress sink, stats,
+// cancellation token, resume check and content cache. The engine calls
+// reuseExisting and entryExtracted from its worker threads, so nothing here
+// may throw.
+class Archive::ExtractHooks : public ExtractObserver {
+public:
+    explicit ExtractHooks(Archive& archive) : archive(archive) {}
+
+    bool reuseExisting(const ExtractItem& item) override {
+        auto start = std::chrono::steady_clock::now();
+        bool reused = false;
+        try {
+            reused = (archive.skipUnchanged && isUnchanged(item)) || linkFromCache(item);
+            if (!reused && !archive.cacheDirectory.empty()) {
+                // The old file may be a hard link into the cache; writing
+                // through it would corrupt the cached copy
+                fs::remove(item.path);
+            }
+        } catch (const std::exception&) {
+            reused = false;
+        }
+        if (!reused) {
+            return false;
+        }
+        setTimestamp(item);
+        if (archive.stats) {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            archive.stats->addStage(StatStage::Metadata, elapsed);
+            archive.stats->recordFile(item.header.originalSize, item.header.compressedSize, elapsed);
+        }
+        report(item);
+        return true;
+    }
+
+    bool shouldExtract(const ExtractItem& item) override {
+        if (archive.resumable && !item.header.hasDescriptor() &&
+            isAlreadyExtracted(item.path, item.header.originalSize, item.header.timestamp)) {
+            report(item);
+            return false;
+        }
+        return true;
+    }
+
+    void entryExtracted(const ExtractItem& item, const ExtractTimings& timings) override {
+        auto start = std::chrono::steady_clock::now();
+        setTimestamp(item);
+        addToCache(item);
+        auto metadata = std::chrono::steady_clock::now() - start;
+
+        if (ArchiveStats* stats = archive.stats) {
+            const uint64_t dataSize = item.dataSize();
+            stats->addStage(StatStage::Read, timings.read, item.header.compressedSize);
+            if (item.header.codec != CODEC_STORED && dataSize > 0) {
+                stats->addStage(StatStage::Inflate, timings.inflate, dataSize);
+            }
+            stats->addStage(StatStage::Write, timings.write, dataSize);
+            stats->addStage(StatStage::Metadata, metadata);
+            stats->recordFile(item.header.originalSize, item.header.compressedSize,
+                              timings.total + metadata);
+        }
+        report(item);
+    }
+
+    bool isCancelled() override {
+        try {
+            archive.checkpoint();
+        } catch (const OperationCancelled&) {
+            return true;
+        }
+        return false;
+    }
+
+private:
+    bool isUnchanged(const ExtractItem& item) const {
+        std::error_code ec;
+        if (!fs::is_regular_file(item.path, ec) || fs::file_size(item.path, ec) != item.header.originalSize || ec) {
+            return false;
+        }
+        auto time = fs::last_write_time(item.path, ec);
+        if (!ec && time.time_since_epoch().count() == item.header.timestamp) {
+            return true;
+        }
+        return matchesEntryData(item.path, item);
+    }
+
+    // <cache>/<first two hex digits>/<SHA-256 in hex>
+    fs::path cachePath(const ExtractItem& item) const {
+        Sha256::Digest digest;
+        std::memcpy(digest.data(), item.header.sha256, digest.size());
+        std::string hex = Sha256::toHex(digest);
+        return fs::path(archive.cacheDirectory) / hex.substr(0, 2) / hex;
+    }
+
+    bool linkFromCache(const ExtractItem& item) const {
+        if (archive.cacheDirectory.empty() || !item.header.hasSha256()) {
+            return false;
+        }
+        std::error_code ec;
+        fs::path cached = cachePath(item);
+        if (fs::file_size(cached, ec) != item.header.originalSize || ec) {
+            return false;
+        }
+        // The cache may have been modified through a linked copy; a bad
+        // entry is dropped so that addToCache replaces it
+        if (!matchesEntryData(cached, item)) {
+            fs::remove(cached, ec);
+            return false;
+        }
+        fs::remove(item.path, ec);
+        return FileIO::linkFile(cached, item.path);
+    }
+
+    // Added under a temporary name and renamed, so a cache entry is always
+    // complete even when several workers or processes add the same content.
+    // Entries are read-only, and so are outputs hard-linked to them.
+    void addToCache(const ExtractItem& item) const {
+        if (archive.cacheDirectory.empty() || !item.header.hasSha256()) {
+            return;
+        }
+        std::error_code ec;
+        fs::path cached = cachePath(item);
+        if (fs::exists(cached, ec)) {
+            try {
+                if (matchesEntryData(cached, item)) {
+                    return;
+                }
+            } catch (const std::exception&) {
+                // Unreadable: replaced below
+            }
+        }
+        fs::create_directories(cached.parent_path(), ec);
+        fs::path temporary = cached;
+        temporary += temporarySuffix();
+        fs::remove(temporary, ec);
+        if (FileIO::linkFile(item.path, temporary)) {
+            fs::permissions(temporary, fs::perms::owner_read | fs::perms::group_read | fs::perms::others_read,
+                            fs::perm_options::replace, ec);
+            fs::rename(temporary, cached, ec);
+            if (ec) {
+                fs::remove(temporary, ec);
+            }
+        }
+    }
+
+    // Unique across threads and across processes sharing the cache
+    static std::string temporarySuffix() {
+        static const std::string process = [] {
+            std::random_device random;
+            return std::to_string((static_cast<uint64_t>(random()) << 32) | random());
+        }();
+        static std::atomic<uint64_t> counter{0};
+        return "." + process + "-" + std::to_string(counter++) + ".tmp";
+    }
+
+    static void setTimestamp(const ExtractItem& item) {
+        std::error_code ec;
+        auto ft = fs::file_time_type(fs::file_time_type::duration(item.header.timestamp));
+        fs::last_write_time(item.path, ft, ec);
+    }
+
+    void report(const ExtractItem& item) {
+        if (archive.progress) {
+            archive.progress->addBytes(item.header.originalSize);
+            archive.progress->addFile();
+        }
+    }
+
+    Archive& archive;
+};
+
+Archive::Archive(const std::string& archName) : archiveName(archName) {
+    if (archName != "-" && fs::exists(archName) && !loadUndoneCatalog()) {
+        loadCatalog(archiveName);
+    }
+}
+
+void Archive::loadCatalog(const std::string& path) {
+    entries.clear();
+    dataEnd = 0;
+
+    // Try to read existing archive
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open archive: " + path);
+    }
+    dataEnd = readCatalog(file, entries);
+    readVolumeTable(file, path);
+}
 
-            std::string fileName;
-            fileName.resize(header.nameLength);
-            if (!file.read(&fileName[0], header.nameLength))
+uint64_t Archive::readCatalog(std::istream& file, EntryTable& entries) {
+    entries.clear();
+
+    // Read and verify archive header
+    auto reader = streamReader(file);
+    uint64_t headerSize = 0;
+    if (!ArchiveFormat::readArchiveHeader(reader, headerSize)) {
+        throw std::runtime_error("Invalid archive format");
+    }
+
+    // Load the persisted name index when the archive has one
+    file.seekg(0, std::ios::end);
+    const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    if (fileSize >= headerSize + INDEX_HEADER_SIZE + INDEX_TRAILER_SIZE) {
+        uint8_t encoded[INDEX_TRAILER_SIZE];
+        file.seekg(static_cast<std::streamoff>(fileSize - sizeof(encoded)));
+        const bool read = static_cast<bool>(file.read(reinterpret_cast<char*>(encoded), sizeof(encoded)));
+        const IndexTrailer trailer = ArchiveFormat::decodeIndexTrailer(encoded);
+        if (read && trailer.signature == INDEX_TRAILER_SIGNATURE && trailer.indexOffset >= headerSize &&
+            trailer.indexOffset < fileSize - sizeof(encoded)) {
+            file.seekg(static_cast<std::streamoff>(trailer.indexOffset));
+            if (entries.readIndex(file)) {
+                return trailer.indexOffset;
+            }
+        }
+        file.clear();
+    }
+    file.seekg(static_cast<std::streamoff>(headerSize));
+
+    // No usable index: scan the entry headers, reusing one name buffer
+    uint64_t offset = headerSize;
+    EntryHeader header;
+    std::string fileName;
+    std::vector<SparseExtent> extents;
+    while (file) {
+        uint64_t size = 0;
+        if (!ArchiveFormat::readEntryHeader(reader, header, size))
+            break;
+
+        fileName.resize(header.nameLength);
+        if (!file.read(&fileName[0], header.nameLength))
+            break;
+        size += header.nameLength;
+
+        // Skip the sparse map, if any
+        if (header.isSparse() && !ArchiveFormat::readSparseMap(reader, header, extents, size))
+            break;
+
+        // Skip compressed data; an encrypted payload cannot be inflated to
+        // find where it ends
+        if (header.hasDescriptor()) {
+            if (header.isEncrypted() || !skipDescriptorPayload(file, header, size))
                 break;
+        } else {
+            if (offset + size + header.compressedSize > fileSize)
+                break;
+            file.seekg(static_cast<std::streamoff>(header.compressedSize), std::ios::cur);
+        }
 
-            // Store entry information
-            entries.push_back(ArchiveEntry{
-                fileName,
-                header.compressedSize,
-                header.originalSize,
-                header.timestamp
-            });
+        // Store entry information
+        entries.add(fileName, header.compressedSize, header.originalSize,
+                    header.timestamp, offset);
+        offset += size + header.compressedSize;
+    }
+    entries.buildNameIndex();
+    return offset;
+}
+
+std::optional<ArchiveEntry> Archive::find(std::string_view name) const {
+    size_t index = entries.find(name);
+    if (index == EntryTable::npos) {
+        return std::nullopt;
+    }
+    return entries[index];
+}
 
-            // Skip compressed data
-            file.seekg(header.compressedSize, std::ios::cur);
+std::vector<char> Archive::readEntry(std::string_view name) const {
+    const std::string entryName(name);
+    const size_t index = entries.find(name);
+    if (index == EntryTable::npos) {
+        throw std::runtime_error("Entry not found: " + entryName);
+    }
+    const ArchiveEntry entry = entries[index];
+    const std::string& source = entryVolumes.empty() ? archiveName : volumePaths[entryVolumes[index]];
+    std::ifstream in(source, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Failed to open archive: " + source);
+    }
+    in.seekg(static_cast<std::streamoff>(entries.offset(index)));
+
+    auto reader = streamReader(in);
+    EntryHeader header;
+    std::vector<SparseExtent> extents;
+    uint64_t headerSize = 0;
+    if (!ArchiveFormat::readEntryHeader(reader, header, headerSize) ||
+        !in.seekg(static_cast<std::streamoff>(header.nameLength), std::ios::cur) ||
+        (header.isSparse() && !ArchiveFormat::readSparseMap(reader, header, extents, headerSize))) {
+        throw std::runtime_error("Corrupt entry: " + entryName);
+    }
+
+    // A descriptor entry's sizes come from the index until the descriptor is read
+    EntryHeader sized = header;
+    if (header.hasDescriptor()) {
+        sized.compressedSize = entry.compressedSize;
+        sized.originalSize = entry.originalSize;
+    }
+    std::vector<char> data;
+    data.reserve(static_cast<size_t>(sized.originalSize));
+    const std::streamoff payloadOffset = in.tellg();
+    std::unique_ptr<EntryDecryptor> decryptor;
+    if (encryptionKey) {
+        decryptor = std::make_unique<EntryDecryptor>(*encryptionKey);
+    }
+    decodeEntry(
+        sized, extents,
+        [&](char* buffer, size_t size) {
+            if (!in.read(buffer, static_cast<std::streamsize>(size))) {
+                throw std::runtime_error("Unexpected end of archive in: " + entryName);
+            }
+        },
+        [&](const char* buffer, size_t size) { data.insert(data.end(), buffer, buffer + size); }, entryName,
+        decryptor.get());
+
+    if (header.hasDescriptor()) {
+        uint64_t descriptorSize = 0;
+        in.seekg(payloadOffset + static_cast<std::streamoff>(sized.compressedSize));
+        if (!ArchiveFormat::readEntryDescriptor(reader, header, descriptorSize) ||
+            header.compressedSize != sized.compressedSize || header.originalSize != sized.originalSize) {
+            throw std::runtime_error("Corrupt entry descriptor for: " + entryName);
+        }
+    }
+    if (header.hasCrc32()) {
+        // Holes are not covered by the checksum
+        if (!header.isSparse()) {
+            extents.assign(1, SparseExtent{0, header.originalSize});
+        }
+        uLong crc = ::crc32(0L, Z_NULL, 0);
+        for (const auto& extent : extents) {
+            for (uint64_t done = 0; done < extent.length;) {
+                const uInt chunk = static_cast<uInt>(std::min<uint64_t>(extent.length - done, 1 << 20));
+                crc = ::crc32(crc, reinterpret_cast<const Bytef*>(data.data() + extent.offset + done), chunk);
+                done += chunk;
+            }
+        }
+        if (static_cast<uint32_t>(crc) != header.crc32) {
+            throw std::runtime_error("Checksum mismatch for: " + entryName);
+        }
+    }
+    return data;
+}
+
+std::vector<ArchiveEntry> Archive::listPrefix(std::string_view directory) const {
+    std::vector<ArchiveEntry> result;
+    for (size_t index : entries.findPrefix(directory)) {
+        result.push_back(entries[index]);
+    }
+    return result;
+}
+
+void Archive::reportInputTotals(const std::vector<fs::path>& files) {
+    if (!progress) {
+        return;
+    }
+    uint64_t totalBytes = 0;
+    for (const auto& file : files) {
+        std::error_code ec;
+        auto size = fs::file_size(file, ec);
+        if (!ec) {
+            totalBytes += size;
         }
     }
+    progress->setTotals(totalBytes, files.size());
+    progress->beginStage("Compressing");
+}
+
+void Archive::checkpoint() {
+    if (cancellation) {
+        cancellation->checkpoint();
+    }
+}
+
+std::string Archive::journalPath() const {
+    return archiveName + ".journal";
+}
+
+std::string Archive::workingPath() const {
+    return archiveName + ".tmp";
 }
+
+std::string Archive::undoPath() const {
+    return archiveName + ".undo";
+}
+
+void Archive::writeUndoRecord() {
+    UndoHeader undo{};
+    undo.signature = UNDO_SIGNATURE;
+    undo.dataEnd = dataEnd;
+    undo.archiveSize = fs::file_size(archiveName);
+    if (undo.archiveSize < dataEnd) {
+        throw std::runtime_error("Archive is shorter than its entry data: " + archiveName);
+    }
+
+    // Only the index and trailer after dataEnd are overwritten by the append
+    std::vector<char> record(UNDO_HEADER_SIZE + (undo.archiveSize - dataEnd));
+    ArchiveFormat::encodeUndoHeader(undo, reinterpret_cast<uint8_t*>(record.data()));
+    if (record.size() > UNDO_HEADER_SIZE) {
+        FileIO::InputFile in(archiveName);
+        in.readAt(dataEnd, record.data() + UNDO_HEADER_SIZE, record.size() - UNDO_HEADER_SIZE);
+    }
+    {
+        std::ofstream out(undoPath(), std::ios::binary | std::ios::trunc);
+        out.write(record.data(), static_cast<std::streamsize>(record.size()));
+        if (!out.flush()) {
+            throw std::runtime_error("Failed to write undo record: " + undoPath());
+        }
+    }
+    // The record has to be on disk before the archive is touched
+    FileIO::syncFile(undoPath());
+    FileIO::syncDirectory(fs::path(archiveName).parent_path());
+}
+
+bool Archive::readUndoRecord(UndoHeader& undo, std::vector<char>& saved) const {
+    std::ifstream in(undoPath(), std::ios::binary);
+    uint8_t encoded[UNDO_HEADER_SIZE];
+    if (!in.read(reinterpret_cast<char*>(encoded), sizeof(encoded))) {
+        return false;
+    }
+    undo = ArchiveFormat::decodeUndoHeader(encoded);
+    std::error_code ec;
+    const uint64_t recordSize = fs::file_size(undoPath(), ec);
+    if (ec || undo.signature != UNDO_SIGNATURE || undo.archiveSize < undo.dataEnd ||
+        recordSize - sizeof(encoded) != undo.archiveSize - undo.dataEnd) {
+        return false;
+    }
+    saved.resize(static_cast<size_t>(undo.archiveSize - undo.dataEnd));
+    return static_cast<bool>(in.read(saved.data(), static_cast<std::streamsize>(saved.size())));
+}
+
+bool Archive::loadUndoneCatalog() {
+    UndoHeader undo{};
+    std::vector<char> saved;
+    if (!fs::exists(undoPath()) || !readUndoRecord(undo, saved)) {
+        return false;
+    }
+    // The saved index describes the archive as it was before the append;
+    // every entry it lists lies before dataEnd, which the append left alone
+    std::istringstream index(std::string(saved.data(), saved.size()));
+    if (!entries.readIndex(index)) {
+        return false;
+    }
+    dataEnd = undo.dataEnd;
+    return true;
+}
+
+void Archive::rollBackAppend() {
+    UndoHeader undo{};
+    std::vector<char> saved;
+    const bool complete = readUndoRecord(undo, saved);
+
+    // An incomplete record means the crash came before the archive was modified
+    if (complete) {
+        fs::resize_file(archiveName, undo.dataEnd);
+        std::fstream archive(archiveName, std::ios::binary | std::ios::in | std::ios::out);
+        archive.seekp(static_cast<std::streamoff>(undo.dataEnd));
+        archive.write(saved.data(), static_cast<std::streamsize>(saved.size()));
+        if (!archive.flush()) {
+            throw std::runtime_error("Failed to roll back interrupted append: " + archiveName);
+        }
+        archive.close();
+        FileIO::syncFile(archiveName);
+    }
+    fs::remove(undoPath());
+    FileIO::syncDirectory(fs::path(archiveName).parent_path());
+}
+
+void Archive::discardUndoRecord() {
+    std::error_code ec;
+    if (fs::remove(undoPath(), ec)) {
+        FileIO::syncDirectory(fs::path(archiveName).parent_path());
+    }
+}
+
+fs::file_status Archive::statInput(const fs::path& file) {
+    ArchiveStats::ScopedTimer timer(stats, StatStage::Metadata);
+    return fs::status(file);
+}
+
+void Archive::writeNameIndex(std::ostream& archive) {
+    if (progress) {
+        progress->beginStage("Writing index");
+    }
+    dataEnd = static_cast<uint64_t>(archive.tellp());
+    entries.buildNameIndex();
+    if (!entries.writeIndex(archive, dataEnd)) {
+        throw std::runtime_error("Failed to write archive index");
+    }
+}
+std::vector<Archive::PendingInput> Archive::collectInputs(const std::vector<fs::path>& files) {
+    // Find common base path for all files
+    ArchivePathMapper pathMapper(files);
+    std::vector<PendingInput> inputs;
+    inputs.reserve(files.size());
+    for (const auto& file : files) {
+        checkpoint();
+        auto status = statInput(file);
+        if (!fs::exists(status)) {
+            throw std::runtime_error("File not found: " + file.string());
+        }
+
+        if (!fs::is_regular_file(status)) {
+            std::cerr << "Skipping non-regular file: " << file << std::endl;
+            continue;
+        }
+
+        std::error_code ec;
+        const uint64_t size = fs::file_size(file, ec);
+        inputs.push_back(PendingInput{file, pathMapper.map(file), ec ? 0 : size});
+    }
+
+    if (entryOrder == EntryOrder::Grouped) {
+        // Extension first, so files of one type sit together even across
+        // directories, then directory and name
+        auto key = [](const PendingInput& input) {
+            const fs::path path(input.archivePath);
+            std::string extension = path.extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            return std::make_tuple(std::move(extension), path.parent_path().string(), path.filename().string());
+        };
+        std::stable_sort(inputs.begin(), inputs.end(),
+                         [&](const PendingInput& a, const PendingInput& b) { return key(a) < key(b); });
+    }
+    return inputs;
+}
+
+void Archive::writeInputs(const std::vector<PendingInput>& inputs, std::ostream& archive,
+                          CompressionType compression, bool streamLarge,
+                          const std::function<void(const PendingInput&, uint64_t, uint64_t)>& written) {
+    EntryScheduler scheduler(threads);
+    levelController.reset(scheduler.threadCount());
+
+    std::vector<uint64_t> sizes;
+    sizes.reserve(inputs.size());
+    for (const auto& input : inputs) {
+        sizes.push_back(input.size);
+    }
+    auto streamed = [&](size_t i) { return streamLarge && inputs[i].size >= STREAMED_ENTRY_THRESHOLD; };
+
+    // Files are read and compressed on the workers, largest first, and
+    // written here in input order; a streamed file is compressed as it is
+    // written, so it has no worker part
+    std::vector<PreparedEntry> prepared(inputs.size());
+    scheduler.run(
+        sizes,
+        [&](size_t i) {
+            if (!streamed(i)) {
+                prepared[i] = prepareFile(inputs[i].file, inputs[i].archivePath, compression);
+            }
+        },
+        [&](size_t i) {
+            checkpoint();
+            const auto start = static_cast<uint64_t>(archive.tellp());
+            if (streamed(i)) {
+                addFileStreamed(inputs[i].file, inputs[i].archivePath, archive, compression);
+            } else {
+                writeEntry(prepared[i], archive, compression);
+                prepared[i] = PreparedEntry();
+            }
+            if (written) {
+                written(inputs[i], start, static_cast<uint64_t>(archive.tellp()));
+            }
+        });
+}
+
 void Archive::createSelfExtracting(const std::vector<std::filesystem::path>& files,
                                   const std::string& outputPath,
                                   CompressionType compression,
@@ -78,61 +904,55 @@ void Archive::createSelfExtracting(const std::vector<std::filesystem::path>& fil
     if (files.empty()) {
         throw std::runtime_error("No files specified for self-extracting archive");
     }
+    if (encryptionKey) {
+        // The stub links no cryptography
+        throw std::runtime_error("Self-extracting archives cannot be encrypted");
+    }
 
     // Step 1: Create archive data in memory
     std::ostringstream archiveStream;
     entries.clear();
 
     // Find common base path for all files
-    std::filesystem::path basePath;
-    if (files.size() > 1) {
-        basePath = files[0].parent_path();
-        for (const auto& file : files) {
-            auto parent = file.parent_path();
-            while (!basePath.empty() && !std::filesystem::equivalent(basePath, parent) && 
-                   !std::filesystem::equivalent(basePath, parent.parent_path())) {
-                basePath = basePath.parent_path();
-            }
-        }
-    }
+    ArchivePathMapper pathMapper(files);
+    reportInputTotals(files);
 
     // Write archive header
-    FileHeader header{};
-    header.signature = SIGNATURE;
-    header.version = CURRENT_VERSION;
-    archiveStream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeArchiveHeader(archiveStream);
 
     // Add files to archive stream
     for (const auto& file : files) {
-        if (!std::filesystem::exists(file)) {
+        checkpoint();
+        auto status = statInput(file);
+        if (!std::filesystem::exists(status)) {
             throw std::runtime_error("File not found: " + file.string());
         }
 
-        if (!std::filesystem::is_regular_file(file)) {
+        if (!std::filesystem::is_regular_file(status)) {
             std::cerr << "Skipping non-regular file: " << file << std::endl;
             continue;
         }
 
-        std::string relativePath = makeArchivePath(file, basePath);
+        std::string relativePath = pathMapper.map(file);
         addFileToArchiveStream(file, relativePath, archiveStream, compression);
     }
+    writeNameIndex(archiveStream);
 
     // Convert stream to vector
     std::string archiveString = archiveStream.str();
     std::vector<char> archiveData(archiveString.begin(), archiveString.end());
 
-    // Step 2: Get or build extractor stub
-    std::string actualStubPath = stubPath;
-    if (actualStubPath.empty()) {
-        actualStubPath = "extractor_stub.exe";
-        if (!buildExtractorStub(actualStubPath)) {
-            throw std::runtime_error("Failed to build extractor stub");
+    // Step 2: Combine the stub with the archive data and command config
+    if (stubPath.empty()) {
+        combineStubWithArchive(reinterpret_cast<const char*>(EMBEDDED_EXTRACTOR_STUB),
+                               EMBEDDED_EXTRACTOR_STUB_SIZE, archiveData, outputPath, autoExec);
+    } else {
+        std::ifstream stubFile(stubPath, std::ios::binary);
+        if (!stubFile) {
+            throw std::runtime_error("Failed to open extractor stub: " + stubPath);
         }
-    }
-
-    // Step 3: Combine stub with archive data and command config
-    if (!combineStubWithArchive(actualStubPath, archiveData, outputPath, autoExec)) {
-        throw std::runtime_error("Failed to create self-extracting executable");
+        std::vector<char> stubData(std::istreambuf_iterator<char>(stubFile), {});
+        combineStubWithArchive(stubData.data(), stubData.size(), archiveData, outputPath, autoExec);
     }
 
     std::cout << "Self-extracting executable '" << outputPath 
@@ -144,81 +964,18 @@ void Archive::createSelfExtracting(const std::vector<std::filesystem::path>& fil
             std::cout << " " << autoExec.arguments;
         }
         std::cout << std::endl;
+        if (autoExec.runInPlace) {
+            std::cout << "Run-in-place: the command starts after " << autoExec.launchEntries.size()
+                      << " launch entries are extracted." << std::endl;
+        }
     }
 }
 
-bool Archive::buildExtractorStub(const std::string& outputPath) {
-    std::cout << "Building extractor stub..." << std::endl;
-    
-    // This assumes you have the extractor_stub.cpp in your project
-    // and a C++ compiler available
-    std::string compileCommand;
-    
-#ifdef _WIN32
-    // Try to use cl.exe (Visual Studio) or g++ (MinGW)
-    compileCommand = "cl.exe /Fe:" + outputPath + " extractor_stub.cpp /EHsc";
-    if (std::system("cl.exe >nul 2>&1") != 0) {
-        // Fall back to g++
-        compileCommand = "g++ -o " + outputPath + " extractor_stub.cpp -static";
-    }
-#else
-    compileCommand = "g++ -o " + outputPath + " extractor_stub.cpp -static";
-#endif
-
-    int result = std::system(compileCommand.c_str());
-    if (result != 0) {
-        std::cerr << "Failed to compile extractor stub. Make sure you have:" << std::endl;
-        std::cerr << "1. extractor_stub.cpp in the current directory" << std::endl;
-        std::cerr << "2. A C++ compiler (cl.exe or g++) in your PATH" << std::endl;
-        return false;
-    }
-
-    return std::filesystem::exists(outputPath);
-}
-
-bool Archive::combineStubWithArchive(const std::string& stubPath,
+void Archive::combineStubWithArchive(const char* stubData, size_t stubSize,
                                      const std::vector<char>& archiveData,
                                      const std::string& outputPath,
                                      const AutoExecConfig& autoExec) {
-    if (!std::filesystem::exists(stubPath)) {
-        std::cerr << "Extractor stub not found: " << stubPath << std::endl;
-        return false;
-    }
-
-    // Read the stub executable
-    std::ifstream stubFile(stubPath, std::ios::binary);
-    if (!stubFile) {
-        std::cerr << "Failed to open stub file: " << stubPath << std::endl;
-        return false;
-    }
-
-    std::vector<char> stubData(std::istreambuf_iterator<char>(stubFile), {});
-    stubFile.close();
-
-    // Create the output file
-    std::ofstream outFile(outputPath, std::ios::binary);
-    if (!outFile) {
-        std::cerr << "Failed to create output file: " << outputPath << std::endl;
-        return false;
-    }
-
-    // Write stub executable
-    outFile.write(stubData.data(), stubData.size());
-
-    // Write marker
-    const char marker[] = "ARCHIVE_DATA_START_MARKER_12345";
-    outFile.write(marker, sizeof(marker) - 1);
-    
-    // Prepare command configuration structure (matching the stub's CommandConfig)
-    struct CommandConfig {
-        char command[512];
-        char arguments[512];
-        bool silent;
-        bool waitForCompletion;
-        char workingDir[256];
-    };
-    
-    CommandConfig cmdConfig = {};
+    SfxCommandConfig cmdConfig = {};
     
     // Copy strings safely
     if (!autoExec.command.empty()) {
@@ -233,29 +990,53 @@ bool Archive::combineStubWithArchive(const std::string& stubPath,
     
     cmdConfig.silent = autoExec.silent;
     cmdConfig.waitForCompletion = autoExec.waitForCompletion;
-    
-    // Write command configuration
-    outFile.write(reinterpret_cast<const char*>(&cmdConfig), sizeof(cmdConfig));
-    
-    // Write archive size
-    size_t archiveSize = archiveData.size();
-    outFile.write(reinterpret_cast<const char*>(&archiveSize), sizeof(archiveSize));
+    cmdConfig.runInPlace = autoExec.runInPlace;
 
-    // Write archive data
-    outFile.write(archiveData.data(), archiveData.size());
+    std::vector<uint8_t> launchList;
+    if (autoExec.runInPlace) {
+        ArchiveFormat::encodeLaunchList(autoExec.launchEntries, launchList);
+    }
 
-    outFile.close();
+    SfxFooter footer;
+    footer.archiveOffset = stubSize;
+    footer.archiveSize = archiveData.size();
+    footer.configSize = static_cast<uint32_t>(sizeof(cmdConfig) + launchList.size());
+    uint8_t footerBytes[SFX_FOOTER_SIZE];
+    ArchiveFormat::encodeSfxFooter(footer, footerBytes);
+
+    // stub | archive | command configuration | footer, written next to the
+    // output and renamed over it once complete
+    const std::string working = outputPath + ".tmp";
+    {
+        std::ofstream outFile(working, std::ios::binary | std::ios::trunc);
+        if (!outFile) {
+            throw std::runtime_error("Failed to create output file: " + outputPath);
+        }
+        outFile.write(stubData, static_cast<std::streamsize>(stubSize));
+        outFile.write(archiveData.data(), static_cast<std::streamsize>(archiveData.size()));
+        outFile.write(reinterpret_cast<const char*>(&cmdConfig), sizeof(cmdConfig));
+        outFile.write(reinterpret_cast<const char*>(launchList.data()),
+                      static_cast<std::streamsize>(launchList.size()));
+        outFile.write(reinterpret_cast<const char*>(footerBytes), sizeof(footerBytes));
+        if (!outFile.flush()) {
+            outFile.close();
+            fs::remove(working);
+            throw std::runtime_error("Failed to write self-extracting executable: " + outputPath);
+        }
+    }
+    if (syncPolicy.enabled) {
+        FileIO::syncFile(working);
+    }
 
     // Make executable on Unix systems
 #ifndef _WIN32
-    std::filesystem::permissions(outputPath, 
+    std::filesystem::permissions(working, 
         std::filesystem::perms::owner_exec | 
         std::filesystem::perms::group_exec | 
         std::filesystem::perms::others_exec,
         std::filesystem::perm_options::add);
 #endif
-
-    return true;
+    FileIO::replaceFile(working, outputPath);
 }
 
 // Helper method to add file to a stream instead of file
@@ -263,277 +1044,824 @@ void Archive::addFileToArchiveStream(const std::filesystem::path& file,
                                     const std::string& archivePath,
                                     std::ostringstream& archive, 
                                     CompressionType compression) {
-    // Read the input file
-    std::ifstream input(file, std::ios::binary);
-    if (!input) {
-        throw std::runtime_error("Failed to open input file: " + file.string());
-    }
-
-    std::vector<char> buffer(std::istreambuf_iterator<char>(input), {});
-    input.close();
+    addFileToArchive(file, archivePath, archive, compression);
+}
 
-    // Compress the data
-    auto compressed = compressData(buffer, compression);
+void Archive::create(const std::vector<fs::path>& files, CompressionType compression) {
+    if (archiveName == "-") {
+        FileIO::setBinaryStandardStreams();
+        createStream(std::cout, files, compression);
+        std::cerr << "Archive written to standard output with " << entries.size() << " files." << std::endl;
+        return;
+    }
+    if (volumeOptions.volumeSize > 0) {
+        createVolumes(files, compression);
+        return;
+    }
 
-    // Write file header
-    FileHeader header{};
-    header.signature = SIGNATURE;
-    header.version = CURRENT_VERSION;
-    header.nameLength = static_cast<uint32_t>(archivePath.length());
-    header.compressedSize = compressed.size();
-    header.originalSize = buffer.size();
-    header.timestamp = std::filesystem::last_write_time(file).time_since_epoch().count();
+    // Everything is written to a working file that replaces the archive
+    // only once complete, so a crash never leaves a torn archive behind
+    const std::string working = workingPath();
+    const fs::path journal = journalPath();
 
-    archive.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    archive.write(archivePath.c_str(), header.nameLength);
-    archive.write(compressed.data(), header.compressedSize);
+    // A resumable create picks up after the last entry in the journal
+    uint64_t committed = resumable && fs::exists(journal) ? readJournal(journal) : 0;
+    if (committed > 0 && (!fs::exists(working) || fs::file_size(working) < committed)) {
+        committed = 0;
+    }
 
-    // Store entry information
-    entries.push_back(ArchiveEntry{
-        archivePath,
-        header.compressedSize,
-        header.originalSize,
-        header.timestamp
-    });
-}
+    const bool adaptive = compression == CompressionType::Adaptive;
 
-void Archive::create(const std::vector<fs::path>& files, CompressionType compression) {
-    std::ofstream archive(archiveName, std::ios::binary);
+    std::fstream archive;
+    std::unordered_set<std::string> done;
+    if (committed > 0) {
+        fs::resize_file(working, committed);
+        loadCatalog(working);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            done.emplace(entries.name(i));
+        }
+        archive.open(working, std::ios::binary | std::ios::in | std::ios::out);
+        archive.seekp(0, std::ios::end);
+    } else {
+        archive.open(working, std::ios::binary | std::ios::out | std::ios::trunc);
+    }
     if (!archive) {
         throw std::runtime_error("Failed to create archive: " + archiveName);
     }
 
-    entries.clear();
-
-    // Write dummy header - will be updated with file count later
-    FileHeader header{};
-    header.signature = SIGNATURE;
-    header.version = CURRENT_VERSION;
-    archive.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (committed == 0) {
+        entries.clear();
+        volumePaths.clear();
+        entryVolumes.clear();
 
-    if (files.empty()) {
-        archive.close();
-        std::cout << "Archive '" << archiveName << "' created successfully (empty)." << std::endl;
-        return;
+        // Write dummy header - will be updated with file count later
+        writeArchiveHeader(archive);
     }
 
-    // Find common base path for all files
-    fs::path basePath;
-    if (files.size() > 1) {
-        basePath = files[0].parent_path();
-        for (const auto& file : files) {
-            auto parent = file.parent_path();
-            while (!basePath.empty() && !fs::equivalent(basePath, parent) && 
-                   !fs::equivalent(basePath, parent.parent_path())) {
-                basePath = basePath.parent_path();
-            }
+    std::ofstream journalOut;
+    if (resumable) {
+        journalOut.open(journal, committed > 0 ? std::ios::app : std::ios::trunc);
+        if (!journalOut) {
+            throw std::runtime_error("Failed to open journal: " + journal.string());
         }
     }
-    for (const auto& file : files) {
-        if (!fs::exists(file)) {
-            throw std::runtime_error("File not found: " + file.string());
-        }
 
-        if (!fs::is_regular_file(file)) {
-            std::cerr << "Skipping non-regular file: " << file << std::endl;
-            continue;
+    try {
+        // Journal lines are only written once the batch they describe is
+        // synced, so a resumed create never trusts data that was lost
+        SyncBatcher batcher(archive, working, syncPolicy, stats, adaptive ? &levelController : nullptr);
+        std::string pendingJournal;
+
+        reportInputTotals(files);
+        std::vector<PendingInput> inputs;
+        for (auto& input : collectInputs(files)) {
+            if (!done.count(input.archivePath)) {
+                inputs.push_back(std::move(input));
+            } else if (progress) {
+                progress->addBytes(input.size);
+                progress->addFile();
+            }
+        }
+        writeInputs(inputs, archive, compression, false,
+                    [&](const PendingInput& input, uint64_t start, uint64_t end) {
+                        if (resumable) {
+                            pendingJournal += std::to_string(end) + ' ' + input.archivePath + '\n';
+                        }
+                        if (batcher.entryWritten(end - start) && resumable) {
+                            journalOut << pendingJournal << std::flush;
+                            pendingJournal.clear();
+                        }
+                    });
+
+        writeNameIndex(archive);
+        batcher.sync();
+        archive.close();
+        FileIO::replaceFile(working, archiveName);
+        discardUndoRecord();
+    } catch (...) {
+        archive.close();
+        // The working file is only worth keeping if a resume can use it
+        if (!resumable) {
+            std::error_code ec;
+            fs::remove(working, ec);
         }
+        throw;
+    }
 
-        std::string relativePath = makeArchivePath(file, basePath);
-        addFileToArchive(file, relativePath, archive, compression);
+    journalOut.close();
+    fs::remove(journal);
+    if (entries.empty()) {
+        std::cout << "Archive '" << archiveName << "' created successfully (empty)." << std::endl;
+    } else {
+        std::cout << "Archive '" << archiveName << "' created successfully with " 
+                  << entries.size() << " files." << std::endl;
     }
+}
+
+void Archive::createStream(std::ostream& out, const std::vector<fs::path>& files,
+                           CompressionType compression) {
+    CountingBuffer counter(out.rdbuf());
+    std::ostream archive(&counter);
+    entries.clear();
+    writeArchiveHeader(archive);
+
+    reportInputTotals(files);
+    writeInputs(collectInputs(files), archive, compression, true, nullptr);
 
-    archive.close();
-    std::cout << "Archive '" << archiveName << "' created successfully with " 
-              << entries.size() << " files." << std::endl;
+    writeNameIndex(archive);
+    ArchiveStats::ScopedTimer timer(stats, StatStage::Write);
+    if (!archive.flush()) {
+        throw std::runtime_error("Failed to write archive");
+    }
 }
 
 void Archive::add(const std::vector<fs::path>& files, CompressionType compression) {
     if (files.empty()) {
         throw std::runtime_error("No files specified for adding to archive");
     }
+    if (!volumePaths.empty()) {
+        throw std::runtime_error("Cannot add to a multi-volume archive: " + archiveName);
+    }
 
-    // Open existing archive in append mode
-    std::ofstream archive(archiveName, std::ios::binary | std::ios::app);
-    if (!archive) {
-        throw std::runtime_error("Failed to open archive for appending: " + archiveName);
+    // Finish undoing an interrupted append before writing over it
+    if (fs::exists(undoPath())) {
+        rollBackAppend();
+        loadCatalog(archiveName);
     }
 
-    // Find common base path for new files
-    fs::path basePath;
-    if (files.size() > 1) {
-        basePath = files[0].parent_path();
-        for (const auto& file : files) {
-            auto parent = file.parent_path();
-            while (!basePath.empty() && !fs::equivalent(basePath, parent) && 
-                   !fs::equivalent(basePath, parent.parent_path())) {
-                basePath = basePath.parent_path();
-            }
+    // Without the append journal, the new entries go into a copy of the
+    // archive that replaces it once complete. With it, the old length and
+    // index are saved first and the archive is extended in place.
+    const bool exists = fs::exists(archiveName);
+    const bool inPlace = exists && appendJournal;
+    const std::string target = inPlace ? archiveName : workingPath();
+    const bool adaptive = compression == CompressionType::Adaptive;
+
+    // Position at the end of the entry data, dropping the old index; a
+    // fresh one is written once the new entries are in.
+    std::fstream archive;
+    if (exists) {
+        if (inPlace) {
+            writeUndoRecord();
+        } else {
+            fs::copy_file(archiveName, target, fs::copy_options::overwrite_existing);
         }
+        if (dataEnd > 0 && fs::file_size(target) > dataEnd) {
+            fs::resize_file(target, dataEnd);
+        }
+        archive.open(target, std::ios::binary | std::ios::in | std::ios::out);
+        archive.seekp(0, std::ios::end);
+    } else {
+        archive.open(target, std::ios::binary | std::ios::out | std::ios::trunc);
+        writeArchiveHeader(archive);
+    }
+    if (!archive) {
+        throw std::runtime_error("Failed to open archive for appending: " + archiveName);
     }
 
     size_t addedCount = 0;
-    for (const auto& file : files) {
-        if (!fs::exists(file)) {
-            throw std::runtime_error("File not found: " + file.string());
+    try {
+        SyncBatcher batcher(archive, target, syncPolicy, stats, adaptive ? &levelController : nullptr);
+
+        reportInputTotals(files);
+        writeInputs(collectInputs(files), archive, compression, false,
+                    [&](const PendingInput&, uint64_t start, uint64_t end) {
+                        batcher.entryWritten(end - start);
+                        addedCount++;
+                    });
+
+        writeNameIndex(archive);
+        batcher.sync();
+        archive.close();
+        if (inPlace) {
+            fs::remove(undoPath());
+            FileIO::syncDirectory(fs::path(archiveName).parent_path());
+        } else {
+            FileIO::replaceFile(target, archiveName);
         }
-
-        if (!fs::is_regular_file(file)) {
-            std::cerr << "Skipping non-regular file: " << file << std::endl;
-            continue;
+    } catch (...) {
+        archive.close();
+        if (inPlace) {
+            rollBackAppend();
+        } else {
+            std::error_code ec;
+            fs::remove(target, ec);
         }
-
-        std::string relativePath = makeArchivePath(file, basePath);
-        addFileToArchive(file, relativePath, archive, compression);
-        addedCount++;
+        // Drop the entries that never made it into the archive
+        if (exists) {
+            loadCatalog(archiveName);
+        } else {
+            entries.clear();
+            dataEnd = 0;
+        }
+        throw;
     }
 
-    archive.close();
     std::cout << "Added " << addedCount << " files to archive '" << archiveName << "'." << std::endl;
 }
 
 std::vector<char> Archive::compressData(const std::vector<char>& input, CompressionType compression) {
-    if (input.empty()) return {};
+    return compressData(input.data(), input.size(), compression);
+}
+
+std::vector<char> Archive::compressData(const char* data, size_t size, CompressionType compression) {
+    if (size == 0) return {};
 
     // Initialize zlib stream
     z_stream strm = {};
-    if (deflateInit(&strm, static_cast<int>(compression)) != Z_OK) {
+    if (deflateInit(&strm, deflateLevel(compression)) != Z_OK) {
         throw std::runtime_error("Failed to initialize compression");
     }
 
-    // Set up input
-    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
-    strm.avail_in = static_cast<uInt>(input.size());
-
-    // Prepare output buffer (slightly larger than input for safety)
-    std::vector<char> output(static_cast<size_t>(input.size() * 1.1) + 12);
-    strm.next_out = reinterpret_cast<Bytef*>(output.data());
-    strm.avail_out = static_cast<uInt>(output.size());
-
-    // Compress
-    if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
-        deflateEnd(&strm);
-        throw std::runtime_error("Compression failed");
+    // zlib counts in uInt, so buffers of 4 GiB or more are fed in pieces;
+    // smaller ones go in one call, which keeps the output unchanged
+    const uint64_t piece = uint64_t{1} << 30;
+    uint64_t inputLeft = size;
+    std::vector<char> output(static_cast<size_t>(size * 1.1) + 12);
+    size_t produced = 0;
+    int status = Z_OK;
+    while (status != Z_STREAM_END) {
+        if (strm.avail_in == 0 && inputLeft > 0) {
+            strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + (size - inputLeft)));
+            strm.avail_in = static_cast<uInt>(std::min(inputLeft, piece));
+            inputLeft -= strm.avail_in;
+        }
+        if (produced == output.size()) {
+            output.resize(output.size() + output.size() / 2);
+        }
+        strm.next_out = reinterpret_cast<Bytef*>(output.data() + produced);
+        strm.avail_out = static_cast<uInt>(std::min<uint64_t>(output.size() - produced, piece));
+        const uInt room = strm.avail_out;
+        status = deflate(&strm, inputLeft == 0 ? Z_FINISH : Z_NO_FLUSH);
+        if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+            deflateEnd(&strm);
+            throw std::runtime_error("Compression failed");
+        }
+        produced += room - strm.avail_out;
     }
 
     // Clean up and resize output
     deflateEnd(&strm);
-    output.resize(strm.total_out);
+    output.resize(produced);
+    return output;
+}
+
+std::vector<char> Archive::compressAdaptive(const char* data, size_t size) {
+    if (size == 0) return {};
+
+    struct Deflater {
+        z_stream strm = {};
+        ~Deflater() { deflateEnd(&strm); }
+    } deflater;
+    z_stream& strm = deflater.strm;
+    int level = levelController.level();
+    if (deflateInit(&strm, level) != Z_OK) {
+        throw std::runtime_error("Failed to initialize compression");
+    }
+
+    std::vector<char> output;
+    output.reserve(deflateBound(&strm, static_cast<uLong>(size)));
+    std::vector<char> buffer(deflateBound(&strm, CompressionController::BLOCK_SIZE));
+    auto emit = [&](const char* piece, size_t length) { output.insert(output.end(), piece, piece + length); };
+    for (size_t done = 0;;) {
+        const size_t piece = std::min(CompressionController::BLOCK_SIZE, size - done);
+        const auto start = std::chrono::steady_clock::now();
+        const size_t before = output.size();
+        strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + done));
+        strm.avail_in = static_cast<uInt>(piece);
+        done += piece;
+        const int flush = done == size ? Z_FINISH : Z_NO_FLUSH;
+        int status = Z_OK;
+        do {
+            strm.next_out = reinterpret_cast<Bytef*>(buffer.data());
+            strm.avail_out = static_cast<uInt>(buffer.size());
+            status = deflate(&strm, flush);
+            if (status == Z_STREAM_ERROR) {
+                throw std::runtime_error("Compression failed");
+            }
+            emit(buffer.data(), buffer.size() - strm.avail_out);
+        } while (strm.avail_out == 0);
+        levelController.recordCompression(level, piece, output.size() - before,
+                                          std::chrono::steady_clock::now() - start);
+        if (flush == Z_FINISH) {
+            if (status != Z_STREAM_END) {
+                throw std::runtime_error("Compression failed");
+            }
+            break;
+        }
+        if (levelController.level() != level) {
+            level = levelController.level();
+            changeDeflateLevel(strm, level, buffer, emit);
+        }
+    }
     return output;
 }
 
+void Archive::decodeEntry(const EntryHeader& header, std::vector<SparseExtent> extents,
+                          const std::function<void(char*, size_t)>& read,
+                          const std::function<void(const char*, size_t)>& emit,
+                          const std::string& name, PayloadDecryptor* decryptor) {
+    // An encrypted payload is decrypted as it is read; its tag is checked
+    // once all of it has been
+    std::unique_ptr<PayloadCipher> cipher;
+    uint64_t inputLeft = header.compressedSize;
+    if (header.isEncrypted()) {
+        if (!decryptor) {
+            throw std::runtime_error("Entry is encrypted: " + name);
+        }
+        if (header.compressedSize < ENCRYPTION_OVERHEAD) {
+            throw std::runtime_error("Corrupt entry: " + name);
+        }
+        uint8_t nonce[ENCRYPTION_NONCE_SIZE];
+        read(reinterpret_cast<char*>(nonce), sizeof(nonce));
+        cipher = decryptor->begin(nonce, name);
+        if (!cipher) {
+            throw std::runtime_error("Failed to initialize decryption for: " + name);
+        }
+        inputLeft -= ENCRYPTION_OVERHEAD;
+    } else if (header.originalSize == 0) {
+        return;
+    }
+    auto readPayload = [&](char* data, size_t size) {
+        read(data, size);
+        if (cipher && !cipher->update(data, data, size)) {
+            throw std::runtime_error("Decryption failed for: " + name);
+        }
+    };
+    // A sealed payload that fails its tag, or that does not decode, was
+    // sealed with another key or altered
+    const std::string authenticationFailed = "Authentication failed for: " + name + " (wrong key or corrupt data)";
+    auto decodeFailed = [&] {
+        return std::runtime_error(cipher ? authenticationFailed : "Decompression failed for: " + name);
+    };
+    if (!header.isSparse()) {
+        extents.assign(1, SparseExtent{0, header.originalSize});
+    }
+    struct Inflater {
+        z_stream strm = {};
+        bool active = false;
+        ~Inflater() {
+            if (active) {
+                inflateEnd(&strm);
+            }
+        }
+    } inflater;
+    z_stream& strm = inflater.strm;
+    if (header.codec != CODEC_STORED) {
+        if (inflateInit2(&strm, header.codec == CODEC_DEFLATE ? -MAX_WBITS : MAX_WBITS) != Z_OK) {
+            throw std::runtime_error("Failed to initialize decompression");
+        }
+        inflater.active = true;
+    }
+
+    // Buffers are sized to the entry, so small entries stay cheap
+    const size_t chunkSize = static_cast<size_t>(std::min<uint64_t>(1 << 20, header.originalSize));
+    std::vector<char> input(header.codec == CODEC_STORED
+                                ? 0
+                                : static_cast<size_t>(std::min<uint64_t>(1 << 20, header.compressedSize)));
+    std::vector<char> output(chunkSize);
+
+    // Fills the start of output with the next size bytes of extent data
+    auto nextData = [&](size_t size) {
+        if (header.codec == CODEC_STORED) {
+            if (size > inputLeft) {
+                throw std::runtime_error("Corrupt stored entry: " + name);
+            }
+            readPayload(output.data(), size);
+            inputLeft -= size;
+            return;
+        }
+        strm.next_out = reinterpret_cast<Bytef*>(output.data());
+        strm.avail_out = static_cast<uInt>(size);
+        while (strm.avail_out > 0) {
+            if (strm.avail_in == 0) {
+                if (inputLeft == 0) {
+                    throw decodeFailed();
+                }
+                size_t piece = static_cast<size_t>(std::min<uint64_t>(input.size(), inputLeft));
+                readPayload(input.data(), piece);
+                strm.next_in = reinterpret_cast<Bytef*>(input.data());
+                strm.avail_in = static_cast<uInt>(piece);
+                inputLeft -= piece;
+            }
+            int status = inflate(&strm, Z_NO_FLUSH);
+            if ((status != Z_OK && status != Z_STREAM_END) || (status == Z_STREAM_END && strm.avail_out > 0)) {
+                throw decodeFailed();
+            }
+        }
+    };
+
+    const std::vector<char> zeros(header.isSparse() ? chunkSize : 0);
+    uint64_t position = 0;
+    auto emitZeros = [&](uint64_t end) {
+        while (position < end) {
+            size_t piece = static_cast<size_t>(std::min<uint64_t>(zeros.size(), end - position));
+            emit(zeros.data(), piece);
+            position += piece;
+        }
+    };
+    for (const auto& extent : extents) {
+        emitZeros(extent.offset);
+        for (uint64_t left = extent.length; left > 0;) {
+            size_t piece = static_cast<size_t>(std::min<uint64_t>(output.size(), left));
+            nextData(piece);
+            emit(output.data(), piece);
+            left -= piece;
+            position += piece;
+        }
+    }
+    emitZeros(header.originalSize);
+
+    if (cipher) {
+        // The tag covers every byte, including any the codec did not need
+        std::vector<char> rest(static_cast<size_t>(std::min<uint64_t>(64 * 1024, inputLeft)));
+        while (inputLeft > 0) {
+            size_t piece = static_cast<size_t>(std::min<uint64_t>(rest.size(), inputLeft));
+            readPayload(rest.data(), piece);
+            inputLeft -= piece;
+        }
+        uint8_t tag[ENCRYPTION_TAG_SIZE];
+        read(reinterpret_cast<char*>(tag), sizeof(tag));
+        if (!cipher->verify(tag)) {
+            throw std::runtime_error(authenticationFailed);
+        }
+    }
+}
+
 void Archive::addFileToArchive(const fs::path& file, const std::string& archivePath,
-                             std::ofstream& archive, CompressionType compression) {
-    // Read the input file
-    std::ifstream input(file, std::ios::binary);
-    if (!input) {
-        throw std::runtime_error("Failed to open input file: " + file.string());
+                             std::ostream& archive, CompressionType compression) {
+    PreparedEntry entry = prepareFile(file, archivePath, compression);
+    writeEntry(entry, archive, compression);
+}
+
+Archive::PreparedEntry Archive::prepareFile(const fs::path& file, const std::string& archivePath,
+                                            CompressionType compression) {
+    const auto fileStart = std::chrono::steady_clock::now();
+
+    // Read the input file, skipping any holes
+    std::vector<SparseExtent> extents;
+    uint64_t fileSize = 0;
+    std::vector<char> buffer;
+    {
+        ArchiveStats::ScopedTimer timer(stats, StatStage::Read);
+        buffer = readSourceFile(file, extents, fileSize);
+        timer.setBytes(buffer.size());
     }
+    int64_t timestamp = 0;
+    {
+        ArchiveStats::ScopedTimer timer(stats, StatStage::Metadata);
+        timestamp = fs::last_write_time(file).time_since_epoch().count();
+    }
+    return compressEntry(archivePath, buffer, std::move(extents), fileSize, timestamp, compression, fileStart);
+}
 
-    std::vector<char> buffer(std::istreambuf_iterator<char>(input), {});
-    input.close();
+void Archive::addEntryData(const std::string& archivePath, const std::vector<char>& buffer,
+                           const std::vector<SparseExtent>& extents, uint64_t fileSize, int64_t timestamp,
+                           std::ostream& archive, CompressionType compression,
+                           std::chrono::steady_clock::time_point fileStart) {
+    PreparedEntry entry = compressEntry(archivePath, buffer, extents, fileSize, timestamp, compression, fileStart);
+    writeEntry(entry, archive, compression);
+}
 
-    // Compress the data
-    auto compressed = compressData(buffer, compression);
+Archive::PreparedEntry Archive::compressEntry(const std::string& archivePath, const std::vector<char>& buffer,
+                                              std::vector<SparseExtent> extents, uint64_t fileSize,
+                                              int64_t timestamp, CompressionType compression,
+                                              std::chrono::steady_clock::time_point fileStart) {
+    PreparedEntry entry;
+    entry.archivePath = archivePath;
+    uint32_t checksum = 0;
+    Sha256::Digest digest{};
+    {
+        ArchiveStats::ScopedTimer timer(stats, StatStage::Compress, buffer.size());
+        entry.compressed = compression == CompressionType::Adaptive
+                               ? compressAdaptive(buffer.data(), buffer.size())
+                               : compressData(buffer, compression);
+        // crc32 counts in uInt, so files of 4 GiB or more go in 1 GiB pieces
+        uLong crc = ::crc32(0L, Z_NULL, 0);
+        for (uint64_t done = 0; done < buffer.size();) {
+            uInt chunk = static_cast<uInt>(std::min<uint64_t>(buffer.size() - done, uint64_t{1} << 30));
+            crc = ::crc32(crc, reinterpret_cast<const Bytef*>(buffer.data() + done), chunk);
+            done += chunk;
+        }
+        checksum = static_cast<uint32_t>(crc);
+        if (contentHashes) {
+            digest = Sha256::hash(buffer.data(), buffer.size());
+        }
+    }
+    if (encryptionKey) {
+        ArchiveStats::ScopedTimer timer(stats, StatStage::Encrypt, entry.compressed.size());
+        entry.compressed = EntryCipher::seal(*encryptionKey, archivePath, entry.compressed);
+    }
 
-    // Write file header
-    FileHeader header{};
-    header.signature = SIGNATURE;
-    header.version = CURRENT_VERSION;
+    EntryHeader& header = entry.header;
+    // A file that is all holes has no extents but is still sparse
+    const bool sparse = buffer.size() != fileSize;
+    header.flags = ENTRY_FLAG_CRC32 | (sparse ? ENTRY_FLAG_SPARSE : 0) | (encryptionKey ? ENTRY_FLAG_ENCRYPTED : 0);
+    header.codec = CODEC_ZLIB;
+    header.crc32 = checksum;
+    if (contentHashes) {
+        header.flags |= ENTRY_FLAG_SHA256;
+        std::memcpy(header.sha256, digest.data(), digest.size());
+    }
     header.nameLength = static_cast<uint32_t>(archivePath.length());
-    header.compressedSize = compressed.size();
-    header.originalSize = buffer.size();
-    header.timestamp = fs::last_write_time(file).time_since_epoch().count();
+    header.compressedSize = entry.compressed.size();
+    header.originalSize = fileSize;
+    header.timestamp = timestamp;
+    entry.extents = std::move(extents);
+    entry.elapsed = std::chrono::steady_clock::now() - fileStart;
+    return entry;
+}
+
+uint64_t Archive::entryRecordSize(const PreparedEntry& entry) {
+    uint8_t encoded[MAX_ENTRY_HEADER_SIZE];
+    uint64_t size = ArchiveFormat::encodeEntryHeader(entry.header, encoded) + entry.header.nameLength +
+                    entry.header.compressedSize;
+    if (entry.header.isSparse()) {
+        std::vector<uint8_t> map;
+        ArchiveFormat::encodeSparseMap(entry.extents, map);
+        size += map.size();
+    }
+    return size;
+}
+
+void Archive::writeEntryRecord(const PreparedEntry& entry, std::ostream& archive) {
+    const EntryHeader& header = entry.header;
+    uint8_t encoded[MAX_ENTRY_HEADER_SIZE];
+    size_t headerSize = ArchiveFormat::encodeEntryHeader(header, encoded);
+    archive.write(reinterpret_cast<const char*>(encoded), static_cast<std::streamsize>(headerSize));
+    archive.write(entry.archivePath.c_str(), header.nameLength);
+    if (header.isSparse()) {
+        std::vector<uint8_t> map;
+        ArchiveFormat::encodeSparseMap(entry.extents, map);
+        archive.write(reinterpret_cast<const char*>(map.data()), static_cast<std::streamsize>(map.size()));
+    }
+    archive.write(entry.compressed.data(), static_cast<std::streamsize>(header.compressedSize));
+}
 
-    archive.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    archive.write(archivePath.c_str(), header.nameLength);
-    archive.write(compressed.data(), header.compressedSize);
+void Archive::writeEntry(const PreparedEntry& entry, std::ostream& archive, CompressionType compression) {
+    const auto writeStart = std::chrono::steady_clock::now();
+    const EntryHeader& header = entry.header;
+    uint64_t offset = static_cast<uint64_t>(archive.tellp());
+    {
+        ArchiveStats::ScopedTimer timer(stats, StatStage::Write, header.compressedSize);
+        writeEntryRecord(entry, archive);
+    }
+    const auto writeTime = std::chrono::steady_clock::now() - writeStart;
+    if (compression == CompressionType::Adaptive) {
+        levelController.recordWrite(header.compressedSize, writeTime);
+    }
 
     if (!archive) {
         throw std::runtime_error("Failed to write to archive");
     }
 
     // Store entry information
-    entries.push_back(ArchiveEntry{
-        archivePath,
-        header.compressedSize,
-        header.originalSize,
-        header.timestamp
-    });
-}
+    entries.add(entry.archivePath, header.compressedSize, header.originalSize,
+                header.timestamp, offset);
 
-void Archive::extract(const std::string& outputDir) {
-    std::ifstream archive(archiveName, std::ios::binary);
-    if (!archive) {
-        throw std::runtime_error("Failed to open archive: " + archiveName);
+    if (progress) {
+        progress->addBytes(header.originalSize);
+        progress->addFile();
+    }
+    if (stats) {
+        stats->recordFile(header.originalSize, header.compressedSize, entry.elapsed + writeTime);
     }
+}
 
-    // Create output directory if it doesn't exist
-    fs::path outPath(outputDir);
-    if (!fs::exists(outPath)) {
-        fs::create_directories(outPath);
+void Archive::addFileStreamed(const fs::path& file, const std::string& archivePath,
+                              std::ostream& archive, CompressionType compression) {
+    const auto fileStart = std::chrono::steady_clock::now();
+    FileIO::InputFile input(file);
+    int64_t timestamp = 0;
+    {
+        ArchiveStats::ScopedTimer timer(stats, StatStage::Metadata);
+        timestamp = fs::last_write_time(file).time_since_epoch().count();
     }
+    uint64_t position = 0;
+    addStreamedEntry(archivePath, input.size(), timestamp,
+                     [&](char* data, size_t size) {
+                         input.readAt(position, data, size);
+                         position += size;
+                     },
+                     archive, compression, fileStart);
+}
 
-    // Read and verify archive header
-    FileHeader header;
-    if (!archive.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
-        header.signature != SIGNATURE) {
-        throw std::runtime_error("Invalid archive format");
+void Archive::addStreamedEntry(const std::string& archivePath, uint64_t size, int64_t timestamp,
+                               const std::function<void(char*, size_t)>& read,
+                               std::ostream& archive, CompressionType compression,
+                               std::chrono::steady_clock::time_point fileStart) {
+    EntryHeader header;
+    header.flags = ENTRY_FLAG_CRC32 | ENTRY_FLAG_DESCRIPTOR | (contentHashes ? ENTRY_FLAG_SHA256 : 0) |
+                   (encryptionKey ? ENTRY_FLAG_ENCRYPTED : 0);
+    header.codec = CODEC_ZLIB;
+    header.nameLength = static_cast<uint32_t>(archivePath.length());
+    header.timestamp = timestamp;
+    const uint64_t offset = static_cast<uint64_t>(archive.tellp());
+    std::unique_ptr<EntryCipher> cipher;
+    if (encryptionKey) {
+        cipher = std::make_unique<EntryCipher>(*encryptionKey, archivePath);
+    }
+    {
+        ArchiveStats::ScopedTimer timer(stats, StatStage::Write);
+        uint8_t encoded[MAX_ENTRY_HEADER_SIZE];
+        size_t headerSize = ArchiveFormat::encodeEntryHeader(header, encoded);
+        archive.write(reinterpret_cast<const char*>(encoded), static_cast<std::streamsize>(headerSize));
+        archive.write(archivePath.c_str(), header.nameLength);
+        if (cipher) {
+            archive.write(reinterpret_cast<const char*>(cipher->nonce()), ENCRYPTION_NONCE_SIZE);
+            header.compressedSize += ENCRYPTION_NONCE_SIZE;
+        }
     }
 
-    while (archive) {
-        if (!archive.read(reinterpret_cast<char*>(&header), sizeof(header)))
-            break;
+    struct Deflater {
+        z_stream strm = {};
+        ~Deflater() { deflateEnd(&strm); }
+    } deflater;
+    z_stream& strm = deflater.strm;
+    const bool adaptive = compression == CompressionType::Adaptive;
+    int level = adaptive ? levelController.level() : static_cast<int>(compression);
+    if (deflateInit(&strm, level) != Z_OK) {
+        throw std::runtime_error("Failed to initialize compression");
+    }
 
-        if (header.signature != SIGNATURE)
+    // Compression and writes interleave, so their time is summed per stage
+    std::vector<char> chunk(CompressionController::BLOCK_SIZE);
+    std::vector<char> compressed(deflateBound(&strm, static_cast<uLong>(chunk.size())));
+    std::chrono::steady_clock::duration compressTime{};
+    std::chrono::steady_clock::duration writeTime{};
+    uLong crc = ::crc32(0L, Z_NULL, 0);
+    Sha256 sha;
+
+    // An encrypted entry is sealed chunk by chunk on its way out
+    std::vector<char> sealed(cipher ? compressed.size() : 0);
+    std::chrono::steady_clock::duration encryptTime{};
+    auto writePayload = [&](const char* data, size_t length) {
+        if (cipher) {
+            const auto start = std::chrono::steady_clock::now();
+            if (!cipher->update(data, sealed.data(), length)) {
+                throw std::runtime_error("Encryption failed");
+            }
+            data = sealed.data();
+            encryptTime += std::chrono::steady_clock::now() - start;
+        }
+        archive.write(data, static_cast<std::streamsize>(length));
+        header.compressedSize += length;
+    };
+    for (uint64_t done = 0;;) {
+        size_t piece = static_cast<size_t>(std::min<uint64_t>(chunk.size(), size - done));
+        {
+            ArchiveStats::ScopedTimer timer(stats, StatStage::Read, piece);
+            read(chunk.data(), piece);
+        }
+        done += piece;
+        const int flush = done == size ? Z_FINISH : Z_NO_FLUSH;
+
+        auto start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::duration chunkCompressTime{};
+        std::chrono::steady_clock::duration chunkWriteTime{};
+        const uint64_t before = header.compressedSize;
+        crc = ::crc32(crc, reinterpret_cast<const Bytef*>(chunk.data()), static_cast<uInt>(piece));
+        if (contentHashes) {
+            sha.update(chunk.data(), piece);
+        }
+        strm.next_in = reinterpret_cast<Bytef*>(chunk.data());
+        strm.avail_in = static_cast<uInt>(piece);
+        int status = Z_OK;
+        do {
+            strm.next_out = reinterpret_cast<Bytef*>(compressed.data());
+            strm.avail_out = static_cast<uInt>(compressed.size());
+            status = deflate(&strm, flush);
+            if (status == Z_STREAM_ERROR) {
+                throw std::runtime_error("Compression failed");
+            }
+            size_t produced = compressed.size() - strm.avail_out;
+            auto written = std::chrono::steady_clock::now();
+            chunkCompressTime += written - start;
+            const auto encryptedBefore = encryptTime;
+            writePayload(compressed.data(), produced);
+            start = std::chrono::steady_clock::now();
+            chunkWriteTime += start - written - (encryptTime - encryptedBefore);
+        } while (strm.avail_out == 0);
+        compressTime += chunkCompressTime;
+        writeTime += chunkWriteTime;
+        if (adaptive) {
+            const uint64_t produced = header.compressedSize - before;
+            levelController.recordWrite(produced, chunkWriteTime);
+            levelController.recordCompression(level, piece, produced, chunkCompressTime);
+        }
+        if (flush == Z_FINISH) {
+            if (status != Z_STREAM_END) {
+                throw std::runtime_error("Compression failed");
+            }
             break;
+        }
+        if (adaptive && levelController.level() != level) {
+            level = levelController.level();
+            changeDeflateLevel(strm, level, compressed, writePayload);
+        }
+    }
+    if (cipher) {
+        uint8_t tag[ENCRYPTION_TAG_SIZE];
+        cipher->finish(tag);
+        archive.write(reinterpret_cast<const char*>(tag), sizeof(tag));
+        header.compressedSize += sizeof(tag);
+    }
+    if (stats) {
+        stats->addStage(StatStage::Compress, compressTime, size);
+        if (cipher) {
+            stats->addStage(StatStage::Encrypt, encryptTime, header.compressedSize);
+        }
+        stats->addStage(StatStage::Write, writeTime, header.compressedSize);
+    }
 
-        std::string fileName;
-        fileName.resize(header.nameLength);
-        if (!archive.read(&fileName[0], header.nameLength))
-            break;
+    header.originalSize = size;
+    header.crc32 = static_cast<uint32_t>(crc);
+    if (contentHashes) {
+        Sha256::Digest digest = sha.finish();
+        std::memcpy(header.sha256, digest.data(), digest.size());
+    }
+    {
+        ArchiveStats::ScopedTimer timer(stats, StatStage::Write);
+        uint8_t descriptor[MAX_DESCRIPTOR_SIZE];
+        size_t descriptorSize = ArchiveFormat::encodeEntryDescriptor(header, descriptor);
+        archive.write(reinterpret_cast<const char*>(descriptor), static_cast<std::streamsize>(descriptorSize));
+    }
+    if (!archive) {
+        throw std::runtime_error("Failed to write to archive");
+    }
 
-        // Create full output path, including any subdirectories
-        fs::path fullPath = outPath / fileName;
-        fs::create_directories(fullPath.parent_path());
+    entries.add(archivePath, header.compressedSize, header.originalSize,
+                header.timestamp, offset);
 
-        // Read compressed data
-        std::vector<char> compressedData(header.compressedSize);
-        if (!archive.read(compressedData.data(), header.compressedSize))
-            break;
+    if (progress) {
+        progress->addBytes(size);
+        progress->addFile();
+    }
+    if (stats) {
+        stats->recordFile(size, header.compressedSize, std::chrono::steady_clock::now() - fileStart);
+    }
+}
 
-        // Decompress
-        z_stream strm = {};
-        if (inflateInit(&strm) != Z_OK) {
-            throw std::runtime_error("Failed to initialize decompression");
+void Archive::extract(const std::string& outputDir) {
+    if (archiveName == "-") {
+        FileIO::setBinaryStandardStreams();
+        runExtract(outputDir, 0);
+    } else {
+        if (!fs::exists(archiveName)) {
+            throw std::runtime_error("Failed to open archive: " + archiveName);
         }
+        runExtract(outputDir, -1);
+    }
 
-        std::vector<char> decompressedData(header.originalSize);
-        strm.next_in = reinterpret_cast<Bytef*>(compressedData.data());
-        strm.avail_in = static_cast<uInt>(header.compressedSize);
-        strm.next_out = reinterpret_cast<Bytef*>(decompressedData.data());
-        strm.avail_out = static_cast<uInt>(header.originalSize);
+    std::cout << "Archive '" << archiveName << "' extracted successfully to '" 
+              << outputDir << "'." << std::endl;
+}
 
-        if (inflate(&strm, Z_FINISH) != Z_STREAM_END) {
-            inflateEnd(&strm);
-            throw std::runtime_error("Decompression failed for: " + fileName);
-        }
-        inflateEnd(&strm);
+void Archive::extractStream(int fd, const std::string& outputDir) {
+    runExtract(outputDir, fd);
+}
 
-        // Write decompressed data
-        std::ofstream outFile(fullPath, std::ios::binary);
-        if (!outFile) {
-            throw std::runtime_error("Failed to create output file: " + fullPath.string());
-        }
-        outFile.write(decompressedData.data(), header.originalSize);
-        outFile.close();
+void Archive::runExtract(const std::string& outputDir, int fd) {
+    // Create output directory if it doesn't exist
+    fs::path outPath(outputDir);
+    if (!fs::exists(outPath)) {
+        fs::create_directories(outPath);
+    }
 
-        // Set file timestamp using filesystem operations
-        auto ft = fs::file_time_type(fs::file_time_type::duration(header.timestamp));
-        fs::last_write_time(fullPath, ft);
+    if (progress) {
+        // A stream has no index to take the totals from
+        if (fd < 0) {
+            uint64_t totalBytes = 0;
+            for (const auto entry : entries) {
+                totalBytes += entry.originalSize;
+            }
+            progress->setTotals(totalBytes, entries.size());
+        }
+        progress->beginStage("Extracting");
     }
 
-    archive.close();
-    std::cout << "Archive '" << archiveName << "' extracted successfully to '" 
-              << outputDir << "'." << std::endl;
+    ExtractOptions options;
+    options.threads = threads;
+    ExtractHooks hooks(*this);
+    options.observer = &hooks;
+    std::unique_ptr<EntryDecryptor> decryptor;
+    if (encryptionKey) {
+        decryptor = std::make_unique<EntryDecryptor>(*encryptionKey);
+        options.decryptor = decryptor.get();
+    }
+    if (fd < 0 && !volumePaths.empty()) {
+        extractVolumes(outPath, options);
+        return;
+    }
+    ExtractEngine engine(options);
+    ExtractResult result = fd < 0 ? engine.run(archiveName, outPath.generic_string())
+                                  : engine.runStream(fd, outPath.generic_string());
+    switch (result) {
+    case ExtractResult::Cancelled:
+        throw OperationCancelled();
+    case ExtractResult::Failed:
+        throw std::runtime_error(engine.errorMessage());
+    case ExtractResult::Success:
+        break;
+    }
 }
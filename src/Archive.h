@@ -7,17 +7,23 @@
 
 #include <string>
 #include <vector>
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <filesystem>
+#include <iosfwd>
+#include <optional>
+#include <string_view>
+#include "CompressionController.h"
 #include "CompressionTypes.h"
 #include "ArchiveFormat.h"
+#include "EntryCipher.h"
+#include "EntryTable.h"
 
-struct ArchiveEntry {
-    std::string name;
-    uint64_t compressedSize;
-    uint64_t originalSize;
-    time_t timestamp;
-};
+class ArchiveProgress;
+class ArchiveStats;
+class CancellationToken;
+struct ExtractOptions;
 
 /**
  * @brief Configuration for auto-execution after extraction
@@ -28,27 +34,154 @@ struct AutoExecConfig {
     bool silent = false;        ///< Run command without showing window
     bool waitForCompletion = true; ///< Wait for command to complete before exiting
     std::string workingDir;     ///< Working directory (empty = extraction directory)
+
+    /**
+     * @brief Start the command as soon as launchEntries are extracted and
+     *        extract everything else in the background
+     */
+    bool runInPlace = false;
+    std::vector<std::string> launchEntries; ///< Archive paths the command needs to start
+};
+
+/**
+ * @brief How create and add make written data durable
+ *
+ * Entries are synced in batches: one fdatasync covers every entry written
+ * since the previous one, and the archive is always synced before it
+ * replaces the target file.
+ */
+struct SyncPolicy {
+    bool enabled = true;                 ///< Call fdatasync at all (false leaves it to the OS)
+    uint64_t batchBytes = 64ull << 20;   ///< Sync once this many bytes are pending...
+    uint32_t batchEntries = 1024;        ///< ...or this many entries, whichever comes first
+};
+
+/**
+ * @brief How create splits an archive into volumes
+ *
+ * With a volume size, create writes a small catalog under the archive name
+ * and the entries to numbered volumes "<archive>.001", "<archive>.002", ...
+ * Each volume is a complete archive of whole entries and never larger than
+ * volumeSize. With several directories, one volume is open in each and
+ * every entry goes to the one holding the least data, so the writes are
+ * spread across the disks.
+ */
+struct VolumeOptions {
+    uint64_t volumeSize = 0;              ///< Largest volume file in bytes, 0 = one archive file
+    std::vector<std::string> directories; ///< Where volumes go; empty = next to the archive
+};
+
+/**
+ * @brief Order in which create and add write new entries
+ */
+enum class EntryOrder {
+    Input,   ///< As given; the console passes files sorted by path
+    Grouped  ///< By extension, then directory, then name, so similar files sit together
+};
+
+/**
+ * @brief What Archive::writePatch put into a patch
+ */
+struct PatchSummary {
+    uint64_t copiedEntries = 0;  ///< Entries taken unchanged from the old archive
+    uint64_t deltaEntries = 0;   ///< Entries sent as a delta against their old version
+    uint64_t literalEntries = 0; ///< Entries sent whole
+    uint64_t patchBytes = 0;
+    uint64_t archiveBytes = 0;   ///< Size of the archive the patch produces
 };
 
 class Archive {
 public:
     explicit Archive(const std::string& archiveName);
 
+    /**
+     * @brief Creates the archive; an archive name of "-" writes it to stdout
+     *
+     * With CompressionType::Adaptive the deflate level follows the measured
+     * compression and write speeds, see CompressionController.
+     */
     void create(const std::vector<std::filesystem::path>& files, 
                 CompressionType compression = CompressionType::Normal);
 
+    /**
+     * @brief Writes a new archive front to back to a stream that cannot seek
+     *
+     * Files of STREAMED_ENTRY_THRESHOLD bytes or more are compressed in
+     * chunks as they are read, with their sizes and checksums in a
+     * descriptor after the data; smaller ones are written as usual. The
+     * result is a regular archive that extract also reads from a file.
+     */
+    void createStream(std::ostream& out, const std::vector<std::filesystem::path>& files,
+                      CompressionType compression = CompressionType::Normal);
+
     void add(const std::vector<std::filesystem::path>& files,
              CompressionType compression = CompressionType::Normal);
 
+    /**
+     * @brief Extracts every entry; an archive name of "-" reads it from stdin
+     */
     void extract(const std::string& outputDir);
 
+    /**
+     * @brief Extracts an archive read front to back from a descriptor,
+     *        such as a pipe, writing files as their entries arrive
+     */
+    void extractStream(int fd, const std::string& outputDir);
+
+    /**
+     * @brief Builds the archive from a ZIP file, replacing its contents
+     *
+     * Stored and deflated ZIP entries are copied without recompressing;
+     * deflated ones keep their raw deflate stream (CODEC_DEFLATE) and
+     * CRC-32. Encrypted entries and other methods are rejected.
+     */
+    void importZip(const std::string& zipPath);
+
+    /**
+     * @brief Writes every entry to a ZIP file
+     *
+     * zlib payloads pass through with their two-byte header and Adler-32
+     * trailer removed; only sparse entries and entries without a CRC-32
+     * are decoded. ZIP64 records are used where sizes or offsets need them.
+     */
+    void exportZip(const std::string& zipPath);
+
+    /**
+     * @brief Builds the archive from a tar file; a path of "-" reads stdin
+     *
+     * Regular files are compressed as by create, large ones in chunks as
+     * they are read; other entry types are skipped.
+     */
+    void importTar(const std::string& tarPath,
+                   CompressionType compression = CompressionType::Normal);
+
+    /**
+     * @brief Writes a patch that turns @p oldArchive into this archive
+     *
+     * Entries whose bytes are already in the old archive are copied from
+     * it. A changed entry of at least PATCH_DELTA_THRESHOLD bytes is sent
+     * as a BinaryDelta of its data against the entry of the same name,
+     * provided compressing the patched data reproduces its payload exactly;
+     * everything else is sent as it is. Multi-volume archives are rejected.
+     */
+    PatchSummary writePatch(const std::string& oldArchive, const std::string& patchPath);
+
+    /**
+     * @brief Builds this archive from @p oldArchive and a patch written by
+     *        writePatch, replacing its contents
+     *
+     * The result is checked against the SHA-256 in the patch before it
+     * replaces the archive.
+     */
+    void applyPatch(const std::string& oldArchive, const std::string& patchPath);
+
     /**
      * @brief Creates a self-extracting executable
      * @param files List of files to include
      * @param outputPath Path for the self-extracting executable (e.g., "installer.exe")
      * @param compression Compression level to use
      * @param autoExec Auto-execution configuration (optional)
-     * @param stubPath Path to the extractor stub executable (optional, will build if not provided)
+     * @param stubPath Path to a custom extractor stub (optional, the embedded stub is used if empty)
      */
     void createSelfExtracting(const std::vector<std::filesystem::path>& files,
                              const std::string& outputPath,
@@ -56,38 +189,416 @@ public:
                              const AutoExecConfig& autoExec = {},
                              const std::string& stubPath = "");
 
-    std::vector<ArchiveEntry> getFileList() const { return entries; }
+    /**
+     * @brief Entries of the archive, without copying
+     *
+     * The returned table (and the names it hands out) is only valid while
+     * this Archive is alive and not being modified.
+     */
+    const EntryTable& getEntries() const { return entries; }
+
+    /**
+     * @brief Attaches a progress sink updated by create, add, extract and
+     *        createSelfExtracting (nullptr to detach)
+     *
+     * The sink must outlive the operations it observes.
+     */
+    void setProgress(ArchiveProgress* sink) { progress = sink; }
+
+    /**
+     * @brief Attaches a stats collector timing the read, compress, inflate,
+     *        write and metadata stages of every entry (nullptr to detach)
+     */
+    void setStats(ArchiveStats* sink) { stats = sink; }
+
+    /**
+     * @brief Attaches a token checked before every entry (nullptr to detach)
+     *
+     * A cancelled operation throws OperationCancelled. A cancelled create
+     * removes the partial archive unless it is resumable.
+     */
+    void setCancellation(CancellationToken* token) { cancellation = token; }
+
+    /**
+     * @brief Makes create and extract resumable after an interruption
+     *
+     * create journals every completed entry to "<archive>.journal" and, if
+     * that journal exists, continues after the last entry it lists instead
+     * of starting over. extract skips files that already exist with the
+     * entry's size and modification time.
+     */
+    void setResumable(bool enabled) { resumable = enabled; }
+
+    void setSyncPolicy(const SyncPolicy& policy) { syncPolicy = policy; }
+
+    /**
+     * @brief Sets the number of worker threads for extract, and for reading
+     *        and compressing files on create and add (0 = one per core)
+     *
+     * create and add start the largest files first but always write the
+     * entries in the same order, so the archive does not depend on the
+     * thread count.
+     */
+    void setThreads(unsigned count) { threads = count; }
+
+    /**
+     * @brief Order of new entries on create and add (EntryOrder::Input by default)
+     *
+     * EntryOrder::Grouped puts files of one type next to each other, which
+     * keeps related data together on extraction.
+     */
+    void setEntryOrder(EntryOrder order) { entryOrder = order; }
+
+    /**
+     * @brief Splits archives written by create into volumes, see VolumeOptions
+     *
+     * Volume sets cannot be added to, and create does not journal them, so
+     * an interrupted create of a volume set starts over.
+     */
+    void setVolumes(const VolumeOptions& options) { volumeOptions = options; }
+
+    /**
+     * @brief Volume files of a multi-volume archive, empty for a single file
+     */
+    const std::vector<std::string>& getVolumes() const { return volumePaths; }
+
+    /**
+     * @brief Stores a SHA-256 of every new entry's data (off by default)
+     *
+     * The hash is the content address used by setExtractCache.
+     */
+    void setContentHashes(bool enabled) { contentHashes = enabled; }
+
+    /**
+     * @brief Encrypts new entries and decrypts encrypted ones with @p key
+     *
+     * Each payload is sealed with AES-256-GCM right after compression (see
+     * ENTRY_FLAG_ENCRYPTED). Names, sizes and checksums stay readable, so
+     * list works without the key; extract and readEntry need it.
+     */
+    void setEncryptionKey(const EntryCipher::Key& key) { encryptionKey = key; }
+
+    /**
+     * @brief Content-addressed cache consulted and filled by extract
+     *
+     * Entries with a SHA-256 whose content is already in the cache are
+     * cloned or hard-linked from it instead of being decoded; extracted
+     * entries are added to it. Cached files are checked against the hash
+     * before they are used, and replaced if they do not match. Hard-linked
+     * files share their data with the cache, so cache entries and the
+     * outputs linked to them are made read-only: they must be replaced
+     * rather than modified in place. An empty path disables the cache.
+     */
+    void setExtractCache(const std::string& directory) { cacheDirectory = directory; }
+
+    /**
+     * @brief Leaves existing output files alone if they match their entry
+     *
+     * A file matches when its size and modification time equal the entry's,
+     * or when its size matches and its data hashes to the entry's SHA-256
+     * (CRC-32 for entries without one). Only the timestamp is updated.
+     */
+    void setSkipUnchanged(bool enabled) { skipUnchanged = enabled; }
+
+    /**
+     * @brief Chooses between appending in place and rewriting a copy
+     *
+     * By default add saves the archive's length and old index to
+     * "<archive>.undo" and extends the archive in place. The next add rolls
+     * an interrupted append back; until then, reads see the archive as it
+     * was before it. Disabled, add copies the archive, appends to the copy
+     * and renames it over the original.
+     */
+    void setAppendJournal(bool enabled) { appendJournal = enabled; }
+
+    /**
+     * @brief Input size from which createStream compresses a file in chunks
+     */
+    static constexpr uint64_t STREAMED_ENTRY_THRESHOLD = 16ull << 20;
+
+    /**
+     * @brief Smallest changed entry writePatch tries to send as a delta
+     */
+    static constexpr uint64_t PATCH_DELTA_THRESHOLD = 16ull << 10;
+
+    /**
+     * @brief Compresses a buffer into a zlib stream as stored in entries
+     */
+    static std::vector<char> compressData(const std::vector<char>& input,
+                                          CompressionType compression);
+    static std::vector<char> compressData(const char* data, size_t size,
+                                          CompressionType compression);
+
+    /**
+     * @brief Streams an entry's file contents to @p emit, holes as zeros
+     *
+     * @p header must carry the entry's final sizes, so for an entry with a
+     * trailing descriptor it is read first. The data is not checksummed.
+     * @param extents The entry's sparse map; ignored for a plain entry
+     * @param read Delivers exactly the requested number of the payload's
+     *        next bytes, or throws
+     * @param decryptor Needed for an encrypted entry, whose tag is checked
+     *        after the last byte is emitted
+     */
+    static void decodeEntry(const EntryHeader& header, std::vector<SparseExtent> extents,
+                            const std::function<void(char*, size_t)>& read,
+                            const std::function<void(const char*, size_t)>& emit,
+                            const std::string& name, PayloadDecryptor* decryptor = nullptr);
+
+    /**
+     * @brief Reads the entry table of an archive held in a seekable stream
+     *
+     * Uses the persisted name index when there is one and scans the entry
+     * headers otherwise. Throws std::runtime_error if the stream does not
+     * start with an archive header.
+     * @return Offset at which the entry data ends
+     */
+    static uint64_t readCatalog(std::istream& in, EntryTable& entries);
+
+    /**
+     * @brief Reads and checks one entry's data; of a multi-volume archive,
+     *        only the volume holding the entry is opened
+     */
+    std::vector<char> readEntry(std::string_view name) const;
+
+    /**
+     * @brief Looks up an entry by its exact archive path (binary search)
+     */
+    std::optional<ArchiveEntry> find(std::string_view name) const;
+
+    /**
+     * @brief Lists the entries below a directory, sorted by name
+     * @param directory Archive directory such as "docs" or "docs/"; empty lists everything
+     */
+    std::vector<ArchiveEntry> listPrefix(std::string_view directory) const;
 
 private:
+    class ExtractHooks;
+    class VolumeWriter;
+
+    /**
+     * @brief One entry read and compressed on a worker, waiting to be written
+     */
+    struct PreparedEntry {
+        std::string archivePath;
+        EntryHeader header;
+        std::vector<SparseExtent> extents;
+        std::vector<char> compressed;
+        std::chrono::steady_clock::duration elapsed{}; ///< Time spent reading and compressing
+    };
+
+    /**
+     * @brief A regular input file with its path inside the archive
+     */
+    struct PendingInput {
+        std::filesystem::path file;
+        std::string archivePath;
+        uint64_t size = 0;
+    };
+
     std::string archiveName;
-    std::vector<ArchiveEntry> entries;
+    EntryTable entries;
+    uint64_t dataEnd = 0;   ///< End of the entry data, where the name index starts
+    ArchiveProgress* progress = nullptr;
+    ArchiveStats* stats = nullptr;
+    CancellationToken* cancellation = nullptr;
+    bool resumable = false;
+    bool appendJournal = true;
+    SyncPolicy syncPolicy;
+    unsigned threads = 0;
+    EntryOrder entryOrder = EntryOrder::Input;
+    bool contentHashes = false;
+    std::optional<EntryCipher::Key> encryptionKey;
+    bool skipUnchanged = false;
+    std::string cacheDirectory;
+    VolumeOptions volumeOptions;
+    std::vector<std::string> volumePaths;  ///< Volume files of a multi-volume archive
+    std::vector<uint32_t> entryVolumes;    ///< Volume number of each entry, indexes volumePaths
+    CompressionController levelController; ///< Restarted by each create or add with CompressionType::Adaptive
+
+    /**
+     * @brief Reads the entry table from an archive file, replacing the current one
+     */
+    void loadCatalog(const std::string& path);
+
+    /**
+     * @brief Reads the volume table of a multi-volume catalog, if @p in
+     *        holds one; @p path locates relative volume paths
+     */
+    void readVolumeTable(std::istream& in, const std::string& path);
+
+    /**
+     * @brief create for VolumeOptions::volumeSize > 0
+     */
+    void createVolumes(const std::vector<std::filesystem::path>& files, CompressionType compression);
+
+    /**
+     * @brief Waits while paused and throws OperationCancelled once cancelled
+     */
+    void checkpoint();
+
+    std::string journalPath() const;
+    std::string workingPath() const;   ///< Where create and add write before renaming
+    std::string undoPath() const;
+
+    /**
+     * @brief Restores the archive from a leftover undo file, if any
+     */
+    void rollBackAppend();
+
+    /**
+     * @brief Saves the archive length and the index after dataEnd to the undo file and syncs it
+     */
+    void writeUndoRecord();
+
+    /**
+     * @brief Reads the undo file; false if it is missing or was never completed
+     */
+    bool readUndoRecord(UndoHeader& undo, std::vector<char>& saved) const;
+
+    /**
+     * @brief Loads the catalog from a leftover undo file without touching the archive
+     */
+    bool loadUndoneCatalog();
+
+    /**
+     * @brief Removes a leftover undo file once the archive has been replaced
+     */
+    void discardUndoRecord();
+
+    /**
+     * @brief Reports the total input size to the progress sink, if any
+     */
+    void reportInputTotals(const std::vector<std::filesystem::path>& files);
+
+    /**
+     * @brief fs::status of an input file, timed as metadata
+     */
+    std::filesystem::file_status statInput(const std::filesystem::path& file);
+
+    /**
+     * @brief Sorts the entry names and writes the index at the stream's position
+     */
+    void writeNameIndex(std::ostream& archive);
+
+    /**
+     * @brief Stats the inputs, skipping anything that is not a regular file,
+     *        maps their archive paths and applies the entry order
+     */
+    std::vector<PendingInput> collectInputs(const std::vector<std::filesystem::path>& files);
+
+    /**
+     * @brief Reads and compresses @p inputs on the worker threads and writes
+     *        them in order
+     * @param streamLarge Compress files of STREAMED_ENTRY_THRESHOLD bytes or
+     *        more in chunks while writing, as createStream does
+     * @param written Called after each entry with its start and end offsets
+     */
+    void writeInputs(const std::vector<PendingInput>& inputs, std::ostream& archive,
+                     CompressionType compression, bool streamLarge,
+                     const std::function<void(const PendingInput&, uint64_t, uint64_t)>& written);
 
     void addFileToArchive(const std::filesystem::path& file, 
                          const std::string& archivePath,
-                         std::ofstream& archive, 
+                         std::ostream& archive, 
                          CompressionType compression);
-                         
-    std::vector<char> compressData(const std::vector<char>& input, 
-                                  CompressionType compression);
 
     /**
-     * @brief Builds the extractor stub executable
-     * @param outputPath Where to save the compiled stub
-     * @return true if successful
+     * @brief Reads and compresses one file; safe to call from worker threads
+     */
+    PreparedEntry prepareFile(const std::filesystem::path& file, const std::string& archivePath,
+                              CompressionType compression);
+
+    /**
+     * @brief Compresses one entry whose data is in memory; safe to call
+     *        from worker threads
+     * @param extents Data regions of a sparse file, empty for a plain one
+     * @param fileStart When work on the entry began, for its latency
+     */
+    PreparedEntry compressEntry(const std::string& archivePath, const std::vector<char>& buffer,
+                                std::vector<SparseExtent> extents, uint64_t fileSize, int64_t timestamp,
+                                CompressionType compression, std::chrono::steady_clock::time_point fileStart);
+
+    /**
+     * @brief Bytes writeEntryRecord writes for @p entry
+     */
+    static uint64_t entryRecordSize(const PreparedEntry& entry);
+
+    /**
+     * @brief Writes an entry's header, name, sparse map and payload
+     */
+    static void writeEntryRecord(const PreparedEntry& entry, std::ostream& archive);
+
+    /**
+     * @brief Writes a compressed entry at the stream's position and adds it
+     *        to the entry table
      */
-    bool buildExtractorStub(const std::string& outputPath);
+    void writeEntry(const PreparedEntry& entry, std::ostream& archive, CompressionType compression);
+
+    /**
+     * @brief Compresses and writes one entry whose data is in memory
+     * @param extents Data regions of a sparse file, empty for a plain one
+     * @param fileStart When work on the entry began, for its latency
+     */
+    void addEntryData(const std::string& archivePath, const std::vector<char>& buffer,
+                      const std::vector<SparseExtent>& extents, uint64_t fileSize, int64_t timestamp,
+                      std::ostream& archive, CompressionType compression,
+                      std::chrono::steady_clock::time_point fileStart);
+
+    /**
+     * @brief compressData for CompressionType::Adaptive: compresses in
+     *        blocks, switching level between them as levelController says
+     */
+    std::vector<char> compressAdaptive(const char* data, size_t size);
+
+    /**
+     * @brief Adds a file in fixed-size chunks, followed by an entry descriptor
+     */
+    void addFileStreamed(const std::filesystem::path& file,
+                         const std::string& archivePath,
+                         std::ostream& archive,
+                         CompressionType compression);
+
+    /**
+     * @brief Writes an entry with a trailing descriptor from @p size bytes
+     *        delivered in order by @p read
+     */
+    void addStreamedEntry(const std::string& archivePath, uint64_t size, int64_t timestamp,
+                          const std::function<void(char*, size_t)>& read,
+                          std::ostream& archive, CompressionType compression,
+                          std::chrono::steady_clock::time_point fileStart);
+
+    /**
+     * @brief Replaces the archive with one holding the entries that
+     *        @p writeEntries adds, written to the working file first
+     */
+    void rebuildFrom(const std::function<void(std::ostream&)>& writeEntries);
+
+    /**
+     * @brief Runs the extraction engine on the archive file, or on @p fd if
+     *        it is not negative
+     */
+    void runExtract(const std::string& outputDir, int fd);
+
+    /**
+     * @brief runExtract for a multi-volume archive; volumes are extracted
+     *        concurrently, sharing the worker threads in @p options
+     */
+    void extractVolumes(const std::filesystem::path& outPath, const ExtractOptions& options);
+
 
     /**
-     * @brief Combines stub executable with archive data and command config
-     * @param stubPath Path to the stub executable
+     * @brief Writes stub, archive data, command config and footer to outputPath
+     * @param stubData Bytes of the extractor stub executable
+     * @param stubSize Size of the stub
      * @param archiveData The archive data to embed
      * @param outputPath Path for the final self-extracting executable
      * @param autoExec Auto-execution configuration
      */
-    bool combineStubWithArchive(const std::string& stubPath,
-                               const std::vector<char>& archiveData,
-                               const std::string& outputPath,
-                               const AutoExecConfig& autoExec);
+    void combineStubWithArchive(const char* stubData, size_t stubSize,
+                                const std::vector<char>& archiveData,
+                                const std::string& outputPath,
+                                const AutoExecConfig& autoExec);
 
     /**
      * @brief Helper method to add file to a stream instead of file
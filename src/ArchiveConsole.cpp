@@ -1,68 +1,239 @@
 #include "ArchiveConsole.h"
+#include "DirectoryScanner.h"
+#include <algorithm>
+#include <cctype>
 #include <iostream>
 #include <filesystem>
-#include <set>
+#include <thread>
 
 void ArchiveConsole::printUsage() const {
     std::cout << "Usage: archive <command> <options>\n";
     std::cout << "Commands:\n";
     std::cout << "  create <archive_name> <file1> [file2 ...]  Create a new archive\n";
     std::cout << "  extract <archive_name> [output_dir]        Extract files from an archive\n";
-    std::cout << "  list <archive_name>                        List contents of an archive\n";
+    std::cout << "  list <archive_name> [prefix]               List contents of an archive (optionally one directory)\n";
+    std::cout << "  convert <input> <output>                   Import a .zip or .tar (- for stdin) or export a .zip\n";
+    std::cout << "  serve <archive_name> [--port=N] [--bind=address] [--threads=N]\n";
+    std::cout << "                                             Serve entries over HTTP (default 127.0.0.1:8080)\n";
+    std::cout << "  estimate <path1> [path2 ...] [--sample=N[K|M|G]] [--depth=N]\n";
+    std::cout << "                                             Predict archive size and time per level from samples\n";
+    std::cout << "  diff-pack <old_archive> <new_archive> <patch>\n";
+    std::cout << "                                             Write a patch of the new and changed entries\n";
+    std::cout << "  apply-patch <old_archive> <patch> <new_archive>\n";
+    std::cout << "                                             Rebuild the new archive from the old one and a patch\n";
+    std::cout << "  An <archive_name> of - streams the archive to stdout (create) or from stdin (extract)\n";
+    std::cout << "Options:\n";
+    std::cout << "  --fastest | --fast | --normal | --best     Compression level for create (default --normal)\n";
+    std::cout << "  --adaptive                                 Pick the level per block to keep the output busy\n";
+    std::cout << "  --order=grouped                            Group new entries by file type, then directory\n";
+    std::cout << "  --volume-size=<N>[K|M|G]                   Split a new archive into volumes of at most N bytes\n";
+    std::cout << "  --volume-dir=<dir>[,<dir>...]              Spread the volumes across these directories\n";
+    std::cout << "  --resume                                   Continue an interrupted create or extract\n";
+    std::cout << "  --stats=json                               Print per-stage timings and histograms as JSON when done\n";
+    std::cout << "  --stats-file=<path>                        Write the JSON stats to a file instead of stdout\n";
+    std::cout << "  --content-hash                             Store SHA-256 hashes of new entries (for --cache-dir)\n";
+    std::cout << "  --key-file=<path>                          Encrypt new entries and decrypt with a 256-bit key\n";
+    std::cout << "  --cache-dir=<dir>                          Link extracted content from/into a content-addressed cache\n";
+    std::cout << "  --skip-unchanged                           Keep existing files that already match their entry\n";
 }
 
 bool ArchiveConsole::createArchive(const std::string& archiveName, int argc, char* argv[]) {
+    progress.setConsoleOutput(verboseOutput);
     progress.startTracking("Creating archive");
+    progress.beginStage("Scanning inputs");
     Archive archive(archiveName);
-    std::vector<std::filesystem::path> files;
-    std::set<std::filesystem::path> uniqueFiles;
+    archive.setProgress(&progress);
+    archive.setStats(stats);
+    archive.setCancellation(cancellation);
+    archive.setResumable(resumable);
+    archive.setContentHashes(contentHashes);
+    if (encryptionKey) {
+        archive.setEncryptionKey(*encryptionKey);
+    }
+    archive.setEntryOrder(entryOrder);
+    archive.setVolumes(volumeOptions);
+    std::vector<std::filesystem::path> roots;
     // Arguments after archiveName are files/dirs
     for (int i = 3; i < argc; ++i) {
         std::filesystem::path inputPath(argv[i]);
-        if (std::filesystem::is_directory(inputPath)) {
-            for (auto& entry : std::filesystem::recursive_directory_iterator(inputPath)) {
-                if (std::filesystem::is_regular_file(entry)) {
-                    uniqueFiles.insert(entry.path());
-                }
-            }
-        } else if (std::filesystem::is_regular_file(inputPath)) {
-            uniqueFiles.insert(inputPath);
+        auto status = std::filesystem::status(inputPath);
+        if (std::filesystem::is_directory(status) || std::filesystem::is_regular_file(status)) {
+            roots.push_back(inputPath);
         } else {
             std::cerr << "Warning: Skipping non-existent or unsupported path: " << inputPath << std::endl;
         }
     }
-    files.assign(uniqueFiles.begin(), uniqueFiles.end());
+    DirectoryScanner scanner;
+    std::vector<std::filesystem::path> files = scanner.scan(roots);
     if (files.empty()) {
         std::cerr << "Error: No input files found to archive.\n";
         progress.finishTracking();
         return false;
     }
-    archive.create(files);
+    archive.create(files, compressionType);
     progress.finishTracking();
     return true;
 }
 
 bool ArchiveConsole::extractArchive(const std::string& archiveName, const std::string& outputDir) {
+    progress.setConsoleOutput(verboseOutput);
     progress.startTracking("Extracting archive");
+    progress.beginStage("Reading index");
     Archive archive(archiveName);
+    archive.setProgress(&progress);
+    archive.setStats(stats);
+    archive.setCancellation(cancellation);
+    archive.setResumable(resumable);
+    archive.setExtractCache(cacheDirectory);
+    archive.setSkipUnchanged(skipUnchanged);
+    if (encryptionKey) {
+        archive.setEncryptionKey(*encryptionKey);
+    }
     archive.extract(outputDir);
     progress.finishTracking();
     return true;
 }
 
-bool ArchiveConsole::listArchiveContents(const std::string& archiveName) const {
+static bool hasExtension(const std::string& path, const char* extension) {
+    std::string actual = std::filesystem::path(path).extension().string();
+    std::transform(actual.begin(), actual.end(), actual.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return actual == extension;
+}
+
+bool ArchiveConsole::convertArchive(const std::string& input, const std::string& output) {
+    const bool fromZip = hasExtension(input, ".zip");
+    const bool fromTar = input == "-" || hasExtension(input, ".tar");
+    const bool toZip = hasExtension(output, ".zip");
+    if ((fromZip || fromTar) == toZip) {
+        std::cerr << "Error: convert needs a .zip or .tar input or a .zip output.\n";
+        return false;
+    }
+
+    progress.setConsoleOutput(verboseOutput);
+    progress.startTracking("Converting archive");
+    Archive archive(fromZip || fromTar ? output : input);
+    archive.setProgress(&progress);
+    archive.setStats(stats);
+    archive.setCancellation(cancellation);
+    archive.setContentHashes(contentHashes);
+    if (encryptionKey) {
+        archive.setEncryptionKey(*encryptionKey);
+    }
+    if (fromZip) {
+        archive.importZip(input);
+    } else if (fromTar) {
+        archive.importTar(input, compressionType);
+    } else {
+        archive.exportZip(output);
+    }
+    progress.finishTracking();
+    return true;
+}
+
+bool ArchiveConsole::diffArchives(const std::string& oldArchive, const std::string& newArchive,
+                                  const std::string& patchPath) {
+    progress.setConsoleOutput(verboseOutput);
+    progress.startTracking("Writing patch");
+    Archive archive(newArchive);
+    archive.setProgress(&progress);
+    archive.setStats(stats);
+    archive.setCancellation(cancellation);
+    const PatchSummary summary = archive.writePatch(oldArchive, patchPath);
+    progress.finishTracking();
+
+    const double share = summary.archiveBytes > 0
+        ? 100.0 * static_cast<double>(summary.patchBytes) / static_cast<double>(summary.archiveBytes) : 0.0;
+    printf("Patch '%s': %s (%.1f%% of '%s'), %llu entries unchanged, %llu as deltas, %llu whole.\n",
+           patchPath.c_str(), ArchiveProgress::formatBytes(static_cast<double>(summary.patchBytes)).c_str(), share,
+           newArchive.c_str(), static_cast<unsigned long long>(summary.copiedEntries),
+           static_cast<unsigned long long>(summary.deltaEntries),
+           static_cast<unsigned long long>(summary.literalEntries));
+    return true;
+}
+
+bool ArchiveConsole::applyPatch(const std::string& oldArchive, const std::string& patchPath,
+                                const std::string& newArchive) {
+    progress.setConsoleOutput(verboseOutput);
+    progress.startTracking("Applying patch");
+    Archive archive(newArchive);
+    archive.setProgress(&progress);
+    archive.setStats(stats);
+    archive.setCancellation(cancellation);
+    archive.applyPatch(oldArchive, patchPath);
+    progress.finishTracking();
+    std::cout << "Rebuilt '" << newArchive << "' with " << archive.getEntries().size() << " files." << std::endl;
+    return true;
+}
+
+bool ArchiveConsole::serveArchive(const std::string& archiveName, const ServeOptions& options) {
+    ArchiveServer server(archiveName, options);
+    server.setCancellation(cancellation);
+    const uint16_t port = server.listen();
+    std::cout << "Serving " << server.entryCount() << " entries from '" << archiveName
+              << "' on http://" << options.address << ":" << port << "/ (Ctrl+C to stop)" << std::endl;
+    server.serve();
+    return true;
+}
+
+bool ArchiveConsole::listArchiveContents(const std::string& archiveName, const std::string& prefix) const {
     Archive archive(archiveName);
-    const auto entries = archive.getFileList();
-    std::cout << "Contents of '" << archiveName << "':" << std::endl;
+    const auto entries = archive.listPrefix(prefix);
+    std::cout << "Contents of '" << archiveName << "'";
+    if (!prefix.empty()) {
+        std::cout << " under '" << prefix << "'";
+    }
+    std::cout << ":" << std::endl;
     std::cout << std::string(60, '-') << std::endl;
     std::cout << "Name                                              Size      Compressed" << std::endl;
     std::cout << std::string(60, '-') << std::endl;
     
     for (const auto& entry : entries) {
-        printf("%-48s %10llu %10llu\n", 
-               entry.name.c_str(), 
+        printf("%-48.*s %10llu %10llu\n", 
+               static_cast<int>(entry.name.size()), entry.name.data(), 
                static_cast<unsigned long long>(entry.originalSize),
                static_cast<unsigned long long>(entry.compressedSize));
     }
     return true;
-}
\ No newline at end of file
+}
+
+bool ArchiveConsole::estimateArchive(const std::vector<std::filesystem::path>& roots, const EstimateOptions& options) {
+    const SizeEstimate estimate = SizeEstimator(options).estimate(roots);
+    if (estimate.files == 0) {
+        std::cerr << "Error: No input files found to estimate.\n";
+        return false;
+    }
+    static const char* names[] = {"fastest", "fast", "normal", "best"};
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    const double input = static_cast<double>(estimate.inputBytes);
+
+    std::cout << "Estimate for " << estimate.files << " files, "
+              << ArchiveProgress::formatBytes(input) << " (sampled "
+              << ArchiveProgress::formatBytes(static_cast<double>(estimate.sampledBytes)) << " in "
+              << estimate.samples << " blocks from " << estimate.strata << " strata)" << std::endl;
+    std::cout << std::string(70, '-') << std::endl;
+    printf("%-10s %14s %8s %16s %16s\n", "Level", "Archive size", "Ratio", "CPU time", "On all cores");
+    std::cout << std::string(70, '-') << std::endl;
+    for (size_t level = 0; level < estimate.levels.size(); ++level) {
+        const LevelEstimate& row = estimate.levels[level];
+        const double output = static_cast<double>(row.outputBytes);
+        printf("%-10s %14s %7.1f%% %16s %16s\n", names[level], ArchiveProgress::formatBytes(output).c_str(),
+               input > 0 ? 100.0 * output / input : 100.0, ArchiveProgress::formatDuration(row.cpuSeconds).c_str(),
+               ArchiveProgress::formatDuration(row.cpuSeconds / cores).c_str());
+    }
+    std::cout << "Times are compression only, on " << cores << " cores; reading and writing come on top."
+              << std::endl << std::endl;
+
+    std::cout << std::string(70, '-') << std::endl;
+    printf("%-22s %9s %9s %9s %9s %9s\n", "Directory", "Input", names[0], names[1], names[2], names[3]);
+    std::cout << std::string(70, '-') << std::endl;
+    for (const auto& directory : estimate.directories) {
+        printf("%-22s %9s", directory.directory.c_str(),
+               ArchiveProgress::formatBytes(static_cast<double>(directory.inputBytes)).c_str());
+        for (uint64_t bytes : directory.outputBytes) {
+            printf(" %9s", ArchiveProgress::formatBytes(static_cast<double>(bytes)).c_str());
+        }
+        printf("\n");
+    }
+    return true;
+}
@@ -3,14 +3,19 @@
 
 #include "Archive.h"
 #include "ArchiveProgress.h"
+#include "ArchiveServer.h"
 #include "CompressionTypes.h"
 #include "CrossPlatform.h"
+#include "SizeEstimator.h"
 #include <vector>
 #include <memory>
 #include <map>
+#include <optional>
 #include <string>
 
 class Archive;
+class ArchiveStats;
+class CancellationToken;
 
 class ArchiveConsole {
 public:
@@ -20,15 +25,102 @@ public:
     void printUsage() const;
     bool createArchive(const std::string& archiveName, int argc, char* argv[]);
     bool extractArchive(const std::string& archiveName, const std::string& outputDir = ".");
-    bool listArchiveContents(const std::string& archiveName) const;
+    bool listArchiveContents(const std::string& archiveName, const std::string& prefix = "") const;
+
+    /**
+     * @brief Converts between formats by extension: a .zip or .tar input
+     *        (- for tar on stdin) into an archive, or an archive into a .zip
+     */
+    bool convertArchive(const std::string& input, const std::string& output);
+
+    /**
+     * @brief Writes a patch that turns @p oldArchive into @p newArchive,
+     *        see Archive::writePatch
+     */
+    bool diffArchives(const std::string& oldArchive, const std::string& newArchive, const std::string& patchPath);
+
+    /**
+     * @brief Rebuilds @p newArchive from @p oldArchive and a patch
+     */
+    bool applyPatch(const std::string& oldArchive, const std::string& patchPath, const std::string& newArchive);
+
+    /**
+     * @brief Serves the archive's entries over HTTP until interrupted
+     */
+    bool serveArchive(const std::string& archiveName, const ServeOptions& options);
+
+    /**
+     * @brief Prints the size and compression time create would need for
+     *        @p roots at each level, estimated from a sample of the input
+     */
+    bool estimateArchive(const std::vector<std::filesystem::path>& roots, const EstimateOptions& options);
+
+    /**
+     * @brief Compression level for create, see CompressionType
+     */
+    void setCompressionType(CompressionType type) { compressionType = type; }
+
+    /**
+     * @brief Order of new entries on create, see Archive::setEntryOrder
+     */
+    void setEntryOrder(EntryOrder order) { entryOrder = order; }
+
+    /**
+     * @brief Split archives written by create into volumes, see Archive::setVolumes
+     */
+    void setVolumes(const VolumeOptions& options) { volumeOptions = options; }
+
+    /**
+     * @brief Collects per-stage stats for subsequent create/extract calls
+     */
+    void setStats(ArchiveStats* sink) { stats = sink; }
+
+    /**
+     * @brief Token that stops create/extract between entries (e.g. on Ctrl+C)
+     */
+    void setCancellation(CancellationToken* token) { cancellation = token; }
+
+    /**
+     * @brief Journal create and skip finished files on extract, see Archive::setResumable
+     */
+    void setResumable(bool enabled) { resumable = enabled; }
+
+    /**
+     * @brief Store SHA-256 content hashes on create, see Archive::setContentHashes
+     */
+    void setContentHashes(bool enabled) { contentHashes = enabled; }
+
+    /**
+     * @brief Encrypt on create and convert, decrypt on extract, see Archive::setEncryptionKey
+     */
+    void setEncryptionKey(const EntryCipher::Key& key) { encryptionKey = key; }
+
+    /**
+     * @brief Content cache for extract, see Archive::setExtractCache
+     */
+    void setExtractCache(const std::string& directory) { cacheDirectory = directory; }
+
+    /**
+     * @brief Keep matching files on extract, see Archive::setSkipUnchanged
+     */
+    void setSkipUnchanged(bool enabled) { skipUnchanged = enabled; }
 
 private:
     CompressionType compressionType = CompressionType::Normal;
+    EntryOrder entryOrder = EntryOrder::Input;
+    VolumeOptions volumeOptions;
     bool promptOverwrite = true;
     bool verboseOutput = true;
     std::string defaultExtractPath = ".";
     std::string defaultComment;
     ArchiveProgress progress;
+    ArchiveStats* stats = nullptr;
+    CancellationToken* cancellation = nullptr;
+    bool resumable = false;
+    bool contentHashes = false;
+    std::optional<EntryCipher::Key> encryptionKey;
+    bool skipUnchanged = false;
+    std::string cacheDirectory;
 };
 
 #endif // ARCHIVE_CONSOLE_H
\ No newline at end of file
@@ -0,0 +1,941 @@
+// Conversion between archives and the ZIP and tar formats
+
+#include "Archive.h"
+#include "ArchiveFormat.h"
+#include "ArchiveProgress.h"
+#include "ArchiveStats.h"
+#include "FileIO.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+using ArchiveFormat::loadLE;
+using ArchiveFormat::storeLE;
+
+namespace {
+
+// ZIP records, see PKWARE's APPNOTE.TXT
+constexpr uint32_t ZIP_LOCAL_SIGNATURE = 0x04034b50;
+constexpr uint32_t ZIP_CENTRAL_SIGNATURE = 0x02014b50;
+constexpr uint32_t ZIP_END_SIGNATURE = 0x06054b50;
+constexpr uint32_t ZIP64_END_SIGNATURE = 0x06064b50;
+constexpr uint32_t ZIP64_LOCATOR_SIGNATURE = 0x07064b50;
+constexpr size_t ZIP_LOCAL_HEADER_SIZE = 30;
+constexpr size_t ZIP_CENTRAL_HEADER_SIZE = 46;
+constexpr size_t ZIP_END_SIZE = 22;
+constexpr size_t ZIP64_END_SIZE = 56;
+constexpr size_t ZIP64_LOCATOR_SIZE = 20;
+constexpr uint16_t ZIP_EXTRA_ZIP64 = 0x0001;
+constexpr uint16_t ZIP_EXTRA_TIMESTAMP = 0x5455; // "UT": Unix modification time
+constexpr uint16_t ZIP_METHOD_STORED = 0;
+constexpr uint16_t ZIP_METHOD_DEFLATE = 8;
+constexpr uint16_t ZIP_FLAG_ENCRYPTED = 0x0001;
+constexpr uint16_t ZIP_FLAG_UTF8 = 0x0800;
+constexpr uint16_t ZIP_VERSION = 20;             // Deflate
+constexpr uint16_t ZIP64_VERSION = 45;
+constexpr uint16_t ZIP_MADE_BY_UNIX = 3 << 8;
+constexpr uint32_t ZIP_FILE_ATTRIBUTES = 0100644u << 16; // Unix mode of exported files
+constexpr uint64_t ZIP32_LIMIT = 0xFFFFFFFF;
+constexpr uint16_t ZIP16_LIMIT = 0xFFFF;
+
+// Entries at least this large get ZIP64 sizes in their local header. It is
+// decided before a re-deflated entry's compressed size is known, so it
+// leaves room for deflate's growth on incompressible data.
+constexpr uint64_t ZIP64_SIZE_THRESHOLD = 0xFF000000;
+
+constexpr size_t TAR_BLOCK_SIZE = 512;
+constexpr uint64_t TAR_MAX_METADATA = 1 << 20; // pax and long-name records
+constexpr size_t COPY_CHUNK = 1 << 20;
+
+struct ZipEntry {
+    std::string name;
+    uint16_t flags = 0;
+    uint16_t method = ZIP_METHOD_STORED;
+    uint32_t crc32 = 0;
+    uint64_t compressedSize = 0;
+    uint64_t originalSize = 0;
+    uint64_t localOffset = 0;
+    int64_t modified = 0;   // Unix seconds
+    bool zip64 = false;     // Sizes are in a ZIP64 extra field
+};
+
+// Overrides for the next tar entry, from pax headers and GNU long names
+struct TarOverrides {
+    std::string path;
+    std::optional<uint64_t> size;
+    std::optional<int64_t> mtime;
+};
+
+// Entry timestamps count file_time_type ticks, whose epoch is not the Unix
+// one everywhere. The two clocks differ by a whole number of seconds.
+std::chrono::seconds fileClockOffset() {
+    static const std::chrono::seconds offset = [] {
+        using std::chrono::milliseconds;
+        auto file = std::chrono::duration_cast<milliseconds>(fs::file_time_type::clock::now().time_since_epoch());
+        auto system = std::chrono::duration_cast<milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+        return std::chrono::round<std::chrono::seconds>(file - system);
+    }();
+    return offset;
+}
+
+int64_t entryTimeFromUnix(int64_t seconds) {
+    return std::chrono::duration_cast<fs::file_time_type::duration>(
+        std::chrono::seconds(seconds) + fileClockOffset()).count();
+}
+
+int64_t unixTimeFromEntry(int64_t ticks) {
+    return (std::chrono::floor<std::chrono::seconds>(fs::file_time_type::duration(ticks)) -
+            fileClockOffset()).count();
+}
+
+int64_t unixTimeFromDos(uint16_t time, uint16_t date) {
+    std::tm local = {};
+    local.tm_year = ((date >> 9) & 0x7F) + 80;
+    local.tm_mon = ((date >> 5) & 0x0F) - 1;
+    local.tm_mday = date & 0x1F;
+    local.tm_hour = time >> 11;
+    local.tm_min = (time >> 5) & 0x3F;
+    local.tm_sec = (time & 0x1F) * 2;
+    local.tm_isdst = -1;
+    return static_cast<int64_t>(std::mktime(&local));
+}
+
+// DOS dates run from 1980 to 2107; anything outside is clamped
+void dosTimeFromUnix(int64_t seconds, uint16_t& time, uint16_t& date) {
+    std::time_t value = static_cast<std::time_t>(seconds);
+    const std::tm* local = std::localtime(&value);
+    if (!local || local->tm_year < 80) {
+        time = 0;
+        date = (1 << 5) | 1;
+        return;
+    }
+    const int year = std::min(local->tm_year - 80, 127);
+    date = static_cast<uint16_t>((year << 9) | ((local->tm_mon + 1) << 5) | local->tm_mday);
+    time = static_cast<uint16_t>((local->tm_hour << 11) | (local->tm_min << 5) | (local->tm_sec / 2));
+}
+
+void readExact(std::istream& in, void* data, size_t size, const std::string& source) {
+    if (!in.read(static_cast<char*>(data), static_cast<std::streamsize>(size))) {
+        throw std::runtime_error("Unexpected end of " + source);
+    }
+}
+
+// Appends a little-endian field to a record being built
+void put(std::string& out, uint64_t value, size_t bytes) {
+    uint8_t buffer[8];
+    storeLE(buffer, value, bytes);
+    out.append(reinterpret_cast<const char*>(buffer), bytes);
+}
+
+void putTimestampExtra(std::string& out, int64_t modified) {
+    put(out, ZIP_EXTRA_TIMESTAMP, 2);
+    put(out, 5, 2);
+    put(out, 1, 1); // Modification time present
+    put(out, static_cast<uint32_t>(modified), 4);
+}
+
+// Reads the central directory, following the ZIP64 end record when the
+// classic one has run out of bits
+std::vector<ZipEntry> readZipDirectory(std::istream& zip, const std::string& zipPath) {
+    zip.seekg(0, std::ios::end);
+    const uint64_t fileSize = static_cast<uint64_t>(zip.tellg());
+    if (fileSize < ZIP_END_SIZE) {
+        throw std::runtime_error("Not a ZIP file: " + zipPath);
+    }
+
+    // The end record is followed by a comment of up to 64 KiB
+    const uint64_t tailSize = std::min<uint64_t>(fileSize, ZIP_END_SIZE + ZIP16_LIMIT);
+    std::vector<uint8_t> tail(static_cast<size_t>(tailSize));
+    zip.seekg(static_cast<std::streamoff>(fileSize - tailSize));
+    readExact(zip, tail.data(), tail.size(), zipPath);
+    size_t end = tail.size() - ZIP_END_SIZE;
+    while (loadLE(&tail[end], 4) != ZIP_END_SIGNATURE) {
+        if (end == 0) {
+            throw std::runtime_error("Not a ZIP file: " + zipPath);
+        }
+        --end;
+    }
+    uint64_t count = loadLE(&tail[end] + 10, 2);
+    uint64_t directorySize = loadLE(&tail[end] + 12, 4);
+    uint64_t directoryOffset = loadLE(&tail[end] + 16, 4);
+
+    const uint64_t endOffset = fileSize - tailSize + end;
+    if ((count == ZIP16_LIMIT || directorySize == ZIP32_LIMIT || directoryOffset == ZIP32_LIMIT) &&
+        endOffset >= ZIP64_LOCATOR_SIZE) {
+        uint8_t locator[ZIP64_LOCATOR_SIZE];
+        zip.seekg(static_cast<std::streamoff>(endOffset - ZIP64_LOCATOR_SIZE));
+        readExact(zip, locator, sizeof(locator), zipPath);
+        if (loadLE(locator, 4) == ZIP64_LOCATOR_SIGNATURE) {
+            uint8_t end64[ZIP64_END_SIZE];
+            zip.seekg(static_cast<std::streamoff>(loadLE(locator + 8, 8)));
+            readExact(zip, end64, sizeof(end64), zipPath);
+            if (loadLE(end64, 4) != ZIP64_END_SIGNATURE) {
+                throw std::runtime_error("Corrupt ZIP64 end record in: " + zipPath);
+            }
+            count = loadLE(end64 + 32, 8);
+            directorySize = loadLE(end64 + 40, 8);
+            directoryOffset = loadLE(end64 + 48, 8);
+        }
+    }
+    if (directoryOffset > fileSize || directorySize > fileSize - directoryOffset) {
+        throw std::runtime_error("Corrupt ZIP central directory in: " + zipPath);
+    }
+
+    std::vector<uint8_t> directory(static_cast<size_t>(directorySize));
+    zip.seekg(static_cast<std::streamoff>(directoryOffset));
+    readExact(zip, directory.data(), directory.size(), zipPath);
+
+    std::vector<ZipEntry> result;
+    result.reserve(static_cast<size_t>(std::min<uint64_t>(count, directorySize / ZIP_CENTRAL_HEADER_SIZE)));
+    size_t position = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        if (directory.size() - position < ZIP_CENTRAL_HEADER_SIZE ||
+            loadLE(&directory[position], 4) != ZIP_CENTRAL_SIGNATURE) {
+            throw std::runtime_error("Corrupt ZIP central directory in: " + zipPath);
+        }
+        const uint8_t* header = &directory[position];
+        const size_t nameLength = static_cast<size_t>(loadLE(header + 28, 2));
+        const size_t extraLength = static_cast<size_t>(loadLE(header + 30, 2));
+        const size_t commentLength = static_cast<size_t>(loadLE(header + 32, 2));
+        if (directory.size() - position - ZIP_CENTRAL_HEADER_SIZE < nameLength + extraLength + commentLength) {
+            throw std::runtime_error("Corrupt ZIP central directory in: " + zipPath);
+        }
+
+        ZipEntry entry;
+        entry.flags = static_cast<uint16_t>(loadLE(header + 8, 2));
+        entry.method = static_cast<uint16_t>(loadLE(header + 10, 2));
+        entry.modified = unixTimeFromDos(static_cast<uint16_t>(loadLE(header + 12, 2)),
+                                         static_cast<uint16_t>(loadLE(header + 14, 2)));
+        entry.crc32 = static_cast<uint32_t>(loadLE(header + 16, 4));
+        entry.compressedSize = loadLE(header + 20, 4);
+        entry.originalSize = loadLE(header + 24, 4);
+        entry.localOffset = loadLE(header + 42, 4);
+        entry.name.assign(reinterpret_cast<const char*>(header + ZIP_CENTRAL_HEADER_SIZE), nameLength);
+
+        // A ZIP64 field holds, in order, each value that is all ones above
+        const uint8_t* extra = header + ZIP_CENTRAL_HEADER_SIZE + nameLength;
+        for (size_t at = 0; at + 4 <= extraLength;) {
+            const uint16_t id = static_cast<uint16_t>(loadLE(extra + at, 2));
+            const size_t size = static_cast<size_t>(loadLE(extra + at + 2, 2));
+            const uint8_t* field = extra + at + 4;
+            if (size > extraLength - at - 4) {
+                break;
+            }
+            if (id == ZIP_EXTRA_ZIP64) {
+                size_t used = 0;
+                for (uint64_t* value : {&entry.originalSize, &entry.compressedSize, &entry.localOffset}) {
+                    if (*value == ZIP32_LIMIT && used + 8 <= size) {
+                        *value = loadLE(field + used, 8);
+                        used += 8;
+                    }
+                }
+            } else if (id == ZIP_EXTRA_TIMESTAMP && size >= 5 && (field[0] & 1)) {
+                entry.modified = static_cast<int32_t>(loadLE(field + 1, 4));
+            }
+            at += 4 + size;
+        }
+
+        position += ZIP_CENTRAL_HEADER_SIZE + nameLength + extraLength + commentLength;
+        result.push_back(std::move(entry));
+    }
+    return result;
+}
+
+std::string zipLocalHeader(const ZipEntry& entry) {
+    uint16_t time = 0;
+    uint16_t date = 0;
+    dosTimeFromUnix(entry.modified, time, date);
+    std::string out;
+    put(out, ZIP_LOCAL_SIGNATURE, 4);
+    put(out, entry.zip64 ? ZIP64_VERSION : ZIP_VERSION, 2);
+    put(out, ZIP_FLAG_UTF8, 2);
+    put(out, entry.method, 2);
+    put(out, time, 2);
+    put(out, date, 2);
+    put(out, entry.crc32, 4);
+    put(out, entry.zip64 ? ZIP32_LIMIT : entry.compressedSize, 4);
+    put(out, entry.zip64 ? ZIP32_LIMIT : entry.originalSize, 4);
+    put(out, entry.name.size(), 2);
+    put(out, (entry.zip64 ? 20 : 0) + 9, 2);
+    out += entry.name;
+    if (entry.zip64) {
+        put(out, ZIP_EXTRA_ZIP64, 2);
+        put(out, 16, 2);
+        put(out, entry.originalSize, 8);
+        put(out, entry.compressedSize, 8);
+    }
+    putTimestampExtra(out, entry.modified);
+    return out;
+}
+
+// Offsets of fields patched in a local header from zipLocalHeader
+constexpr uint64_t ZIP_LOCAL_CRC_OFFSET = 14;
+
+uint64_t zipCompressedSizeOffset(const ZipEntry& entry) {
+    return entry.zip64 ? ZIP_LOCAL_HEADER_SIZE + entry.name.size() + 4 + 8 : ZIP_LOCAL_CRC_OFFSET + 4;
+}
+
+void writeZipDirectory(std::ostream& zip, const std::vector<ZipEntry>& zipEntries) {
+    const uint64_t directoryOffset = static_cast<uint64_t>(zip.tellp());
+    std::string record;
+    for (const auto& entry : zipEntries) {
+        const bool offset64 = entry.localOffset >= ZIP32_LIMIT;
+        const size_t zip64Size = (entry.zip64 ? 16 : 0) + (offset64 ? 8 : 0);
+        const uint16_t version = zip64Size > 0 ? ZIP64_VERSION : ZIP_VERSION;
+        uint16_t time = 0;
+        uint16_t date = 0;
+        dosTimeFromUnix(entry.modified, time, date);
+
+        record.clear();
+        put(record, ZIP_CENTRAL_SIGNATURE, 4);
+        put(record, ZIP_MADE_BY_UNIX | version, 2);
+        put(record, version, 2);
+        put(record, ZIP_FLAG_UTF8, 2);
+        put(record, entry.method, 2);
+        put(record, time, 2);
+        put(record, date, 2);
+        put(record, entry.crc32, 4);
+        put(record, entry.zip64 ? ZIP32_LIMIT : entry.compressedSize, 4);
+        put(record, entry.zip64 ? ZIP32_LIMIT : entry.originalSize, 4);
+        put(record, entry.name.size(), 2);
+        put(record, (zip64Size > 0 ? 4 + zip64Size : 0) + 9, 2);
+        put(record, 0, 2); // Comment length
+        put(record, 0, 2); // Disk number
+        put(record, 0, 2); // Internal attributes
+        put(record, ZIP_FILE_ATTRIBUTES, 4);
+        put(record, offset64 ? ZIP32_LIMIT : entry.localOffset, 4);
+        record += entry.name;
+        if (zip64Size > 0) {
+            put(record, ZIP_EXTRA_ZIP64, 2);
+            put(record, zip64Size, 2);
+            if (entry.zip64) {
+                put(record, entry.originalSize, 8);
+                put(record, entry.compressedSize, 8);
+            }
+            if (offset64) {
+                put(record, entry.localOffset, 8);
+            }
+        }
+        putTimestampExtra(record, entry.modified);
+        zip.write(record.data(), static_cast<std::streamsize>(record.size()));
+    }
+
+    const uint64_t directorySize = static_cast<uint64_t>(zip.tellp()) - directoryOffset;
+    const uint64_t count = zipEntries.size();
+    std::string end;
+    if (count >= ZIP16_LIMIT || directorySize >= ZIP32_LIMIT || directoryOffset >= ZIP32_LIMIT) {
+        put(end, ZIP64_END_SIGNATURE, 4);
+        put(end, ZIP64_END_SIZE - 12, 8);
+        put(end, ZIP_MADE_BY_UNIX | ZIP64_VERSION, 2);
+        put(end, ZIP64_VERSION, 2);
+        put(end, 0, 4); // This disk
+        put(end, 0, 4); // Disk with the central directory
+        put(end, count, 8);
+        put(end, count, 8);
+        put(end, directorySize, 8);
+        put(end, directoryOffset, 8);
+
+        put(end, ZIP64_LOCATOR_SIGNATURE, 4);
+        put(end, 0, 4);
+        put(end, directoryOffset + directorySize, 8);
+        put(end, 1, 4); // Total disks
+    }
+    put(end, ZIP_END_SIGNATURE, 4);
+    put(end, 0, 2);
+    put(end, 0, 2);
+    put(end, std::min<uint64_t>(count, ZIP16_LIMIT), 2);
+    put(end, std::min<uint64_t>(count, ZIP16_LIMIT), 2);
+    put(end, std::min(directorySize, ZIP32_LIMIT), 4);
+    put(end, std::min(directoryOffset, ZIP32_LIMIT), 4);
+    put(end, 0, 2); // Comment length
+    zip.write(end.data(), static_cast<std::streamsize>(end.size()));
+}
+
+// Parses a numeric tar header field: octal text, or base-256 when the
+// first byte has its high bit set (GNU, for values octal cannot hold)
+uint64_t tarNumber(const char* field, size_t size) {
+    const auto* bytes = reinterpret_cast<const uint8_t*>(field);
+    uint64_t value = 0;
+    if (bytes[0] & 0x80) {
+        value = bytes[0] & 0x7F;
+        for (size_t i = 1; i < size; ++i) {
+            value = (value << 8) | bytes[i];
+        }
+        return value;
+    }
+    size_t i = 0;
+    while (i < size && field[i] == ' ') {
+        ++i;
+    }
+    for (; i < size && field[i] >= '0' && field[i] <= '7'; ++i) {
+        value = value * 8 + static_cast<uint64_t>(field[i] - '0');
+    }
+    return value;
+}
+
+std::string tarString(const char* field, size_t size) {
+    return std::string(field, std::find(field, field + size, '\0'));
+}
+
+// The checksum is the byte sum of the header with its own field as spaces
+bool isTarChecksumValid(const char* block) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i) {
+        sum += (i >= 148 && i < 156) ? ' ' : static_cast<uint8_t>(block[i]);
+    }
+    return sum == tarNumber(block + 148, 8);
+}
+
+// Applies the "<length> <key>=<value>\n" records of a pax extended header
+void readPaxRecords(const std::string& data, TarOverrides& next) {
+    size_t position = 0;
+    while (position < data.size()) {
+        const uint64_t length = std::strtoull(data.c_str() + position, nullptr, 10);
+        if (length == 0 || length > data.size() - position) {
+            break;
+        }
+        const std::string record = data.substr(position, static_cast<size_t>(length));
+        position += static_cast<size_t>(length);
+
+        const size_t space = record.find(' ');
+        const size_t equals = record.find('=', space);
+        if (space == std::string::npos || equals == std::string::npos || record.back() != '\n') {
+            continue;
+        }
+        const std::string key = record.substr(space + 1, equals - space - 1);
+        const std::string value = record.substr(equals + 1, record.size() - equals - 2);
+        if (key == "path") {
+            next.path = value;
+        } else if (key == "size") {
+            next.size = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (key == "mtime") {
+            next.mtime = std::strtoll(value.c_str(), nullptr, 10); // Fractions are dropped
+        }
+    }
+}
+
+} // namespace
+
+void Archive::rebuildFrom(const std::function<void(std::ostream&)>& writeEntries) {
+    const std::string working = workingPath();
+    std::ofstream archive(working, std::ios::binary | std::ios::trunc);
+    if (!archive) {
+        throw std::runtime_error("Failed to create archive: " + archiveName);
+    }
+
+    try {
+        entries.clear();
+        uint8_t prefix[ENTRY_PREFIX_SIZE];
+        archive.write(reinterpret_cast<const char*>(prefix),
+                      static_cast<std::streamsize>(ArchiveFormat::encodeArchiveHeader(prefix)));
+        writeEntries(archive);
+        writeNameIndex(archive);
+        {
+            ArchiveStats::ScopedTimer timer(stats, StatStage::Write);
+            if (!archive.flush()) {
+                throw std::runtime_error("Failed to write archive: " + working);
+            }
+            if (syncPolicy.enabled) {
+                FileIO::syncFile(working);
+            }
+        }
+        archive.close();
+        FileIO::replaceFile(working, archiveName);
+        discardUndoRecord();
+    } catch (...) {
+        archive.close();
+        std::error_code ec;
+        fs::remove(working, ec);
+        if (fs::exists(archiveName)) {
+            loadCatalog(archiveName);
+        } else {
+            entries.clear();
+            dataEnd = 0;
+        }
+        throw;
+    }
+}
+
+void Archive::importZip(const std::string& zipPath) {
+    std::ifstream zip(zipPath, std::ios::binary);
+    if (!zip) {
+        throw std::runtime_error("Failed to open ZIP file: " + zipPath);
+    }
+    const std::vector<ZipEntry> zipEntries = readZipDirectory(zip, zipPath);
+
+    if (progress) {
+        uint64_t totalBytes = 0;
+        for (const auto& zipEntry : zipEntries) {
+            totalBytes += zipEntry.originalSize;
+        }
+        progress->setTotals(totalBytes, zipEntries.size());
+        progress->beginStage("Converting");
+    }
+
+    rebuildFrom([&](std::ostream& archive) {
+        std::vector<char> chunk(COPY_CHUNK);
+        for (const auto& zipEntry : zipEntries) {
+            checkpoint();
+            std::string name = zipEntry.name;
+            std::replace(name.begin(), name.end(), '\\', '/');
+            if (name.empty() || name.back() == '/') {
+                continue; // Directories are implied by the paths of their files
+            }
+            if (zipEntry.flags & ZIP_FLAG_ENCRYPTED) {
+                throw std::runtime_error("Encrypted ZIP entries are not supported: " + name);
+            }
+            if (zipEntry.method != ZIP_METHOD_STORED && zipEntry.method != ZIP_METHOD_DEFLATE) {
+                throw std::runtime_error("Unsupported ZIP compression method " +
+                                         std::to_string(zipEntry.method) + " for: " + name);
+            }
+            if (zipEntry.method == ZIP_METHOD_STORED && zipEntry.compressedSize != zipEntry.originalSize) {
+                throw std::runtime_error("Corrupt stored ZIP entry: " + name);
+            }
+            const auto fileStart = std::chrono::steady_clock::now();
+
+            // The local header's extra field may differ from the central one
+            {
+                ArchiveStats::ScopedTimer timer(stats, StatStage::Read);
+                uint8_t local[ZIP_LOCAL_HEADER_SIZE];
+                zip.seekg(static_cast<std::streamoff>(zipEntry.localOffset));
+                readExact(zip, local, sizeof(local), zipPath);
+                if (loadLE(local, 4) != ZIP_LOCAL_SIGNATURE) {
+                    throw std::runtime_error("Corrupt ZIP local header for: " + name);
+                }
+                zip.seekg(static_cast<std::streamoff>(loadLE(local + 26, 2) + loadLE(local + 28, 2)),
+                          std::ios::cur);
+            }
+
+            // ZIP's deflate data and CRC-32 are kept exactly as they are,
+            // the data only sealed when encrypting
+            EntryHeader header;
+            header.flags = ENTRY_FLAG_CRC32;
+            header.codec = zipEntry.method == ZIP_METHOD_DEFLATE ? CODEC_DEFLATE : CODEC_STORED;
+            header.crc32 = zipEntry.crc32;
+            header.nameLength = static_cast<uint32_t>(name.size());
+            header.compressedSize = zipEntry.compressedSize;
+            header.originalSize = zipEntry.originalSize;
+            header.timestamp = entryTimeFromUnix(zipEntry.modified);
+            std::unique_ptr<EntryCipher> cipher;
+            if (encryptionKey) {
+                cipher = std::make_unique<EntryCipher>(*encryptionKey, name);
+                header.flags |= ENTRY_FLAG_ENCRYPTED;
+                header.compressedSize += ENCRYPTION_OVERHEAD;
+            }
+
+            const uint64_t offset = static_cast<uint64_t>(archive.tellp());
+            {
+                ArchiveStats::ScopedTimer timer(stats, StatStage::Write);
+                uint8_t encoded[MAX_ENTRY_HEADER_SIZE];
+                size_t headerSize = ArchiveFormat::encodeEntryHeader(header, encoded);
+                archive.write(reinterpret_cast<const char*>(encoded), static_cast<std::streamsize>(headerSize));
+                archive.write(name.data(), static_cast<std::streamsize>(name.size()));
+                if (cipher) {
+                    archive.write(reinterpret_cast<const char*>(cipher->nonce()), ENCRYPTION_NONCE_SIZE);
+                }
+            }
+            for (uint64_t done = 0; done < zipEntry.compressedSize;) {
+                size_t piece = static_cast<size_t>(std::min<uint64_t>(chunk.size(), zipEntry.compressedSize - done));
+                {
+                    ArchiveStats::ScopedTimer timer(stats, StatStage::Read, piece);
+                    readExact(zip, chunk.data(), piece, zipPath);
+                }
+                if (cipher) {
+                    ArchiveStats::ScopedTimer timer(stats, StatStage::Encrypt, piece);
+                    if (!cipher->update(chunk.data(), chunk.data(), piece)) {
+                        throw std::runtime_error("Encryption failed");
+                    }
+                }
+                {
+                    ArchiveStats::ScopedTimer timer(stats, StatStage::Write, piece);
+                    archive.write(chunk.data(), static_cast<std::streamsize>(piece));
+                }
+                done += piece;
+            }
+            if (cipher) {
+                uint8_t tag[ENCRYPTION_TAG_SIZE];
+                cipher->finish(tag);
+                archive.write(reinterpret_cast<const char*>(tag), sizeof(tag));
+            }
+            if (!archive) {
+                throw std::runtime_error("Failed to write to archive");
+            }
+
+            entries.add(name, header.compressedSize, header.originalSize, header.timestamp, offset);
+            if (progress) {
+                progress->addBytes(header.originalSize);
+                progress->addFile();
+            }
+            if (stats) {
+                stats->recordFile(header.originalSize, header.compressedSize,
+                                  std::chrono::steady_clock::now() - fileStart);
+            }
+        }
+    });
+
+    std::cout << "Imported " << entries.size() << " files from '" << zipPath
+              << "' into '" << archiveName << "'." << std::endl;
+}
+
+void Archive::exportZip(const std::string& zipPath) {
+    if (!volumePaths.empty()) {
+        throw std::runtime_error("Cannot export a multi-volume archive: " + archiveName);
+    }
+    std::ifstream source(archiveName, std::ios::binary);
+    if (!source) {
+        throw std::runtime_error("Failed to open archive: " + archiveName);
+    }
+    auto reader = [&source](void* data, size_t size) {
+        return static_cast<bool>(source.read(static_cast<char*>(data), static_cast<std::streamsize>(size)));
+    };
+    auto readPayload = [&](char* data, size_t size) { readExact(source, data, size, archiveName); };
+    std::unique_ptr<EntryDecryptor> decryptor;
+    if (encryptionKey) {
+        decryptor = std::make_unique<EntryDecryptor>(*encryptionKey);
+    }
+
+    // Entries are copied in archive order so the archive is read front to back
+    std::vector<size_t> order(entries.size());
+    std::iota(order.begin(), order.end(), size_t{0});
+    std::sort(order.begin(), order.end(),
+              [this](size_t a, size_t b) { return entries.offset(a) < entries.offset(b); });
+
+    if (progress) {
+        uint64_t totalBytes = 0;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            totalBytes += entries[i].originalSize;
+        }
+        progress->setTotals(totalBytes, entries.size());
+        progress->beginStage("Converting");
+    }
+
+    const std::string working = zipPath + ".tmp";
+    std::ofstream zip(working, std::ios::binary | std::ios::trunc);
+    if (!zip) {
+        throw std::runtime_error("Failed to create ZIP file: " + zipPath);
+    }
+
+    try {
+        std::vector<ZipEntry> written;
+        written.reserve(order.size());
+        std::vector<char> chunk(COPY_CHUNK);
+        for (size_t index : order) {
+            checkpoint();
+            const auto fileStart = std::chrono::steady_clock::now();
+            const ArchiveEntry entry = entries[index];
+            const std::string name(entry.name);
+            if (name.size() > ZIP16_LIMIT) {
+                throw std::runtime_error("Name too long for a ZIP file: " + name);
+            }
+
+            EntryHeader header;
+            std::vector<SparseExtent> extents;
+            uint64_t headerSize = 0;
+            {
+                ArchiveStats::ScopedTimer timer(stats, StatStage::Read);
+                source.seekg(static_cast<std::streamoff>(entries.offset(index)));
+                if (!ArchiveFormat::readEntryHeader(reader, header, headerSize) ||
+                    !source.seekg(header.nameLength, std::ios::cur) ||
+                    (header.isSparse() && !ArchiveFormat::readSparseMap(reader, header, extents, headerSize))) {
+                    throw std::runtime_error("Corrupt entry: " + name);
+                }
+            }
+            const uint64_t payloadOffset = static_cast<uint64_t>(source.tellg());
+            if (header.hasDescriptor()) {
+                // Sizes and checksums follow the payload, whose size the index has
+                uint64_t descriptorSize = 0;
+                source.seekg(static_cast<std::streamoff>(payloadOffset + entry.compressedSize));
+                if (!ArchiveFormat::readEntryDescriptor(reader, header, descriptorSize)) {
+                    throw std::runtime_error("Corrupt entry descriptor for: " + name);
+                }
+            }
+            if (header.codec != CODEC_STORED && header.codec != CODEC_ZLIB && header.codec != CODEC_DEFLATE) {
+                throw std::runtime_error("Unsupported codec " + std::to_string(header.codec) + " for: " + name);
+            }
+
+            ZipEntry zipEntry;
+            zipEntry.name = name;
+            zipEntry.method = header.codec == CODEC_STORED ? ZIP_METHOD_STORED : ZIP_METHOD_DEFLATE;
+            zipEntry.crc32 = header.crc32;
+            zipEntry.originalSize = header.originalSize;
+            zipEntry.localOffset = static_cast<uint64_t>(zip.tellp());
+            zipEntry.modified = unixTimeFromEntry(header.timestamp);
+
+            // Find a payload the ZIP can take as it is: a zlib stream is
+            // raw deflate between a 2-byte header and the Adler-32
+            uint64_t rawOffset = payloadOffset;
+            uint64_t rawSize = header.compressedSize;
+            bool passThrough = !header.isSparse() && !header.isEncrypted();
+            if (header.originalSize == 0) {
+                zipEntry.method = ZIP_METHOD_STORED;
+                rawSize = 0;
+                passThrough = true;
+            } else if (passThrough && header.codec == CODEC_ZLIB) {
+                uint8_t wrapper[2] = {};
+                source.seekg(static_cast<std::streamoff>(payloadOffset));
+                passThrough = header.compressedSize >= 6 && reader(wrapper, sizeof(wrapper)) &&
+                              (wrapper[0] & 0x0F) == Z_DEFLATED && !(wrapper[1] & 0x20); // No preset dictionary
+                rawOffset += 2;
+                rawSize -= 6;
+            }
+
+            // Only legacy entries lack a CRC-32
+            if (passThrough && !header.hasCrc32() && header.originalSize > 0) {
+                uLong crc = ::crc32(0L, Z_NULL, 0);
+                ArchiveStats::ScopedTimer timer(stats, StatStage::Inflate, header.originalSize);
+                source.seekg(static_cast<std::streamoff>(payloadOffset));
+                decodeEntry(header, extents, readPayload, [&](const char* data, size_t size) {
+                    crc = ::crc32(crc, reinterpret_cast<const Bytef*>(data), static_cast<uInt>(size));
+                }, name, decryptor.get());
+                zipEntry.crc32 = static_cast<uint32_t>(crc);
+            }
+
+            if (passThrough) {
+                zipEntry.compressedSize = rawSize;
+                zipEntry.zip64 = std::max(zipEntry.originalSize, rawSize) >= ZIP64_SIZE_THRESHOLD;
+                const std::string local = zipLocalHeader(zipEntry);
+                zip.write(local.data(), static_cast<std::streamsize>(local.size()));
+                source.seekg(static_cast<std::streamoff>(rawOffset));
+                for (uint64_t done = 0; done < rawSize;) {
+                    size_t piece = static_cast<size_t>(std::min<uint64_t>(chunk.size(), rawSize - done));
+                    {
+                        ArchiveStats::ScopedTimer timer(stats, StatStage::Read, piece);
+                        readExact(source, chunk.data(), piece, archiveName);
+                    }
+                    {
+                        ArchiveStats::ScopedTimer timer(stats, StatStage::Write, piece);
+                        zip.write(chunk.data(), static_cast<std::streamsize>(piece));
+                    }
+                    done += piece;
+                }
+            } else {
+                // Sparse and encrypted entries and zlib streams with a
+                // preset dictionary are decoded, holes included, and deflated
+                // again. A sparse entry's CRC-32 covers only its extents, so
+                // it is redone.
+                zipEntry.method = ZIP_METHOD_DEFLATE;
+                zipEntry.zip64 = zipEntry.originalSize >= ZIP64_SIZE_THRESHOLD;
+                const std::string local = zipLocalHeader(zipEntry);
+                zip.write(local.data(), static_cast<std::streamsize>(local.size()));
+
+                struct Deflater {
+                    z_stream strm = {};
+                    ~Deflater() { deflateEnd(&strm); }
+                } deflater;
+                z_stream& strm = deflater.strm;
+                if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                                 Z_DEFAULT_STRATEGY) != Z_OK) {
+                    throw std::runtime_error("Failed to initialize compression");
+                }
+                std::vector<char> compressed(deflateBound(&strm, static_cast<uLong>(COPY_CHUNK)));
+                auto deflateInto = [&](const char* data, size_t size, int flush) {
+                    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+                    strm.avail_in = static_cast<uInt>(size);
+                    int status = Z_OK;
+                    do {
+                        strm.next_out = reinterpret_cast<Bytef*>(compressed.data());
+                        strm.avail_out = static_cast<uInt>(compressed.size());
+                        status = deflate(&strm, flush);
+                        if (status == Z_STREAM_ERROR) {
+                            throw std::runtime_error("Compression failed");
+                        }
+                        size_t produced = compressed.size() - strm.avail_out;
+                        zip.write(compressed.data(), static_cast<std::streamsize>(produced));
+                        zipEntry.compressedSize += produced;
+                    } while (strm.avail_out == 0);
+                    if (flush == Z_FINISH && status != Z_STREAM_END) {
+                        throw std::runtime_error("Compression failed");
+                    }
+                };
+                uLong crc = ::crc32(0L, Z_NULL, 0);
+                {
+                    ArchiveStats::ScopedTimer timer(stats, StatStage::Compress, header.originalSize);
+                    source.seekg(static_cast<std::streamoff>(payloadOffset));
+                    decodeEntry(header, extents, readPayload, [&](const char* data, size_t size) {
+                        crc = ::crc32(crc, reinterpret_cast<const Bytef*>(data), static_cast<uInt>(size));
+                        deflateInto(data, size, Z_NO_FLUSH);
+                    }, name, decryptor.get());
+                    deflateInto(nullptr, 0, Z_FINISH);
+                }
+                zipEntry.crc32 = static_cast<uint32_t>(crc);
+
+                // The checksum and compressed size are only known now
+                uint8_t field[8];
+                storeLE(field, zipEntry.crc32, 4);
+                zip.seekp(static_cast<std::streamoff>(zipEntry.localOffset + ZIP_LOCAL_CRC_OFFSET));
+                zip.write(reinterpret_cast<const char*>(field), 4);
+                storeLE(field, zipEntry.compressedSize, zipEntry.zip64 ? 8 : 4);
+                zip.seekp(static_cast<std::streamoff>(zipEntry.localOffset + zipCompressedSizeOffset(zipEntry)));
+                zip.write(reinterpret_cast<const char*>(field), zipEntry.zip64 ? 8 : 4);
+                zip.seekp(0, std::ios::end);
+            }
+            if (!zip) {
+                throw std::runtime_error("Failed to write ZIP file: " + zipPath);
+            }
+
+            if (progress) {
+                progress->addBytes(zipEntry.originalSize);
+                progress->addFile();
+            }
+            if (stats) {
+                stats->recordFile(zipEntry.originalSize, zipEntry.compressedSize,
+                                  std::chrono::steady_clock::now() - fileStart);
+            }
+            written.push_back(std::move(zipEntry));
+        }
+
+        if (progress) {
+            progress->beginStage("Writing index");
+        }
+        writeZipDirectory(zip, written);
+        {
+            ArchiveStats::ScopedTimer timer(stats, StatStage::Write);
+            if (!zip.flush()) {
+                throw std::runtime_error("Failed to write ZIP file: " + zipPath);
+            }
+            if (syncPolicy.enabled) {
+                FileIO::syncFile(working);
+            }
+        }
+        zip.close();
+        FileIO::replaceFile(working, zipPath);
+    } catch (...) {
+        zip.close();
+        std::error_code ec;
+        fs::remove(working, ec);
+        throw;
+    }
+
+    std::cout << "Exported " << entries.size() << " files from '" << archiveName
+              << "' to '" << zipPath << "'." << std::endl;
+}
+
+void Archive::importTar(const std::string& tarPath, CompressionType compression) {
+    std::ifstream file;
+    if (tarPath == "-") {
+        FileIO::setBinaryStandardStreams();
+    } else {
+        file.open(tarPath, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("Failed to open tar file: " + tarPath);
+        }
+    }
+    std::istream& tar = tarPath == "-" ? std::cin : file;
+    const std::string source = tarPath == "-" ? "standard input" : tarPath;
+
+    // A tar file has no table of contents, so there are no totals to report
+    if (progress) {
+        progress->beginStage("Converting");
+    }
+
+    rebuildFrom([&](std::ostream& archive) {
+        TarOverrides next;
+        std::vector<char> block(TAR_BLOCK_SIZE);
+        for (;;) {
+            checkpoint();
+            tar.read(block.data(), TAR_BLOCK_SIZE);
+            if (tar.gcount() == 0) {
+                break; // Tolerate a missing end-of-archive marker
+            }
+            if (static_cast<size_t>(tar.gcount()) != TAR_BLOCK_SIZE) {
+                throw std::runtime_error("Unexpected end of " + source);
+            }
+            if (std::all_of(block.begin(), block.end(), [](char c) { return c == '\0'; })) {
+                break;
+            }
+            if (!isTarChecksumValid(block.data())) {
+                throw std::runtime_error("Corrupt tar header in: " + source);
+            }
+
+            std::string name = tarString(&block[0], 100);
+            if (std::memcmp(&block[257], "ustar", 5) == 0 && block[345] != '\0') {
+                name = tarString(&block[345], 155) + '/' + name;
+            }
+            uint64_t size = tarNumber(&block[124], 12);
+            int64_t mtime = static_cast<int64_t>(tarNumber(&block[136], 12));
+            const char type = block[156];
+            if (!next.path.empty()) {
+                name = next.path;
+            }
+            if (next.size) {
+                size = *next.size;
+            }
+            if (next.mtime) {
+                mtime = *next.mtime;
+            }
+            const uint64_t padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+            auto skipData = [&]() {
+                tar.ignore(static_cast<std::streamsize>(size + padding));
+            };
+
+            // pax headers and GNU long names describe the entry after them
+            if (type == 'x' || type == 'L') {
+                if (size > TAR_MAX_METADATA) {
+                    throw std::runtime_error("Corrupt tar header in: " + source);
+                }
+                std::string data(static_cast<size_t>(size), '\0');
+                readExact(tar, data.data(), data.size(), source);
+                tar.ignore(static_cast<std::streamsize>(padding));
+                if (type == 'x') {
+                    readPaxRecords(data, next);
+                } else {
+                    next.path = tarString(data.data(), data.size());
+                }
+                continue;
+            }
+            if (type == 'g' || type == 'K') {
+                skipData(); // Global pax headers and long link targets
+                continue;
+            }
+            next = TarOverrides{};
+
+            if (type != '0' && type != '\0' && type != '7') {
+                if (type != '5') {
+                    std::cerr << "Skipping non-regular tar entry: " << name << std::endl;
+                }
+                skipData();
+                continue;
+            }
+
+            // Archive paths are relative
+            while (name.compare(0, 2, "./") == 0) {
+                name.erase(0, 2);
+            }
+            const size_t start = name.find_first_not_of('/');
+            name.erase(0, start == std::string::npos ? name.size() : start);
+            if (name.empty()) {
+                skipData();
+                continue;
+            }
+
+            const auto fileStart = std::chrono::steady_clock::now();
+            const int64_t timestamp = entryTimeFromUnix(mtime);
+            if (size < STREAMED_ENTRY_THRESHOLD) {
+                std::vector<char> buffer(static_cast<size_t>(size));
+                {
+                    ArchiveStats::ScopedTimer timer(stats, StatStage::Read, size);
+                    readExact(tar, buffer.data(), buffer.size(), source);
+                }
+                addEntryData(name, buffer, {}, size, timestamp, archive, compression, fileStart);
+            } else {
+                addStreamedEntry(name, size, timestamp,
+                                 [&](char* data, size_t piece) { readExact(tar, data, piece, source); },
+                                 archive, compression, fileStart);
+            }
+            tar.ignore(static_cast<std::streamsize>(padding));
+        }
+    });
+
+    std::cout << "Imported " << entries.size() << " files from '" << source
+              << "' into '" << archiveName << "'." << std::endl;
+}
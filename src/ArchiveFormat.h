@@ -1,18 +1,684 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <ctime>
+#include <string>
+#include <vector>
 
 // Archive format constants
-constexpr uint32_t SIGNATURE = 0x4E415649;  // "IVAN"
-constexpr uint16_t CURRENT_VERSION = 0x0200; // Version 2.0
-
-// Header structure for each file in the archive
-struct FileHeader {
-    uint32_t signature;      // File signature "IVAN"
-    uint16_t version;        // Archive version
-    uint32_t nameLength;     // Length of the file name
-    uint64_t compressedSize; // Size after compression
-    uint64_t originalSize;   // Original file size
-    int64_t timestamp;       // File timestamp
-};
\ No newline at end of file
+constexpr uint32_t SIGNATURE = 0x4E415649;         // "IVAN"
+constexpr uint16_t CURRENT_VERSION = 0x0300;       // Version 3.0, explicitly serialized headers
+constexpr uint16_t LEGACY_VERSION = 0x0200;        // Version 2.0, raw FileHeader struct
+constexpr uint16_t LEGACY_SPARSE_VERSION = 0x0201; // Version 2.0 entry with a sparse extent map
+
+// Entry flags
+constexpr uint8_t ENTRY_FLAG_SPARSE = 0x01;  // A sparse extent map follows the name
+constexpr uint8_t ENTRY_FLAG_CRC32 = 0x02;   // The header carries a CRC-32 of the data
+constexpr uint8_t ENTRY_FLAG_SHA256 = 0x04;  // The header carries a SHA-256 of the data
+constexpr uint8_t ENTRY_FLAG_DESCRIPTOR = 0x08; // Sizes and checksums follow the payload
+constexpr uint8_t ENTRY_FLAG_ENCRYPTED = 0x10;  // The payload is sealed with AES-256-GCM
+
+// Payload codecs
+constexpr uint8_t CODEC_STORED = 0;          // Payload is the data itself
+constexpr uint8_t CODEC_ZLIB = 1;            // Payload is a zlib stream
+constexpr uint8_t CODEC_DEFLATE = 2;         // Payload is a raw deflate stream, as in ZIP files
+
+// Every multi-byte field is little-endian and nothing is padded, so the
+// layout does not depend on the compiler. A version 3 entry is
+//
+//   offset 0   uint32  signature        SIGNATURE
+//   offset 4   uint16  version          CURRENT_VERSION
+//   offset 6   uint8   flags            ENTRY_FLAG_*
+//   offset 7   uint8   codec            CODEC_*
+//   offset 8   varint  nameLength
+//              varint  compressedSize   payload bytes
+//              varint  originalSize
+//              varint  timestamp        zigzag-encoded
+//              uint32  crc32            only with ENTRY_FLAG_CRC32: zlib crc32
+//                                       of the data bytes (the extents, in order)
+//              uint8   sha256[32]       only with ENTRY_FLAG_SHA256: SHA-256 of
+//                                       the same bytes, the content address
+//              char[nameLength]         name, '/' separated
+//              sparse map               only with ENTRY_FLAG_SPARSE
+//              payload
+//
+// Entries written to a forward-only stream may set ENTRY_FLAG_DESCRIPTOR
+// instead of knowing their sizes up front. Their header stores zero for
+// compressedSize and originalSize and no checksums; the payload is a
+// self-terminating zlib stream followed by a descriptor:
+//
+//              varint  compressedSize
+//              varint  originalSize
+//              uint32  crc32            only with ENTRY_FLAG_CRC32
+//              uint8   sha256[32]       only with ENTRY_FLAG_SHA256
+//
+// Descriptor entries are never sparse and always use CODEC_ZLIB.
+//
+// With ENTRY_FLAG_ENCRYPTED the payload (not the descriptor) is
+//
+//              uint8   nonce[12]        random for every entry
+//              ciphertext               the codec's bytes, AES-256-GCM
+//              uint8   tag[16]          authenticates the ciphertext and name
+//
+// and compressedSize counts all three. Headers, names and checksums stay
+// in the clear, so listing and skipping work without the key.
+//
+// Varints are LEB128: 7 bits per byte, low bits first, high bit set on all
+// but the last byte. The archive starts with the 8-byte prefix alone
+// (flags and codec zero).
+//
+// Version 2 entries are still read. They are the 40-byte FileHeader struct
+// as x86-64 compilers laid it out: signature at 0, version at 4, nameLength
+// at 8, compressedSize at 16, originalSize at 24 and timestamp at 32, with
+// padding in between; the payload is always zlib.
+constexpr size_t ENTRY_PREFIX_SIZE = 8;
+constexpr size_t LEGACY_HEADER_SIZE = 40;
+constexpr size_t MAX_VARINT_SIZE = 10;
+constexpr size_t MAX_ENTRY_HEADER_SIZE = ENTRY_PREFIX_SIZE + 4 * MAX_VARINT_SIZE + 4 + 32;
+constexpr size_t MAX_DESCRIPTOR_SIZE = 2 * MAX_VARINT_SIZE + 4 + 32;
+constexpr size_t ENCRYPTION_NONCE_SIZE = 12;
+constexpr size_t ENCRYPTION_TAG_SIZE = 16;
+constexpr size_t ENCRYPTION_OVERHEAD = ENCRYPTION_NONCE_SIZE + ENCRYPTION_TAG_SIZE;
+
+// Decoded entry header, independent of the version it was read from
+struct EntryHeader {
+    uint16_t version = CURRENT_VERSION;
+    uint8_t flags = 0;
+    uint8_t codec = CODEC_ZLIB;
+    uint32_t nameLength = 0;
+    uint64_t compressedSize = 0; // Size of the payload
+    uint64_t originalSize = 0;   // Original file size
+    int64_t timestamp = 0;       // File timestamp (file_time_type ticks)
+    uint32_t crc32 = 0;          // Valid with ENTRY_FLAG_CRC32
+    uint8_t sha256[32] = {};     // Valid with ENTRY_FLAG_SHA256
+
+    bool isSparse() const { return (flags & ENTRY_FLAG_SPARSE) != 0; }
+    bool hasCrc32() const { return (flags & ENTRY_FLAG_CRC32) != 0; }
+    bool hasSha256() const { return (flags & ENTRY_FLAG_SHA256) != 0; }
+    bool hasDescriptor() const { return (flags & ENTRY_FLAG_DESCRIPTOR) != 0; }
+    bool isEncrypted() const { return (flags & ENTRY_FLAG_ENCRYPTED) != 0; }
+};
+
+// Region of a sparse file that holds data. The payload of a sparse entry
+// holds only the bytes of its extents, concatenated in order; everything
+// else reads back as zeros. In version 3 the map is a varint extent count
+// followed by (varint gap, varint length) pairs, where gap is the distance
+// from the end of the previous extent. Version 2 stored a uint32 count and
+// raw 16-byte {offset, length} pairs.
+struct SparseExtent {
+    uint64_t offset;         // Offset of the region within the file
+    uint64_t length;         // Length of the region in bytes
+};
+
+namespace ArchiveFormat {
+
+inline void storeLE(uint8_t* out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+inline uint64_t loadLE(const uint8_t* in, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+inline size_t putVarint(uint8_t* out, uint64_t value) {
+    size_t size = 0;
+    while (value >= 0x80) {
+        out[size++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    out[size++] = static_cast<uint8_t>(value);
+    return size;
+}
+
+inline uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Reads a varint through read(void* data, size_t size) -> bool, adding the
+// bytes consumed to consumed
+template <typename Read>
+bool getVarint(Read&& read, uint64_t& value, uint64_t& consumed) {
+    value = 0;
+    for (size_t i = 0; i < MAX_VARINT_SIZE; ++i) {
+        uint8_t byte = 0;
+        if (!read(&byte, 1)) {
+            return false;
+        }
+        ++consumed;
+        value |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Encodes the archive prefix into out (ENTRY_PREFIX_SIZE bytes)
+inline size_t encodeArchiveHeader(uint8_t* out) {
+    storeLE(out, SIGNATURE, 4);
+    storeLE(out + 4, CURRENT_VERSION, 2);
+    out[6] = 0;
+    out[7] = 0;
+    return ENTRY_PREFIX_SIZE;
+}
+
+// Encodes the CRC-32 and SHA-256 fields selected by the entry's flags
+inline size_t encodeChecksums(const EntryHeader& header, uint8_t* out) {
+    size_t size = 0;
+    if (header.hasCrc32()) {
+        storeLE(out, header.crc32, 4);
+        size += 4;
+    }
+    if (header.hasSha256()) {
+        std::memcpy(out + size, header.sha256, sizeof(header.sha256));
+        size += sizeof(header.sha256);
+    }
+    return size;
+}
+
+template <typename Read>
+bool readChecksums(Read&& read, EntryHeader& header, uint64_t& size) {
+    if (header.hasCrc32()) {
+        uint8_t crc[4];
+        if (!read(crc, sizeof(crc))) {
+            return false;
+        }
+        header.crc32 = static_cast<uint32_t>(loadLE(crc, 4));
+        size += sizeof(crc);
+    }
+    if (header.hasSha256()) {
+        if (!read(header.sha256, sizeof(header.sha256))) {
+            return false;
+        }
+        size += sizeof(header.sha256);
+    }
+    return true;
+}
+
+// Encodes a version 3 entry header into out (at most MAX_ENTRY_HEADER_SIZE
+// bytes) and returns its size
+inline size_t encodeEntryHeader(const EntryHeader& header, uint8_t* out) {
+    size_t size = encodeArchiveHeader(out);
+    out[6] = header.flags;
+    out[7] = header.codec;
+    size += putVarint(out + size, header.nameLength);
+    size += putVarint(out + size, header.compressedSize);
+    size += putVarint(out + size, header.originalSize);
+    size += putVarint(out + size, zigzag(header.timestamp));
+    if (!header.hasDescriptor()) {
+        size += encodeChecksums(header, out + size);
+    }
+    return size;
+}
+
+// Encodes the descriptor that follows the payload of an entry with
+// ENTRY_FLAG_DESCRIPTOR (at most MAX_DESCRIPTOR_SIZE bytes)
+inline size_t encodeEntryDescriptor(const EntryHeader& header, uint8_t* out) {
+    size_t size = putVarint(out, header.compressedSize);
+    size += putVarint(out + size, header.originalSize);
+    return size + encodeChecksums(header, out + size);
+}
+
+// Reads the archive prefix; size receives its length (which depends on
+// the version that wrote the archive)
+template <typename Read>
+bool readArchiveHeader(Read&& read, uint64_t& size) {
+    uint8_t prefix[LEGACY_HEADER_SIZE];
+    if (!read(prefix, 6) || loadLE(prefix, 4) != SIGNATURE) {
+        return false;
+    }
+    size = loadLE(prefix + 4, 2) < CURRENT_VERSION ? LEGACY_HEADER_SIZE : ENTRY_PREFIX_SIZE;
+    return read(prefix + 6, static_cast<size_t>(size - 6));
+}
+
+// Reads one entry header of either version. Returns false at the end of
+// the entries (a different signature, such as the name index) or if the
+// header is cut short; size receives the header's length.
+template <typename Read>
+bool readEntryHeader(Read&& read, EntryHeader& header, uint64_t& size) {
+    uint8_t prefix[LEGACY_HEADER_SIZE];
+    if (!read(prefix, ENTRY_PREFIX_SIZE) || loadLE(prefix, 4) != SIGNATURE) {
+        return false;
+    }
+    header = EntryHeader{};
+    header.version = static_cast<uint16_t>(loadLE(prefix + 4, 2));
+
+    if (header.version < CURRENT_VERSION) {
+        if (!read(prefix + ENTRY_PREFIX_SIZE, LEGACY_HEADER_SIZE - ENTRY_PREFIX_SIZE)) {
+            return false;
+        }
+        header.flags = header.version == LEGACY_SPARSE_VERSION ? ENTRY_FLAG_SPARSE : 0;
+        header.codec = CODEC_ZLIB;
+        header.nameLength = static_cast<uint32_t>(loadLE(prefix + 8, 4));
+        header.compressedSize = loadLE(prefix + 16, 8);
+        header.originalSize = loadLE(prefix + 24, 8);
+        header.timestamp = static_cast<int64_t>(loadLE(prefix + 32, 8));
+        size = LEGACY_HEADER_SIZE;
+        return true;
+    }
+
+    header.flags = prefix[6];
+    header.codec = prefix[7];
+    size = ENTRY_PREFIX_SIZE;
+    uint64_t nameLength = 0;
+    uint64_t timestamp = 0;
+    if (!getVarint(read, nameLength, size) || nameLength > UINT32_MAX ||
+        !getVarint(read, header.compressedSize, size) ||
+        !getVarint(read, header.originalSize, size) ||
+        !getVarint(read, timestamp, size)) {
+        return false;
+    }
+    header.nameLength = static_cast<uint32_t>(nameLength);
+    header.timestamp = unzigzag(timestamp);
+    return header.hasDescriptor() || readChecksums(read, header, size);
+}
+
+// Reads the descriptor after the payload of an entry with
+// ENTRY_FLAG_DESCRIPTOR into header, adding the bytes consumed to size
+template <typename Read>
+bool readEntryDescriptor(Read&& read, EntryHeader& header, uint64_t& size) {
+    return getVarint(read, header.compressedSize, size) &&
+           getVarint(read, header.originalSize, size) &&
+           readChecksums(read, header, size);
+}
+
+// Appends the version 3 encoding of a sparse map to out
+inline void encodeSparseMap(const std::vector<SparseExtent>& extents, std::vector<uint8_t>& out) {
+    uint8_t buffer[MAX_VARINT_SIZE];
+    out.insert(out.end(), buffer, buffer + putVarint(buffer, extents.size()));
+    uint64_t end = 0;
+    for (const auto& extent : extents) {
+        out.insert(out.end(), buffer, buffer + putVarint(buffer, extent.offset - end));
+        out.insert(out.end(), buffer, buffer + putVarint(buffer, extent.length));
+        end = extent.offset + extent.length;
+    }
+}
+
+// Reads the sparse map of an entry with ENTRY_FLAG_SPARSE, adding the bytes
+// consumed to size. Extents must be ordered and lie within the file.
+template <typename Read>
+bool readSparseMap(Read&& read, const EntryHeader& header, std::vector<SparseExtent>& extents,
+                   uint64_t& size) {
+    extents.clear();
+    uint64_t count = 0;
+    if (header.version < CURRENT_VERSION) {
+        uint8_t raw[sizeof(SparseExtent)];
+        if (!read(raw, 4)) {
+            return false;
+        }
+        count = loadLE(raw, 4);
+        size += 4;
+        if (count > header.originalSize) {
+            return false;
+        }
+        for (uint64_t i = 0; i < count; ++i) {
+            if (!read(raw, sizeof(raw))) {
+                return false;
+            }
+            extents.push_back(SparseExtent{loadLE(raw, 8), loadLE(raw + 8, 8)});
+            size += sizeof(raw);
+        }
+    } else {
+        if (!getVarint(read, count, size) || count > header.originalSize) {
+            return false;
+        }
+        uint64_t end = 0;
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t gap = 0;
+            uint64_t length = 0;
+            if (!getVarint(read, gap, size) || !getVarint(read, length, size)) {
+                return false;
+            }
+            extents.push_back(SparseExtent{end + gap, length});
+            end += gap + length;
+        }
+    }
+
+    uint64_t end = 0;
+    for (const auto& extent : extents) {
+        if (extent.offset < end || extent.length > header.originalSize ||
+            extent.offset > header.originalSize - extent.length) {
+            return false;
+        }
+        end = extent.offset + extent.length;
+    }
+    return true;
+}
+
+} // namespace ArchiveFormat
+
+// Sorted name index, written after the last entry. Readers that scan entry
+// headers stop at it because its signature differs from SIGNATURE.
+//
+//   IndexHeader
+//   IndexRecord[entryCount]     entries in archive order
+//   uint32_t[entryCount]        entry numbers sorted by name
+//   char[namesSize]             all names back to back (see IndexRecord::nameEnd)
+//   IndexTrailer                last bytes of the archive
+//
+// Every field is little-endian, in the order the structs below declare
+// them, without padding.
+constexpr uint32_t INDEX_SIGNATURE = 0x58444E49;         // "INDX"
+constexpr uint32_t INDEX_TRAILER_SIGNATURE = 0x444E4549; // "IEND"
+constexpr size_t INDEX_HEADER_SIZE = 24;
+constexpr size_t INDEX_RECORD_SIZE = 40;
+constexpr size_t INDEX_TRAILER_SIZE = 16;
+
+struct IndexHeader {
+    uint32_t signature;      // INDEX_SIGNATURE
+    uint32_t reserved;
+    uint64_t entryCount;     // Number of IndexRecords
+    uint64_t namesSize;      // Total size of the name block
+};
+
+struct IndexRecord {
+    uint64_t offset;         // Offset of the entry header
+    uint64_t compressedSize;
+    uint64_t originalSize;
+    int64_t timestamp;
+    uint64_t nameEnd;        // End of this entry's name in the name block
+};
+
+struct IndexTrailer {
+    uint64_t indexOffset;    // Offset of the IndexHeader
+    uint32_t reserved;
+    uint32_t signature;      // INDEX_TRAILER_SIGNATURE
+};
+
+namespace ArchiveFormat {
+
+inline void encodeIndexHeader(const IndexHeader& header, uint8_t* out) {
+    storeLE(out, header.signature, 4);
+    storeLE(out + 4, 0, 4);
+    storeLE(out + 8, header.entryCount, 8);
+    storeLE(out + 16, header.namesSize, 8);
+}
+
+inline IndexHeader decodeIndexHeader(const uint8_t* in) {
+    IndexHeader header{};
+    header.signature = static_cast<uint32_t>(loadLE(in, 4));
+    header.entryCount = loadLE(in + 8, 8);
+    header.namesSize = loadLE(in + 16, 8);
+    return header;
+}
+
+inline void encodeIndexRecord(const IndexRecord& record, uint8_t* out) {
+    storeLE(out, record.offset, 8);
+    storeLE(out + 8, record.compressedSize, 8);
+    storeLE(out + 16, record.originalSize, 8);
+    storeLE(out + 24, static_cast<uint64_t>(record.timestamp), 8);
+    storeLE(out + 32, record.nameEnd, 8);
+}
+
+inline IndexRecord decodeIndexRecord(const uint8_t* in) {
+    return IndexRecord{loadLE(in, 8), loadLE(in + 8, 8), loadLE(in + 16, 8),
+                       static_cast<int64_t>(loadLE(in + 24, 8)), loadLE(in + 32, 8)};
+}
+
+inline void encodeIndexTrailer(const IndexTrailer& trailer, uint8_t* out) {
+    storeLE(out, trailer.indexOffset, 8);
+    storeLE(out + 8, 0, 4);
+    storeLE(out + 12, trailer.signature, 4);
+}
+
+inline IndexTrailer decodeIndexTrailer(const uint8_t* in) {
+    IndexTrailer trailer{};
+    trailer.indexOffset = loadLE(in, 8);
+    trailer.signature = static_cast<uint32_t>(loadLE(in + 12, 4));
+    return trailer;
+}
+
+} // namespace ArchiveFormat
+
+// A multi-volume archive is a catalog plus numbered volume files. Each
+// volume is a complete archive of whole entries with its own index. The
+// catalog holds no entry data: its archive header is followed by the volume
+// table and then a name index whose offsets point into the volumes.
+//
+//   archive header
+//   VolumeHeader
+//   uint32_t[entryCount]        volume of each entry, in index order
+//   VolumeRecord[volumeCount]
+//   char[pathsSize]             volume paths back to back (see VolumeRecord::pathEnd),
+//                               relative to the catalog's directory unless absolute
+//   name index                  as above, offsets within the entry's volume
+//
+// Like the index, every field is little-endian and unpadded.
+constexpr uint32_t VOLUME_SIGNATURE = 0x534C4F56; // "VOLS"
+constexpr size_t VOLUME_HEADER_SIZE = 24;
+constexpr size_t VOLUME_RECORD_SIZE = 16;
+
+struct VolumeHeader {
+    uint32_t signature;      // VOLUME_SIGNATURE
+    uint32_t volumeCount;
+    uint64_t entryCount;
+    uint64_t pathsSize;
+};
+
+struct VolumeRecord {
+    uint64_t size;           // Size of the volume file
+    uint64_t pathEnd;        // End of this volume's path in the path block
+};
+
+namespace ArchiveFormat {
+
+inline void encodeVolumeHeader(const VolumeHeader& header, uint8_t* out) {
+    storeLE(out, header.signature, 4);
+    storeLE(out + 4, header.volumeCount, 4);
+    storeLE(out + 8, header.entryCount, 8);
+    storeLE(out + 16, header.pathsSize, 8);
+}
+
+inline VolumeHeader decodeVolumeHeader(const uint8_t* in) {
+    return VolumeHeader{static_cast<uint32_t>(loadLE(in, 4)), static_cast<uint32_t>(loadLE(in + 4, 4)),
+                        loadLE(in + 8, 8), loadLE(in + 16, 8)};
+}
+
+inline void encodeVolumeRecord(const VolumeRecord& record, uint8_t* out) {
+    storeLE(out, record.size, 8);
+    storeLE(out + 8, record.pathEnd, 8);
+}
+
+inline VolumeRecord decodeVolumeRecord(const uint8_t* in) {
+    return VolumeRecord{loadLE(in, 8), loadLE(in + 8, 8)};
+}
+
+} // namespace ArchiveFormat
+
+// Undo record written to "<archive>.undo" before an in-place append. The
+// append only overwrites what follows the entry data, so the record holds
+// the archive's length before the append and the archiveSize - dataEnd
+// bytes of name index and trailer that follow this header. An interrupted
+// append is rolled back by truncating to dataEnd and restoring them.
+// Every field is little-endian and unpadded.
+constexpr uint32_t UNDO_SIGNATURE = 0x4F444E55; // "UNDO"
+constexpr size_t UNDO_HEADER_SIZE = 24;
+
+struct UndoHeader {
+    uint32_t signature;      // UNDO_SIGNATURE
+    uint32_t reserved;
+    uint64_t dataEnd;        // End of the entry data before the append
+    uint64_t archiveSize;    // Length of the archive before the append
+};
+
+namespace ArchiveFormat {
+
+inline void encodeUndoHeader(const UndoHeader& header, uint8_t* out) {
+    storeLE(out, header.signature, 4);
+    storeLE(out + 4, 0, 4);
+    storeLE(out + 8, header.dataEnd, 8);
+    storeLE(out + 16, header.archiveSize, 8);
+}
+
+inline UndoHeader decodeUndoHeader(const uint8_t* in) {
+    return UndoHeader{static_cast<uint32_t>(loadLE(in, 4)), 0, loadLE(in + 8, 8), loadLE(in + 16, 8)};
+}
+
+} // namespace ArchiveFormat
+
+// Patch written by Archive::writePatch: a PatchHeader and a list of
+// operations that rebuild the new archive byte for byte, front to back,
+// from the old one. Each operation starts with a uint8 kind:
+//
+//   PATCH_COPY     varint oldOffset, varint length   bytes of the old archive
+//   PATCH_LITERAL  varint length, bytes              bytes of the new archive
+//   PATCH_PACKED   varint length, varint packedSize, zlib stream
+//                                                    literal headers and index
+//   PATCH_DELTA    varint oldOffset, uint8 level, varint payloadSize,
+//                  varint deltaSize, BinaryDelta
+//                  a zlib payload: the old entry at oldOffset is decoded,
+//                  the delta applied and the result compressed at level,
+//                  which reproduces the new payload of payloadSize bytes
+//   PATCH_END
+constexpr uint32_t PATCH_SIGNATURE = 0x48435450; // "PTCH"
+constexpr uint32_t PATCH_VERSION = 1;
+constexpr size_t PATCH_HEADER_SIZE = 56;          // Little-endian fields, as declared
+
+constexpr uint8_t PATCH_END = 0;
+constexpr uint8_t PATCH_COPY = 1;
+constexpr uint8_t PATCH_LITERAL = 2;
+constexpr uint8_t PATCH_PACKED = 3;
+constexpr uint8_t PATCH_DELTA = 4;
+
+struct PatchHeader {
+    uint32_t signature;      // PATCH_SIGNATURE
+    uint32_t version;        // PATCH_VERSION
+    uint64_t oldSize;        // Size of the archive the patch applies to
+    uint64_t newSize;        // Size of the archive it produces
+    uint8_t newSha256[32];   // SHA-256 of the archive it produces
+};
+
+namespace ArchiveFormat {
+
+inline void encodePatchHeader(const PatchHeader& header, uint8_t* out) {
+    storeLE(out, header.signature, 4);
+    storeLE(out + 4, header.version, 4);
+    storeLE(out + 8, header.oldSize, 8);
+    storeLE(out + 16, header.newSize, 8);
+    std::memcpy(out + 24, header.newSha256, sizeof(header.newSha256));
+}
+
+inline PatchHeader decodePatchHeader(const uint8_t* in) {
+    PatchHeader header{};
+    header.signature = static_cast<uint32_t>(loadLE(in, 4));
+    header.version = static_cast<uint32_t>(loadLE(in + 4, 4));
+    header.oldSize = loadLE(in + 8, 8);
+    header.newSize = loadLE(in + 16, 8);
+    std::memcpy(header.newSha256, in + 24, sizeof(header.newSha256));
+    return header;
+}
+
+} // namespace ArchiveFormat
+
+// A self-extracting executable is the extractor stub followed by an
+// archive, the command to run after extraction and a fixed-size footer
+// that locates both, so the stub never has to search its own image:
+//
+//   stub | archive | SfxCommandConfig | launch list | footer (SFX_FOOTER_SIZE bytes)
+//
+// The launch list names the entries a run-in-place executable extracts
+// before it starts the command: a varint count, then a varint length and
+// the bytes of each archive path. configSize covers the configuration and
+// the list; executables without a list end right after the configuration.
+//
+// The footer is little-endian: uint64 archiveOffset, uint64 archiveSize,
+// uint32 configSize, uint32 reserved, uint64 SFX_MAGIC.
+constexpr uint64_t SFX_MAGIC = 0x315846534E415649ull; // "IVANSFX1"
+constexpr size_t SFX_FOOTER_SIZE = 32;
+
+// Only byte-sized members, so the layout is the same on every compiler
+struct SfxCommandConfig {
+    char command[512];       // Command to execute, empty for none
+    char arguments[512];     // Command arguments
+    uint8_t silent;          // Run without a window / output
+    uint8_t waitForCompletion;
+    char workingDir[256];    // Working directory (empty = extraction directory)
+    uint8_t runInPlace;      // Start the command once the launch list is extracted
+};
+
+static_assert(sizeof(SfxCommandConfig) == 1283, "SfxCommandConfig must not contain padding");
+
+struct SfxFooter {
+    uint64_t archiveOffset = 0;
+    uint64_t archiveSize = 0;
+    uint32_t configSize = 0;
+};
+
+namespace ArchiveFormat {
+
+inline void encodeSfxFooter(const SfxFooter& footer, uint8_t* out) {
+    storeLE(out, footer.archiveOffset, 8);
+    storeLE(out + 8, footer.archiveSize, 8);
+    storeLE(out + 16, footer.configSize, 4);
+    storeLE(out + 20, 0, 4);
+    storeLE(out + 24, SFX_MAGIC, 8);
+}
+
+// Decodes the footer found in the last SFX_FOOTER_SIZE bytes of a file of
+// fileSize bytes, checking that everything it points at lies inside the file
+inline bool decodeSfxFooter(const uint8_t* in, uint64_t fileSize, SfxFooter& footer) {
+    if (fileSize < SFX_FOOTER_SIZE || loadLE(in + 24, 8) != SFX_MAGIC) {
+        return false;
+    }
+    footer.archiveOffset = loadLE(in, 8);
+    footer.archiveSize = loadLE(in + 8, 8);
+    footer.configSize = static_cast<uint32_t>(loadLE(in + 16, 4));
+    const uint64_t payloadEnd = fileSize - SFX_FOOTER_SIZE;
+    return footer.configSize <= payloadEnd && footer.archiveSize <= payloadEnd - footer.configSize &&
+           footer.archiveOffset == payloadEnd - footer.configSize - footer.archiveSize;
+}
+
+inline void encodeLaunchList(const std::vector<std::string>& names, std::vector<uint8_t>& out) {
+    uint8_t varint[MAX_VARINT_SIZE];
+    out.insert(out.end(), varint, varint + putVarint(varint, names.size()));
+    for (const auto& name : names) {
+        out.insert(out.end(), varint, varint + putVarint(varint, name.size()));
+        out.insert(out.end(), name.begin(), name.end());
+    }
+}
+
+// Decodes the launch list that follows SfxCommandConfig; an empty range is
+// an empty list
+inline bool decodeLaunchList(const uint8_t* data, size_t size, std::vector<std::string>& names) {
+    names.clear();
+    if (size == 0) {
+        return true;
+    }
+    size_t position = 0;
+    auto read = [&](void* out, size_t count) {
+        if (count > size - position) {
+            return false;
+        }
+        std::memcpy(out, data + position, count);
+        position += count;
+        return true;
+    };
+    uint64_t count = 0;
+    uint64_t consumed = 0;
+    if (!getVarint(read, count, consumed) || count > size) {
+        return false;
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t length = 0;
+        if (!getVarint(read, length, consumed) || length > size - position) {
+            return false;
+        }
+        names.emplace_back(reinterpret_cast<const char*>(data + position), static_cast<size_t>(length));
+        position += static_cast<size_t>(length);
+    }
+    return true;
+}
+
+} // namespace ArchiveFormat
@@ -0,0 +1,693 @@
+// Patches between two versions of an archive, see PatchHeader
+
+#include "Archive.h"
+#include "ArchiveFormat.h"
+#include "ArchiveProgress.h"
+#include "ArchiveStats.h"
+#include "BinaryDelta.h"
+#include "FileIO.h"
+#include "Sha256.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t COPY_CHUNK = 1 << 20;
+
+// Entries are decoded whole on both sides of a delta
+constexpr uint64_t DELTA_SIZE_LIMIT = 256ull << 20;
+
+// Header bytes fetched at once when parsing a record
+constexpr size_t RECORD_READ_AHEAD = 4096;
+
+// One entry record of an archive file as laid out on disk
+struct Record {
+    std::string name;
+    EntryHeader header;       ///< Final sizes and checksums, descriptor included
+    std::vector<SparseExtent> extents;
+    uint64_t offset = 0;        ///< Entry header
+    uint64_t payloadOffset = 0;
+    uint64_t payloadEnd = 0;
+    uint64_t end = 0;           ///< Next record, or the index
+};
+
+// An archive file opened for random access, with its records parsed
+class ArchiveImage {
+public:
+    explicit ArchiveImage(const std::string& path) : path(path), file(path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Failed to open archive: " + path);
+        }
+        dataEnd = Archive::readCatalog(in, entries);
+        fileSize = file.size();
+
+        std::vector<size_t> order(entries.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(),
+                  [this](size_t a, size_t b) { return entries.offset(a) < entries.offset(b); });
+        records.resize(entries.size());
+        for (size_t k = 0; k < order.size(); ++k) {
+            const uint64_t end = k + 1 < order.size() ? entries.offset(order[k + 1]) : dataEnd;
+            records[order[k]] = parse(order[k], end);
+            byOffset.push_back(order[k]);
+        }
+        dataStart = order.empty() ? dataEnd : entries.offset(order.front());
+    }
+
+    const EntryTable& table() const { return entries; }
+    const Record& record(size_t index) const { return records[index]; }
+
+    // Record indexes in file order
+    const std::vector<size_t>& fileOrder() const { return byOffset; }
+
+    const Record* recordAt(uint64_t offset) const {
+        auto it = std::lower_bound(byOffset.begin(), byOffset.end(), offset,
+                                   [this](size_t index, uint64_t value) { return entries.offset(index) < value; });
+        return it != byOffset.end() && entries.offset(*it) == offset ? &records[*it] : nullptr;
+    }
+
+    uint64_t size() const { return fileSize; }
+    uint64_t start() const { return dataStart; } ///< First record, after the archive header
+    uint64_t end() const { return dataEnd; }     ///< Where the index starts
+
+    void read(uint64_t offset, char* data, size_t size) const {
+        if (offset > fileSize || size > fileSize - offset) {
+            throw std::runtime_error("Unexpected end of archive: " + path);
+        }
+        file.readAt(offset, data, size);
+    }
+
+    std::vector<char> read(uint64_t offset, uint64_t size) const {
+        std::vector<char> data(static_cast<size_t>(size));
+        read(offset, data.data(), data.size());
+        return data;
+    }
+
+    // Decodes a plain entry's data from its payload and checks its CRC-32
+    static std::vector<char> decode(const Record& record, const std::vector<char>& payload) {
+        std::vector<char> data;
+        data.reserve(static_cast<size_t>(record.header.originalSize));
+        size_t position = 0;
+        Archive::decodeEntry(
+            record.header, record.extents,
+            [&](char* buffer, size_t size) {
+                if (size > payload.size() - position) {
+                    throw std::runtime_error("Unexpected end of payload in: " + record.name);
+                }
+                std::memcpy(buffer, payload.data() + position, size);
+                position += size;
+            },
+            [&](const char* buffer, size_t size) { data.insert(data.end(), buffer, buffer + size); }, record.name);
+        if (record.header.hasCrc32()) {
+            uLong crc = ::crc32(0L, Z_NULL, 0);
+            for (size_t done = 0; done < data.size();) {
+                const uInt chunk = static_cast<uInt>(std::min<size_t>(data.size() - done, 1 << 20));
+                crc = ::crc32(crc, reinterpret_cast<const Bytef*>(data.data() + done), chunk);
+                done += chunk;
+            }
+            if (static_cast<uint32_t>(crc) != record.header.crc32) {
+                throw std::runtime_error("Checksum mismatch for: " + record.name);
+            }
+        }
+        return data;
+    }
+
+    std::vector<char> decode(const Record& record) const {
+        return decode(record, read(record.payloadOffset, record.payloadEnd - record.payloadOffset));
+    }
+
+private:
+    Record parse(size_t index, uint64_t end) const {
+        Record record;
+        record.name = std::string(entries[index].name);
+        record.offset = entries.offset(index);
+        record.end = end;
+
+        // Headers are parsed a byte at a time, so they are served from a
+        // block read ahead
+        std::vector<char> block;
+        uint64_t blockStart = 0;
+        uint64_t position = record.offset;
+        auto reader = [&](void* data, size_t size) {
+            if (position > fileSize || size > fileSize - position) {
+                return false;
+            }
+            if (position < blockStart || position + size > blockStart + block.size()) {
+                blockStart = position;
+                block.resize(static_cast<size_t>(std::min<uint64_t>(std::max(size, RECORD_READ_AHEAD),
+                                                                   fileSize - position)));
+                file.readAt(blockStart, block.data(), block.size());
+            }
+            std::memcpy(data, block.data() + (position - blockStart), size);
+            position += size;
+            return true;
+        };
+
+        EntryHeader& header = record.header;
+        uint64_t headerSize = 0;
+        if (!ArchiveFormat::readEntryHeader(reader, header, headerSize) || header.nameLength > fileSize - position) {
+            throw std::runtime_error("Corrupt entry: " + record.name);
+        }
+        position += header.nameLength;
+        if (header.isSparse() && !ArchiveFormat::readSparseMap(reader, header, record.extents, headerSize)) {
+            throw std::runtime_error("Corrupt entry: " + record.name);
+        }
+        record.payloadOffset = position;
+        if (header.hasDescriptor()) {
+            // The index has the sizes a descriptor entry's header lacks
+            const ArchiveEntry entry = entries[index];
+            uint64_t descriptorSize = 0;
+            position = record.payloadOffset + entry.compressedSize;
+            if (!ArchiveFormat::readEntryDescriptor(reader, header, descriptorSize) ||
+                header.compressedSize != entry.compressedSize || header.originalSize != entry.originalSize) {
+                throw std::runtime_error("Corrupt entry descriptor for: " + record.name);
+            }
+        }
+        record.payloadEnd = record.payloadOffset + header.compressedSize;
+        if (record.payloadEnd < record.payloadOffset || record.payloadEnd > end) {
+            throw std::runtime_error("Corrupt entry: " + record.name);
+        }
+        return record;
+    }
+
+    std::string path;
+    FileIO::InputFile file;
+    EntryTable entries;
+    std::vector<Record> records;   ///< By table index
+    std::vector<size_t> byOffset;
+    uint64_t fileSize = 0;
+    uint64_t dataStart = 0;
+    uint64_t dataEnd = 0;
+};
+
+bool sameBytes(const ArchiveImage& a, uint64_t aOffset, const ArchiveImage& b, uint64_t bOffset, uint64_t size) {
+    std::vector<char> left(static_cast<size_t>(std::min<uint64_t>(size, COPY_CHUNK)));
+    std::vector<char> right(left.size());
+    for (uint64_t done = 0; done < size;) {
+        const size_t piece = static_cast<size_t>(std::min<uint64_t>(left.size(), size - done));
+        a.read(aOffset + done, left.data(), piece);
+        b.read(bOffset + done, right.data(), piece);
+        if (std::memcmp(left.data(), right.data(), piece) != 0) {
+            return false;
+        }
+        done += piece;
+    }
+    return true;
+}
+
+// zlib levels that may have produced a stream, most likely first, from
+// the FLEVEL bits of its header
+std::vector<int> candidateLevels(const std::vector<char>& payload) {
+    switch (static_cast<uint8_t>(payload[1]) >> 6) {
+    case 0: return {1};
+    case 1: return {3, 2, 4, 5};
+    case 2: return {6};
+    default: return {9, 7, 8};
+    }
+}
+
+void putVarint(std::ostream& out, uint64_t value) {
+    uint8_t buffer[MAX_VARINT_SIZE];
+    out.write(reinterpret_cast<const char*>(buffer),
+              static_cast<std::streamsize>(ArchiveFormat::putVarint(buffer, value)));
+}
+
+// Writes patch operations, merging adjacent copies and batching the
+// small literal regions between them
+class PatchWriter {
+public:
+    PatchWriter(std::ostream& out, const ArchiveImage& target) : out(out), target(target) {}
+
+    void copy(uint64_t offset, uint64_t length) {
+        if (length == 0) {
+            return;
+        }
+        flushPending();
+        if (copyLength > 0 && copyOffset + copyLength == offset) {
+            copyLength += length;
+            return;
+        }
+        flushCopy();
+        copyOffset = offset;
+        copyLength = length;
+    }
+
+    // Headers, descriptors and the index: small and compressible
+    void metadata(uint64_t offset, uint64_t length) {
+        if (length == 0) {
+            return;
+        }
+        flushCopy();
+        const size_t start = pending.size();
+        pending.resize(start + static_cast<size_t>(length));
+        target.read(offset, pending.data() + start, static_cast<size_t>(length));
+        if (pending.size() >= COPY_CHUNK) {
+            flushPending();
+        }
+    }
+
+    // A payload, already compressed, copied from the new archive
+    void literal(uint64_t offset, uint64_t length) {
+        flush();
+        out.put(static_cast<char>(PATCH_LITERAL));
+        putVarint(out, length);
+        std::vector<char> chunk(static_cast<size_t>(std::min<uint64_t>(length, COPY_CHUNK)));
+        for (uint64_t done = 0; done < length;) {
+            const size_t piece = static_cast<size_t>(std::min<uint64_t>(chunk.size(), length - done));
+            target.read(offset + done, chunk.data(), piece);
+            out.write(chunk.data(), static_cast<std::streamsize>(piece));
+            done += piece;
+        }
+    }
+
+    void delta(uint64_t oldOffset, int level, uint64_t payloadSize, const std::vector<char>& delta) {
+        flush();
+        out.put(static_cast<char>(PATCH_DELTA));
+        putVarint(out, oldOffset);
+        out.put(static_cast<char>(level));
+        putVarint(out, payloadSize);
+        putVarint(out, delta.size());
+        out.write(delta.data(), static_cast<std::streamsize>(delta.size()));
+    }
+
+    void finish() {
+        flush();
+        out.put(static_cast<char>(PATCH_END));
+    }
+
+private:
+    void flush() {
+        flushCopy();
+        flushPending();
+    }
+
+    void flushCopy() {
+        if (copyLength > 0) {
+            out.put(static_cast<char>(PATCH_COPY));
+            putVarint(out, copyOffset);
+            putVarint(out, copyLength);
+            copyLength = 0;
+        }
+    }
+
+    void flushPending() {
+        if (pending.empty()) {
+            return;
+        }
+        const std::vector<char> packed = Archive::compressData(pending, CompressionType::Best);
+        if (packed.size() + MAX_VARINT_SIZE < pending.size()) {
+            out.put(static_cast<char>(PATCH_PACKED));
+            putVarint(out, pending.size());
+            putVarint(out, packed.size());
+            out.write(packed.data(), static_cast<std::streamsize>(packed.size()));
+        } else {
+            out.put(static_cast<char>(PATCH_LITERAL));
+            putVarint(out, pending.size());
+            out.write(pending.data(), static_cast<std::streamsize>(pending.size()));
+        }
+        pending.clear();
+    }
+
+    std::ostream& out;
+    const ArchiveImage& target;
+    uint64_t copyOffset = 0;
+    uint64_t copyLength = 0;
+    std::vector<char> pending;
+};
+
+// Sends a region of the new archive as a copy if the old archive has the
+// same bytes at oldOffset
+void sendRegion(PatchWriter& writer, const ArchiveImage& target, uint64_t offset, uint64_t length,
+                const ArchiveImage& base, std::optional<uint64_t> oldOffset, uint64_t oldLength) {
+    if (oldOffset && oldLength == length && sameBytes(target, offset, base, *oldOffset, length)) {
+        writer.copy(*oldOffset, length);
+    } else {
+        writer.metadata(offset, length);
+    }
+}
+
+} // namespace
+
+PatchSummary Archive::writePatch(const std::string& oldArchive, const std::string& patchPath) {
+    if (!volumePaths.empty() || !Archive(oldArchive).getVolumes().empty()) {
+        throw std::runtime_error("Cannot patch a multi-volume archive");
+    }
+    const ArchiveImage base(oldArchive);
+    const ArchiveImage target(archiveName);
+
+    // Payloads of the old archive by checksum and size, so entries that
+    // were renamed or duplicated are still copied
+    std::multimap<std::pair<uint32_t, uint64_t>, size_t> payloads;
+    for (size_t i = 0; i < base.table().size(); ++i) {
+        const Record& record = base.record(i);
+        if (record.header.hasCrc32()) {
+            payloads.emplace(std::make_pair(record.header.crc32, record.header.compressedSize), i);
+        }
+    }
+    auto findPayload = [&](const Record& record, const Record* previous) -> const Record* {
+        const uint64_t size = record.payloadEnd - record.payloadOffset;
+        if (previous && previous->payloadEnd - previous->payloadOffset == size &&
+            sameBytes(target, record.payloadOffset, base, previous->payloadOffset, size)) {
+            return previous;
+        }
+        if (!record.header.hasCrc32()) {
+            return nullptr;
+        }
+        auto range = payloads.equal_range({record.header.crc32, size});
+        for (auto it = range.first; it != range.second; ++it) {
+            const Record& candidate = base.record(it->second);
+            if (sameBytes(target, record.payloadOffset, base, candidate.payloadOffset, size)) {
+                return &candidate;
+            }
+        }
+        return nullptr;
+    };
+
+    // A delta is only worth sending if recompressing the patched data gives
+    // back the payload exactly, which holds for one-shot zlib payloads
+    // written by the same zlib at a fixed level
+    auto findDelta = [&](const Record& record, const Record* previous,
+                         int& level) -> std::optional<std::vector<char>> {
+        const EntryHeader& header = record.header;
+        if (!previous || header.codec != CODEC_ZLIB || header.isSparse() || header.isEncrypted() ||
+            header.originalSize < PATCH_DELTA_THRESHOLD || header.originalSize > DELTA_SIZE_LIMIT ||
+            previous->header.isSparse() || previous->header.isEncrypted() ||
+            previous->header.originalSize > DELTA_SIZE_LIMIT) {
+            return std::nullopt;
+        }
+        const std::vector<char> payload = target.read(record.payloadOffset, record.payloadEnd - record.payloadOffset);
+        if (payload.size() < 2) {
+            return std::nullopt;
+        }
+        const std::vector<char> data = ArchiveImage::decode(record, payload);
+        bool reproducible = false;
+        for (int candidate : candidateLevels(payload)) {
+            ArchiveStats::ScopedTimer timer(stats, StatStage::Compress, data.size());
+            if (compressData(data, static_cast<CompressionType>(candidate)) == payload) {
+                level = candidate;
+                reproducible = true;
+                break;
+            }
+        }
+        if (!reproducible) {
+            return std::nullopt;
+        }
+        std::vector<char> delta = BinaryDelta::encode(base.decode(*previous), data);
+        if (delta.size() + 3 * MAX_VARINT_SIZE >= payload.size()) {
+            return std::nullopt;
+        }
+        return delta;
+    };
+
+    PatchSummary summary;
+    summary.archiveBytes = target.size();
+    if (progress) {
+        progress->setTotals(target.size(), target.table().size());
+        progress->beginStage("Comparing");
+    }
+
+    PatchHeader header{};
+    header.signature = PATCH_SIGNATURE;
+    header.version = PATCH_VERSION;
+    header.oldSize = base.size();
+    header.newSize = target.size();
+    {
+        Sha256 hash;
+        std::vector<char> chunk(COPY_CHUNK);
+        for (uint64_t done = 0; done < target.size();) {
+            const size_t piece = static_cast<size_t>(std::min<uint64_t>(chunk.size(), target.size() - done));
+            ArchiveStats::ScopedTimer timer(stats, StatStage::Read, piece);
+            target.read(done, chunk.data(), piece);
+            hash.update(chunk.data(), piece);
+            done += piece;
+        }
+        const Sha256::Digest digest = hash.finish();
+        std::copy(digest.begin(), digest.end(), header.newSha256);
+    }
+
+    const std::string working = patchPath + ".tmp";
+    std::ofstream out(working, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Failed to create patch: " + patchPath);
+    }
+
+    try {
+        uint8_t encoded[PATCH_HEADER_SIZE];
+        ArchiveFormat::encodePatchHeader(header, encoded);
+        out.write(reinterpret_cast<const char*>(encoded), sizeof(encoded));
+        PatchWriter writer(out, target);
+        sendRegion(writer, target, 0, target.start(), base, 0, base.start());
+        for (size_t index : target.fileOrder()) {
+            checkpoint();
+            const Record& record = target.record(index);
+            const size_t oldIndex = base.table().find(record.name);
+            const Record* previous = oldIndex != EntryTable::npos ? &base.record(oldIndex) : nullptr;
+
+            std::optional<uint64_t> oldHead;
+            std::optional<uint64_t> oldTail;
+            if (previous) {
+                oldHead = previous->offset;
+                oldTail = previous->payloadEnd;
+            }
+            sendRegion(writer, target, record.offset, record.payloadOffset - record.offset, base, oldHead,
+                       previous ? previous->payloadOffset - previous->offset : 0);
+
+            const uint64_t payloadSize = record.payloadEnd - record.payloadOffset;
+            int level = 0;
+            if (const Record* same = findPayload(record, previous)) {
+                writer.copy(same->payloadOffset, payloadSize);
+                ++summary.copiedEntries;
+            } else if (auto delta = findDelta(record, previous, level)) {
+                writer.delta(previous->offset, level, payloadSize, *delta);
+                ++summary.deltaEntries;
+            } else {
+                writer.literal(record.payloadOffset, payloadSize);
+                ++summary.literalEntries;
+            }
+
+            sendRegion(writer, target, record.payloadEnd, record.end - record.payloadEnd, base, oldTail,
+                       previous ? previous->end - previous->payloadEnd : 0);
+            if (progress) {
+                progress->addBytes(record.end - record.offset);
+                progress->addFile();
+            }
+        }
+        sendRegion(writer, target, target.end(), target.size() - target.end(), base, base.end(),
+                   base.size() - base.end());
+        writer.finish();
+
+        {
+            ArchiveStats::ScopedTimer timer(stats, StatStage::Write);
+            if (!out.flush()) {
+                throw std::runtime_error("Failed to write patch: " + patchPath);
+            }
+            summary.patchBytes = static_cast<uint64_t>(out.tellp());
+            if (syncPolicy.enabled) {
+                FileIO::syncFile(working);
+            }
+        }
+        out.close();
+        FileIO::replaceFile(working, patchPath);
+    } catch (...) {
+        out.close();
+        std::error_code ec;
+        fs::remove(working, ec);
+        throw;
+    }
+    return summary;
+}
+
+void Archive::applyPatch(const std::string& oldArchive, const std::string& patchPath) {
+    if (!volumePaths.empty()) {
+        throw std::runtime_error("Cannot patch a multi-volume archive: " + archiveName);
+    }
+    std::ifstream patch(patchPath, std::ios::binary);
+    if (!patch) {
+        throw std::runtime_error("Failed to open patch: " + patchPath);
+    }
+    uint8_t encoded[PATCH_HEADER_SIZE] = {};
+    const bool read = static_cast<bool>(patch.read(reinterpret_cast<char*>(encoded), sizeof(encoded)));
+    const PatchHeader header = ArchiveFormat::decodePatchHeader(encoded);
+    if (!read || header.signature != PATCH_SIGNATURE) {
+        throw std::runtime_error("Not a patch: " + patchPath);
+    }
+    if (header.version != PATCH_VERSION) {
+        throw std::runtime_error("Unsupported patch version " + std::to_string(header.version) + ": " + patchPath);
+    }
+    const ArchiveImage base(oldArchive);
+    if (base.size() != header.oldSize) {
+        throw std::runtime_error("Patch does not apply to: " + oldArchive);
+    }
+    // Sizes read from the patch are checked against what is left of it
+    // before they are allocated
+    const std::streamoff dataStart = patch.tellg();
+    patch.seekg(0, std::ios::end);
+    const uint64_t patchEnd = static_cast<uint64_t>(patch.tellg());
+    patch.seekg(dataStart);
+    auto patchLeft = [&]() { return patchEnd - static_cast<uint64_t>(patch.tellg()); };
+
+    auto reader = [&patch](void* data, size_t size) {
+        return static_cast<bool>(patch.read(static_cast<char*>(data), static_cast<std::streamsize>(size)));
+    };
+    auto readVarint = [&]() {
+        uint64_t value = 0;
+        uint64_t consumed = 0;
+        if (!ArchiveFormat::getVarint(reader, value, consumed)) {
+            throw std::runtime_error("Corrupt patch: " + patchPath);
+        }
+        return value;
+    };
+    auto readBytes = [&](char* data, uint64_t size) {
+        if (!reader(data, static_cast<size_t>(size))) {
+            throw std::runtime_error("Corrupt patch: " + patchPath);
+        }
+    };
+
+    if (progress) {
+        progress->setTotals(header.newSize, 0);
+        progress->beginStage("Patching");
+    }
+
+    const std::string working = workingPath();
+    std::ofstream out(working, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Failed to create archive: " + archiveName);
+    }
+
+    try {
+        Sha256 hash;
+        uint64_t written = 0;
+        auto emit = [&](const char* data, size_t size) {
+            if (size > header.newSize - written) {
+                throw std::runtime_error("Corrupt patch: " + patchPath);
+            }
+            {
+                ArchiveStats::ScopedTimer timer(stats, StatStage::Write, size);
+                out.write(data, static_cast<std::streamsize>(size));
+            }
+            hash.update(data, size);
+            written += size;
+            if (progress) {
+                progress->addBytes(size);
+            }
+        };
+
+        std::vector<char> chunk(COPY_CHUNK);
+        for (;;) {
+            checkpoint();
+            const int operation = patch.get();
+            if (operation == std::char_traits<char>::eof()) {
+                throw std::runtime_error("Corrupt patch: " + patchPath);
+            }
+            if (operation == PATCH_END) {
+                break;
+            }
+            if (operation == PATCH_COPY) {
+                const uint64_t offset = readVarint();
+                const uint64_t length = readVarint();
+                if (offset > base.size() || length > base.size() - offset) {
+                    throw std::runtime_error("Corrupt patch: " + patchPath);
+                }
+                for (uint64_t done = 0; done < length;) {
+                    const size_t piece = static_cast<size_t>(std::min<uint64_t>(chunk.size(), length - done));
+                    {
+                        ArchiveStats::ScopedTimer timer(stats, StatStage::Read, piece);
+                        base.read(offset + done, chunk.data(), piece);
+                    }
+                    emit(chunk.data(), piece);
+                    done += piece;
+                }
+            } else if (operation == PATCH_LITERAL) {
+                const uint64_t length = readVarint();
+                for (uint64_t done = 0; done < length;) {
+                    const size_t piece = static_cast<size_t>(std::min<uint64_t>(chunk.size(), length - done));
+                    readBytes(chunk.data(), piece);
+                    emit(chunk.data(), piece);
+                    done += piece;
+                }
+            } else if (operation == PATCH_PACKED) {
+                const uint64_t length = readVarint();
+                const uint64_t packedSize = readVarint();
+                if (length > header.newSize - written || packedSize > length + (length >> 3) + 64 ||
+                    packedSize > patchLeft()) {
+                    throw std::runtime_error("Corrupt patch: " + patchPath);
+                }
+                std::vector<char> packed(static_cast<size_t>(packedSize));
+                readBytes(packed.data(), packed.size());
+                std::vector<char> data(static_cast<size_t>(length));
+                uLongf unpackedSize = static_cast<uLongf>(data.size());
+                if (uncompress(reinterpret_cast<Bytef*>(data.data()), &unpackedSize,
+                               reinterpret_cast<const Bytef*>(packed.data()), static_cast<uLong>(packed.size())) != Z_OK ||
+                    unpackedSize != data.size()) {
+                    throw std::runtime_error("Corrupt patch: " + patchPath);
+                }
+                emit(data.data(), data.size());
+            } else if (operation == PATCH_DELTA) {
+                const uint64_t oldOffset = readVarint();
+                const int level = patch.get();
+                const uint64_t payloadSize = readVarint();
+                const uint64_t deltaSize = readVarint();
+                const Record* previous = base.recordAt(oldOffset);
+                if (!previous || level < 1 || level > 9 || payloadSize > header.newSize - written ||
+                    deltaSize > payloadSize || deltaSize > patchLeft()) {
+                    throw std::runtime_error("Corrupt patch: " + patchPath);
+                }
+                std::vector<char> delta(static_cast<size_t>(deltaSize));
+                readBytes(delta.data(), delta.size());
+                std::vector<char> data;
+                {
+                    ArchiveStats::ScopedTimer timer(stats, StatStage::Inflate, previous->header.originalSize);
+                    // The entry recompresses to payloadSize bytes, which bounds its size
+                    const uint64_t maxSize = payloadSize > UINT64_MAX / BinaryDelta::MAX_ZLIB_RATIO
+                                                 ? UINT64_MAX
+                                                 : payloadSize * BinaryDelta::MAX_ZLIB_RATIO;
+                    data = BinaryDelta::apply(base.decode(*previous), delta.data(), delta.size(), maxSize);
+                }
+                std::vector<char> payload;
+                {
+                    ArchiveStats::ScopedTimer timer(stats, StatStage::Compress, data.size());
+                    payload = compressData(data, static_cast<CompressionType>(level));
+                }
+                if (payload.size() != payloadSize) {
+                    throw std::runtime_error("Patched entry does not match: " + previous->name);
+                }
+                emit(payload.data(), payload.size());
+            } else {
+                throw std::runtime_error("Corrupt patch: " + patchPath);
+            }
+        }
+
+        const Sha256::Digest digest = hash.finish();
+        if (written != header.newSize || !std::equal(digest.begin(), digest.end(), header.newSha256)) {
+            throw std::runtime_error("Patched archive does not match the patch: " + archiveName);
+        }
+        {
+            ArchiveStats::ScopedTimer timer(stats, StatStage::Write);
+            if (!out.flush()) {
+                throw std::runtime_error("Failed to write archive: " + working);
+            }
+            if (syncPolicy.enabled) {
+                FileIO::syncFile(working);
+            }
+        }
+        out.close();
+        FileIO::replaceFile(working, archiveName);
+        discardUndoRecord();
+    } catch (...) {
+        out.close();
+        std::error_code ec;
+        fs::remove(working, ec);
+        throw;
+    }
+    loadCatalog(archiveName);
+}
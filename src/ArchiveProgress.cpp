@@ -1,13 +1,53 @@
 // filepath: e:\proj\archiver\src\ArchiveProgress.cpp
 
 #include "ArchiveProgress.h"
+#include <algorithm>
+#include <cstdio>
+
+std::string ArchiveProgress::formatBytes(double bytes) {
+    static const char* units[] = {"B", "KB", "MB", "GB", "TB"};
+    int unit = 0;
+    while (bytes >= 1024.0 && unit < 4) {
+        bytes /= 1024.0;
+        ++unit;
+    }
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.1f %s", bytes, units[unit]);
+    return buffer;
+}
+
+std::string ArchiveProgress::formatDuration(double seconds) {
+    long total = static_cast<long>(seconds + 0.5);
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%02ld:%02ld:%02ld", total / 3600, (total / 60) % 60, total % 60);
+    return buffer;
+}
 
 ArchiveProgress::ArchiveProgress() : currentProgress(0) {
 }
 
+ArchiveProgress::~ArchiveProgress() {
+    stopRenderer();
+}
+
 void ArchiveProgress::startTracking(const std::string& operation) {
+    stopRenderer();
     currentOperation = operation;
     currentProgress = 0;
+    finished = false;
+    bytesDone = 0;
+    filesDone = 0;
+    totalBytes = 0;
+    totalFiles = 0;
+    startTime = Clock::now().time_since_epoch().count();
+    {
+        std::lock_guard<std::mutex> lock(stageMutex);
+        currentStage.clear();
+        stageTimings.clear();
+    }
+    if (consoleOutput) {
+        startRenderer();
+    }
 }
 
 void ArchiveProgress::updateProgress(int percentage) {
@@ -17,15 +57,160 @@ void ArchiveProgress::updateProgress(int percentage) {
 }
 
 void ArchiveProgress::finishTracking() {
+    closeStage(Clock::now());
     currentProgress = 100;
+    finished = true;
+    stopRenderer();
+    if (consoleOutput && !currentOperation.empty()) {
+        render(true);
+    }
     currentOperation.clear();
 }
 
 int ArchiveProgress::getProgress() const {
+    if (finished) {
+        return 100;
+    }
+    uint64_t total = totalBytes.load(std::memory_order_relaxed);
+    if (total > 0) {
+        return static_cast<int>(std::min<uint64_t>(100, getBytesDone() * 100 / total));
+    }
+    uint64_t files = totalFiles.load(std::memory_order_relaxed);
+    if (files > 0) {
+        return static_cast<int>(std::min<uint64_t>(100, getFilesDone() * 100 / files));
+    }
     return currentProgress;
 }
 
 void ArchiveProgress::reset() {
+    stopRenderer();
     currentProgress = 0;
+    finished = false;
+    bytesDone = 0;
+    filesDone = 0;
+    totalBytes = 0;
+    totalFiles = 0;
     currentOperation.clear();
-}
\ No newline at end of file
+    std::lock_guard<std::mutex> lock(stageMutex);
+    currentStage.clear();
+    stageTimings.clear();
+}
+
+void ArchiveProgress::setTotals(uint64_t bytes, uint64_t files) {
+    totalBytes = bytes;
+    totalFiles = files;
+}
+
+void ArchiveProgress::beginStage(const std::string& stage) {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(stageMutex);
+    if (!currentStage.empty()) {
+        stageTimings.emplace_back(currentStage, std::chrono::duration<double>(now - stageStart).count());
+    }
+    currentStage = stage;
+    stageStart = now;
+}
+
+void ArchiveProgress::closeStage(Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(stageMutex);
+    if (!currentStage.empty()) {
+        stageTimings.emplace_back(currentStage, std::chrono::duration<double>(now - stageStart).count());
+        currentStage.clear();
+    }
+}
+
+double ArchiveProgress::getElapsedSeconds() const {
+    Clock::time_point start{Clock::duration(startTime.load(std::memory_order_relaxed))};
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+double ArchiveProgress::getBytesPerSecond() const {
+    double elapsed = getElapsedSeconds();
+    return elapsed > 0 ? static_cast<double>(getBytesDone()) / elapsed : 0.0;
+}
+
+double ArchiveProgress::getEtaSeconds() const {
+    uint64_t total = totalBytes.load(std::memory_order_relaxed);
+    uint64_t done = getBytesDone();
+    double rate = getBytesPerSecond();
+    if (total == 0 || rate <= 0) {
+        return -1.0;
+    }
+    return done >= total ? 0.0 : static_cast<double>(total - done) / rate;
+}
+
+std::vector<std::pair<std::string, double>> ArchiveProgress::getStageTimings() const {
+    std::lock_guard<std::mutex> lock(stageMutex);
+    auto timings = stageTimings;
+    if (!currentStage.empty()) {
+        timings.emplace_back(currentStage,
+                             std::chrono::duration<double>(Clock::now() - stageStart).count());
+    }
+    return timings;
+}
+
+void ArchiveProgress::setConsoleOutput(bool enabled, int intervalMs) {
+    stopRenderer();
+    consoleOutput = enabled;
+    renderIntervalMs = std::max(10, intervalMs);
+    if (consoleOutput && !currentOperation.empty() && !finished) {
+        startRenderer();
+    }
+}
+
+void ArchiveProgress::startRenderer() {
+    stopRendering = false;
+    renderThread = std::thread([this] {
+        std::unique_lock<std::mutex> lock(renderMutex);
+        while (!renderWake.wait_for(lock, std::chrono::milliseconds(renderIntervalMs),
+                                    [this] { return stopRendering; })) {
+            render(false);
+        }
+    });
+}
+
+void ArchiveProgress::stopRenderer() {
+    if (!renderThread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(renderMutex);
+        stopRendering = true;
+    }
+    renderWake.notify_all();
+    renderThread.join();
+}
+
+void ArchiveProgress::render(bool final) const {
+    std::string stage;
+    {
+        std::lock_guard<std::mutex> lock(stageMutex);
+        stage = currentStage;
+    }
+
+    std::string line = currentOperation;
+    if (!stage.empty()) {
+        line += " [" + stage + "]";
+    }
+    char buffer[160];
+    std::snprintf(buffer, sizeof(buffer), " %3d%%  %s  %s/s  %llu files", getProgress(),
+                  formatBytes(static_cast<double>(getBytesDone())).c_str(),
+                  formatBytes(getBytesPerSecond()).c_str(),
+                  static_cast<unsigned long long>(getFilesDone()));
+    line += buffer;
+    if (final) {
+        line += "  in " + formatDuration(getElapsedSeconds());
+    } else {
+        double eta = getEtaSeconds();
+        line += "  ETA " + (eta < 0 ? std::string("--:--:--") : formatDuration(eta));
+    }
+
+    std::fprintf(stderr, "\r%-100s", line.c_str());
+    if (final) {
+        std::fprintf(stderr, "\n");
+        for (const auto& timing : getStageTimings()) {
+            std::fprintf(stderr, "  %-24s %10.3f s\n", timing.first.c_str(), timing.second);
+        }
+    }
+    std::fflush(stderr);
+}
@@ -1,21 +1,109 @@
 #ifndef ARCHIVE_PROGRESS_H
 #define ARCHIVE_PROGRESS_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+/**
+ * @brief Thread-safe progress sink for long-running archive operations
+ *
+ * Workers report completed bytes and files through addBytes()/addFile(),
+ * which are single relaxed atomic adds and safe to call per file from any
+ * thread. Throughput, ETA and rendering are computed on the reader side:
+ * either by polling the getters or by enabling console output, which
+ * redraws a status line from a background thread at a fixed interval.
+ */
 class ArchiveProgress {
 public:
+    using Clock = std::chrono::steady_clock;
+
     ArchiveProgress();
-    
+    ~ArchiveProgress();
+
+    ArchiveProgress(const ArchiveProgress&) = delete;
+    ArchiveProgress& operator=(const ArchiveProgress&) = delete;
+
     void startTracking(const std::string& operation);
     void updateProgress(int percentage);
     void finishTracking();
     int getProgress() const;
     void reset();
 
+    /**
+     * @brief Sets the amount of work expected for the current operation
+     *
+     * May be called (again) once the totals are known; until then progress
+     * falls back to the value set with updateProgress().
+     */
+    void setTotals(uint64_t totalBytes, uint64_t totalFiles);
+
+    void addBytes(uint64_t bytes) { bytesDone.fetch_add(bytes, std::memory_order_relaxed); }
+    void addFile() { filesDone.fetch_add(1, std::memory_order_relaxed); }
+
+    /**
+     * @brief Starts a named stage; the previous stage's duration is recorded
+     */
+    void beginStage(const std::string& stage);
+
+    uint64_t getBytesDone() const { return bytesDone.load(std::memory_order_relaxed); }
+    uint64_t getFilesDone() const { return filesDone.load(std::memory_order_relaxed); }
+    double getElapsedSeconds() const;
+    double getBytesPerSecond() const;
+
+    /**
+     * @brief Estimated seconds remaining, or a negative value if unknown
+     */
+    double getEtaSeconds() const;
+
+    /**
+     * @brief Durations of the stages completed so far, in order
+     */
+    std::vector<std::pair<std::string, double>> getStageTimings() const;
+
+    /**
+     * @brief Enables the throttled status line on stderr
+     * @param enabled Whether to render
+     * @param intervalMs Minimum time between redraws
+     */
+    void setConsoleOutput(bool enabled, int intervalMs = 250);
+
+    static std::string formatBytes(double bytes);       ///< "12.3 MB"
+    static std::string formatDuration(double seconds);  ///< "hh:mm:ss"
+
 private:
     std::string currentOperation;
-    int currentProgress;
+    std::atomic<int> currentProgress;
+    std::atomic<bool> finished{false};
+
+    std::atomic<uint64_t> bytesDone{0};
+    std::atomic<uint64_t> filesDone{0};
+    std::atomic<uint64_t> totalBytes{0};
+    std::atomic<uint64_t> totalFiles{0};
+    std::atomic<Clock::rep> startTime{0};
+
+    mutable std::mutex stageMutex;
+    std::string currentStage;
+    Clock::time_point stageStart;
+    std::vector<std::pair<std::string, double>> stageTimings;
+
+    bool consoleOutput = false;
+    int renderIntervalMs = 250;
+    std::thread renderThread;
+    std::mutex renderMutex;
+    std::condition_variable renderWake;
+    bool stopRendering = false;
+
+    void closeStage(Clock::time_point now);
+    void startRenderer();
+    void stopRenderer();
+    void render(bool final) const;
 };
 
-#endif // ARCHIVE_PROGRESS_H
\ No newline at end of file
+#endif // ARCHIVE_PROGRESS_H
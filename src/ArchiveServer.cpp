@@ -0,0 +1,621 @@
+#include "ArchiveServer.h"
+#include "Archive.h"
+#include "CancellationToken.h"
+#include "EntryTable.h"
+#include "ExtractEngine.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // SO_NOSIGPIPE is set on the socket instead
+#endif
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
+
+struct ArchiveServer::Request {
+    std::string method;
+    std::string path;           ///< Decoded, without the leading '/' and query
+    std::string range;
+    std::string acceptEncoding;
+    bool keepAlive = true;
+};
+
+namespace {
+
+constexpr size_t MAX_REQUEST_HEADER = 16 * 1024;
+constexpr int POLL_INTERVAL_MS = 200;
+constexpr int SEND_TIMEOUT_SECONDS = 30;
+constexpr size_t SEND_CHUNK = 256 * 1024;
+
+std::string lowercase(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return text;
+}
+
+std::string trim(const std::string& text) {
+    size_t first = text.find_first_not_of(" \t");
+    if (first == std::string::npos) {
+        return {};
+    }
+    return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+}
+
+bool percentDecode(const std::string& text, std::string& out) {
+    out.clear();
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] != '%') {
+            out += text[i];
+            continue;
+        }
+        if (i + 2 >= text.size() || !std::isxdigit(static_cast<unsigned char>(text[i + 1])) ||
+            !std::isxdigit(static_cast<unsigned char>(text[i + 2]))) {
+            return false;
+        }
+        out += static_cast<char>(std::stoi(text.substr(i + 1, 2), nullptr, 16));
+        i += 2;
+    }
+    return true;
+}
+
+// True if an Accept-Encoding value lists deflate without q=0
+bool acceptsDeflate(const std::string& acceptEncoding) {
+    size_t start = 0;
+    while (start <= acceptEncoding.size()) {
+        size_t end = acceptEncoding.find(',', start);
+        if (end == std::string::npos) {
+            end = acceptEncoding.size();
+        }
+        const std::string item = lowercase(acceptEncoding.substr(start, end - start));
+        const size_t semicolon = item.find(';');
+        if (trim(item.substr(0, semicolon)) == "deflate") {
+            if (semicolon == std::string::npos) {
+                return true;
+            }
+            const size_t q = item.find("q=", semicolon);
+            return q == std::string::npos || std::strtod(item.c_str() + q + 2, nullptr) > 0;
+        }
+        start = end + 1;
+    }
+    return false;
+}
+
+enum class RangeResult {
+    Whole,          // No range, or one this server answers with the whole entry
+    Partial,
+    Unsatisfiable
+};
+
+// Parses a single "bytes=first-last", "bytes=first-" or "bytes=-suffix"
+// range. Multiple ranges are answered with the whole entry.
+RangeResult parseRange(const std::string& value, uint64_t size, uint64_t& first, uint64_t& last) {
+    if (value.empty()) {
+        return RangeResult::Whole;
+    }
+    const std::string spec = trim(value);
+    if (lowercase(spec.substr(0, 6)) != "bytes=" || spec.find(',') != std::string::npos) {
+        return RangeResult::Whole;
+    }
+    const std::string range = trim(spec.substr(6));
+    const size_t dash = range.find('-');
+    if (dash == std::string::npos) {
+        return RangeResult::Whole;
+    }
+    const std::string from = range.substr(0, dash);
+    const std::string to = range.substr(dash + 1);
+    auto isNumber = [](const std::string& text) {
+        return !text.empty() && std::all_of(text.begin(), text.end(),
+                                            [](unsigned char c) { return std::isdigit(c) != 0; });
+    };
+    if (from.empty()) {
+        if (!isNumber(to) || size == 0) {
+            return isNumber(to) ? RangeResult::Unsatisfiable : RangeResult::Whole;
+        }
+        const uint64_t suffix = std::strtoull(to.c_str(), nullptr, 10);
+        if (suffix == 0) {
+            return RangeResult::Unsatisfiable;
+        }
+        first = size - std::min(suffix, size);
+        last = size - 1;
+        return RangeResult::Partial;
+    }
+    if (!isNumber(from) || (!to.empty() && !isNumber(to))) {
+        return RangeResult::Whole;
+    }
+    first = std::strtoull(from.c_str(), nullptr, 10);
+    last = to.empty() ? UINT64_MAX : std::strtoull(to.c_str(), nullptr, 10);
+    if (last < first) {
+        return RangeResult::Whole;
+    }
+    if (first >= size) {
+        return RangeResult::Unsatisfiable;
+    }
+    last = std::min(last, size - 1);
+    return RangeResult::Partial;
+}
+
+const char* contentType(const std::string& name) {
+    static const std::pair<const char*, const char*> types[] = {
+        {".html", "text/html; charset=utf-8"}, {".htm", "text/html; charset=utf-8"},
+        {".txt", "text/plain; charset=utf-8"}, {".css", "text/css"},
+        {".js", "text/javascript"},            {".json", "application/json"},
+        {".xml", "application/xml"},           {".svg", "image/svg+xml"},
+        {".png", "image/png"},                 {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"},               {".gif", "image/gif"},
+        {".wasm", "application/wasm"},         {".pdf", "application/pdf"},
+    };
+    const size_t dot = name.rfind('.');
+    if (dot != std::string::npos && name.find('/', dot) == std::string::npos) {
+        const std::string extension = lowercase(name.substr(dot));
+        for (const auto& type : types) {
+            if (extension == type.first) {
+                return type.second;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+#ifndef _WIN32
+
+bool sendAll(int fd, const char* data, size_t size, int flags = 0) {
+    while (size > 0) {
+        ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL | flags);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+// Copies a byte range of the archive to the socket, in the kernel where
+// the platform allows
+bool sendFileRange(int client, int fd, uint64_t offset, uint64_t length) {
+#ifdef __linux__
+    off_t position = static_cast<off_t>(offset);
+    while (length > 0) {
+        ssize_t sent = ::sendfile(client, fd, &position, static_cast<size_t>(std::min<uint64_t>(length, 1u << 30)));
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        length -= static_cast<uint64_t>(sent);
+    }
+    return true;
+#else
+    std::vector<char> buffer(static_cast<size_t>(std::min<uint64_t>(length, SEND_CHUNK)));
+    while (length > 0) {
+        size_t piece = static_cast<size_t>(std::min<uint64_t>(length, buffer.size()));
+        if (!ExtractIO::readAt(fd, offset, buffer.data(), piece) || !sendAll(client, buffer.data(), piece)) {
+            return false;
+        }
+        offset += piece;
+        length -= piece;
+    }
+    return true;
+#endif
+}
+
+#endif // _WIN32
+
+} // namespace
+
+ArchiveServer::ArchiveServer(const std::string& archivePath, ServeOptions options)
+    : archivePath(archivePath), options(options) {
+    std::ifstream in(archivePath, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Failed to open archive: " + archivePath);
+    }
+    EntryTable table;
+    Archive::readCatalog(in, table);
+
+    // Locate every payload once so requests go straight to the bytes
+    auto reader = [&in](void* data, size_t size) {
+        return static_cast<bool>(in.read(static_cast<char*>(data), static_cast<std::streamsize>(size)));
+    };
+    entries.reserve(table.size());
+    for (size_t i = 0; i < table.size(); ++i) {
+        const std::string name(table[i].name);
+        ServedEntry entry;
+        uint64_t size = 0;
+        in.clear();
+        in.seekg(static_cast<std::streamoff>(table.offset(i)));
+        if (!ArchiveFormat::readEntryHeader(reader, entry.header, size) ||
+            !in.seekg(entry.header.nameLength, std::ios::cur) ||
+            (entry.header.isSparse() &&
+             !ArchiveFormat::readSparseMap(reader, entry.header, entry.extents, size))) {
+            throw std::runtime_error("Corrupt entry: " + name);
+        }
+        entry.payloadOffset = static_cast<uint64_t>(in.tellg());
+        if (entry.header.hasDescriptor()) {
+            in.seekg(static_cast<std::streamoff>(entry.payloadOffset + table[i].compressedSize));
+            if (!ArchiveFormat::readEntryDescriptor(reader, entry.header, size)) {
+                throw std::runtime_error("Corrupt entry descriptor for: " + name);
+            }
+        }
+        entries[name] = std::move(entry); // A later entry of the same name wins, as on extract
+    }
+
+    archiveFd = ExtractIO::openForReading(archivePath.c_str());
+    if (archiveFd < 0) {
+        throw std::runtime_error("Failed to open archive: " + archivePath);
+    }
+}
+
+ArchiveServer::~ArchiveServer() {
+#ifndef _WIN32
+    if (listenFd >= 0) {
+        ::close(listenFd);
+    }
+#endif
+    if (archiveFd >= 0) {
+        ExtractIO::closeFile(archiveFd);
+    }
+}
+
+bool ArchiveServer::shouldStop() const {
+    return stopping.load(std::memory_order_relaxed) || (cancellation && cancellation->isCancelled());
+}
+
+#ifdef _WIN32
+
+uint16_t ArchiveServer::listen() {
+    throw std::runtime_error("Serving archives is not supported on Windows");
+}
+
+void ArchiveServer::serve() {
+    listen();
+}
+
+void ArchiveServer::acceptConnections() {}
+
+void ArchiveServer::handleConnection(int client) {
+    (void)client;
+}
+
+bool ArchiveServer::waitReadable(int client) const {
+    (void)client;
+    return false;
+}
+
+bool ArchiveServer::respond(int client, const Request& request) {
+    (void)client;
+    (void)request;
+    return false;
+}
+
+#else
+
+uint16_t ArchiveServer::listen() {
+    if (listenFd >= 0) {
+        throw std::runtime_error("Server is already listening");
+    }
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* addresses = nullptr;
+    const std::string port = std::to_string(options.port);
+    int status = ::getaddrinfo(options.address.empty() ? nullptr : options.address.c_str(), port.c_str(),
+                               &hints, &addresses);
+    if (status != 0) {
+        throw std::runtime_error("Failed to resolve '" + options.address + "': " + ::gai_strerror(status));
+    }
+
+    std::string error;
+    for (addrinfo* address = addresses; address && listenFd < 0; address = address->ai_next) {
+        int fd = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd < 0) {
+            error = std::strerror(errno);
+            continue;
+        }
+        int enable = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+        if (::bind(fd, address->ai_addr, address->ai_addrlen) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+            error = std::strerror(errno);
+            ::close(fd);
+            continue;
+        }
+        // Workers poll the socket and race to accept, so accept must not block
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        listenFd = fd;
+    }
+    ::freeaddrinfo(addresses);
+    if (listenFd < 0) {
+        throw std::runtime_error("Failed to listen on " + options.address + ":" + port + ": " + error);
+    }
+
+    sockaddr_storage bound = {};
+    socklen_t length = sizeof(bound);
+    ::getsockname(listenFd, reinterpret_cast<sockaddr*>(&bound), &length);
+    return ntohs(bound.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6*>(&bound)->sin6_port
+                                             : reinterpret_cast<sockaddr_in*>(&bound)->sin_port);
+}
+
+void ArchiveServer::serve() {
+    if (listenFd < 0) {
+        listen();
+    }
+    unsigned count = options.threads;
+    if (count == 0) {
+        count = 8 * std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < count; ++i) {
+        workers.emplace_back([this] { acceptConnections(); });
+    }
+    acceptConnections();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ArchiveServer::acceptConnections() {
+    while (!shouldStop()) {
+        pollfd ready = {listenFd, POLLIN, 0};
+        if (::poll(&ready, 1, POLL_INTERVAL_MS) <= 0) {
+            continue;
+        }
+        int client = ::accept(listenFd, nullptr, nullptr);
+        if (client < 0) {
+            continue; // Another worker took it, or the client went away
+        }
+        ::fcntl(client, F_SETFD, FD_CLOEXEC);
+        ::fcntl(client, F_SETFL, ::fcntl(client, F_GETFL) & ~O_NONBLOCK);
+        handleConnection(client);
+        ::close(client);
+    }
+}
+
+bool ArchiveServer::waitReadable(int client) const {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.idleTimeoutMs);
+    while (!shouldStop() && std::chrono::steady_clock::now() < deadline) {
+        pollfd ready = {client, POLLIN, 0};
+        int status = ::poll(&ready, 1, POLL_INTERVAL_MS);
+        if (status > 0) {
+            return true;
+        }
+        if (status < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+    return false;
+}
+
+void ArchiveServer::handleConnection(int client) {
+    int enable = 1;
+    ::setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+#ifdef SO_NOSIGPIPE
+    ::setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+    timeval timeout = {SEND_TIMEOUT_SECONDS, 0};
+    ::setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string buffer;
+    char chunk[8192];
+    for (;;) {
+        size_t headerEnd;
+        while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+            if (buffer.size() > MAX_REQUEST_HEADER) {
+                static const char tooLarge[] =
+                    "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+                sendAll(client, tooLarge, sizeof(tooLarge) - 1);
+                return;
+            }
+            if (!waitReadable(client)) {
+                return;
+            }
+            ssize_t received = ::recv(client, chunk, sizeof(chunk), 0);
+            if (received <= 0) {
+                return;
+            }
+            buffer.append(chunk, static_cast<size_t>(received));
+        }
+
+        // Request line, then "Name: value" lines
+        Request request;
+        bool valid = true;
+        std::string version;
+        size_t lineEnd = buffer.find("\r\n");
+        {
+            const std::string line = buffer.substr(0, lineEnd);
+            const size_t first = line.find(' ');
+            const size_t second = line.find(' ', first + 1);
+            std::string target;
+            if (first == std::string::npos || second == std::string::npos) {
+                valid = false;
+            } else {
+                request.method = line.substr(0, first);
+                target = line.substr(first + 1, second - first - 1);
+                version = line.substr(second + 1);
+            }
+            target = target.substr(0, target.find('?'));
+            valid = valid && !target.empty() && target[0] == '/' && percentDecode(target.substr(1), request.path);
+        }
+        request.keepAlive = version == "HTTP/1.1";
+        while (valid && lineEnd < headerEnd) {
+            const size_t start = lineEnd + 2;
+            lineEnd = buffer.find("\r\n", start);
+            const std::string line = buffer.substr(start, lineEnd - start);
+            const size_t colon = line.find(':');
+            if (colon == std::string::npos) {
+                valid = false;
+                break;
+            }
+            const std::string name = lowercase(line.substr(0, colon));
+            const std::string value = trim(line.substr(colon + 1));
+            if (name == "range") {
+                request.range = value;
+            } else if (name == "accept-encoding") {
+                request.acceptEncoding = value;
+            } else if (name == "connection") {
+                const std::string token = lowercase(value);
+                request.keepAlive = token == "close" ? false : token == "keep-alive" ? true : request.keepAlive;
+            } else if ((name == "content-length" && value != "0") || name == "transfer-encoding") {
+                request.keepAlive = false; // Bodies are not read, so nothing can follow them
+            }
+        }
+        buffer.erase(0, headerEnd + 4);
+
+        if (!valid) {
+            static const char badRequest[] =
+                "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            sendAll(client, badRequest, sizeof(badRequest) - 1);
+            return;
+        }
+        if (!respond(client, request) || !request.keepAlive) {
+            return;
+        }
+    }
+}
+
+bool ArchiveServer::respond(int client, const Request& request) {
+    const bool head = request.method == "HEAD";
+    std::string response;
+    auto status = [&](const char* line) {
+        response = std::string("HTTP/1.1 ") + line + "\r\n";
+        response += request.keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    };
+    auto field = [&](const char* name, const std::string& value) {
+        response += name;
+        response += ": ";
+        response += value;
+        response += "\r\n";
+    };
+    auto sendHeaders = [&](bool bodyFollows) {
+        response += "\r\n";
+        return sendAll(client, response.data(), response.size(), bodyFollows ? MSG_MORE : 0);
+    };
+    auto sendText = [&](const char* line, const std::string& body) {
+        status(line);
+        field("Content-Type", "text/plain; charset=utf-8");
+        field("Content-Length", std::to_string(body.size()));
+        return sendHeaders(!head) && (head || sendAll(client, body.data(), body.size()));
+    };
+
+    if (request.method != "GET" && !head) {
+        status("405 Method Not Allowed");
+        field("Allow", "GET, HEAD");
+        field("Content-Length", "0");
+        return sendHeaders(false);
+    }
+    auto found = entries.find(request.path);
+    if (found == entries.end()) {
+        return sendText("404 Not Found", "Not found: " + request.path + "\n");
+    }
+    const ServedEntry& entry = found->second;
+    const EntryHeader& header = entry.header;
+    if (header.isEncrypted()) {
+        return sendText("403 Forbidden", "Entry is encrypted: " + request.path + "\n");
+    }
+
+    const bool plain = !header.isSparse();
+    const bool passThrough = plain && header.codec == CODEC_ZLIB && header.compressedSize > 0 &&
+                             acceptsDeflate(request.acceptEncoding);
+    const bool ranged = plain && header.codec == CODEC_STORED;
+    char etag[16] = {};
+    if (header.hasCrc32()) {
+        std::snprintf(etag, sizeof(etag), "\"%08x%s\"", header.crc32, passThrough ? "z" : "");
+    }
+
+    uint64_t first = 0;
+    uint64_t last = 0;
+    RangeResult range = ranged ? parseRange(request.range, header.originalSize, first, last) : RangeResult::Whole;
+    if (range == RangeResult::Unsatisfiable) {
+        status("416 Range Not Satisfiable");
+        field("Content-Range", "bytes */" + std::to_string(header.originalSize));
+        field("Content-Length", "0");
+        return sendHeaders(false);
+    }
+
+    if (range == RangeResult::Partial) {
+        status("206 Partial Content");
+        field("Content-Range", "bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" +
+                                   std::to_string(header.originalSize));
+    } else {
+        status("200 OK");
+    }
+    field("Content-Type", contentType(request.path));
+    if (etag[0]) {
+        field("ETag", etag);
+    }
+    if (ranged) {
+        field("Accept-Ranges", "bytes");
+    }
+    if (header.codec == CODEC_ZLIB) {
+        field("Vary", "Accept-Encoding");
+    }
+
+    if (passThrough) {
+        // A zlib stream is exactly HTTP's deflate coding
+        field("Content-Encoding", "deflate");
+        field("Content-Length", std::to_string(header.compressedSize));
+        return sendHeaders(!head) &&
+               (head || sendFileRange(client, archiveFd, entry.payloadOffset, header.compressedSize));
+    }
+    if (ranged) {
+        const uint64_t length = range == RangeResult::Partial ? last - first + 1 : header.originalSize;
+        field("Content-Length", std::to_string(length));
+        return sendHeaders(!head && length > 0) &&
+               (head || sendFileRange(client, archiveFd, entry.payloadOffset + first, length));
+    }
+
+    field("Content-Length", std::to_string(header.originalSize));
+    if (!sendHeaders(!head && header.originalSize > 0)) {
+        return false;
+    }
+    if (head) {
+        return true;
+    }
+    // Headers are out, so a failure now can only drop the connection
+    try {
+        uint64_t position = entry.payloadOffset;
+        Archive::decodeEntry(
+            header, entry.extents,
+            [&](char* data, size_t size) {
+                if (!ExtractIO::readAt(archiveFd, position, data, size)) {
+                    throw std::runtime_error("Failed to read archive: " + archivePath);
+                }
+                position += size;
+            },
+            [&](const char* data, size_t size) {
+                if (!sendAll(client, data, size)) {
+                    throw std::runtime_error("Client went away");
+                }
+            },
+            request.path);
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+#endif // _WIN32
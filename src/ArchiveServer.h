@@ -0,0 +1,102 @@
+/**
+ * @file ArchiveServer.h
+ * @brief Serving archive entries over HTTP straight from the archive file
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ArchiveFormat.h"
+
+class CancellationToken;
+
+struct ServeOptions {
+    std::string address = "127.0.0.1"; ///< Interface to listen on
+    uint16_t port = 8080;               ///< 0 picks a free port
+    unsigned threads = 0;               ///< Connections served at once, 0 = 8 per core
+    int idleTimeoutMs = 5000;           ///< How long a keep-alive connection may sit idle
+};
+
+/**
+ * @brief Read-only HTTP/1.1 server mapping URL paths to archive entries
+ *
+ * "GET /docs/a.txt" serves the entry "docs/a.txt". zlib entries go out
+ * as "Content-Encoding: deflate" to clients that accept it, copied from the
+ * archive with sendfile and never inflated; stored entries support single
+ * byte ranges. Everything else is decoded on the fly, apart from encrypted
+ * entries, which are refused since the server holds no key. Each worker
+ * thread serves one keep-alive connection at a time. POSIX only.
+ */
+class ArchiveServer {
+public:
+    /**
+     * @brief Reads the entry headers; throws std::runtime_error if
+     *        @p archivePath is not an archive
+     */
+    explicit ArchiveServer(const std::string& archivePath, ServeOptions options = ServeOptions());
+    ~ArchiveServer();
+
+    ArchiveServer(const ArchiveServer&) = delete;
+    ArchiveServer& operator=(const ArchiveServer&) = delete;
+
+    /**
+     * @brief Binds the listening socket
+     * @return The port, which is useful with ServeOptions::port = 0
+     */
+    uint16_t listen();
+
+    /**
+     * @brief Serves requests until stop() or the cancellation token fires;
+     *        listens first if listen() was not called
+     */
+    void serve();
+
+    /**
+     * @brief Makes serve() return once open requests are answered; may be
+     *        called from any thread
+     */
+    void stop() { stopping.store(true, std::memory_order_relaxed); }
+
+    /**
+     * @brief Token whose cancellation also stops serve() (nullptr to detach)
+     */
+    void setCancellation(CancellationToken* token) { cancellation = token; }
+
+    size_t entryCount() const { return entries.size(); }
+
+private:
+    struct ServedEntry {
+        EntryHeader header;                 ///< Final sizes and checksums
+        std::vector<SparseExtent> extents;
+        uint64_t payloadOffset = 0;
+    };
+    struct Request;
+
+    bool shouldStop() const;
+    void acceptConnections();
+    void handleConnection(int client);
+
+    /**
+     * @brief Waits until @p client has data, stopping early on shutdown or
+     *        after the idle timeout
+     */
+    bool waitReadable(int client) const;
+
+    /**
+     * @brief Answers one request
+     * @return false if the connection must be closed
+     */
+    bool respond(int client, const Request& request);
+
+    std::string archivePath;
+    ServeOptions options;
+    std::unordered_map<std::string, ServedEntry> entries;
+    int archiveFd = -1;
+    int listenFd = -1;
+    std::atomic<bool> stopping{false};
+    CancellationToken* cancellation = nullptr;
+};
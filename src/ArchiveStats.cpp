@@ -0,0 +1,184 @@
+#include "ArchiveStats.h"
+#include <cstdio>
+#include <sstream>
+
+namespace {
+
+std::atomic<uint64_t> nextStatsId{1};
+
+// Per-thread cache of the slot used for the most recent ArchiveStats. The id
+// (rather than the pointer) identifies the owner, so a new instance at a
+// reused address never picks up a stale slot.
+struct SlotCache {
+    uint64_t owner = 0;
+    void* slot = nullptr;
+};
+thread_local SlotCache slotCache;
+
+size_t latencyBucket(std::chrono::steady_clock::duration elapsed) {
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    size_t bucket = 0;
+    while (micros > 1 && bucket + 1 < ArchiveStats::LATENCY_BUCKETS) {
+        micros >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buffer[8];
+            std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            out += buffer;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+} // namespace
+
+ArchiveStats::ArchiveStats() : id(nextStatsId.fetch_add(1)) {
+}
+
+ArchiveStats::~ArchiveStats() = default;
+
+const char* ArchiveStats::stageName(StatStage stage) {
+    switch (stage) {
+    case StatStage::Read: return "read";
+    case StatStage::Compress: return "compress";
+    case StatStage::Encrypt: return "encrypt";
+    case StatStage::Inflate: return "inflate";
+    case StatStage::Write: return "write";
+    case StatStage::Metadata: return "metadata";
+    default: return "unknown";
+    }
+}
+
+ArchiveStats::ThreadSlot& ArchiveStats::localSlot() {
+    if (slotCache.owner == id) {
+        return *static_cast<ThreadSlot*>(slotCache.slot);
+    }
+    std::lock_guard<std::mutex> lock(slotMutex);
+    const auto self = std::this_thread::get_id();
+    ThreadSlot* slot = nullptr;
+    for (auto& entry : slots) {
+        if (entry.first == self) {
+            slot = entry.second.get();
+            break;
+        }
+    }
+    if (!slot) {
+        slots.emplace_back(self, std::make_unique<ThreadSlot>());
+        slot = slots.back().second.get();
+    }
+    slotCache.owner = id;
+    slotCache.slot = slot;
+    return *slot;
+}
+
+void ArchiveStats::addStage(StatStage stage, std::chrono::steady_clock::duration elapsed, uint64_t bytes) {
+    ThreadSlot& slot = localSlot();
+    size_t index = static_cast<size_t>(stage);
+    slot.nanoseconds[index].add(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    slot.calls[index].add(1);
+    slot.bytes[index].add(bytes);
+}
+
+void ArchiveStats::recordFile(uint64_t originalSize, uint64_t compressedSize,
+                              std::chrono::steady_clock::duration elapsed) {
+    ThreadSlot& slot = localSlot();
+    slot.files.add(1);
+    slot.originalBytes.add(originalSize);
+    slot.compressedBytes.add(compressedSize);
+    slot.fileLatency[latencyBucket(elapsed)].add(1);
+
+    size_t ratioBucket = RATIO_BUCKETS - 1;
+    if (originalSize > 0 && compressedSize <= originalSize) {
+        ratioBucket = static_cast<size_t>(compressedSize * 10 / originalSize);
+        if (ratioBucket >= RATIO_BUCKETS - 1) {
+            ratioBucket = RATIO_BUCKETS - 2; // Exactly 100% stays in the 90-100% bucket
+        }
+    } else if (originalSize == 0) {
+        ratioBucket = 0;
+    }
+    slot.ratios[ratioBucket].add(1);
+}
+
+ArchiveStats::Totals ArchiveStats::totals() const {
+    Totals result;
+    std::lock_guard<std::mutex> lock(slotMutex);
+    for (const auto& entry : slots) {
+        const ThreadSlot* slot = entry.second.get();
+        for (size_t i = 0; i < STAGE_COUNT; ++i) {
+            result.stages[i].nanoseconds += slot->nanoseconds[i].get();
+            result.stages[i].calls += slot->calls[i].get();
+            result.stages[i].bytes += slot->bytes[i].get();
+        }
+        result.files += slot->files.get();
+        result.originalBytes += slot->originalBytes.get();
+        result.compressedBytes += slot->compressedBytes.get();
+        for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+            result.fileLatency[i] += slot->fileLatency[i].get();
+        }
+        for (size_t i = 0; i < RATIO_BUCKETS; ++i) {
+            result.ratios[i] += slot->ratios[i].get();
+        }
+    }
+    return result;
+}
+
+std::string ArchiveStats::toJson(const std::string& operation) const {
+    Totals t = totals();
+    size_t threads;
+    {
+        std::lock_guard<std::mutex> lock(slotMutex);
+        threads = slots.size();
+    }
+
+    std::ostringstream out;
+    out << "{\n";
+    out << "  \"operation\": \"" << jsonEscape(operation) << "\",\n";
+    out << "  \"threads\": " << threads << ",\n";
+    out << "  \"files\": " << t.files << ",\n";
+    out << "  \"original_bytes\": " << t.originalBytes << ",\n";
+    out << "  \"compressed_bytes\": " << t.compressedBytes << ",\n";
+    char ratio[32];
+    std::snprintf(ratio, sizeof(ratio), "%.4f",
+                  t.originalBytes ? static_cast<double>(t.compressedBytes) / static_cast<double>(t.originalBytes) : 0.0);
+    out << "  \"compression_ratio\": " << ratio << ",\n";
+
+    out << "  \"stages\": {\n";
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        const StageTotals& stage = t.stages[i];
+        char seconds[32];
+        std::snprintf(seconds, sizeof(seconds), "%.6f", static_cast<double>(stage.nanoseconds) / 1e9);
+        out << "    \"" << stageName(static_cast<StatStage>(i)) << "\": {\"seconds\": " << seconds
+            << ", \"calls\": " << stage.calls << ", \"bytes\": " << stage.bytes << "}"
+            << (i + 1 < STAGE_COUNT ? "," : "") << "\n";
+    }
+    out << "  },\n";
+
+    // Bucket i holds files that took [2^i, 2^(i+1)) microseconds (bucket 0 includes < 1us)
+    out << "  \"file_latency_us_log2\": [";
+    for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+        out << t.fileLatency[i] << (i + 1 < LATENCY_BUCKETS ? ", " : "");
+    }
+    out << "],\n";
+
+    // Bucket i holds files compressed to [10*i, 10*(i+1))% of their size; the last is > 100%
+    out << "  \"compression_ratio_histogram\": [";
+    for (size_t i = 0; i < RATIO_BUCKETS; ++i) {
+        out << t.ratios[i] << (i + 1 < RATIO_BUCKETS ? ", " : "");
+    }
+    out << "]\n";
+    out << "}\n";
+    return out.str();
+}
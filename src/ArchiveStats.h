@@ -0,0 +1,141 @@
+/**
+ * @file ArchiveStats.h
+ * @brief Lightweight per-stage timing and counters for archive operations
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Stages timed by ArchiveStats
+ */
+enum class StatStage : int {
+    Read = 0,   ///< Reading input files
+    Compress,   ///< compressData
+    Encrypt,    ///< Sealing compressed payloads
+    Inflate,    ///< Decompressing entries
+    Write,      ///< Writing archive data or extracted files
+    Metadata,   ///< stat, mkdir, timestamp updates
+    Count
+};
+
+/**
+ * @brief Collects timings, latency histograms and compression ratios
+ *
+ * Every thread records into its own slot, so recording never contends;
+ * slots are only merged when a report is produced. Pass a null pointer
+ * wherever an ArchiveStats* is accepted to disable collection entirely.
+ */
+class ArchiveStats {
+public:
+    static constexpr size_t STAGE_COUNT = static_cast<size_t>(StatStage::Count);
+    static constexpr size_t LATENCY_BUCKETS = 32;  ///< log2(microseconds) buckets
+    static constexpr size_t RATIO_BUCKETS = 11;    ///< 10% buckets, last is >100%
+
+    /**
+     * @brief Times a scope and adds it to a stage (no-op for null stats)
+     */
+    class ScopedTimer {
+    public:
+        ScopedTimer(ArchiveStats* stats, StatStage stage, uint64_t bytes = 0)
+            : stats(stats), stage(stage), bytes(bytes) {
+            if (stats) {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+        ~ScopedTimer() {
+            if (stats) {
+                stats->addStage(stage, std::chrono::steady_clock::now() - start, bytes);
+            }
+        }
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+        void setBytes(uint64_t value) { bytes = value; }
+
+    private:
+        ArchiveStats* stats;
+        StatStage stage;
+        uint64_t bytes;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    struct StageTotals {
+        uint64_t nanoseconds = 0;
+        uint64_t calls = 0;
+        uint64_t bytes = 0;
+    };
+
+    struct Totals {
+        std::array<StageTotals, STAGE_COUNT> stages{};
+        uint64_t files = 0;
+        uint64_t originalBytes = 0;
+        uint64_t compressedBytes = 0;
+        std::array<uint64_t, LATENCY_BUCKETS> fileLatency{};
+        std::array<uint64_t, RATIO_BUCKETS> ratios{};
+    };
+
+    ArchiveStats();
+    ~ArchiveStats();
+
+    ArchiveStats(const ArchiveStats&) = delete;
+    ArchiveStats& operator=(const ArchiveStats&) = delete;
+
+    void addStage(StatStage stage, std::chrono::steady_clock::duration elapsed, uint64_t bytes = 0);
+
+    /**
+     * @brief Records one finished entry
+     * @param elapsed Time spent on the entry from start to finish
+     */
+    void recordFile(uint64_t originalSize, uint64_t compressedSize,
+                    std::chrono::steady_clock::duration elapsed);
+
+    /**
+     * @brief Sums all thread slots
+     */
+    Totals totals() const;
+
+    /**
+     * @brief Renders totals() as a JSON document
+     * @param operation Name of the operation, included for context
+     */
+    std::string toJson(const std::string& operation = "") const;
+
+    static const char* stageName(StatStage stage);
+
+private:
+    struct Counter {
+        std::atomic<uint64_t> value{0};
+        // Only the owning thread writes, so a plain load/store avoids a locked add
+        void add(uint64_t delta) { value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed); }
+        uint64_t get() const { return value.load(std::memory_order_relaxed); }
+    };
+
+    struct ThreadSlot {
+        std::array<Counter, STAGE_COUNT> nanoseconds;
+        std::array<Counter, STAGE_COUNT> calls;
+        std::array<Counter, STAGE_COUNT> bytes;
+        Counter files;
+        Counter originalBytes;
+        Counter compressedBytes;
+        std::array<Counter, LATENCY_BUCKETS> fileLatency;
+        std::array<Counter, RATIO_BUCKETS> ratios;
+    };
+
+    const uint64_t id;
+    mutable std::mutex slotMutex;
+    std::vector<std::pair<std::thread::id, std::unique_ptr<ThreadSlot>>> slots;
+
+    ThreadSlot& localSlot();
+};
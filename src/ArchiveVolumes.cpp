@@ -0,0 +1,448 @@
+// Multi-volume archives: a catalog plus numbered volumes, see VolumeOptions
+
+#include "Archive.h"
+#include "ArchiveFormat.h"
+#include "ArchiveProgress.h"
+#include "ArchiveStats.h"
+#include "CancellationToken.h"
+#include "EntryScheduler.h"
+#include "ExtractEngine.h"
+#include "FileIO.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Compressed data queued per volume writer before create waits for it
+constexpr uint64_t MAX_QUEUED_BYTES = 64ull << 20;
+
+// Size of the index a volume ends with
+uint64_t indexSize(uint64_t entryCount, uint64_t namesSize) {
+    return INDEX_HEADER_SIZE + entryCount * (INDEX_RECORD_SIZE + sizeof(uint32_t)) + namesSize +
+           INDEX_TRAILER_SIZE;
+}
+
+// "<directory>/<archive file name>.007"
+fs::path volumeFile(const fs::path& directory, const fs::path& catalog, uint32_t number) {
+    char suffix[16];
+    std::snprintf(suffix, sizeof(suffix), ".%03u", number + 1);
+    return directory / (catalog.filename().string() + suffix);
+}
+
+} // namespace
+
+// Writes one volume on its own thread. Entries arrive with their offsets
+// already assigned by create; the volume's own index follows the last one.
+class Archive::VolumeWriter {
+public:
+    VolumeWriter(Archive& archive, fs::path path, CompressionType compression)
+        : archive(archive), path(std::move(path)), working(this->path.string() + ".tmp"),
+          compression(compression) {
+        thread = std::thread([this] { run(); });
+    }
+
+    ~VolumeWriter() {
+        close();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    VolumeWriter(const VolumeWriter&) = delete;
+    VolumeWriter& operator=(const VolumeWriter&) = delete;
+
+    /**
+     * @brief Queues an entry, waiting while too much data is queued
+     */
+    void push(std::unique_ptr<PreparedEntry> entry) {
+        std::unique_lock<std::mutex> lock(mutex);
+        space.wait(lock, [this] { return queuedBytes < MAX_QUEUED_BYTES || queue.empty() || error; });
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        queuedBytes += entry->compressed.size();
+        queue.push_back(std::move(entry));
+        ready.notify_one();
+    }
+
+    /**
+     * @brief No more entries; the index is written in the background
+     */
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+        ready.notify_one();
+    }
+
+    /**
+     * @brief Waits until the volume is complete and rethrows any write error
+     */
+    void finish() {
+        close();
+        if (thread.joinable()) {
+            thread.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    const fs::path& finalPath() const { return path; }
+    const fs::path& workingPath() const { return working; }
+    uint64_t size() const { return written; }
+
+private:
+    void run() {
+        try {
+            std::ofstream out(working, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                throw std::runtime_error("Failed to create volume: " + path.string());
+            }
+            uint8_t prefix[ENTRY_PREFIX_SIZE];
+            out.write(reinterpret_cast<const char*>(prefix),
+                      static_cast<std::streamsize>(ArchiveFormat::encodeArchiveHeader(prefix)));
+
+            EntryTable table;
+            for (;;) {
+                std::unique_ptr<PreparedEntry> entry;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready.wait(lock, [this] { return !queue.empty() || closing; });
+                    if (queue.empty()) {
+                        break;
+                    }
+                    entry = std::move(queue.front());
+                    queue.pop_front();
+                }
+                write(*entry, out, table);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    queuedBytes -= entry->compressed.size();
+                }
+                space.notify_one();
+            }
+
+            table.buildNameIndex();
+            if (!table.writeIndex(out, static_cast<uint64_t>(out.tellp())) || !out.flush()) {
+                throw std::runtime_error("Failed to write volume: " + path.string());
+            }
+            written = static_cast<uint64_t>(out.tellp());
+            out.close();
+            if (archive.syncPolicy.enabled) {
+                FileIO::syncFile(working);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            error = std::current_exception();
+            queue.clear();
+            space.notify_all();
+        }
+    }
+
+    void write(const PreparedEntry& entry, std::ostream& out, EntryTable& table) {
+        const EntryHeader& header = entry.header;
+        const uint64_t offset = static_cast<uint64_t>(out.tellp());
+        const auto start = std::chrono::steady_clock::now();
+        {
+            ArchiveStats::ScopedTimer timer(archive.stats, StatStage::Write, header.compressedSize);
+            writeEntryRecord(entry, out);
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        if (!out) {
+            throw std::runtime_error("Failed to write volume: " + path.string());
+        }
+        table.add(entry.archivePath, header.compressedSize, header.originalSize, header.timestamp, offset);
+
+        if (compression == CompressionType::Adaptive) {
+            archive.levelController.recordWrite(header.compressedSize, elapsed);
+        }
+        if (archive.progress) {
+            archive.progress->addBytes(header.originalSize);
+            archive.progress->addFile();
+        }
+        if (archive.stats) {
+            archive.stats->recordFile(header.originalSize, header.compressedSize, entry.elapsed + elapsed);
+        }
+    }
+
+    Archive& archive;
+    const fs::path path;
+    const fs::path working;
+    const CompressionType compression;
+    std::thread thread;
+
+    std::mutex mutex;
+    std::condition_variable ready;   ///< Writer: an entry was queued, or closing
+    std::condition_variable space;   ///< create: queued data dropped below the limit
+    std::deque<std::unique_ptr<PreparedEntry>> queue;
+    uint64_t queuedBytes = 0;
+    bool closing = false;
+    std::exception_ptr error;
+    uint64_t written = 0;
+};
+
+void Archive::createVolumes(const std::vector<fs::path>& files, CompressionType compression) {
+    const uint64_t volumeSize = volumeOptions.volumeSize;
+    const fs::path catalog(archiveName);
+    std::vector<fs::path> directories(volumeOptions.directories.begin(), volumeOptions.directories.end());
+    if (directories.empty()) {
+        directories.push_back(catalog.parent_path());
+    }
+    for (const auto& directory : directories) {
+        if (!directory.empty()) {
+            fs::create_directories(directory);
+        }
+    }
+
+    entries.clear();
+    entryVolumes.clear();
+    volumePaths.clear();
+    dataEnd = 0;
+
+    // The volume open in each directory, and how much went to the directory
+    struct Slot {
+        bool open = false;
+        uint32_t volume = 0;
+        uint64_t bytes = 0;      ///< Size of the open volume so far
+        uint64_t count = 0;      ///< Entries in the open volume
+        uint64_t names = 0;      ///< Name bytes in the open volume
+        uint64_t total = 0;      ///< Bytes assigned to the directory
+    };
+    std::vector<Slot> slots(directories.size());
+    std::vector<std::unique_ptr<VolumeWriter>> writers;
+    auto fits = [&](const Slot& slot, uint64_t record, uint64_t nameLength) {
+        return slot.bytes + record + indexSize(slot.count + 1, slot.names + nameLength) <= volumeSize;
+    };
+
+    const std::string working = workingPath();
+    try {
+        reportInputTotals(files);
+        const std::vector<PendingInput> inputs = collectInputs(files);
+        EntryScheduler scheduler(threads);
+        levelController.reset(scheduler.threadCount());
+        std::vector<uint64_t> sizes;
+        sizes.reserve(inputs.size());
+        for (const auto& input : inputs) {
+            sizes.push_back(input.size);
+        }
+
+        // Entries are placed in input order, so the volumes only depend on
+        // the inputs; writing them is left to one thread per volume
+        std::vector<PreparedEntry> prepared(inputs.size());
+        scheduler.run(
+            sizes,
+            [&](size_t i) { prepared[i] = prepareFile(inputs[i].file, inputs[i].archivePath, compression); },
+            [&](size_t i) {
+                checkpoint();
+                auto entry = std::make_unique<PreparedEntry>(std::move(prepared[i]));
+                const uint64_t record = entryRecordSize(*entry);
+                const uint64_t nameLength = entry->header.nameLength;
+                if (!fits(Slot{true, 0, ENTRY_PREFIX_SIZE, 0, 0, 0}, record, nameLength)) {
+                    throw std::runtime_error("Entry does not fit in a volume of " + std::to_string(volumeSize) +
+                                             " bytes: " + entry->archivePath);
+                }
+
+                size_t target = 0;
+                for (size_t d = 1; d < slots.size(); ++d) {
+                    if (slots[d].total < slots[target].total) {
+                        target = d;
+                    }
+                }
+                Slot& slot = slots[target];
+                if (slot.open && !fits(slot, record, nameLength)) {
+                    writers[slot.volume]->close();
+                    slot.open = false;
+                }
+                if (!slot.open) {
+                    const uint32_t number = static_cast<uint32_t>(writers.size());
+                    writers.push_back(std::make_unique<VolumeWriter>(
+                        *this, volumeFile(directories[target], catalog, number), compression));
+                    slot = Slot{true, number, ENTRY_PREFIX_SIZE, 0, 0, slot.total};
+                }
+
+                entries.add(entry->archivePath, entry->header.compressedSize, entry->header.originalSize,
+                            entry->header.timestamp, slot.bytes);
+                entryVolumes.push_back(slot.volume);
+                slot.bytes += record;
+                slot.total += record;
+                slot.count += 1;
+                slot.names += nameLength;
+                writers[slot.volume]->push(std::move(entry));
+            });
+
+        for (auto& writer : writers) {
+            writer->finish();
+        }
+        for (auto& writer : writers) {
+            FileIO::replaceFile(writer->workingPath(), writer->finalPath());
+        }
+
+        // Volume paths are stored relative to the catalog where possible,
+        // so a volume set can be moved as a whole
+        const fs::path base = fs::absolute(catalog).parent_path().lexically_normal();
+        std::string paths;
+        std::vector<VolumeRecord> records;
+        for (const auto& writer : writers) {
+            const fs::path absolute = fs::absolute(writer->finalPath()).lexically_normal();
+            fs::path stored = absolute.lexically_relative(base);
+            if (stored.empty()) {
+                stored = absolute;
+            }
+            paths += stored.generic_string();
+            records.push_back(VolumeRecord{writer->size(), paths.size()});
+            volumePaths.push_back(writer->finalPath().string());
+        }
+
+        std::ofstream out(working, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Failed to create archive: " + archiveName);
+        }
+        uint8_t prefix[ENTRY_PREFIX_SIZE];
+        out.write(reinterpret_cast<const char*>(prefix),
+                  static_cast<std::streamsize>(ArchiveFormat::encodeArchiveHeader(prefix)));
+        VolumeHeader header{};
+        header.signature = VOLUME_SIGNATURE;
+        header.volumeCount = static_cast<uint32_t>(records.size());
+        header.entryCount = entryVolumes.size();
+        header.pathsSize = paths.size();
+        std::vector<uint8_t> table(VOLUME_HEADER_SIZE + entryVolumes.size() * sizeof(uint32_t) +
+                                   records.size() * VOLUME_RECORD_SIZE);
+        ArchiveFormat::encodeVolumeHeader(header, table.data());
+        uint8_t* cursor = table.data() + VOLUME_HEADER_SIZE;
+        for (uint32_t volume : entryVolumes) {
+            ArchiveFormat::storeLE(cursor, volume, 4);
+            cursor += 4;
+        }
+        for (const auto& record : records) {
+            ArchiveFormat::encodeVolumeRecord(record, cursor);
+            cursor += VOLUME_RECORD_SIZE;
+        }
+        out.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size()));
+        out.write(paths.data(), static_cast<std::streamsize>(paths.size()));
+        writeNameIndex(out);
+        if (!out.flush()) {
+            throw std::runtime_error("Failed to write archive: " + archiveName);
+        }
+        out.close();
+        if (syncPolicy.enabled) {
+            FileIO::syncFile(working);
+        }
+        FileIO::replaceFile(working, archiveName);
+        discardUndoRecord();
+    } catch (...) {
+        std::error_code ec;
+        for (auto& writer : writers) {
+            const fs::path partial = writer->workingPath();
+            writer.reset();
+            fs::remove(partial, ec);
+        }
+        fs::remove(working, ec);
+        entries.clear();
+        entryVolumes.clear();
+        volumePaths.clear();
+        throw;
+    }
+
+    std::cout << "Archive '" << archiveName << "' created successfully with " << entries.size()
+              << " files in " << volumePaths.size() << " volumes." << std::endl;
+}
+
+void Archive::readVolumeTable(std::istream& in, const std::string& path) {
+    volumePaths.clear();
+    entryVolumes.clear();
+
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(ENTRY_PREFIX_SIZE));
+    uint8_t encoded[VOLUME_HEADER_SIZE];
+    if (dataEnd < ENTRY_PREFIX_SIZE + sizeof(encoded) || !in.read(reinterpret_cast<char*>(encoded), sizeof(encoded))) {
+        in.clear();
+        return;
+    }
+    const VolumeHeader header = ArchiveFormat::decodeVolumeHeader(encoded);
+    if (header.signature != VOLUME_SIGNATURE) {
+        return;
+    }
+
+    // The table sits between the archive header and the index
+    const uint64_t room = dataEnd - ENTRY_PREFIX_SIZE - sizeof(encoded);
+    const uint64_t tableSize = header.entryCount * sizeof(uint32_t) + header.volumeCount * VOLUME_RECORD_SIZE;
+    if (header.entryCount != entries.size() || header.volumeCount == 0 || tableSize > room ||
+        header.pathsSize > room - tableSize) {
+        throw std::runtime_error("Corrupt volume table: " + path);
+    }
+    std::vector<uint8_t> table(static_cast<size_t>(tableSize));
+    std::string paths(static_cast<size_t>(header.pathsSize), '\0');
+    if (!in.read(reinterpret_cast<char*>(table.data()), static_cast<std::streamsize>(table.size())) ||
+        !in.read(&paths[0], static_cast<std::streamsize>(paths.size()))) {
+        throw std::runtime_error("Corrupt volume table: " + path);
+    }
+    std::vector<uint32_t> volumes(static_cast<size_t>(header.entryCount));
+    for (size_t i = 0; i < volumes.size(); ++i) {
+        volumes[i] = static_cast<uint32_t>(ArchiveFormat::loadLE(table.data() + i * 4, 4));
+        if (volumes[i] >= header.volumeCount) {
+            throw std::runtime_error("Corrupt volume table: " + path);
+        }
+    }
+    std::vector<VolumeRecord> records;
+    const uint8_t* cursor = table.data() + volumes.size() * 4;
+    for (uint32_t i = 0; i < header.volumeCount; ++i, cursor += VOLUME_RECORD_SIZE) {
+        records.push_back(ArchiveFormat::decodeVolumeRecord(cursor));
+    }
+
+    const fs::path base = fs::path(path).parent_path();
+    uint64_t start = 0;
+    for (const auto& record : records) {
+        if (record.pathEnd < start || record.pathEnd > paths.size()) {
+            throw std::runtime_error("Corrupt volume table: " + path);
+        }
+        const fs::path stored(paths.substr(static_cast<size_t>(start), static_cast<size_t>(record.pathEnd - start)));
+        volumePaths.push_back((stored.is_absolute() ? stored : base / stored).string());
+        start = record.pathEnd;
+    }
+    entryVolumes = std::move(volumes);
+}
+
+void Archive::extractVolumes(const fs::path& outPath, const ExtractOptions& options) {
+    // Each volume is a complete archive of its own. Volumes usually sit on
+    // different disks, so they are read at the same time, largest first,
+    // and the worker threads are divided among them.
+    std::vector<uint64_t> sizes;
+    for (const auto& volume : volumePaths) {
+        std::error_code ec;
+        const uint64_t size = fs::file_size(volume, ec);
+        if (ec) {
+            throw std::runtime_error("Failed to open volume: " + volume);
+        }
+        sizes.push_back(size);
+    }
+    const unsigned concurrency = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    EntryScheduler scheduler(static_cast<unsigned>(std::min<size_t>(concurrency, volumePaths.size())), UINT64_MAX);
+    ExtractOptions volumeOptions = options;
+    volumeOptions.threads = std::max(1u, concurrency / scheduler.threadCount());
+
+    scheduler.run(
+        sizes,
+        [&](size_t i) {
+            ExtractEngine engine(volumeOptions);
+            switch (engine.run(volumePaths[i], outPath.generic_string())) {
+            case ExtractResult::Cancelled:
+                throw OperationCancelled();
+            case ExtractResult::Failed:
+                throw std::runtime_error(engine.errorMessage());
+            case ExtractResult::Success:
+                break;
+            }
+        },
+        [](size_t) {});
+}
@@ -0,0 +1,205 @@
+#include "BinaryDelta.h"
+#include "ArchiveFormat.h"
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace {
+
+constexpr uint64_t HASH_MULTIPLIER = 0x100000001B3ull;
+constexpr uint64_t SLOT_MULTIPLIER = 0x9E3779B97F4A7C15ull;
+
+uint64_t windowHash(const char* data) {
+    uint64_t hash = 0;
+    for (size_t i = 0; i < BinaryDelta::WINDOW; ++i) {
+        hash = hash * HASH_MULTIPLIER + static_cast<uint8_t>(data[i]);
+    }
+    return hash;
+}
+
+// HASH_MULTIPLIER^(WINDOW - 1), the weight of the byte leaving the window
+uint64_t leavingWeight() {
+    uint64_t weight = 1;
+    for (size_t i = 1; i < BinaryDelta::WINDOW; ++i) {
+        weight *= HASH_MULTIPLIER;
+    }
+    return weight;
+}
+
+void appendVarint(std::vector<char>& out, uint64_t value) {
+    uint8_t buffer[MAX_VARINT_SIZE];
+    const size_t size = ArchiveFormat::putVarint(buffer, value);
+    out.insert(out.end(), buffer, buffer + size);
+}
+
+// Reads varints from a buffer, throwing at its end
+class DeltaReader {
+public:
+    DeltaReader(const char* data, size_t size) : data(data), size(size) {}
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        uint64_t consumed = 0;
+        if (!ArchiveFormat::getVarint([this](void* out, size_t n) { return take(out, n); }, value, consumed)) {
+            throw std::runtime_error("Corrupt delta");
+        }
+        return value;
+    }
+
+    const char* bytes(uint64_t count) {
+        if (count > size - position) {
+            throw std::runtime_error("Corrupt delta");
+        }
+        const char* start = data + position;
+        position += static_cast<size_t>(count);
+        return start;
+    }
+
+    size_t remaining() const { return size - position; }
+
+private:
+    bool take(void* out, size_t n) {
+        if (n > size - position) {
+            return false;
+        }
+        std::memcpy(out, data + position, n);
+        position += n;
+        return true;
+    }
+
+    const char* data;
+    size_t size;
+    size_t position = 0;
+};
+
+} // namespace
+
+std::vector<char> BinaryDelta::encode(const std::vector<char>& base, const std::vector<char>& target) {
+    if (base.size() > MAX_BASE_SIZE) {
+        throw std::runtime_error("Delta base too large");
+    }
+
+    // Open-addressed by hash; later positions replace earlier ones, which
+    // keeps the table a plain array and loses only repeated content
+    const size_t positions = base.size() >= WINDOW ? (base.size() - WINDOW) / STRIDE + 1 : 0;
+    unsigned bits = 10;
+    while ((size_t{1} << bits) < 2 * positions) {
+        ++bits;
+    }
+    std::vector<uint32_t> table(size_t{1} << bits, 0); // position + 1, 0 = empty
+    auto slot = [bits](uint64_t hash) { return static_cast<size_t>((hash * SLOT_MULTIPLIER) >> (64 - bits)); };
+    for (size_t i = 0; i < positions; ++i) {
+        table[slot(windowHash(base.data() + i * STRIDE))] = static_cast<uint32_t>(i * STRIDE + 1);
+    }
+
+    std::vector<char> instructions;
+    size_t literalStart = 0;
+    uint64_t copyEnd = 0;
+    auto emit = [&](size_t literalEnd, uint64_t copyStart, uint64_t copyLength) {
+        appendVarint(instructions, literalEnd - literalStart);
+        instructions.insert(instructions.end(), target.begin() + static_cast<std::ptrdiff_t>(literalStart),
+                            target.begin() + static_cast<std::ptrdiff_t>(literalEnd));
+        appendVarint(instructions, copyLength);
+        if (copyLength > 0) {
+            appendVarint(instructions, ArchiveFormat::zigzag(static_cast<int64_t>(copyStart - copyEnd)));
+            copyEnd = copyStart + copyLength;
+        }
+    };
+
+    const uint64_t weight = leavingWeight();
+    size_t i = 0;
+    uint64_t hash = target.size() >= WINDOW ? windowHash(target.data()) : 0;
+    while (i + WINDOW <= target.size()) {
+        const uint32_t candidate = table[slot(hash)];
+        if (candidate != 0 && std::memcmp(base.data() + candidate - 1, target.data() + i, WINDOW) == 0) {
+            size_t start = candidate - 1;
+            size_t length = WINDOW;
+            while (i + length < target.size() && start + length < base.size() &&
+                   base[start + length] == target[i + length]) {
+                ++length;
+            }
+            size_t back = 0;
+            while (i - back > literalStart && start > back && base[start - back - 1] == target[i - back - 1]) {
+                ++back;
+            }
+            emit(i - back, start - back, length + back);
+            i += length;
+            literalStart = i;
+            if (i + WINDOW <= target.size()) {
+                hash = windowHash(target.data() + i);
+            }
+            continue;
+        }
+        if (i + WINDOW < target.size()) {
+            hash = (hash - weight * static_cast<uint8_t>(target[i])) * HASH_MULTIPLIER +
+                   static_cast<uint8_t>(target[i + WINDOW]);
+        }
+        ++i;
+    }
+    if (literalStart < target.size() || instructions.empty()) {
+        emit(target.size(), 0, 0);
+    }
+
+    std::vector<char> delta;
+    appendVarint(delta, target.size());
+    appendVarint(delta, instructions.size());
+    uLongf packedSize = compressBound(static_cast<uLong>(instructions.size()));
+    const size_t header = delta.size();
+    delta.resize(header + packedSize);
+    if (compress2(reinterpret_cast<Bytef*>(delta.data() + header), &packedSize,
+                  reinterpret_cast<const Bytef*>(instructions.data()), static_cast<uLong>(instructions.size()),
+                  Z_BEST_COMPRESSION) != Z_OK) {
+        throw std::runtime_error("Failed to compress delta");
+    }
+    delta.resize(header + packedSize);
+    return delta;
+}
+
+std::vector<char> BinaryDelta::apply(const std::vector<char>& base, const char* delta, size_t size,
+                                     uint64_t maxTargetSize) {
+    DeltaReader header(delta, size);
+    const uint64_t targetSize = header.varint();
+    const uint64_t instructionsSize = header.varint();
+    const size_t packedSize = header.remaining();
+    if (targetSize > maxTargetSize || instructionsSize / MAX_ZLIB_RATIO > packedSize) {
+        throw std::runtime_error("Corrupt delta");
+    }
+
+    std::vector<char> instructions(static_cast<size_t>(instructionsSize));
+    uLongf unpackedSize = static_cast<uLongf>(instructions.size());
+    if (uncompress(reinterpret_cast<Bytef*>(instructions.data()), &unpackedSize,
+                   reinterpret_cast<const Bytef*>(header.bytes(packedSize)), static_cast<uLong>(packedSize)) != Z_OK ||
+        unpackedSize != instructions.size()) {
+        throw std::runtime_error("Corrupt delta");
+    }
+
+    DeltaReader reader(instructions.data(), instructions.size());
+    std::vector<char> target;
+    target.reserve(static_cast<size_t>(targetSize));
+    uint64_t copyEnd = 0;
+    while (target.size() < targetSize || reader.remaining() > 0) {
+        const uint64_t literalLength = reader.varint();
+        if (literalLength > targetSize - target.size()) {
+            throw std::runtime_error("Corrupt delta");
+        }
+        const char* literal = reader.bytes(literalLength);
+        target.insert(target.end(), literal, literal + literalLength);
+
+        const uint64_t copyLength = reader.varint();
+        if (copyLength == 0) {
+            continue;
+        }
+        const uint64_t copyStart = copyEnd + static_cast<uint64_t>(ArchiveFormat::unzigzag(reader.varint()));
+        if (copyStart > base.size() || copyLength > base.size() - copyStart ||
+            copyLength > targetSize - target.size()) {
+            throw std::runtime_error("Corrupt delta");
+        }
+        target.insert(target.end(), base.begin() + static_cast<std::ptrdiff_t>(copyStart),
+                      base.begin() + static_cast<std::ptrdiff_t>(copyStart + copyLength));
+        copyEnd = copyStart + copyLength;
+    }
+    if (target.size() != targetSize) {
+        throw std::runtime_error("Corrupt delta");
+    }
+    return target;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file BinaryDelta.h
+ * @brief Copy/add deltas between two byte strings, used by archive patches
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief xdelta-style encoder and decoder
+ *
+ * The base is indexed by a rolling hash of WINDOW bytes at every STRIDE-th
+ * position; the target is scanned with the same hash, and each hit is
+ * verified and extended in both directions into a copy from the base.
+ * Bytes between copies are added literally. A delta is
+ *
+ *   varint  targetSize
+ *   varint  instructionsSize
+ *   zlib stream of instructions
+ *
+ * where each instruction is a varint add length, that many literal bytes,
+ * a varint copy length and, if that is not zero, the zigzag varint distance
+ * from the end of the previous copy to the start of this one. Copies of
+ * nearby base regions therefore cost a byte or two, and the literals of a
+ * text change compress along with the instructions.
+ */
+class BinaryDelta {
+public:
+    static constexpr size_t WINDOW = 32;
+    static constexpr size_t STRIDE = 16;
+
+    /**
+     * @brief Largest base that can be indexed; positions are 32-bit
+     */
+    static constexpr uint64_t MAX_BASE_SIZE = UINT32_MAX - 1;
+
+    /**
+     * @brief Most bytes a zlib stream inflates to per compressed byte
+     */
+    static constexpr uint64_t MAX_ZLIB_RATIO = 1032;
+
+    static std::vector<char> encode(const std::vector<char>& base, const std::vector<char>& target);
+
+    /**
+     * @brief Rebuilds the target; throws std::runtime_error on a corrupt delta
+     *
+     * Sizes in the delta are checked against @p size and @p maxTargetSize
+     * before anything is allocated for them.
+     */
+    static std::vector<char> apply(const std::vector<char>& base, const char* delta, size_t size,
+                                   uint64_t maxTargetSize);
+};
@@ -0,0 +1,28 @@
+#include "CancellationToken.h"
+#include <chrono>
+
+void CancellationToken::pause() {
+    std::lock_guard<std::mutex> lock(pauseMutex);
+    paused = true;
+}
+
+void CancellationToken::resume() {
+    {
+        std::lock_guard<std::mutex> lock(pauseMutex);
+        paused = false;
+    }
+    pauseWake.notify_all();
+}
+
+void CancellationToken::checkpoint() {
+    if (isPaused()) {
+        std::unique_lock<std::mutex> lock(pauseMutex);
+        // cancel() does not notify (it must stay signal-safe), so poll for it
+        while (paused && !isCancelled()) {
+            pauseWake.wait_for(lock, std::chrono::milliseconds(100));
+        }
+    }
+    if (isCancelled()) {
+        throw OperationCancelled();
+    }
+}
@@ -0,0 +1,52 @@
+/**
+ * @file CancellationToken.h
+ * @brief Cooperative cancellation and pausing of archive operations
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+
+/**
+ * @brief Thrown by an operation that stopped because its token was cancelled
+ */
+class OperationCancelled : public std::runtime_error {
+public:
+    OperationCancelled() : std::runtime_error("Operation cancelled") {}
+};
+
+/**
+ * @brief Shared flag that long-running operations check between entries
+ *
+ * cancel() only sets an atomic flag, so it may be called from any thread or
+ * from a signal handler. pause()/resume() hold operations at their next
+ * checkpoint until resumed or cancelled.
+ */
+class CancellationToken {
+public:
+    CancellationToken() = default;
+
+    CancellationToken(const CancellationToken&) = delete;
+    CancellationToken& operator=(const CancellationToken&) = delete;
+
+    void cancel() noexcept { cancelled.store(true, std::memory_order_relaxed); }
+    bool isCancelled() const noexcept { return cancelled.load(std::memory_order_relaxed); }
+
+    void pause();
+    void resume();
+    bool isPaused() const noexcept { return paused.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Waits while paused, then throws OperationCancelled if cancelled
+     */
+    void checkpoint();
+
+private:
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> paused{false};
+    std::mutex pauseMutex;
+    std::condition_variable pauseWake;
+};
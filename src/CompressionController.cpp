@@ -0,0 +1,114 @@
+#include "CompressionController.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Typical zlib throughput and output size per level relative to level 6,
+// used only until a level has been measured
+constexpr std::array<double, CompressionController::MAX_LEVEL + 1> PRIOR_SPEED = {
+    0, 3.0, 2.8, 2.4, 1.8, 1.4, 1.0, 0.8, 0.45, 0.3};
+constexpr std::array<double, CompressionController::MAX_LEVEL + 1> PRIOR_RATIO = {
+    0, 1.15, 1.12, 1.09, 1.05, 1.02, 1.0, 0.995, 0.99, 0.99};
+
+// A sample's weight halves after this many newer bytes
+constexpr double HALF_LIFE_BYTES = 2.0 * 1024 * 1024;
+
+// Moving up needs this much spare speed, so the level does not flap
+// between two neighbours that both roughly keep up
+constexpr double RAISE_HEADROOM = 1.1;
+
+constexpr double MIN_SECONDS = 1e-9;
+constexpr double MIN_RATIO = 1e-3;
+
+double seconds(CompressionController::Duration elapsed) {
+    return std::chrono::duration<double>(elapsed).count();
+}
+
+} // namespace
+
+void CompressionController::Rate::add(double input, double output, double elapsed) {
+    const double keep = std::exp2(-input / HALF_LIFE_BYTES);
+    inputBytes = inputBytes * keep + input;
+    outputBytes = outputBytes * keep + output;
+    seconds = seconds * keep + elapsed;
+}
+
+void CompressionController::reset(unsigned workerCount) {
+    std::lock_guard<std::mutex> lock(mutex);
+    levels = {};
+    sink = Rate();
+    blocks = {};
+    workers = workerCount ? workerCount : 1;
+    current.store(START_LEVEL, std::memory_order_relaxed);
+}
+
+std::array<uint64_t, CompressionController::MAX_LEVEL + 1> CompressionController::blocksPerLevel() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return blocks;
+}
+
+void CompressionController::recordCompression(int level, uint64_t inputBytes, uint64_t outputBytes,
+                                              Duration elapsed) {
+    if (level < MIN_LEVEL || level > MAX_LEVEL || inputBytes == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    levels[level].add(static_cast<double>(inputBytes), static_cast<double>(outputBytes), seconds(elapsed));
+    ++blocks[level];
+
+    // Nothing is known about the sink until the first write
+    if (sink.inputBytes <= 0) {
+        return;
+    }
+    const double sinkSpeed = sink.inputBytes / std::max(sink.seconds, MIN_SECONDS);
+
+    // The highest level whose compression keeps up with what the sink
+    // takes; if none does, the CPU is the bottleneck and the fastest wins
+    const int now = current.load(std::memory_order_relaxed);
+    int target = MIN_LEVEL;
+    for (int candidate = MAX_LEVEL; candidate > MIN_LEVEL; --candidate) {
+        const double demand = sinkSpeed / std::max(ratio(candidate), MIN_RATIO);
+        const double headroom = candidate > now ? RAISE_HEADROOM : 1.0;
+        if (speed(candidate) * workers >= demand * headroom) {
+            target = candidate;
+            break;
+        }
+    }
+    current.store(now + (target > now) - (target < now), std::memory_order_relaxed);
+}
+
+void CompressionController::recordWrite(uint64_t bytes, Duration elapsed) {
+    // Flushes carry no bytes, so they add time without aging the average
+    std::lock_guard<std::mutex> lock(mutex);
+    sink.add(static_cast<double>(bytes), 0, seconds(elapsed));
+}
+
+int CompressionController::nearestMeasured(int level) const {
+    for (int distance = 0; distance <= MAX_LEVEL - MIN_LEVEL; ++distance) {
+        for (int candidate : {level - distance, level + distance}) {
+            if (candidate >= MIN_LEVEL && candidate <= MAX_LEVEL && levels[candidate].inputBytes > 0) {
+                return candidate;
+            }
+        }
+    }
+    return 0;
+}
+
+double CompressionController::speed(int level) const {
+    const int measured = nearestMeasured(level);
+    if (measured == 0) {
+        return 0;
+    }
+    const Rate& rate = levels[measured];
+    return rate.inputBytes / std::max(rate.seconds, MIN_SECONDS) * PRIOR_SPEED[level] / PRIOR_SPEED[measured];
+}
+
+double CompressionController::ratio(int level) const {
+    const int measured = nearestMeasured(level);
+    if (measured == 0) {
+        return 1;
+    }
+    const Rate& rate = levels[measured];
+    return rate.outputBytes / rate.inputBytes * PRIOR_RATIO[level] / PRIOR_RATIO[measured];
+}
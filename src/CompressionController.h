@@ -0,0 +1,91 @@
+/**
+ * @file CompressionController.h
+ * @brief Picks deflate levels from measured compression and write speeds
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * @brief Chooses the deflate level for CompressionType::Adaptive
+ *
+ * Writers report how long each block took to compress at its level and how
+ * long the archive sink took to take the output. The controller keeps
+ * decayed per-level averages and picks the highest level that still
+ * compresses fast enough to keep the sink busy: a slow disk or network
+ * share gets better ratios, a fast one gets the cheaper levels. Levels
+ * that were never tried are estimated from the measured ones using typical
+ * zlib speed and ratio ratios, and the level moves one step per block so
+ * a noisy sample cannot swing it across the range.
+ *
+ * With several compressing threads feeding one sink, the measured speed
+ * per thread is multiplied by the worker count. All members may be called
+ * from any thread.
+ */
+class CompressionController {
+public:
+    static constexpr int MIN_LEVEL = 1;
+    static constexpr int MAX_LEVEL = 9;
+    static constexpr int START_LEVEL = 6;
+    static constexpr size_t BLOCK_SIZE = 1 << 20; ///< Input bytes between level decisions
+
+    using Duration = std::chrono::steady_clock::duration;
+
+    CompressionController() = default;
+
+    /**
+     * @brief Forgets all measurements and starts over at START_LEVEL
+     * @param workers Threads compressing in parallel into the same sink
+     */
+    void reset(unsigned workers = 1);
+
+    /**
+     * @brief Level to use for the next block
+     */
+    int level() const { return current.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Reports one compressed block and re-evaluates the level
+     * @param level Level the block was compressed at
+     * @param inputBytes Uncompressed bytes in the block
+     * @param outputBytes Compressed bytes it produced
+     */
+    void recordCompression(int level, uint64_t inputBytes, uint64_t outputBytes, Duration elapsed);
+
+    /**
+     * @brief Reports time the sink spent taking @p bytes of compressed data;
+     *        flushes and syncs report their time with zero bytes
+     */
+    void recordWrite(uint64_t bytes, Duration elapsed);
+
+    /**
+     * @brief Number of blocks compressed at each level (index 0 unused)
+     */
+    std::array<uint64_t, MAX_LEVEL + 1> blocksPerLevel() const;
+
+private:
+    // Decayed sums, so recent blocks count most and rates stay byte-weighted;
+    // the sink counts the bytes it took as input
+    struct Rate {
+        double inputBytes = 0;
+        double outputBytes = 0;
+        double seconds = 0;
+        void add(double input, double output, double elapsed);
+    };
+
+    double speed(int level) const; ///< Input bytes per second
+    double ratio(int level) const; ///< Output bytes per input byte
+    int nearestMeasured(int level) const;
+
+    mutable std::mutex mutex;
+    std::array<Rate, MAX_LEVEL + 1> levels{};
+    Rate sink;
+    std::array<uint64_t, MAX_LEVEL + 1> blocks{};
+    unsigned workers = 1;
+    std::atomic<int> current{START_LEVEL};
+};
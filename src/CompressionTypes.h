@@ -11,7 +11,16 @@ enum class CompressionType : int {
     Fastest = Z_BEST_SPEED,         ///< Fastest compression (1)
     Fast = 3,                       ///< Fast compression
     Normal = Z_DEFAULT_COMPRESSION, ///< Normal compression (-1/6)
-    Best = Z_BEST_COMPRESSION       ///< Maximum compression (9)
+    Best = Z_BEST_COMPRESSION,      ///< Maximum compression (9)
+    Adaptive = 10                   ///< Level picked per block from measured speeds, see CompressionController
 };
 
-#endif // COMPRESSION_TYPES_H
\ No newline at end of file
+/**
+ * @brief zlib level for a compression type; Adaptive starts at the default
+ *        level wherever nothing adapts it
+ */
+inline int deflateLevel(CompressionType compression) {
+    return compression == CompressionType::Adaptive ? Z_DEFAULT_COMPRESSION : static_cast<int>(compression);
+}
+
+#endif // COMPRESSION_TYPES_H
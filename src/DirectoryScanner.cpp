@@ -0,0 +1,221 @@
+#include "DirectoryScanner.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#endif
+
+namespace fs = std::filesystem;
+
+DirectoryScanner::DirectoryScanner(unsigned threadCount) : threads(threadCount) {
+    if (threads == 0) {
+        // Scanning is latency bound (especially on network filesystems), so
+        // use a few threads even on small machines.
+        threads = std::max(4u, std::thread::hardware_concurrency());
+    }
+}
+
+#ifdef _WIN32
+
+std::vector<fs::path> DirectoryScanner::scan(const std::vector<fs::path>& roots) {
+    // FindNextFile already returns the file type, so directory_entry's
+    // cached status avoids an extra stat per file.
+    std::vector<fs::path> files;
+    for (const auto& root : roots) {
+        if (!fs::is_directory(root)) {
+            files.push_back(root);
+            continue;
+        }
+        for (const auto& entry : fs::recursive_directory_iterator(root)) {
+            if (entry.is_regular_file()) {
+                files.push_back(entry.path());
+            }
+        }
+    }
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+    return files;
+}
+
+#else
+
+namespace {
+
+// Directory queue shared by the walker threads. pending counts directories
+// that are queued or being read; the walk is done when it drops to zero.
+struct ScanState {
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::string> queue;
+    size_t pending = 0;
+    std::exception_ptr error;
+
+    void push(std::string dir) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(dir));
+            ++pending;
+        }
+        wake.notify_one();
+    }
+
+    bool pop(std::string& dir) {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return !queue.empty() || pending == 0; });
+        if (queue.empty()) {
+            return false;
+        }
+        dir = std::move(queue.front());
+        queue.pop_front();
+        return true;
+    }
+
+    void done() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0) {
+            wake.notify_all();
+        }
+    }
+
+    void fail(std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+            error = e;
+        }
+        // Drop remaining work so the other threads wind down
+        pending -= queue.size();
+        queue.clear();
+    }
+};
+
+void readDirectory(const std::string& dir, ScanState& state, std::vector<std::string>& found) {
+    DIR* handle = ::opendir(dir.c_str());
+    if (!handle) {
+        throw fs::filesystem_error("Failed to open directory", fs::path(dir),
+                                   std::error_code(errno, std::generic_category()));
+    }
+
+    std::string path;
+    while (dirent* entry = ::readdir(handle)) {
+        const char* name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        path.assign(dir);
+        if (path.back() != '/') {
+            path += '/';
+        }
+        path += name;
+
+        bool isFile = false;
+        bool isDir = false;
+        switch (entry->d_type) {
+        case DT_REG:
+            isFile = true;
+            break;
+        case DT_DIR:
+            isDir = true;
+            break;
+        case DT_LNK:
+        case DT_UNKNOWN: {
+            // Symlinks are resolved for files only, like is_regular_file();
+            // directories found through a link are not descended into.
+            struct stat st;
+            if (entry->d_type == DT_UNKNOWN && ::lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+                isDir = true;
+            } else if (::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+                isFile = true;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+
+        if (isDir) {
+            state.push(path);
+        } else if (isFile) {
+            found.push_back(path);
+        }
+    }
+    ::closedir(handle);
+}
+
+} // namespace
+
+std::vector<fs::path> DirectoryScanner::scan(const std::vector<fs::path>& roots) {
+    ScanState state;
+    std::vector<std::string> rootFiles;
+    for (const auto& root : roots) {
+        if (fs::is_directory(root)) {
+            state.push(root.string());
+        } else {
+            rootFiles.push_back(root.string());
+        }
+    }
+
+    // Each thread collects into its own vector; they are merged and sorted
+    // once at the end instead of maintaining an ordered set during the walk.
+    std::vector<std::vector<std::string>> found(threads);
+    auto worker = [&](std::vector<std::string>& local) {
+        std::string dir;
+        while (state.pop(dir)) {
+            try {
+                readDirectory(dir, state, local);
+            } catch (...) {
+                state.fail(std::current_exception());
+            }
+            state.done();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (unsigned i = 1; i < threads; ++i) {
+        pool.emplace_back(worker, std::ref(found[i]));
+    }
+    worker(found[0]);
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    if (state.error) {
+        std::rethrow_exception(state.error);
+    }
+
+    size_t total = rootFiles.size();
+    for (const auto& local : found) {
+        total += local.size();
+    }
+    std::vector<std::string> merged;
+    merged.reserve(total);
+    merged.insert(merged.end(), rootFiles.begin(), rootFiles.end());
+    for (auto& local : found) {
+        merged.insert(merged.end(), std::make_move_iterator(local.begin()),
+                      std::make_move_iterator(local.end()));
+        std::vector<std::string>().swap(local);
+    }
+
+    std::sort(merged.begin(), merged.end());
+    merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+
+    std::vector<fs::path> files;
+    files.reserve(merged.size());
+    for (auto& path : merged) {
+        files.emplace_back(std::move(path));
+    }
+    return files;
+}
+
+#endif
@@ -0,0 +1,37 @@
+/**
+ * @file DirectoryScanner.h
+ * @brief Parallel collection of input files from directory trees
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+/**
+ * @brief Walks directory trees on several threads and collects regular files
+ *
+ * On POSIX systems entries are classified from readdir's d_type, so a stat
+ * call is only made for symlinks and for filesystems that do not report a
+ * type. Symlinks to files are collected; symlinks to directories are not
+ * followed, matching std::filesystem::recursive_directory_iterator.
+ */
+class DirectoryScanner {
+public:
+    /**
+     * @param threads Number of walker threads (0 = pick from hardware concurrency)
+     */
+    explicit DirectoryScanner(unsigned threads = 0);
+
+    /**
+     * @brief Collects all regular files below @p roots
+     * @param roots Directories to walk; regular files are passed through as-is
+     * @return Sorted, duplicate-free list of files
+     */
+    std::vector<std::filesystem::path> scan(const std::vector<std::filesystem::path>& roots);
+
+    unsigned threadCount() const { return threads; }
+
+private:
+    unsigned threads;
+};
@@ -0,0 +1,16 @@
+/**
+ * @file EmbeddedStub.h
+ * @brief The extractor stub executable, embedded at build time
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/**
+ * @brief Bytes of the extractor_stub executable built alongside the library
+ *
+ * Generated from the stub by cmake/EmbedFile.cmake.
+ */
+extern const unsigned char EMBEDDED_EXTRACTOR_STUB[];
+extern const size_t EMBEDDED_EXTRACTOR_STUB_SIZE;
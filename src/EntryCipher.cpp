@@ -0,0 +1,178 @@
+#include "EntryCipher.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <stdexcept>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+namespace {
+
+// EVP_CipherUpdate takes an int length
+constexpr size_t MAX_UPDATE = 1u << 30;
+
+// Fetched once; looking the cipher up for every entry would cost more
+// than encrypting a small one
+const EVP_CIPHER* aes256Gcm() {
+    static EVP_CIPHER* cipher = EVP_CIPHER_fetch(nullptr, "AES-256-GCM", nullptr);
+    return cipher;
+}
+
+// Clears a string that held key material once it goes out of scope
+struct KeyText {
+    std::string text;
+
+    ~KeyText() { OPENSSL_cleanse(&text[0], text.size()); }
+};
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+} // namespace
+
+struct EntryCipher::Context {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    EVP_CIPHER_CTX* saved = nullptr;
+
+    ~Context() {
+        EVP_CIPHER_CTX_free(saved);
+        EVP_CIPHER_CTX_free(ctx);
+    }
+
+    void start(const Key& key, const uint8_t* iv, std::string_view name, int encrypt) {
+        int length = 0;
+        if (!ctx || !aes256Gcm() ||
+            EVP_CipherInit_ex(ctx, aes256Gcm(), nullptr, key.data(), iv, encrypt) != 1 ||
+            EVP_CipherUpdate(ctx, nullptr, &length, reinterpret_cast<const unsigned char*>(name.data()),
+                             static_cast<int>(name.size())) != 1) {
+            throw std::runtime_error("Failed to initialize encryption");
+        }
+    }
+};
+
+EntryCipher::EntryCipher(const Key& key, std::string_view name) : context(std::make_unique<Context>()) {
+    if (RAND_bytes(iv.data(), static_cast<int>(iv.size())) != 1) {
+        throw std::runtime_error("Failed to generate a nonce");
+    }
+    context->start(key, iv.data(), name, 1);
+}
+
+EntryCipher::EntryCipher(const Key& key, const uint8_t* nonce, std::string_view name)
+    : context(std::make_unique<Context>()) {
+    std::copy(nonce, nonce + iv.size(), iv.begin());
+    context->start(key, iv.data(), name, 0);
+}
+
+EntryCipher::~EntryCipher() = default;
+
+bool EntryCipher::update(const char* in, char* out, size_t size) {
+    while (size > 0) {
+        const int piece = static_cast<int>(std::min(size, MAX_UPDATE));
+        int length = 0;
+        if (EVP_CipherUpdate(context->ctx, reinterpret_cast<unsigned char*>(out), &length,
+                             reinterpret_cast<const unsigned char*>(in), piece) != 1 ||
+            length != piece) {
+            return false;
+        }
+        in += piece;
+        out += piece;
+        size -= static_cast<size_t>(piece);
+    }
+    return true;
+}
+
+void EntryCipher::mark() {
+    if (!context->saved) {
+        context->saved = EVP_CIPHER_CTX_new();
+    }
+    EVP_CIPHER_CTX_copy(context->saved, context->ctx);
+}
+
+void EntryCipher::rewind() {
+    EVP_CIPHER_CTX_copy(context->ctx, context->saved);
+}
+
+bool EntryCipher::verify(const uint8_t* tag) {
+    int length = 0;
+    unsigned char none[1];
+    return EVP_CIPHER_CTX_ctrl(context->ctx, EVP_CTRL_GCM_SET_TAG, static_cast<int>(ENCRYPTION_TAG_SIZE),
+                               const_cast<uint8_t*>(tag)) == 1 &&
+           EVP_CipherFinal_ex(context->ctx, none, &length) == 1;
+}
+
+void EntryCipher::finish(uint8_t* tag) {
+    int length = 0;
+    unsigned char none[1];
+    if (EVP_CipherFinal_ex(context->ctx, none, &length) != 1 ||
+        EVP_CIPHER_CTX_ctrl(context->ctx, EVP_CTRL_GCM_GET_TAG, static_cast<int>(ENCRYPTION_TAG_SIZE), tag) != 1) {
+        throw std::runtime_error("Encryption failed");
+    }
+}
+
+std::vector<char> EntryCipher::seal(const Key& key, std::string_view name, const std::vector<char>& payload) {
+    EntryCipher cipher(key, name);
+    std::vector<char> sealed(ENCRYPTION_NONCE_SIZE + payload.size() + ENCRYPTION_TAG_SIZE);
+    std::copy(cipher.nonce(), cipher.nonce() + ENCRYPTION_NONCE_SIZE, sealed.begin());
+    if (!cipher.update(payload.data(), sealed.data() + ENCRYPTION_NONCE_SIZE, payload.size())) {
+        throw std::runtime_error("Encryption failed");
+    }
+    cipher.finish(reinterpret_cast<uint8_t*>(sealed.data() + ENCRYPTION_NONCE_SIZE + payload.size()));
+    return sealed;
+}
+
+EntryCipher::Key EntryCipher::loadKey(const std::filesystem::path& file) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Failed to open key file: " + file.string());
+    }
+    in.seekg(0, std::ios::end);
+    const std::streamoff size = in.tellg();
+    in.seekg(0);
+    KeyText contents{std::string(static_cast<size_t>(std::max<std::streamoff>(size, 0)), '\0')};
+    if (!in.read(&contents.text[0], static_cast<std::streamsize>(contents.text.size()))) {
+        throw std::runtime_error("Failed to read key file: " + file.string());
+    }
+    Key key{};
+    if (contents.text.size() == KEY_SIZE) {
+        std::copy(contents.text.begin(), contents.text.end(), key.begin());
+        return key;
+    }
+    // Reserved up front so no copy of the digits is left behind by growth
+    KeyText digits;
+    digits.text.reserve(contents.text.size());
+    for (char c : contents.text) {
+        if (!std::isspace(static_cast<unsigned char>(c))) {
+            digits.text += c;
+        }
+    }
+    if (digits.text.size() != 2 * KEY_SIZE) {
+        throw std::runtime_error("Key file must hold 32 bytes or 64 hex digits: " + file.string());
+    }
+    for (size_t i = 0; i < KEY_SIZE; ++i) {
+        const int high = hexValue(digits.text[2 * i]);
+        const int low = hexValue(digits.text[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            OPENSSL_cleanse(key.data(), key.size());
+            throw std::runtime_error("Key file must hold 32 bytes or 64 hex digits: " + file.string());
+        }
+        key[i] = static_cast<uint8_t>(high << 4 | low);
+    }
+    return key;
+}
+
+EntryDecryptor::~EntryDecryptor() {
+    OPENSSL_cleanse(key.data(), key.size());
+}
+
+std::unique_ptr<PayloadCipher> EntryDecryptor::begin(const uint8_t* nonce, const std::string& name) {
+    try {
+        return std::make_unique<EntryCipher>(key, nonce, name);
+    } catch (const std::exception&) {
+        return nullptr;
+    }
+}
@@ -0,0 +1,94 @@
+/**
+ * @file EntryCipher.h
+ * @brief AES-256-GCM sealing of entry payloads (ENTRY_FLAG_ENCRYPTED)
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ExtractEngine.h"
+
+/**
+ * @brief Encrypts or decrypts one entry's payload
+ *
+ * Every entry has its own random nonce, so entries stay independently
+ * decryptable and random access works as without encryption. The entry
+ * name is authenticated with the payload, so sealed payloads cannot be
+ * swapped between entries. The cipher comes from OpenSSL, which uses
+ * AES-NI/VAES and PCLMULQDQ where the CPU has them.
+ */
+class EntryCipher : public PayloadCipher {
+public:
+    static constexpr size_t KEY_SIZE = 32;
+
+    using Key = std::array<uint8_t, KEY_SIZE>;
+
+    /**
+     * @brief Starts encrypting the entry @p name under a fresh random nonce
+     */
+    EntryCipher(const Key& key, std::string_view name);
+
+    /**
+     * @brief Starts decrypting the entry @p name whose payload begins with @p nonce
+     */
+    EntryCipher(const Key& key, const uint8_t* nonce, std::string_view name);
+
+    ~EntryCipher() override;
+
+    EntryCipher(const EntryCipher&) = delete;
+    EntryCipher& operator=(const EntryCipher&) = delete;
+
+    /// ENCRYPTION_NONCE_SIZE bytes to write before the ciphertext
+    const uint8_t* nonce() const { return iv.data(); }
+
+    bool update(const char* in, char* out, size_t size) override;
+    void mark() override;
+    void rewind() override;
+    bool verify(const uint8_t* tag) override;
+
+    /**
+     * @brief Ends encryption and stores the ENCRYPTION_TAG_SIZE byte tag
+     */
+    void finish(uint8_t* tag);
+
+    /**
+     * @brief Seals a whole payload: nonce, ciphertext and tag
+     */
+    static std::vector<char> seal(const Key& key, std::string_view name, const std::vector<char>& payload);
+
+    /**
+     * @brief Reads a key file holding 32 raw bytes or 64 hex digits
+     *
+     * The file's contents are cleared from memory once the key is parsed.
+     */
+    static Key loadKey(const std::filesystem::path& file);
+
+private:
+    struct Context;
+
+    std::unique_ptr<Context> context;
+    std::array<uint8_t, ENCRYPTION_NONCE_SIZE> iv{};
+};
+
+/**
+ * @brief Hands ExtractEngine and Archive::decodeEntry a cipher per entry
+ */
+class EntryDecryptor : public PayloadDecryptor {
+public:
+    explicit EntryDecryptor(const EntryCipher::Key& key) : key(key) {}
+    ~EntryDecryptor() override; ///< Clears the key
+
+    EntryDecryptor(const EntryDecryptor&) = delete;
+    EntryDecryptor& operator=(const EntryDecryptor&) = delete;
+
+    std::unique_ptr<PayloadCipher> begin(const uint8_t* nonce, const std::string& name) override;
+
+private:
+    EntryCipher::Key key;
+};
@@ -0,0 +1,139 @@
+#include "EntryScheduler.h"
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+
+namespace {
+
+// Largest job first; among equal sizes the earlier one
+struct SmallerJob {
+    const std::vector<uint64_t>* sizes;
+    bool operator()(size_t a, size_t b) const {
+        return (*sizes)[a] != (*sizes)[b] ? (*sizes)[a] < (*sizes)[b] : a > b;
+    }
+};
+
+struct ScheduleState {
+    ScheduleState(const std::vector<uint64_t>& sizes, unsigned threads, uint64_t windowBytes)
+        : sizes(sizes), threads(threads), windowBytes(windowBytes), ready(SmallerJob{&sizes}),
+          finished(sizes.size(), false), errors(sizes.size()) {}
+
+    const std::vector<uint64_t>& sizes;
+    const unsigned threads;
+    const uint64_t windowBytes;
+
+    std::mutex mutex;
+    std::condition_variable wake;      ///< Workers: a job became ready, or stopping
+    std::condition_variable jobDone;   ///< Consumer: a job finished
+    std::priority_queue<size_t, std::vector<size_t>, SmallerJob> ready;
+    std::vector<bool> finished;
+    std::vector<std::exception_ptr> errors;
+    size_t consumed = 0;               ///< Jobs before this index are consumed
+    size_t frontier = 0;               ///< Jobs before this index were admitted
+    uint64_t windowUsed = 0;           ///< Input bytes in [consumed, frontier)
+    bool stopping = false;
+
+    // Admits jobs into the window; called with the mutex held
+    void admit() {
+        while (frontier < sizes.size() &&
+               (frontier - consumed < threads || windowUsed + sizes[frontier] <= windowBytes)) {
+            ready.push(frontier);
+            windowUsed += sizes[frontier];
+            ++frontier;
+        }
+    }
+
+    void worker(const std::function<void(size_t)>& work) {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [this] { return stopping || !ready.empty(); });
+            if (stopping) {
+                return;
+            }
+            const size_t job = ready.top();
+            ready.pop();
+            lock.unlock();
+            std::exception_ptr error;
+            try {
+                work(job);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            lock.lock();
+            finished[job] = true;
+            errors[job] = error;
+            jobDone.notify_one();
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+    }
+};
+
+} // namespace
+
+EntryScheduler::EntryScheduler(unsigned threads, uint64_t windowBytes)
+    : threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())),
+      windowBytes(windowBytes) {
+}
+
+void EntryScheduler::run(const std::vector<uint64_t>& sizes, const std::function<void(size_t)>& work,
+                         const std::function<void(size_t)>& consume) {
+    const size_t count = sizes.size();
+    if (threads == 1 || count <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            work(i);
+            consume(i);
+        }
+        return;
+    }
+
+    ScheduleState state(sizes, threads, windowBytes);
+    state.admit();
+
+    // Joins the workers however the consumer loop ends
+    struct Pool {
+        ScheduleState& state;
+        std::vector<std::thread> threads;
+        ~Pool() {
+            state.stop();
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+    } pool{state, {}};
+    const unsigned workers = static_cast<unsigned>(std::min<size_t>(threads, count));
+    pool.threads.reserve(workers);
+    for (unsigned i = 0; i < workers; ++i) {
+        pool.threads.emplace_back([&state, &work] { state.worker(work); });
+    }
+
+    for (size_t next = 0; next < count; ++next) {
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            state.jobDone.wait(lock, [&] { return static_cast<bool>(state.finished[next]); });
+            error = state.errors[next];
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        consume(next);
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.windowUsed -= sizes[next];
+            state.consumed = next + 1;
+            state.admit();
+        }
+        state.wake.notify_all();
+    }
+}
@@ -0,0 +1,51 @@
+/**
+ * @file EntryScheduler.h
+ * @brief Parallel per-entry work for create, largest inputs first
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * @brief Runs one job per entry on worker threads and hands the results to
+ *        the calling thread in entry order
+ *
+ * Workers always take the largest job that has not started, so a big file
+ * does not end up running alone on one core at the end of a run. A
+ * finished job waits until every job before it has been consumed, which
+ * keeps the output order fixed. To bound the memory those waiting results
+ * take, only jobs in a window ahead of the consumer are started: up to
+ * windowBytes of input, and at least one job per thread.
+ */
+class EntryScheduler {
+public:
+    static constexpr uint64_t DEFAULT_WINDOW_BYTES = 512ull << 20;
+
+    /**
+     * @param threads Worker threads (0 = one per core); with 1, each job
+     *        runs on the calling thread right before it is consumed
+     */
+    explicit EntryScheduler(unsigned threads = 0, uint64_t windowBytes = DEFAULT_WINDOW_BYTES);
+
+    /**
+     * @brief Runs work(i) for every job and consume(i) in index order
+     *
+     * work runs concurrently on the worker threads; consume runs on the
+     * calling thread. An exception from work(i) is rethrown when job i's
+     * turn to be consumed comes, so errors surface in the same order as
+     * without threads. Once anything throws, no further jobs start and
+     * run() returns after the running ones finish.
+     * @param sizes Input bytes of each job
+     */
+    void run(const std::vector<uint64_t>& sizes, const std::function<void(size_t)>& work,
+             const std::function<void(size_t)>& consume);
+
+    unsigned threadCount() const { return threads; }
+
+private:
+    unsigned threads;
+    uint64_t windowBytes;
+};
@@ -0,0 +1,217 @@
+#include "EntryTable.h"
+#include "ArchiveFormat.h"
+#include <algorithm>
+#include <istream>
+#include <limits>
+#include <ostream>
+
+void EntryTable::add(std::string_view name, uint64_t compressedSize, uint64_t originalSize,
+                     int64_t timestamp, uint64_t offset) {
+    names.append(name.data(), name.size());
+    nameEnds.push_back(names.size());
+    compressedSizes.push_back(compressedSize);
+    originalSizes.push_back(originalSize);
+    timestamps.push_back(timestamp);
+    offsets.push_back(offset);
+    sortedOrder.clear();
+}
+
+void EntryTable::reserve(size_t entryCount, size_t nameBytes) {
+    names.reserve(nameBytes);
+    nameEnds.reserve(entryCount);
+    compressedSizes.reserve(entryCount);
+    originalSizes.reserve(entryCount);
+    timestamps.reserve(entryCount);
+    offsets.reserve(entryCount);
+}
+
+void EntryTable::clear() {
+    names.clear();
+    nameEnds.clear();
+    compressedSizes.clear();
+    originalSizes.clear();
+    timestamps.clear();
+    offsets.clear();
+    sortedOrder.clear();
+}
+
+size_t EntryTable::memoryUsage() const {
+    return names.capacity() +
+           (nameEnds.capacity() + compressedSizes.capacity() + originalSizes.capacity() +
+            offsets.capacity()) * sizeof(uint64_t) +
+           timestamps.capacity() * sizeof(int64_t) +
+           sortedOrder.capacity() * sizeof(uint32_t);
+}
+
+void EntryTable::buildNameIndex() {
+    sortedOrder.resize(size());
+    for (size_t i = 0; i < sortedOrder.size(); ++i) {
+        sortedOrder[i] = static_cast<uint32_t>(i);
+    }
+    // Stable so duplicate names keep archive order and find() returns the first
+    std::stable_sort(sortedOrder.begin(), sortedOrder.end(),
+                     [this](uint32_t a, uint32_t b) { return name(a) < name(b); });
+}
+
+std::pair<size_t, size_t> EntryTable::sortedRange(std::string_view prefix) const {
+    auto first = std::lower_bound(sortedOrder.begin(), sortedOrder.end(), prefix,
+                                  [this](uint32_t entry, std::string_view key) {
+                                      return name(entry) < key;
+                                  });
+    auto last = std::partition_point(first, sortedOrder.end(), [this, prefix](uint32_t entry) {
+        return name(entry).compare(0, prefix.size(), prefix) == 0;
+    });
+    return {static_cast<size_t>(first - sortedOrder.begin()),
+            static_cast<size_t>(last - sortedOrder.begin())};
+}
+
+size_t EntryTable::find(std::string_view entryName) const {
+    auto range = sortedRange(entryName);
+    if (range.first < range.second && name(sortedOrder[range.first]) == entryName) {
+        return sortedOrder[range.first];
+    }
+    return npos;
+}
+
+std::vector<size_t> EntryTable::findPrefix(std::string_view directory) const {
+    std::vector<size_t> result;
+    if (directory.empty()) {
+        result.reserve(sortedOrder.size());
+        result.assign(sortedOrder.begin(), sortedOrder.end());
+        return result;
+    }
+
+    if (directory.back() != '/') {
+        size_t exact = find(directory);
+        if (exact != npos) {
+            result.push_back(exact);
+        }
+    }
+
+    std::string prefix(directory);
+    if (prefix.back() != '/') {
+        prefix += '/';
+    }
+    auto range = sortedRange(prefix);
+    result.reserve(result.size() + (range.second - range.first));
+    for (size_t i = range.first; i < range.second; ++i) {
+        result.push_back(sortedOrder[i]);
+    }
+    return result;
+}
+
+bool EntryTable::writeIndex(std::ostream& out, uint64_t indexOffset) const {
+    if (size() > std::numeric_limits<uint32_t>::max() || sortedOrder.size() != size()) {
+        return false;
+    }
+
+    uint8_t encoded[INDEX_HEADER_SIZE];
+    IndexHeader header{};
+    header.signature = INDEX_SIGNATURE;
+    header.entryCount = size();
+    header.namesSize = names.size();
+    ArchiveFormat::encodeIndexHeader(header, encoded);
+    out.write(reinterpret_cast<const char*>(encoded), sizeof(encoded));
+
+    // Records and the sorted order are encoded in batches to keep the
+    // temporary buffer small
+    constexpr size_t batchSize = 4096;
+    std::vector<uint8_t> batch(std::min(batchSize, size()) * INDEX_RECORD_SIZE);
+    for (size_t i = 0; i < size(); i += batchSize) {
+        const size_t n = std::min(batchSize, size() - i);
+        for (size_t j = 0; j < n; ++j) {
+            ArchiveFormat::encodeIndexRecord(IndexRecord{offsets[i + j], compressedSizes[i + j],
+                                                         originalSizes[i + j], timestamps[i + j], nameEnds[i + j]},
+                                             batch.data() + j * INDEX_RECORD_SIZE);
+        }
+        out.write(reinterpret_cast<const char*>(batch.data()), static_cast<std::streamsize>(n * INDEX_RECORD_SIZE));
+    }
+    for (size_t i = 0; i < size(); i += batchSize) {
+        const size_t n = std::min(batchSize, size() - i);
+        for (size_t j = 0; j < n; ++j) {
+            ArchiveFormat::storeLE(batch.data() + j * 4, sortedOrder[i + j], 4);
+        }
+        out.write(reinterpret_cast<const char*>(batch.data()), static_cast<std::streamsize>(n * 4));
+    }
+    out.write(names.data(), static_cast<std::streamsize>(names.size()));
+
+    uint8_t trailerBytes[INDEX_TRAILER_SIZE];
+    IndexTrailer trailer{};
+    trailer.indexOffset = indexOffset;
+    trailer.signature = INDEX_TRAILER_SIGNATURE;
+    ArchiveFormat::encodeIndexTrailer(trailer, trailerBytes);
+    out.write(reinterpret_cast<const char*>(trailerBytes), sizeof(trailerBytes));
+    return static_cast<bool>(out);
+}
+
+bool EntryTable::readIndex(std::istream& in) {
+    uint8_t encoded[INDEX_HEADER_SIZE];
+    if (!in.read(reinterpret_cast<char*>(encoded), sizeof(encoded))) {
+        return false;
+    }
+    const IndexHeader header = ArchiveFormat::decodeIndexHeader(encoded);
+    if (header.signature != INDEX_SIGNATURE || header.entryCount > std::numeric_limits<uint32_t>::max()) {
+        return false;
+    }
+
+    clear();
+    const size_t count = static_cast<size_t>(header.entryCount);
+    reserve(count, static_cast<size_t>(header.namesSize));
+    nameEnds.resize(count);
+    compressedSizes.resize(count);
+    originalSizes.resize(count);
+    timestamps.resize(count);
+    offsets.resize(count);
+
+    constexpr size_t batchSize = 4096;
+    std::vector<uint8_t> batch(std::min(batchSize, count) * INDEX_RECORD_SIZE);
+    for (size_t i = 0; i < count; i += batchSize) {
+        size_t n = std::min(batchSize, count - i);
+        if (!in.read(reinterpret_cast<char*>(batch.data()), static_cast<std::streamsize>(n * INDEX_RECORD_SIZE))) {
+            clear();
+            return false;
+        }
+        for (size_t j = 0; j < n; ++j) {
+            const IndexRecord record = ArchiveFormat::decodeIndexRecord(batch.data() + j * INDEX_RECORD_SIZE);
+            offsets[i + j] = record.offset;
+            compressedSizes[i + j] = record.compressedSize;
+            originalSizes[i + j] = record.originalSize;
+            timestamps[i + j] = record.timestamp;
+            nameEnds[i + j] = record.nameEnd;
+        }
+    }
+
+    sortedOrder.resize(count);
+    for (size_t i = 0; i < count; i += batchSize) {
+        size_t n = std::min(batchSize, count - i);
+        if (!in.read(reinterpret_cast<char*>(batch.data()), static_cast<std::streamsize>(n * 4))) {
+            clear();
+            return false;
+        }
+        for (size_t j = 0; j < n; ++j) {
+            sortedOrder[i + j] = static_cast<uint32_t>(ArchiveFormat::loadLE(batch.data() + j * 4, 4));
+        }
+    }
+    names.resize(static_cast<size_t>(header.namesSize));
+    if (!in.read(&names[0], static_cast<std::streamsize>(names.size()))) {
+        clear();
+        return false;
+    }
+
+    // Reject indexes whose name ends or order would index out of bounds
+    uint64_t previousEnd = 0;
+    for (uint64_t end : nameEnds) {
+        if (end < previousEnd || end > names.size()) {
+            clear();
+            return false;
+        }
+        previousEnd = end;
+    }
+    for (uint32_t entry : sortedOrder) {
+        if (entry >= count) {
+            clear();
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,156 @@
+/**
+ * @file EntryTable.h
+ * @brief Compact in-memory table of archive entries
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <iosfwd>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Read-only view of one archive entry
+ *
+ * The name points into the owning EntryTable and stays valid until the
+ * table is modified.
+ */
+struct ArchiveEntry {
+    std::string_view name;
+    uint64_t compressedSize;
+    uint64_t originalSize;
+    time_t timestamp;
+};
+
+/**
+ * @brief Struct-of-arrays entry table with all names in one arena
+ *
+ * Each entry costs its name bytes plus five 64-bit fields and a 32-bit slot
+ * in the name-sorted order, with no per-entry heap allocation, so tables
+ * with millions of entries stay small and can be handed out by reference.
+ */
+class EntryTable {
+public:
+    class const_iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = ArchiveEntry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = ArchiveEntry;
+
+        const_iterator() = default;
+        const_iterator(const EntryTable* table, size_t index) : table(table), index(index) {}
+
+        ArchiveEntry operator*() const { return (*table)[index]; }
+        ArchiveEntry operator[](difference_type n) const { return (*table)[index + n]; }
+
+        const_iterator& operator++() { ++index; return *this; }
+        const_iterator operator++(int) { auto copy = *this; ++index; return copy; }
+        const_iterator& operator--() { --index; return *this; }
+        const_iterator operator--(int) { auto copy = *this; --index; return copy; }
+        const_iterator& operator+=(difference_type n) { index += n; return *this; }
+        const_iterator& operator-=(difference_type n) { index -= n; return *this; }
+        const_iterator operator+(difference_type n) const { return {table, index + n}; }
+        const_iterator operator-(difference_type n) const { return {table, index - n}; }
+        difference_type operator-(const const_iterator& other) const {
+            return static_cast<difference_type>(index) - static_cast<difference_type>(other.index);
+        }
+
+        bool operator==(const const_iterator& other) const { return index == other.index; }
+        bool operator!=(const const_iterator& other) const { return index != other.index; }
+        bool operator<(const const_iterator& other) const { return index < other.index; }
+
+    private:
+        const EntryTable* table = nullptr;
+        size_t index = 0;
+    };
+
+    size_t size() const { return compressedSizes.size(); }
+    bool empty() const { return compressedSizes.empty(); }
+
+    ArchiveEntry operator[](size_t index) const {
+        return ArchiveEntry{name(index), compressedSizes[index], originalSizes[index],
+                            static_cast<time_t>(timestamps[index])};
+    }
+
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, size()}; }
+
+    std::string_view name(size_t index) const {
+        size_t start = index == 0 ? 0 : nameEnds[index - 1];
+        return std::string_view(names).substr(start, nameEnds[index] - start);
+    }
+
+    /**
+     * @brief Offset of the entry's header within the archive file
+     */
+    uint64_t offset(size_t index) const { return offsets[index]; }
+
+    void add(std::string_view name, uint64_t compressedSize, uint64_t originalSize,
+             int64_t timestamp, uint64_t offset);
+
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    /**
+     * @brief Rebuilds the name-sorted order used by find() and findPrefix()
+     *
+     * Must be called after entries are added; tables loaded with readIndex()
+     * already carry the order.
+     */
+    void buildNameIndex();
+
+    /**
+     * @brief Binary search for an entry by exact name
+     * @return Entry number, or npos if there is none
+     */
+    size_t find(std::string_view name) const;
+
+    /**
+     * @brief Entry numbers of all entries inside a directory, sorted by name
+     *
+     * A @p directory of "docs" or "docs/" matches "docs/a.txt" and
+     * "docs/sub/b.txt" but not "docs2/c.txt"; an exact file name matches
+     * that file. An empty @p directory matches everything.
+     */
+    std::vector<size_t> findPrefix(std::string_view directory) const;
+
+    /**
+     * @brief Writes the persisted index (see ArchiveFormat.h)
+     * @param indexOffset Offset in the archive at which the index starts
+     * @return false if the table is too large to index
+     */
+    bool writeIndex(std::ostream& out, uint64_t indexOffset) const;
+
+    /**
+     * @brief Replaces the table with a persisted index
+     * @param in Stream positioned at the IndexHeader
+     * @return false if the stream does not hold a valid index
+     */
+    bool readIndex(std::istream& in);
+
+    void reserve(size_t entryCount, size_t nameBytes);
+    void clear();
+
+    /**
+     * @brief Approximate heap usage of the table in bytes
+     */
+    size_t memoryUsage() const;
+
+private:
+    std::string names;               ///< All entry names, back to back
+    std::vector<uint64_t> nameEnds;  ///< End of each name in the arena
+    std::vector<uint64_t> compressedSizes;
+    std::vector<uint64_t> originalSizes;
+    std::vector<int64_t> timestamps;
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> sortedOrder; ///< Entry numbers ordered by name
+
+    std::pair<size_t, size_t> sortedRange(std::string_view prefix) const;
+};
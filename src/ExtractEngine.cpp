@@ -0,0 +1,1050 @@
+#include "ExtractEngine.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <zlib.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ExtractIO {
+
+int openForReading(const char* path) {
+#ifdef _WIN32
+    return _open(path, _O_RDONLY | _O_BINARY);
+#else
+    return ::open(path, O_RDONLY | O_CLOEXEC);
+#endif
+}
+
+int openForWriting(const char* path) {
+#ifdef _WIN32
+    return _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+#endif
+}
+
+void closeFile(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+uint64_t fileSize(int fd) {
+#ifdef _WIN32
+    __int64 size = _lseeki64(fd, 0, SEEK_END);
+#else
+    off_t size = ::lseek(fd, 0, SEEK_END);
+#endif
+    return size < 0 ? 0 : static_cast<uint64_t>(size);
+}
+
+bool readAt(int fd, uint64_t offset, void* data, size_t size) {
+    char* cursor = static_cast<char*>(data);
+    while (size > 0) {
+#ifdef _WIN32
+        if (_lseeki64(fd, static_cast<__int64>(offset), SEEK_SET) < 0) {
+            return false;
+        }
+        int n = _read(fd, cursor, static_cast<unsigned int>(size < (1u << 30) ? size : (1u << 30)));
+#else
+        ssize_t n = ::pread(fd, cursor, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (n <= 0) {
+            return false;
+        }
+        cursor += n;
+        offset += static_cast<uint64_t>(n);
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+long readSome(int fd, void* data, size_t size) {
+    for (;;) {
+#ifdef _WIN32
+        int n = _read(fd, data, static_cast<unsigned int>(size < (1u << 30) ? size : (1u << 30)));
+#else
+        ssize_t n = ::read(fd, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        return static_cast<long>(n);
+    }
+}
+
+bool writeAt(int fd, uint64_t offset, const char* data, size_t size) {
+    while (size > 0) {
+#ifdef _WIN32
+        if (_lseeki64(fd, static_cast<__int64>(offset), SEEK_SET) < 0) {
+            return false;
+        }
+        int n = _write(fd, data, static_cast<unsigned int>(size < (1u << 30) ? size : (1u << 30)));
+#else
+        ssize_t n = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        offset += static_cast<uint64_t>(n);
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool setFileSize(int fd, uint64_t size) {
+#ifdef _WIN32
+    return _chsize_s(fd, static_cast<__int64>(size)) == 0;
+#else
+    return ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+}
+
+bool removeFile(const char* path) {
+#ifdef _WIN32
+    return _unlink(path) == 0;
+#else
+    return ::unlink(path) == 0;
+#endif
+}
+
+static bool makeDirectory(const std::string& path) {
+#ifdef _WIN32
+    return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+    return ::mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+bool makeParentDirectories(const std::string& path) {
+    for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+        if (!makeDirectory(path.substr(0, slash))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool isSafeEntryName(const std::string& name) {
+    if (name.empty() || name[0] == '/' || name.find('\\') != std::string::npos ||
+        name.find(':') != std::string::npos) {
+        return false;
+    }
+    size_t start = 0;
+    while (start <= name.size()) {
+        size_t end = name.find('/', start);
+        if (end == std::string::npos) {
+            end = name.size();
+        }
+        if (name.compare(start, end - start, "..") == 0 && end - start == 2) {
+            return false;
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+} // namespace ExtractIO
+
+uint64_t ExtractItem::dataSize() const {
+    uint64_t size = 0;
+    for (const auto& extent : extents) {
+        size += extent.length;
+    }
+    return size;
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t SCAN_BUFFER_SIZE = 64 * 1024;
+constexpr size_t INPUT_CHUNK_SIZE = 64 * 1024;
+constexpr size_t OUTPUT_CHUNK_SIZE = 256 * 1024;
+constexpr size_t ZERO_BLOCK_SIZE = 4096;
+constexpr size_t QUEUE_DEPTH_PER_THREAD = 4;
+constexpr uint64_t STREAM_BUFFER_LIMIT = 1024 * 1024;  // Largest pipe payload handed to a worker
+constexpr const char* TRUNCATED_ARCHIVE = "Unexpected end of archive";
+
+// An encrypted payload that fails its tag, or that does not decode, was
+// sealed with another key or altered
+std::string authenticationFailed(const std::string& name) {
+    return "Authentication failed for: " + name + " (wrong key or corrupt data)";
+}
+
+// Source of one entry's compressed bytes, handed to the decoder in chunks
+class PayloadInput {
+public:
+    virtual ~PayloadInput() = default;
+
+    // Returns the next chunk of at most maxSize bytes, or null at the end of
+    // the input or on a read error. The chunk stays valid until the next call.
+    virtual const char* next(size_t maxSize, size_t& size) = 0;
+
+    // Gives back the last size bytes of the most recent chunk
+    virtual void unread(size_t size) = 0;
+
+    bool read(void* data, size_t size) {
+        char* out = static_cast<char*>(data);
+        while (size > 0) {
+            size_t chunk = 0;
+            const char* in = next(size, chunk);
+            if (!in) {
+                return false;
+            }
+            std::memcpy(out, in, chunk);
+            out += chunk;
+            size -= chunk;
+        }
+        return true;
+    }
+
+    bool operator()(void* data, size_t size) { return read(data, size); }
+};
+
+// Positioned reads from a worker's own descriptor
+class FileInput : public PayloadInput {
+public:
+    FileInput(int fd, uint64_t offset, std::vector<char>& buffer) : fd(fd), position(offset), buffer(buffer) {}
+
+    const char* next(size_t maxSize, size_t& size) override {
+        size = std::min(maxSize, buffer.size());
+        if (!ExtractIO::readAt(fd, position, buffer.data(), size)) {
+            return nullptr;
+        }
+        position += size;
+        return buffer.data();
+    }
+
+    void unread(size_t size) override { position -= size; }
+
+private:
+    int fd;
+    uint64_t position;
+    std::vector<char>& buffer;
+};
+
+// A payload the scanning thread already read into memory
+class MemoryInput : public PayloadInput {
+public:
+    explicit MemoryInput(const std::vector<char>& data) : data(data) {}
+
+    const char* next(size_t maxSize, size_t& size) override {
+        if (position == data.size()) {
+            return nullptr;
+        }
+        size = std::min(maxSize, data.size() - position);
+        position += size;
+        return data.data() + position - size;
+    }
+
+    void unread(size_t size) override { position -= size; }
+
+private:
+    const std::vector<char>& data;
+    size_t position = 0;
+};
+
+// Buffered reads of the archive by the scanning thread. A seekable source
+// skips payloads and leaves them to the workers; a pipe is consumed
+// strictly in order, so every byte passes through here.
+class SourceReader : public PayloadInput {
+public:
+    SourceReader(int fd, uint64_t start, uint64_t end, bool seekable)
+        : fd(fd), position(start), end(end), seekable(seekable), bufferStart(start) {}
+
+    const char* next(size_t maxSize, size_t& size) override {
+        if ((position < bufferStart || position >= bufferStart + bufferLength) && !fill()) {
+            return nullptr;
+        }
+        size = static_cast<size_t>(std::min<uint64_t>(maxSize, bufferStart + bufferLength - position));
+        position += size;
+        return buffer.data() + (position - size - bufferStart);
+    }
+
+    void unread(size_t size) override { position -= size; }
+
+    bool skip(uint64_t size) {
+        if (size > end - position) {
+            return false;
+        }
+        if (seekable) {
+            position += size;
+            return true;
+        }
+        while (size > 0) {
+            size_t chunk = 0;
+            if (!next(static_cast<size_t>(std::min<uint64_t>(size, buffer.size())), chunk)) {
+                return false;
+            }
+            size -= chunk;
+        }
+        return true;
+    }
+
+    // Reads a pipe to its end so the writer does not fail on a closed pipe
+    void drain() {
+        size_t chunk = 0;
+        while (!seekable && next(buffer.size(), chunk)) {
+        }
+    }
+
+    uint64_t offset() const { return position; }
+    bool isSeekable() const { return seekable; }
+
+private:
+    bool fill() {
+        bufferStart = position;
+        bufferLength = 0;
+        size_t want = static_cast<size_t>(std::min<uint64_t>(end - position, buffer.size()));
+        if (want == 0) {
+            return false;
+        }
+        if (seekable) {
+            if (!ExtractIO::readAt(fd, position, buffer.data(), want)) {
+                return false;
+            }
+            bufferLength = want;
+            return true;
+        }
+        long n = ExtractIO::readSome(fd, buffer.data(), want);
+        bufferLength = n > 0 ? static_cast<size_t>(n) : 0;
+        return n > 0;
+    }
+
+    int fd;
+    uint64_t position;
+    uint64_t end;
+    bool seekable;
+    std::vector<char> buffer = std::vector<char>(SCAN_BUFFER_SIZE);
+    uint64_t bufferStart;
+    size_t bufferLength = 0;
+};
+
+// Decrypts another input chunk by chunk. Ciphertext given back through
+// unread is decrypted again when it is read next, so before each chunk the
+// cipher is marked when the decoder may give some back.
+class DecryptingInput : public PayloadInput {
+public:
+    DecryptingInput(PayloadInput& source, PayloadCipher& cipher, bool rewindable, std::vector<char>& buffer)
+        : source(source), cipher(cipher), rewindable(rewindable), buffer(buffer) {}
+
+    const char* next(size_t maxSize, size_t& size) override {
+        const char* data = source.next(std::min(maxSize, buffer.size()), size);
+        if (!data) {
+            return nullptr;
+        }
+        if (rewindable) {
+            cipher.mark();
+        }
+        if (!cipher.update(data, buffer.data(), size)) {
+            return nullptr;
+        }
+        last = data;
+        lastSize = size;
+        return buffer.data();
+    }
+
+    void unread(size_t size) override {
+        source.unread(size);
+        cipher.rewind();
+        cipher.update(last, buffer.data(), lastSize - size);
+    }
+
+private:
+    PayloadInput& source;
+    PayloadCipher& cipher;
+    bool rewindable;
+    std::vector<char>& buffer;
+    const char* last = nullptr;
+    size_t lastSize = 0;
+};
+
+bool isZeroBlock(const char* data, size_t size) {
+    return data[0] == 0 && std::memcmp(data, data + 1, size - 1) == 0;
+}
+
+// Writes a buffer at a file offset, skipping aligned all-zero blocks so they
+// stay holes once the file is truncated to its final size
+bool writeSkippingZeros(int fd, uint64_t offset, const char* data, size_t size) {
+    size_t runStart = 0;
+    size_t pos = 0;
+    while (pos < size) {
+        uint64_t absolute = offset + pos;
+        size_t blockLen = std::min<size_t>(ZERO_BLOCK_SIZE - static_cast<size_t>(absolute % ZERO_BLOCK_SIZE),
+                                           size - pos);
+        if (blockLen == ZERO_BLOCK_SIZE && isZeroBlock(data + pos, blockLen)) {
+            if (pos > runStart && !ExtractIO::writeAt(fd, offset + runStart, data + runStart, pos - runStart)) {
+                return false;
+            }
+            runStart = pos + blockLen;
+        }
+        pos += blockLen;
+    }
+    return size <= runStart || ExtractIO::writeAt(fd, offset + runStart, data + runStart, size - runStart);
+}
+
+// Places consecutive data bytes at the logical offsets of an entry's extents
+class ExtentWriter {
+public:
+    ExtentWriter(int fd, const std::vector<SparseExtent>& extents) : fd(fd), extents(extents) {}
+
+    bool write(const char* data, size_t size) {
+        while (size > 0) {
+            skipFinished();
+            if (index == extents.size()) {
+                return false; // More data than the extents describe
+            }
+            const SparseExtent& extent = extents[index];
+            size_t piece = static_cast<size_t>(std::min<uint64_t>(size, extent.length - within));
+            if (!writeSkippingZeros(fd, extent.offset + within, data, piece)) {
+                return false;
+            }
+            data += piece;
+            size -= piece;
+            within += piece;
+        }
+        return true;
+    }
+
+    bool complete() {
+        skipFinished();
+        return index == extents.size();
+    }
+
+private:
+    void skipFinished() {
+        while (index < extents.size() && within == extents[index].length) {
+            ++index;
+            within = 0;
+        }
+    }
+
+    int fd;
+    const std::vector<SparseExtent>& extents;
+    size_t index = 0;
+    uint64_t within = 0;
+};
+
+// Per-thread state: a private descriptor for the source (positioned reads
+// are not atomic on every platform), an inflate stream reused across
+// entries, and the chunk buffers
+class Worker {
+public:
+    explicit Worker(PayloadDecryptor* decryptor)
+        : decryptor(decryptor), input(INPUT_CHUNK_SIZE), output(OUTPUT_CHUNK_SIZE) {}
+    ~Worker() {
+        if (streamReady) {
+            inflateEnd(&stream);
+        }
+        if (source >= 0) {
+            ExtractIO::closeFile(source);
+        }
+    }
+
+    Worker(const Worker&) = delete;
+    Worker& operator=(const Worker&) = delete;
+
+    bool open(const std::string& sourcePath) {
+        source = ExtractIO::openForReading(sourcePath.c_str());
+        return source >= 0;
+    }
+
+    // Decodes an entry from its payload in memory, or else from the source.
+    // Either can be read twice, so an encrypted payload is authenticated
+    // before any of it is inflated or written.
+    std::string extract(ExtractItem& item, bool verify, ExtractTimings& timings) {
+        const bool inMemory = !item.payload.empty() || source < 0;
+        if (item.header.isEncrypted() && !item.header.hasDescriptor()) {
+            MemoryInput memory(item.payload);
+            FileInput file(source, item.payloadOffset, input);
+            std::string message = authenticate(item, inMemory ? static_cast<PayloadInput&>(memory) : file, timings);
+            if (!message.empty()) {
+                return message;
+            }
+        }
+        if (inMemory) {
+            MemoryInput memory(item.payload);
+            return extract(item, memory, verify, timings);
+        }
+        FileInput file(source, item.payloadOffset, input);
+        return extract(item, file, verify, timings);
+    }
+
+    // Returns an empty string on success, otherwise what went wrong. For a
+    // descriptor entry, item's sizes, checksums and extents are filled in
+    // from the descriptor.
+    std::string extract(ExtractItem& item, PayloadInput& in, bool verify, ExtractTimings& timings) {
+        const auto start = Clock::now();
+        int fd = ExtractIO::openForWriting(item.path.c_str());
+        if (fd < 0) {
+            return "Cannot create output file: " + item.path;
+        }
+        std::string message = decode(item, in, fd, verify, timings);
+        if (message.empty() && !ExtractIO::setFileSize(fd, item.header.originalSize)) {
+            message = "Failed to write: " + item.path;
+        }
+        ExtractIO::closeFile(fd);
+        if (!message.empty()) {
+            ExtractIO::removeFile(item.path.c_str()); // No partial or unauthenticated output
+        }
+        timings.total = Clock::now() - start;
+        return message;
+    }
+
+    // Reads past an entry that is not extracted; descriptor entries can only
+    // be skipped by decoding them
+    std::string discard(ExtractItem& item, PayloadInput& in) {
+        ExtractTimings timings;
+        return decode(item, in, -1, false, timings);
+    }
+
+private:
+    // Decrypts a whole payload without keeping the plaintext, only to check its tag
+    std::string authenticate(const ExtractItem& item, PayloadInput& in, ExtractTimings& timings) {
+        const auto start = Clock::now();
+        if (!decryptor) {
+            return "Entry is encrypted: " + item.name;
+        }
+        if (item.header.compressedSize < ENCRYPTION_OVERHEAD) {
+            return "Corrupt entry: " + item.name;
+        }
+        uint8_t nonce[ENCRYPTION_NONCE_SIZE];
+        if (!in.read(nonce, sizeof(nonce))) {
+            return "Failed to read archive data for: " + item.name;
+        }
+        std::unique_ptr<PayloadCipher> cipher = decryptor->begin(nonce, item.name);
+        if (!cipher) {
+            return "Failed to initialize decryption for: " + item.name;
+        }
+        if (plain.empty()) {
+            plain.resize(INPUT_CHUNK_SIZE);
+        }
+        for (uint64_t remaining = item.header.compressedSize - ENCRYPTION_OVERHEAD; remaining > 0;) {
+            size_t chunk = 0;
+            const char* data = in.next(static_cast<size_t>(std::min<uint64_t>(remaining, plain.size())), chunk);
+            if (!data || !cipher->update(data, plain.data(), chunk)) {
+                return "Failed to read archive data for: " + item.name;
+            }
+            remaining -= chunk;
+        }
+        uint8_t tag[ENCRYPTION_TAG_SIZE];
+        if (!in.read(tag, sizeof(tag))) {
+            return "Failed to read archive data for: " + item.name;
+        }
+        timings.read += Clock::now() - start;
+        return cipher->verify(tag) ? std::string() : authenticationFailed(item.name);
+    }
+
+    std::string decode(ExtractItem& item, PayloadInput& in, int fd, bool verify, ExtractTimings& timings) {
+        EntryHeader& header = item.header;
+        const bool descriptor = header.hasDescriptor();
+        if (descriptor) {
+            if (header.codec != CODEC_ZLIB || header.isSparse()) {
+                return "Corrupt entry: " + item.name;
+            }
+            item.extents.assign(1, SparseExtent{0, UINT64_MAX});
+        }
+        const uint64_t dataSize = item.dataSize();
+
+        // An encrypted payload is decrypted on its way to the codec; the
+        // nonce and tag around it are read from the source directly
+        const bool encrypted = header.isEncrypted();
+        uint64_t payloadSize = header.compressedSize;
+        std::unique_ptr<PayloadCipher> cipher;
+        std::unique_ptr<DecryptingInput> decrypting;
+        if (encrypted) {
+            if (!decryptor) {
+                return "Entry is encrypted: " + item.name;
+            }
+            if (!descriptor && payloadSize < ENCRYPTION_OVERHEAD) {
+                return "Corrupt entry: " + item.name;
+            }
+            uint8_t nonce[ENCRYPTION_NONCE_SIZE];
+            if (!in.read(nonce, sizeof(nonce))) {
+                return "Failed to read archive data for: " + item.name;
+            }
+            cipher = decryptor->begin(nonce, item.name);
+            if (!cipher) {
+                return "Failed to initialize decryption for: " + item.name;
+            }
+            if (plain.empty()) {
+                plain.resize(INPUT_CHUNK_SIZE);
+            }
+            decrypting = std::make_unique<DecryptingInput>(in, *cipher, descriptor, plain);
+            payloadSize -= descriptor ? 0 : ENCRYPTION_OVERHEAD;
+        }
+        PayloadInput& payload = decrypting ? static_cast<PayloadInput&>(*decrypting) : in;
+        auto decompressionFailed = [&] {
+            return encrypted ? authenticationFailed(item.name) : "Decompression failed for: " + item.name;
+        };
+
+        ExtentWriter writer(fd, item.extents);
+        uLong crc = crc32(0L, Z_NULL, 0);
+        uint64_t remaining = descriptor ? UINT64_MAX : payloadSize;
+        uint64_t produced = 0;
+        uint64_t consumed = 0;
+
+        auto emit = [&](const char* data, size_t size) {
+            if (fd < 0) {
+                return true;
+            }
+            auto start = Clock::now();
+            bool ok = writer.write(data, size);
+            timings.write += Clock::now() - start;
+            return ok;
+        };
+        auto fetch = [&](size_t maxSize, size_t& size) {
+            auto start = Clock::now();
+            const char* chunk = payload.next(static_cast<size_t>(std::min<uint64_t>(remaining, maxSize)), size);
+            timings.read += Clock::now() - start;
+            if (chunk) {
+                remaining -= size;
+                consumed += size;
+            }
+            return chunk;
+        };
+
+        if (header.codec == CODEC_STORED) {
+            if (payloadSize != dataSize) {
+                return "Corrupt stored entry: " + item.name;
+            }
+            while (remaining > 0) {
+                size_t chunk = 0;
+                const char* data = fetch(output.size(), chunk);
+                if (!data) {
+                    return "Failed to read archive data for: " + item.name;
+                }
+                auto start = Clock::now();
+                crc = crc32(crc, reinterpret_cast<const Bytef*>(data), static_cast<uInt>(chunk));
+                timings.inflate += Clock::now() - start;
+                if (!emit(data, chunk)) {
+                    return "Failed to write: " + item.path;
+                }
+            }
+            produced = dataSize;
+        } else if (header.codec != CODEC_ZLIB && header.codec != CODEC_DEFLATE) {
+            return "Unsupported codec " + std::to_string(header.codec) + " for: " + item.name;
+        } else if (dataSize > 0) {
+            const int windowBits = header.codec == CODEC_DEFLATE ? -MAX_WBITS : MAX_WBITS;
+            if (!streamReady) {
+                if (inflateInit2(&stream, windowBits) != Z_OK) {
+                    return "Failed to initialize decompression";
+                }
+                streamReady = true;
+            } else {
+                inflateReset2(&stream, windowBits);
+            }
+            stream.avail_in = 0;
+
+            int status = Z_OK;
+            while (status != Z_STREAM_END) {
+                if (stream.avail_in == 0) {
+                    size_t chunk = 0;
+                    const char* data = remaining > 0 ? fetch(input.size(), chunk) : nullptr;
+                    if (!data) {
+                        return decompressionFailed();
+                    }
+                    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+                    stream.avail_in = static_cast<uInt>(chunk);
+                }
+
+                auto start = Clock::now();
+                stream.next_out = reinterpret_cast<Bytef*>(output.data());
+                stream.avail_out = static_cast<uInt>(output.size());
+                status = inflate(&stream, Z_NO_FLUSH);
+                size_t chunk = output.size() - stream.avail_out;
+                if (status != Z_OK && status != Z_STREAM_END) {
+                    return decompressionFailed();
+                }
+                produced += chunk;
+                if (produced > dataSize) {
+                    return decompressionFailed();
+                }
+                crc = crc32(crc, reinterpret_cast<const Bytef*>(output.data()), static_cast<uInt>(chunk));
+                timings.inflate += Clock::now() - start;
+                if (!emit(output.data(), chunk)) {
+                    return "Failed to write: " + item.path;
+                }
+            }
+            if (descriptor) {
+                // The stream ended inside the last chunk; the rest is the descriptor
+                payload.unread(stream.avail_in);
+                consumed -= stream.avail_in;
+            }
+        }
+
+        if (encrypted) {
+            // The tag covers every byte, including any the codec did not need
+            while (!descriptor && remaining > 0) {
+                size_t chunk = 0;
+                if (!fetch(input.size(), chunk)) {
+                    return "Failed to read archive data for: " + item.name;
+                }
+            }
+            uint8_t tag[ENCRYPTION_TAG_SIZE];
+            if (!in.read(tag, sizeof(tag)) || !cipher->verify(tag)) {
+                return authenticationFailed(item.name);
+            }
+            consumed += ENCRYPTION_OVERHEAD;
+        }
+        if (descriptor) {
+            uint64_t size = 0;
+            if (!ArchiveFormat::readEntryDescriptor(in, header, size) ||
+                header.compressedSize != consumed) {
+                return "Corrupt entry descriptor for: " + item.name;
+            }
+            item.extents.clear();
+            if (header.originalSize > 0) {
+                item.extents.push_back(SparseExtent{0, header.originalSize});
+            }
+        } else if (!writer.complete() && fd >= 0) {
+            return decompressionFailed();
+        }
+        if (produced != item.dataSize()) {
+            return decompressionFailed();
+        }
+        if (verify && header.hasCrc32() && static_cast<uint32_t>(crc) != header.crc32) {
+            return "Checksum mismatch for: " + item.name;
+        }
+        return std::string();
+    }
+
+    PayloadDecryptor* decryptor;
+    int source = -1;
+    z_stream stream = {};
+    bool streamReady = false;
+    std::vector<char> input;
+    std::vector<char> output;
+    std::vector<char> plain; ///< Decrypted input, allocated on the first encrypted entry
+};
+
+// Bounded hand-off from the scanning thread to the workers; also collects
+// the first error so everyone stops early
+class WorkQueue {
+public:
+    explicit WorkQueue(size_t capacity) : capacity(capacity) {}
+
+    bool push(ExtractItem&& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return items.size() < capacity || failed; });
+        if (failed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(ExtractItem& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed || failed; });
+        if (failed || items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+    void fail(const std::string& message) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!failed) {
+            failed = true;
+            error = message;
+        }
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+    bool hasFailed() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return failed;
+    }
+
+    std::string errorMessage() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return error;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<ExtractItem> items;
+    size_t capacity;
+    bool closed = false;
+    bool failed = false;
+    std::string error;
+};
+
+} // namespace
+
+ExtractEngine::ExtractEngine(ExtractOptions options) : options(options) {
+}
+
+ExtractResult ExtractEngine::run(const std::string& sourcePath, const std::string& outputDir,
+                                 uint64_t offset, uint64_t size) {
+    error.clear();
+    extracted = 0;
+
+    int fd = ExtractIO::openForReading(sourcePath.c_str());
+    if (fd < 0) {
+        error = "Failed to open archive: " + sourcePath;
+        return ExtractResult::Failed;
+    }
+    const uint64_t fileEnd = ExtractIO::fileSize(fd);
+    offset = std::min(offset, fileEnd);
+    ExtractResult result = extract(fd, sourcePath, outputDir, offset, offset + std::min(size, fileEnd - offset));
+    ExtractIO::closeFile(fd);
+    return result;
+}
+
+ExtractResult ExtractEngine::runStream(int fd, const std::string& outputDir) {
+    error.clear();
+    extracted = 0;
+    return extract(fd, std::string(), outputDir, 0, UINT64_MAX);
+}
+
+ExtractResult ExtractEngine::extract(int fd, const std::string& sourcePath, const std::string& outputDir,
+                                     uint64_t start, uint64_t end) {
+    const bool seekable = !sourcePath.empty();
+    SourceReader reader(fd, start, end, seekable);
+
+    uint64_t headerSize = 0;
+    if (!ArchiveFormat::readArchiveHeader(reader, headerSize)) {
+        error = "Invalid archive format";
+        return ExtractResult::Failed;
+    }
+    // Current archives always end with the name index after the entries;
+    // older ones may end right after the last entry
+    const bool indexed = headerSize == ENTRY_PREFIX_SIZE;
+
+    std::string root = outputDir.empty() ? std::string(".") : outputDir;
+    if (root.back() != '/' && root.back() != '\\') {
+        root += '/';
+    }
+    if (!ExtractIO::makeParentDirectories(root)) {
+        error = "Cannot create output directory: " + outputDir;
+        return ExtractResult::Failed;
+    }
+
+    unsigned threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    threads = std::max(1u, threads);
+    ExtractObserver* observer = options.observer;
+    std::atomic<uint64_t> done{0};
+    WorkQueue queue(threads * QUEUE_DEPTH_PER_THREAD);
+
+    auto finished = [&](const ExtractItem& item, const std::string& message, const ExtractTimings& timings) {
+        if (!message.empty()) {
+            queue.fail(message);
+            return;
+        }
+        done.fetch_add(1, std::memory_order_relaxed);
+        if (observer) {
+            observer->entryExtracted(item, timings);
+        }
+    };
+    auto process = [&](Worker& worker, ExtractItem& item) {
+        if (observer && observer->reuseExisting(item)) {
+            return;
+        }
+        ExtractTimings timings;
+        std::string message = worker.extract(item, options.verifyChecksums, timings);
+        finished(item, message, timings);
+    };
+
+    // A single thread extracts inline; otherwise the scanning thread only
+    // feeds the pool, apart from payloads it has to read itself
+    Worker scanner(options.decryptor);
+    std::vector<std::thread> pool;
+    if (threads == 1) {
+        if (seekable && !scanner.open(sourcePath)) {
+            queue.fail("Failed to open archive: " + sourcePath);
+        }
+    } else {
+        for (unsigned i = 0; i < threads; ++i) {
+            pool.emplace_back([&] {
+                Worker worker(options.decryptor);
+                if (seekable && !worker.open(sourcePath)) {
+                    queue.fail("Failed to open archive: " + sourcePath);
+                    return;
+                }
+                ExtractItem item;
+                while (queue.pop(item)) {
+                    process(worker, item);
+                }
+            });
+        }
+    }
+
+    bool cancelled = false;
+    std::string lastDirectory;
+    while (!queue.hasFailed()) {
+        if (observer && observer->isCancelled()) {
+            cancelled = true;
+            break;
+        }
+
+        // The entries end at a different signature, such as the name
+        // index's; anything cut short before that is a truncated archive
+        ExtractItem item;
+        const uint64_t entryStart = reader.offset();
+        uint32_t signature = 0;
+        bool prefixRead = false;
+        auto readHeader = [&](void* data, size_t size) {
+            if (!reader.read(data, size)) {
+                return false;
+            }
+            if (!prefixRead) {
+                uint8_t bytes[4] = {};
+                std::memcpy(bytes, data, std::min(size, sizeof(bytes)));
+                signature = static_cast<uint32_t>(ArchiveFormat::loadLE(bytes, sizeof(bytes)));
+                prefixRead = true;
+            }
+            return true;
+        };
+        if (!ArchiveFormat::readEntryHeader(readHeader, item.header, headerSize)) {
+            const bool endOfEntries = prefixRead ? signature != SIGNATURE : !indexed && reader.offset() == entryStart;
+            if (!endOfEntries) {
+                queue.fail(TRUNCATED_ARCHIVE);
+            }
+            break;
+        }
+        item.name.assign(item.header.nameLength, '\0');
+        if (!reader.read(&item.name[0], item.header.nameLength)) {
+            queue.fail(TRUNCATED_ARCHIVE);
+            break;
+        }
+        if (item.header.isSparse()) {
+            if (!ArchiveFormat::readSparseMap(reader, item.header, item.extents, headerSize)) {
+                queue.fail("Corrupt sparse map for: " + item.name);
+                break;
+            }
+        } else if (item.header.originalSize > 0) {
+            item.extents.push_back(SparseExtent{0, item.header.originalSize});
+        }
+        item.payloadOffset = reader.offset();
+
+        // Descriptor entries end wherever their zlib stream does, and a pipe
+        // cannot be read out of order, so those payloads pass through the
+        // scanning thread. Large ones are decoded right here instead of
+        // being buffered for a worker.
+        const bool descriptor = item.header.hasDescriptor();
+        const bool decodeHere = descriptor || (!seekable && item.header.compressedSize > STREAM_BUFFER_LIMIT);
+        if (seekable && !descriptor && !reader.skip(item.header.compressedSize)) {
+            queue.fail(TRUNCATED_ARCHIVE);
+            break;
+        }
+
+        if (!ExtractIO::isSafeEntryName(item.name)) {
+            queue.fail("Unsafe entry name: " + item.name);
+            break;
+        }
+        item.path = root + item.name;
+        if (observer && !observer->shouldExtract(item)) {
+            if (descriptor) {
+                std::string message = scanner.discard(item, reader);
+                if (!message.empty()) {
+                    queue.fail(message);
+                    break;
+                }
+            } else if (!seekable && !reader.skip(item.header.compressedSize)) {
+                queue.fail(TRUNCATED_ARCHIVE);
+                break;
+            }
+            continue;
+        }
+
+        // Entries of one directory are usually adjacent
+        std::string directory = item.path.substr(0, item.path.rfind('/') + 1);
+        if (directory != lastDirectory) {
+            if (!ExtractIO::makeParentDirectories(item.path)) {
+                queue.fail("Cannot create directory for: " + item.path);
+                break;
+            }
+            lastDirectory = directory;
+        }
+
+        if (decodeHere) {
+            // The content hash of a descriptor entry is not known yet
+            if (!descriptor && observer && observer->reuseExisting(item)) {
+                if (!reader.skip(item.header.compressedSize)) {
+                    queue.fail(TRUNCATED_ARCHIVE);
+                    break;
+                }
+                continue;
+            }
+            ExtractTimings timings;
+            std::string message = scanner.extract(item, reader, options.verifyChecksums, timings);
+            const uint64_t payloadEnd = item.payloadOffset + item.header.compressedSize;
+            if (message.empty() && !descriptor && !reader.skip(payloadEnd - reader.offset())) {
+                queue.fail(TRUNCATED_ARCHIVE);
+                break;
+            }
+            finished(item, message, timings);
+            continue;
+        }
+        if (!seekable) {
+            item.payload.resize(static_cast<size_t>(item.header.compressedSize));
+            if (!reader.read(item.payload.data(), item.payload.size())) {
+                queue.fail(TRUNCATED_ARCHIVE);
+                break;
+            }
+        }
+
+        if (threads == 1) {
+            process(scanner, item);
+        } else if (!queue.push(std::move(item))) {
+            break;
+        }
+    }
+
+    queue.close();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    extracted = done.load();
+    if (queue.hasFailed()) {
+        error = queue.errorMessage();
+        return ExtractResult::Failed;
+    }
+    if (cancelled) {
+        return ExtractResult::Cancelled;
+    }
+    reader.drain();
+    return ExtractResult::Success;
+}
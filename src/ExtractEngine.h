@@ -0,0 +1,222 @@
+/**
+ * @file ExtractEngine.h
+ * @brief Streaming, multi-threaded extraction shared by Archive and the stub
+ *
+ * The engine is compiled into both the library and the self-extractor
+ * stub, which is built without exceptions, RTTI, iostreams or
+ * std::filesystem. It therefore reports errors through ExtractResult and
+ * errorMessage() and does its own descriptor-level I/O.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ArchiveFormat.h"
+
+/**
+ * @brief One archive entry as seen by the extraction engine
+ */
+struct ExtractItem {
+    std::string name;                   ///< Path inside the archive
+    std::string path;                   ///< Output path
+    EntryHeader header;
+    std::vector<SparseExtent> extents;  ///< Data regions; a plain entry has one
+    uint64_t payloadOffset = 0;         ///< Offset of the payload in the source file
+    std::vector<char> payload;          ///< Payload already read from a pipe, if any
+
+    uint64_t dataSize() const;
+};
+
+/**
+ * @brief Time a worker spent on each stage of one entry
+ */
+struct ExtractTimings {
+    std::chrono::steady_clock::duration read{};
+    std::chrono::steady_clock::duration inflate{};
+    std::chrono::steady_clock::duration write{};
+    std::chrono::steady_clock::duration total{};
+};
+
+/**
+ * @brief Hooks for progress, filtering and cancellation
+ */
+class ExtractObserver {
+public:
+    virtual ~ExtractObserver() = default;
+
+    /**
+     * @brief Called on the scanning thread before an entry is queued
+     *
+     * For an entry with a trailing descriptor (EntryHeader::hasDescriptor)
+     * the sizes and checksums in the header are not known yet.
+     * @return false to skip the entry
+     */
+    virtual bool shouldExtract(const ExtractItem& item) {
+        (void)item;
+        return true;
+    }
+
+    /**
+     * @brief Called on a worker thread before an entry is decoded
+     *
+     * Return true if the output file was put in place some other way, for
+     * example linked from a cache or found up to date; the entry is then
+     * neither decoded nor reported to entryExtracted. Must not throw. Not
+     * called for entries with a trailing descriptor, whose checksums are
+     * only known once they are decoded.
+     */
+    virtual bool reuseExisting(const ExtractItem& item) {
+        (void)item;
+        return false;
+    }
+
+    /**
+     * @brief Called on a worker thread once an entry's file is complete
+     *
+     * Runs concurrently for different entries and must not throw.
+     */
+    virtual void entryExtracted(const ExtractItem& item, const ExtractTimings& timings) {
+        (void)item;
+        (void)timings;
+    }
+
+    /**
+     * @brief Polled on the scanning thread between entries
+     * @return true to stop; entries already being written are finished
+     */
+    virtual bool isCancelled() { return false; }
+};
+
+/**
+ * @brief Decryption state of one encrypted entry
+ *
+ * Fed the ciphertext in order; in and out of update may be the same buffer.
+ */
+class PayloadCipher {
+public:
+    virtual ~PayloadCipher() = default;
+
+    virtual bool update(const char* in, char* out, size_t size) = 0;
+
+    /// Remembers the current position in the ciphertext...
+    virtual void mark() = 0;
+
+    /// ...and goes back to it, for input the decoder gave back
+    virtual void rewind() = 0;
+
+    /// True if @p tag (ENCRYPTION_TAG_SIZE bytes) matches all ciphertext so far
+    virtual bool verify(const uint8_t* tag) = 0;
+};
+
+/**
+ * @brief Source of ciphers for entries with ENTRY_FLAG_ENCRYPTED
+ *
+ * The engine has no cryptography of its own, so without one of these,
+ * as in the extractor stub, encrypted entries fail to extract. Called
+ * from worker threads concurrently.
+ */
+class PayloadDecryptor {
+public:
+    virtual ~PayloadDecryptor() = default;
+
+    /// Cipher for the entry @p name whose payload starts with @p nonce, or null
+    virtual std::unique_ptr<PayloadCipher> begin(const uint8_t* nonce, const std::string& name) = 0;
+};
+
+struct ExtractOptions {
+    unsigned threads = 0;           ///< Worker threads, 0 = hardware concurrency
+    bool verifyChecksums = true;    ///< Check entries that carry a CRC-32
+    ExtractObserver* observer = nullptr;
+    PayloadDecryptor* decryptor = nullptr;
+};
+
+enum class ExtractResult {
+    Success,
+    Cancelled,
+    Failed
+};
+
+/**
+ * @brief Extracts an archive stored in a byte range of a file
+ *
+ * One thread walks the entry headers and creates directories; worker
+ * threads inflate payloads in fixed-size chunks and write each chunk
+ * straight to its extent, so memory use does not depend on entry size.
+ * All-zero blocks are skipped and left as holes.
+ */
+class ExtractEngine {
+public:
+    explicit ExtractEngine(ExtractOptions options = ExtractOptions());
+
+    /**
+     * @brief Extracts every entry into @p outputDir
+     * @param sourcePath File holding the archive
+     * @param offset Start of the archive within the file
+     * @param size Length of the archive; clamped to the end of the file
+     */
+    ExtractResult run(const std::string& sourcePath, const std::string& outputDir,
+                      uint64_t offset = 0, uint64_t size = UINT64_MAX);
+
+    /**
+     * @brief Extracts an archive read front to back from a pipe or socket
+     *
+     * Files are written as their entries arrive. Small payloads are still
+     * decoded by the workers; large ones and entries with trailing
+     * descriptors are decoded by the reading thread. The descriptor is
+     * read to its end and left open.
+     */
+    ExtractResult runStream(int fd, const std::string& outputDir);
+
+    /**
+     * @brief Description of the first error when run() returned Failed
+     */
+    const std::string& errorMessage() const { return error; }
+
+    uint64_t filesExtracted() const { return extracted; }
+
+private:
+    ExtractResult extract(int fd, const std::string& sourcePath, const std::string& outputDir,
+                          uint64_t start, uint64_t end);
+
+    ExtractOptions options;
+    std::string error;
+    uint64_t extracted = 0;
+};
+
+/**
+ * @brief Descriptor-level helpers shared with the extractor stub
+ *
+ * All functions report failure through their return value; paths use '/'.
+ */
+namespace ExtractIO {
+
+int openForReading(const char* path);
+int openForWriting(const char* path);
+void closeFile(int fd);
+uint64_t fileSize(int fd);
+bool readAt(int fd, uint64_t offset, void* data, size_t size);
+
+/**
+ * @brief Reads what is available from a descriptor, such as a pipe
+ * @return Bytes read, 0 at end of file, negative on error
+ */
+long readSome(int fd, void* data, size_t size);
+bool writeAt(int fd, uint64_t offset, const char* data, size_t size);
+bool setFileSize(int fd, uint64_t size);
+bool removeFile(const char* path);
+
+/**
+ * @brief Creates every directory leading up to the last '/' of @p path
+ */
+bool makeParentDirectories(const std::string& path);
+
+/**
+ * @brief True if @p name stays inside the output directory
+ */
+bool isSafeEntryName(const std::string& name);
+
+} // namespace ExtractIO
@@ -0,0 +1,405 @@
+#include "FileIO.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace FileIO {
+
+namespace {
+
+std::string errnoMessage(const std::string& what, const fs::path& path = {}) {
+    std::string message = what;
+    if (!path.empty()) {
+        message += ": " + path.string();
+    }
+    return message + " (" + std::strerror(errno) + ")";
+}
+
+int openFile(const fs::path& path, bool forWriting) {
+#ifdef _WIN32
+    int flags = forWriting ? (_O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY)
+                           : (_O_RDONLY | _O_BINARY);
+    return _wopen(path.c_str(), flags, _S_IREAD | _S_IWRITE);
+#else
+    int flags = forWriting ? (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC)
+                           : (O_RDONLY | O_CLOEXEC);
+    return ::open(path.c_str(), flags, 0666);
+#endif
+}
+
+void closeFile(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+int syncDescriptor(int fd) {
+#ifdef _WIN32
+    return _commit(fd);
+#elif defined(__APPLE__)
+    return ::fsync(fd);
+#else
+    int rc;
+    do {
+        rc = ::fdatasync(fd);
+    } while (rc != 0 && errno == EINTR);
+    return rc;
+#endif
+}
+
+bool isZeroBlock(const char* data, size_t size) {
+    static const char zeros[ZERO_BLOCK_SIZE] = {};
+    return std::memcmp(data, zeros, size) == 0;
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------
+// InputFile
+
+InputFile::InputFile(const fs::path& path) : fd(openFile(path, false)) {
+    if (fd < 0) {
+        throw std::runtime_error(errnoMessage("Failed to open input file", path));
+    }
+}
+
+InputFile::~InputFile() {
+    close();
+}
+
+InputFile::InputFile(InputFile&& other) noexcept : fd(other.fd) {
+    other.fd = -1;
+}
+
+InputFile& InputFile::operator=(InputFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        fd = other.fd;
+        other.fd = -1;
+    }
+    return *this;
+}
+
+uint64_t InputFile::size() const {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_fstat64(fd, &st) != 0) {
+#else
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+#endif
+        throw std::runtime_error(errnoMessage("Failed to stat input file"));
+    }
+    return static_cast<uint64_t>(st.st_size);
+}
+
+void InputFile::readAt(uint64_t offset, char* data, size_t size) const {
+    while (size > 0) {
+#ifdef _WIN32
+        if (_lseeki64(fd, static_cast<__int64>(offset), SEEK_SET) < 0) {
+            throw std::runtime_error(errnoMessage("Failed to seek input file"));
+        }
+        unsigned int chunk = static_cast<unsigned int>(std::min<size_t>(size, 1u << 30));
+        int n = _read(fd, data, chunk);
+#else
+        ssize_t n = ::pread(fd, data, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (n < 0) {
+            throw std::runtime_error(errnoMessage("Failed to read input file"));
+        }
+        if (n == 0) {
+            throw std::runtime_error("Unexpected end of input file");
+        }
+        data += n;
+        offset += static_cast<uint64_t>(n);
+        size -= static_cast<size_t>(n);
+    }
+}
+
+std::vector<SparseExtent> InputFile::dataExtents() const {
+    const uint64_t fileSize = size();
+    std::vector<SparseExtent> extents;
+    if (fileSize == 0) {
+        return extents;
+    }
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE) && !defined(_WIN32)
+    off_t pos = 0;
+    const off_t end = static_cast<off_t>(fileSize);
+    while (pos < end) {
+        off_t dataStart = ::lseek(fd, pos, SEEK_DATA);
+        if (dataStart < 0) {
+            if (errno == ENXIO) {
+                break; // Only a trailing hole remains
+            }
+            return {SparseExtent{0, fileSize}};
+        }
+        off_t holeStart = ::lseek(fd, dataStart, SEEK_HOLE);
+        if (holeStart < 0) {
+            return {SparseExtent{0, fileSize}};
+        }
+        holeStart = std::min(holeStart, end);
+        extents.push_back(SparseExtent{static_cast<uint64_t>(dataStart),
+                                       static_cast<uint64_t>(holeStart - dataStart)});
+        pos = holeStart;
+    }
+    return extents;
+#else
+    extents.push_back(SparseExtent{0, fileSize});
+    return extents;
+#endif
+}
+
+void InputFile::close() {
+    if (fd >= 0) {
+        closeFile(fd);
+        fd = -1;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// OutputFile
+
+OutputFile::OutputFile(const fs::path& path) : fd(openFile(path, true)) {
+    if (fd < 0) {
+        throw std::runtime_error(errnoMessage("Failed to create output file", path));
+    }
+}
+
+OutputFile::~OutputFile() {
+    close();
+}
+
+OutputFile::OutputFile(OutputFile&& other) noexcept : fd(other.fd) {
+    other.fd = -1;
+}
+
+OutputFile& OutputFile::operator=(OutputFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        fd = other.fd;
+        other.fd = -1;
+    }
+    return *this;
+}
+
+void OutputFile::preallocate(uint64_t offset, uint64_t length) {
+#if defined(__linux__)
+    // fallocate (unlike posix_fallocate) fails instead of writing zeros on
+    // filesystems without native support, which is what we want here.
+    if (length > 0) {
+        (void)::fallocate(fd, 0, static_cast<off_t>(offset), static_cast<off_t>(length));
+    }
+#else
+    (void)offset;
+    (void)length;
+#endif
+}
+
+void OutputFile::writeAt(uint64_t offset, const char* data, size_t size) {
+    while (size > 0) {
+#ifdef _WIN32
+        if (_lseeki64(fd, static_cast<__int64>(offset), SEEK_SET) < 0) {
+            throw std::runtime_error(errnoMessage("Failed to seek output file"));
+        }
+        unsigned int chunk = static_cast<unsigned int>(std::min<size_t>(size, 1u << 30));
+        int n = _write(fd, data, chunk);
+#else
+        ssize_t n = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (n < 0) {
+            throw std::runtime_error(errnoMessage("Failed to write output file"));
+        }
+        data += n;
+        offset += static_cast<uint64_t>(n);
+        size -= static_cast<size_t>(n);
+    }
+}
+
+void OutputFile::truncate(uint64_t size) {
+#ifdef _WIN32
+    int rc = _chsize_s(fd, static_cast<__int64>(size));
+#else
+    int rc = ::ftruncate(fd, static_cast<off_t>(size));
+#endif
+    if (rc != 0) {
+        throw std::runtime_error(errnoMessage("Failed to set output file size"));
+    }
+}
+
+void OutputFile::close() {
+    if (fd >= 0) {
+        closeFile(fd);
+        fd = -1;
+    }
+}
+
+void OutputFile::sync() {
+    if (syncDescriptor(fd) != 0) {
+        throw std::runtime_error(errnoMessage("Failed to sync output file"));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Durability helpers
+
+void syncFile(const fs::path& path) {
+#ifdef _WIN32
+    int fd = _wopen(path.c_str(), _O_WRONLY | _O_BINARY);
+#else
+    int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+#endif
+    if (fd < 0) {
+        throw std::runtime_error(errnoMessage("Failed to open file for syncing", path));
+    }
+    int rc = syncDescriptor(fd);
+    int savedErrno = errno;
+    closeFile(fd);
+    if (rc != 0) {
+        errno = savedErrno;
+        throw std::runtime_error(errnoMessage("Failed to sync file", path));
+    }
+}
+
+void syncDirectory(const fs::path& directory) {
+#ifdef _WIN32
+    (void)directory;
+#else
+    const fs::path dir = directory.empty() ? fs::path(".") : directory;
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error(errnoMessage("Failed to open directory for syncing", dir));
+    }
+    int rc = ::fsync(fd);
+    int savedErrno = errno;
+    closeFile(fd);
+    // Some filesystems cannot sync directories; the rename is still atomic
+    if (rc != 0 && savedErrno != EINVAL && savedErrno != ENOTSUP) {
+        errno = savedErrno;
+        throw std::runtime_error(errnoMessage("Failed to sync directory", dir));
+    }
+#endif
+}
+
+void replaceFile(const fs::path& source, const fs::path& target) {
+    fs::rename(source, target);
+    syncDirectory(target.parent_path());
+}
+
+void setBinaryStandardStreams() {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+}
+
+bool linkFile(const fs::path& source, const fs::path& target) {
+    std::error_code ec;
+#if defined(__linux__) && defined(FICLONE)
+    int in = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in >= 0) {
+        int out = ::open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (out >= 0) {
+            bool cloned = ::ioctl(out, FICLONE, in) == 0;
+            ::close(out);
+            if (cloned) {
+                ::close(in);
+                return true;
+            }
+            fs::remove(target, ec);
+        }
+        ::close(in);
+    }
+#endif
+    fs::create_hard_link(source, target, ec);
+    if (!ec) {
+        return true;
+    }
+    return fs::copy_file(source, target, fs::copy_options::overwrite_existing, ec) && !ec;
+}
+
+// ---------------------------------------------------------------------------
+// Sparse helpers
+
+std::vector<SparseExtent> findNonZeroExtents(const char* data, size_t size,
+                                             uint64_t baseOffset) {
+    std::vector<SparseExtent> extents;
+    size_t pos = 0;
+    while (pos < size) {
+        // Blocks are aligned to the file offset, not to the buffer start
+        uint64_t absolute = baseOffset + pos;
+        size_t blockLen = ZERO_BLOCK_SIZE - static_cast<size_t>(absolute % ZERO_BLOCK_SIZE);
+        blockLen = std::min(blockLen, size - pos);
+
+        bool zero = blockLen == ZERO_BLOCK_SIZE && isZeroBlock(data + pos, blockLen);
+        if (!zero) {
+            if (!extents.empty() &&
+                extents.back().offset + extents.back().length == absolute) {
+                extents.back().length += blockLen;
+            } else {
+                extents.push_back(SparseExtent{absolute, blockLen});
+            }
+        }
+        pos += blockLen;
+    }
+    return extents;
+}
+
+void writeSparseFile(const fs::path& path, const char* data,
+                     const std::vector<SparseExtent>& extents, uint64_t fileSize) {
+    struct Run {
+        SparseExtent extent;
+        const char* source;
+    };
+
+    // Work out which regions actually carry data before touching the disk so
+    // they can all be reserved up front.
+    std::vector<Run> runs;
+    const char* cursor = data;
+    for (const auto& extent : extents) {
+        for (const auto& sub : findNonZeroExtents(cursor, static_cast<size_t>(extent.length),
+                                                  extent.offset)) {
+            runs.push_back(Run{sub, cursor + (sub.offset - extent.offset)});
+        }
+        cursor += extent.length;
+    }
+
+    OutputFile out(path);
+    for (const auto& run : runs) {
+        out.preallocate(run.extent.offset, run.extent.length);
+    }
+    for (const auto& run : runs) {
+        out.writeAt(run.extent.offset, run.source, static_cast<size_t>(run.extent.length));
+    }
+    out.truncate(fileSize);
+    out.close();
+}
+
+} // namespace FileIO
@@ -0,0 +1,153 @@
+/**
+ * @file FileIO.h
+ * @brief Descriptor-level file access used by the archive read/write paths
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#include "ArchiveFormat.h"
+
+namespace FileIO {
+
+/**
+ * @brief Block size used when looking for all-zero runs in file data
+ */
+constexpr size_t ZERO_BLOCK_SIZE = 4096;
+
+/**
+ * @brief Read-only file opened at the descriptor level
+ */
+class InputFile {
+public:
+    InputFile() = default;
+    explicit InputFile(const std::filesystem::path& path);
+    ~InputFile();
+
+    InputFile(InputFile&& other) noexcept;
+    InputFile& operator=(InputFile&& other) noexcept;
+    InputFile(const InputFile&) = delete;
+    InputFile& operator=(const InputFile&) = delete;
+
+    bool isOpen() const { return fd >= 0; }
+    uint64_t size() const;
+
+    /**
+     * @brief Reads exactly @p size bytes at @p offset, throwing on a short read
+     */
+    void readAt(uint64_t offset, char* data, size_t size) const;
+
+    /**
+     * @brief Returns the allocated (non-hole) regions of the file
+     *
+     * Falls back to a single extent covering the whole file when the
+     * platform or filesystem cannot report holes.
+     */
+    std::vector<SparseExtent> dataExtents() const;
+
+    void close();
+
+private:
+    int fd = -1;
+};
+
+/**
+ * @brief Write-only file that supports preallocation and sparse writes
+ */
+class OutputFile {
+public:
+    OutputFile() = default;
+    explicit OutputFile(const std::filesystem::path& path);
+    ~OutputFile();
+
+    OutputFile(OutputFile&& other) noexcept;
+    OutputFile& operator=(OutputFile&& other) noexcept;
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    bool isOpen() const { return fd >= 0; }
+
+    /**
+     * @brief Reserves disk blocks for a range (best effort, never throws)
+     */
+    void preallocate(uint64_t offset, uint64_t length);
+
+    void writeAt(uint64_t offset, const char* data, size_t size);
+
+    /**
+     * @brief Sets the logical file size; regions never written become holes
+     */
+    void truncate(uint64_t size);
+
+    /**
+     * @brief Flushes the file's data (not necessarily its metadata) to disk
+     */
+    void sync();
+
+    void close();
+
+private:
+    int fd = -1;
+};
+
+/**
+ * @brief Flushes the data of an existing file to disk (fdatasync)
+ *
+ * Any descriptor for the file can be used to sync it, so this also covers
+ * data written through a stream opened elsewhere, once that is flushed.
+ */
+void syncFile(const std::filesystem::path& path);
+
+/**
+ * @brief Makes renames and creations in a directory durable (no-op on Windows)
+ */
+void syncDirectory(const std::filesystem::path& directory);
+
+/**
+ * @brief Atomically replaces @p target with @p source and syncs the directory
+ *
+ * @p source must already be synced; after this returns either the old or
+ * the new contents are visible under @p target, even after a crash.
+ */
+void replaceFile(const std::filesystem::path& source, const std::filesystem::path& target);
+
+/**
+ * @brief Gives @p target the contents of @p source as cheaply as possible
+ *
+ * Tries a copy-on-write clone (FICLONE), then a hard link, then a copy.
+ * A hard-linked target shares its data with @p source, so neither may be
+ * modified in place afterwards. Returns false if everything failed; never
+ * throws. @p target must not exist.
+ */
+bool linkFile(const std::filesystem::path& source, const std::filesystem::path& target);
+
+/**
+ * @brief Stops stdin and stdout from translating line endings (no-op
+ *        outside Windows), for archives streamed through them
+ */
+void setBinaryStandardStreams();
+
+/**
+ * @brief Splits a buffer into extents that are not entirely zero
+ *
+ * Zero runs shorter than ZERO_BLOCK_SIZE, or not aligned to it, stay inside
+ * the neighbouring data extent so writes remain block-sized.
+ */
+std::vector<SparseExtent> findNonZeroExtents(const char* data, size_t size,
+                                             uint64_t baseOffset = 0);
+
+/**
+ * @brief Writes file contents, preallocating data regions and leaving holes
+ *        for zero blocks
+ * @param path Destination file (created or truncated)
+ * @param data Concatenated bytes of all @p extents
+ * @param extents Logical placement of @p data within the file
+ * @param fileSize Final logical size of the file
+ */
+void writeSparseFile(const std::filesystem::path& path, const char* data,
+                     const std::vector<SparseExtent>& extents, uint64_t fileSize);
+
+} // namespace FileIO
@@ -0,0 +1,303 @@
+#include "MemoryArchive.h"
+#include "Archive.h"
+#include "ArchiveFormat.h"
+#include "Sha256.h"
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace {
+
+// zlib counts in 32-bit units, so large buffers are fed in pieces
+constexpr uint64_t ZLIB_CHUNK = 1u << 30;
+
+// Presents a caller's buffer as a seekable input stream without copying it
+class MemoryBuffer : public std::streambuf {
+public:
+    MemoryBuffer(const char* data, size_t size) {
+        char* begin = const_cast<char*>(data); // Never written through
+        setg(begin, begin, begin + size);
+    }
+
+protected:
+    pos_type seekoff(off_type offset, std::ios::seekdir dir, std::ios::openmode which) override {
+        if (!(which & std::ios::in)) {
+            return pos_type(off_type(-1));
+        }
+        const char* base = dir == std::ios::beg ? eback() : dir == std::ios::cur ? gptr() : egptr();
+        off_type target = (base - eback()) + offset;
+        if (target < 0 || target > egptr() - eback()) {
+            return pos_type(off_type(-1));
+        }
+        setg(eback(), eback() + target, egptr());
+        return pos_type(target);
+    }
+
+    pos_type seekpos(pos_type position, std::ios::openmode which) override {
+        return seekoff(off_type(position), std::ios::beg, which);
+    }
+};
+
+// Forwards everything written to an ArchiveSink
+class SinkBuffer : public std::streambuf {
+public:
+    explicit SinkBuffer(ArchiveSink& sink) : sink(sink) {}
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            char byte = traits_type::to_char_type(c);
+            sink.write(&byte, 1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize size) override {
+        sink.write(data, static_cast<size_t>(size));
+        return size;
+    }
+
+private:
+    ArchiveSink& sink;
+};
+
+// Inflates a payload into the extents of a caller's buffer
+void inflateInto(const char* payload, uint64_t payloadSize, int windowBits, char* out,
+                 const std::vector<SparseExtent>& extents, const std::string& name) {
+    z_stream strm = {};
+    if (inflateInit2(&strm, windowBits) != Z_OK) {
+        throw std::runtime_error("Failed to initialize decompression");
+    }
+    auto fail = [&]() {
+        inflateEnd(&strm);
+        throw std::runtime_error("Decompression failed for: " + name);
+    };
+
+    uint64_t inputLeft = payloadSize;
+    auto feed = [&]() {
+        if (strm.avail_in == 0 && inputLeft > 0) {
+            uInt chunk = static_cast<uInt>(std::min(inputLeft, ZLIB_CHUNK));
+            strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload + (payloadSize - inputLeft)));
+            strm.avail_in = chunk;
+            inputLeft -= chunk;
+        }
+    };
+
+    int status = Z_OK;
+    for (const auto& extent : extents) {
+        char* dest = out + extent.offset;
+        uint64_t left = extent.length;
+        while (left > 0 && status != Z_STREAM_END) {
+            feed();
+            strm.next_out = reinterpret_cast<Bytef*>(dest);
+            strm.avail_out = static_cast<uInt>(std::min(left, ZLIB_CHUNK));
+            const uInt room = strm.avail_out;
+            status = inflate(&strm, Z_NO_FLUSH);
+            if (status != Z_OK && status != Z_STREAM_END) {
+                fail();
+            }
+            dest += room - strm.avail_out;
+            left -= room - strm.avail_out;
+        }
+        if (left > 0) {
+            fail();
+        }
+    }
+
+    // All data is out; the stream must end without producing more
+    while (status == Z_OK) {
+        feed();
+        char extra;
+        strm.next_out = reinterpret_cast<Bytef*>(&extra);
+        strm.avail_out = 1;
+        status = inflate(&strm, Z_NO_FLUSH);
+        if (strm.avail_out == 0 || (status != Z_OK && status != Z_STREAM_END)) {
+            fail();
+        }
+    }
+    inflateEnd(&strm);
+}
+
+} // namespace
+
+MemoryArchiveWriter::MemoryArchiveWriter(ArchiveSink& sink, CompressionType compression)
+    : sink(sink), compression(compression) {
+    uint8_t prefix[ENTRY_PREFIX_SIZE];
+    write(prefix, ArchiveFormat::encodeArchiveHeader(prefix));
+}
+
+void MemoryArchiveWriter::write(const void* data, size_t size) {
+    sink.write(static_cast<const char*>(data), size);
+    offset += size;
+}
+
+void MemoryArchiveWriter::add(const std::string& name, ByteView data, int64_t timestamp) {
+    if (finished) {
+        throw std::runtime_error("Archive is already finished");
+    }
+    std::vector<char> compressed = Archive::compressData(data.data, data.size, compression);
+
+    EntryHeader header;
+    header.flags = ENTRY_FLAG_CRC32;
+    header.codec = CODEC_ZLIB;
+    uLong crc = ::crc32(0L, Z_NULL, 0);
+    for (uint64_t done = 0; done < data.size;) {
+        uInt chunk = static_cast<uInt>(std::min<uint64_t>(data.size - done, ZLIB_CHUNK));
+        crc = ::crc32(crc, reinterpret_cast<const Bytef*>(data.data + done), chunk);
+        done += chunk;
+    }
+    header.crc32 = static_cast<uint32_t>(crc);
+    if (contentHashes) {
+        header.flags |= ENTRY_FLAG_SHA256;
+        Sha256::Digest digest = Sha256::hash(data.data, data.size);
+        std::memcpy(header.sha256, digest.data(), digest.size());
+    }
+    header.nameLength = static_cast<uint32_t>(name.size());
+    header.compressedSize = compressed.size();
+    header.originalSize = data.size;
+    header.timestamp = timestamp;
+
+    const uint64_t entryOffset = offset;
+    uint8_t encoded[MAX_ENTRY_HEADER_SIZE];
+    write(encoded, ArchiveFormat::encodeEntryHeader(header, encoded));
+    write(name.data(), name.size());
+    write(compressed.data(), compressed.size());
+    entries.add(name, header.compressedSize, header.originalSize, header.timestamp, entryOffset);
+}
+
+void MemoryArchiveWriter::finish() {
+    if (finished) {
+        return;
+    }
+    finished = true;
+    entries.buildNameIndex();
+    SinkBuffer buffer(sink);
+    std::ostream out(&buffer);
+    if (!entries.writeIndex(out, offset)) {
+        throw std::runtime_error("Failed to write archive index");
+    }
+}
+
+MemoryArchiveReader::MemoryArchiveReader(ByteView archive) : archive(archive) {
+    MemoryBuffer buffer(archive.data, archive.size);
+    std::istream in(&buffer);
+    Archive::readCatalog(in, entries);
+}
+
+std::optional<ArchiveEntry> MemoryArchiveReader::find(std::string_view name) const {
+    size_t index = entries.find(name);
+    if (index == EntryTable::npos) {
+        return std::nullopt;
+    }
+    return entries[index];
+}
+
+std::vector<char> MemoryArchiveReader::read(std::string_view name) const {
+    auto entry = find(name);
+    if (!entry) {
+        throw std::runtime_error("Entry not found: " + std::string(name));
+    }
+    std::vector<char> data(static_cast<size_t>(entry->originalSize));
+    read(name, data.data(), data.size());
+    return data;
+}
+
+uint64_t MemoryArchiveReader::read(std::string_view name, char* out, size_t capacity) const {
+    const std::string entryName(name);
+    size_t index = entries.find(name);
+    if (index == EntryTable::npos) {
+        throw std::runtime_error("Entry not found: " + entryName);
+    }
+    const ArchiveEntry entry = entries[index];
+    if (capacity < entry.originalSize) {
+        throw std::runtime_error("Buffer too small for: " + entryName);
+    }
+
+    uint64_t position = entries.offset(index);
+    auto reader = [&](void* data, size_t size) {
+        if (position > archive.size || size > archive.size - position) {
+            return false;
+        }
+        std::memcpy(data, archive.data + position, size);
+        position += size;
+        return true;
+    };
+    EntryHeader header;
+    std::vector<SparseExtent> extents;
+    uint64_t headerSize = 0;
+    if (!ArchiveFormat::readEntryHeader(reader, header, headerSize) ||
+        header.nameLength > archive.size - position) {
+        throw std::runtime_error("Corrupt entry: " + entryName);
+    }
+    position += header.nameLength;
+    if (header.isSparse() && !ArchiveFormat::readSparseMap(reader, header, extents, headerSize)) {
+        throw std::runtime_error("Corrupt sparse map for: " + entryName);
+    }
+    if (header.isEncrypted()) {
+        throw std::runtime_error("Entry is encrypted: " + entryName);
+    }
+
+    // A descriptor entry's sizes come from the index until the descriptor is read
+    const uint64_t compressedSize = header.hasDescriptor() ? entry.compressedSize : header.compressedSize;
+    const uint64_t originalSize = header.hasDescriptor() ? entry.originalSize : header.originalSize;
+    if (!header.isSparse() && originalSize > 0) {
+        extents.push_back(SparseExtent{0, originalSize});
+    }
+    if (compressedSize > archive.size - position || originalSize > capacity) {
+        throw std::runtime_error("Corrupt entry: " + entryName);
+    }
+    // The extents are written straight into the caller's buffer and, when
+    // stored, copied straight out of the payload
+    uint64_t dataSize = 0;
+    for (const auto& extent : extents) {
+        if (extent.length > originalSize || extent.offset > originalSize - extent.length) {
+            throw std::runtime_error("Corrupt sparse map for: " + entryName);
+        }
+        dataSize += extent.length;
+    }
+    if (header.codec == CODEC_STORED && dataSize != compressedSize) {
+        throw std::runtime_error("Corrupt entry: " + entryName);
+    }
+    const char* payload = archive.data + position;
+    position += compressedSize;
+
+    if (header.isSparse()) {
+        std::memset(out, 0, static_cast<size_t>(originalSize)); // Holes read as zeros
+    }
+    if (header.codec == CODEC_STORED) {
+        for (const auto& extent : extents) {
+            std::memcpy(out + extent.offset, payload, static_cast<size_t>(extent.length));
+            payload += extent.length;
+        }
+    } else if (header.codec != CODEC_ZLIB && header.codec != CODEC_DEFLATE) {
+        throw std::runtime_error("Unsupported codec " + std::to_string(header.codec) + " for: " + entryName);
+    } else if (compressedSize > 0) {
+        inflateInto(payload, compressedSize, header.codec == CODEC_DEFLATE ? -MAX_WBITS : MAX_WBITS,
+                    out, extents, entryName);
+    }
+
+    if (header.hasDescriptor()) {
+        uint64_t descriptorSize = 0;
+        if (!ArchiveFormat::readEntryDescriptor(reader, header, descriptorSize) ||
+            header.compressedSize != compressedSize || header.originalSize != originalSize) {
+            throw std::runtime_error("Corrupt entry descriptor for: " + entryName);
+        }
+    }
+    if (header.hasCrc32()) {
+        uLong crc = ::crc32(0L, Z_NULL, 0);
+        for (const auto& extent : extents) {
+            for (uint64_t done = 0; done < extent.length;) {
+                uInt chunk = static_cast<uInt>(std::min(extent.length - done, ZLIB_CHUNK));
+                crc = ::crc32(crc, reinterpret_cast<const Bytef*>(out + extent.offset + done), chunk);
+                done += chunk;
+            }
+        }
+        if (static_cast<uint32_t>(crc) != header.crc32) {
+            throw std::runtime_error("Checksum mismatch for: " + entryName);
+        }
+    }
+    return originalSize;
+}
@@ -0,0 +1,144 @@
+/**
+ * @file MemoryArchive.h
+ * @brief Building and reading archives entirely in memory
+ *
+ * Services that produce or consume content in memory can use these
+ * classes instead of Archive, which works on files. The bytes written and
+ * read are the regular archive format.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "CompressionTypes.h"
+#include "EntryTable.h"
+
+/**
+ * @brief Read-only view of bytes owned by the caller
+ *
+ * Stands in for std::span<const std::byte>, which needs C++20.
+ */
+struct ByteView {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    ByteView() = default;
+    ByteView(const void* data, size_t size) : data(static_cast<const char*>(data)), size(size) {}
+    ByteView(const std::vector<char>& bytes) : data(bytes.data()), size(bytes.size()) {}
+    ByteView(const std::string& bytes) : data(bytes.data()), size(bytes.size()) {}
+    ByteView(std::string_view bytes) : data(bytes.data()), size(bytes.size()) {}
+};
+
+/**
+ * @brief Receives an archive's bytes in order
+ */
+class ArchiveSink {
+public:
+    virtual ~ArchiveSink() = default;
+
+    /**
+     * @brief Takes the next bytes of the archive; throw to abort
+     */
+    virtual void write(const char* data, size_t size) = 0;
+};
+
+/**
+ * @brief Sink appending to a caller-owned vector
+ */
+class VectorSink : public ArchiveSink {
+public:
+    explicit VectorSink(std::vector<char>& out) : out(out) {}
+
+    void write(const char* data, size_t size) override { out.insert(out.end(), data, data + size); }
+
+private:
+    std::vector<char>& out;
+};
+
+/**
+ * @brief Writes an archive of in-memory files to a sink
+ *
+ * The archive header is written on construction, each entry as it is
+ * added, and the name index by finish(). Input buffers are compressed in
+ * place and may be released as soon as add returns.
+ */
+class MemoryArchiveWriter {
+public:
+    explicit MemoryArchiveWriter(ArchiveSink& sink, CompressionType compression = CompressionType::Normal);
+
+    MemoryArchiveWriter(const MemoryArchiveWriter&) = delete;
+    MemoryArchiveWriter& operator=(const MemoryArchiveWriter&) = delete;
+
+    /**
+     * @brief Stores a SHA-256 of every entry's data, see Archive::setContentHashes
+     */
+    void setContentHashes(bool enabled) { contentHashes = enabled; }
+
+    /**
+     * @brief Adds one entry
+     * @param name Path inside the archive, '/' separated
+     * @param timestamp Modification time in std::filesystem::file_time_type ticks
+     */
+    void add(const std::string& name, ByteView data, int64_t timestamp = 0);
+
+    /**
+     * @brief Writes the name index; nothing may be added afterwards
+     */
+    void finish();
+
+    const EntryTable& getEntries() const { return entries; }
+
+private:
+    void write(const void* data, size_t size);
+
+    ArchiveSink& sink;
+    CompressionType compression;
+    bool contentHashes = false;
+    bool finished = false;
+    uint64_t offset = 0;
+    EntryTable entries;
+};
+
+/**
+ * @brief Reads entries of an archive held in a caller-owned buffer
+ *
+ * Nothing is copied: the buffer must stay alive and unchanged while the
+ * reader is used. Reads decode straight into the caller's buffer and may
+ * run concurrently from several threads.
+ */
+class MemoryArchiveReader {
+public:
+    /**
+     * @brief Loads the entry table; throws std::runtime_error if @p archive
+     *        is not an archive
+     */
+    explicit MemoryArchiveReader(ByteView archive);
+
+    const EntryTable& getEntries() const { return entries; }
+
+    std::optional<ArchiveEntry> find(std::string_view name) const;
+
+    /**
+     * @brief Decodes an entry into @p out and verifies its checksum
+     *
+     * Throws std::runtime_error if there is no such entry, @p capacity is
+     * smaller than the entry's original size, the entry is encrypted or
+     * the data is corrupt.
+     * @return Number of bytes written, the entry's original size
+     */
+    uint64_t read(std::string_view name, char* out, size_t capacity) const;
+
+    /**
+     * @brief Decodes an entry into a new buffer
+     */
+    std::vector<char> read(std::string_view name) const;
+
+private:
+    ByteView archive;
+    EntryTable entries;
+};
@@ -0,0 +1,40 @@
+/**
+ * @file Sha256.h
+ * @brief Incremental SHA-256, used for content-addressed entry hashes
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class Sha256 {
+public:
+    using Digest = std::array<uint8_t, 32>;
+
+    Sha256();
+
+    void update(const void* data, size_t size);
+
+    /**
+     * @brief Completes the hash; the object must not be updated afterwards
+     */
+    Digest finish();
+
+    static Digest hash(const void* data, size_t size);
+
+    /**
+     * @brief Lower-case hexadecimal form of a digest
+     */
+    static std::string toHex(const Digest& digest);
+
+private:
+    void transform(const uint8_t* block);
+
+    std::array<uint32_t, 8> state;
+    std::array<uint8_t, 64> buffer{};
+    size_t buffered = 0;
+    uint64_t length = 0;
+};
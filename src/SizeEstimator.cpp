@@ -0,0 +1,279 @@
+#include "SizeEstimator.h"
+#include "Archive.h"
+#include "ArchiveFormat.h"
+#include "DirectoryScanner.h"
+#include "FileIO.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t LEVEL_COUNT = SizeEstimator::LEVELS.size();
+
+// Sizes within a factor of 16 share a stratum
+constexpr unsigned SIZE_CLASS_BITS = 4;
+
+struct Input {
+    fs::path path;
+    uint64_t size = 0;
+    size_t directory = 0;
+    uint32_t nameLength = 0;
+};
+
+// Compressed bytes and seconds per input byte, summed over sample points
+struct Rates {
+    double points = 0;
+    std::array<double, LEVEL_COUNT> output{};
+    std::array<double, LEVEL_COUNT> seconds{};
+
+    void add(const Rates& other) {
+        points += other.points;
+        for (size_t level = 0; level < LEVEL_COUNT; ++level) {
+            output[level] += other.output[level];
+            seconds[level] += other.seconds[level];
+        }
+    }
+};
+
+struct Stratum {
+    std::string extension;
+    uint64_t bytes = 0;
+    std::vector<size_t> files;
+    Rates rates;
+};
+
+struct Sample {
+    size_t stratum = 0;
+    size_t file = 0;
+    uint64_t offset = 0;
+    size_t length = 0;
+    uint64_t points = 1; ///< Sample points that fell into this block
+    bool read = false;
+    Rates rates;
+};
+
+// Runs work(i) for every i below count on up to threads threads; work must
+// not throw
+void parallelFor(size_t count, unsigned threads, const std::function<void(size_t)>& work) {
+    std::atomic<size_t> next{0};
+    auto worker = [&] {
+        for (size_t i = next++; i < count; i = next++) {
+            work(i);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads && t < count; ++t) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+}
+
+unsigned sizeClass(uint64_t size) {
+    unsigned bits = 0;
+    for (; size > 0; size >>= 1) {
+        ++bits;
+    }
+    return bits / SIZE_CLASS_BITS;
+}
+
+std::string lowercaseExtension(const fs::path& file) {
+    std::string extension = file.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension;
+}
+
+// Header and index bytes create adds for one file
+uint64_t entryOverhead(const Input& input, uint64_t compressedSize) {
+    EntryHeader header;
+    header.flags = ENTRY_FLAG_CRC32;
+    header.nameLength = input.nameLength;
+    header.compressedSize = compressedSize;
+    header.originalSize = input.size;
+    header.timestamp = fs::file_time_type::clock::now().time_since_epoch().count();
+    uint8_t encoded[MAX_ENTRY_HEADER_SIZE];
+    return ArchiveFormat::encodeEntryHeader(header, encoded) + 2ull * input.nameLength + INDEX_RECORD_SIZE +
+           sizeof(uint32_t);
+}
+
+} // namespace
+
+SizeEstimator::SizeEstimator(const EstimateOptions& options) : options(options) {
+    if (this->options.threads == 0) {
+        this->options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (this->options.blockSize == 0) {
+        throw std::runtime_error("Estimate block size must not be zero");
+    }
+}
+
+SizeEstimate SizeEstimator::estimate(const std::vector<fs::path>& roots) const {
+    DirectoryScanner scanner(options.threads);
+    const std::vector<fs::path> files = scanner.scan(roots);
+
+    // Each file counts towards the directory depth levels below its root
+    std::map<std::string, size_t> directoryIds;
+    std::vector<Input> inputs(files.size());
+    for (size_t i = 0; i < files.size(); ++i) {
+        Input& input = inputs[i];
+        input.path = files[i];
+        fs::path directory = files[i].parent_path();
+        std::string name = files[i].filename().string();
+        for (const auto& root : roots) {
+            const fs::path relative = files[i].lexically_relative(root);
+            if (relative.empty() || *relative.begin() == ".." || relative == ".") {
+                continue;
+            }
+            directory = root;
+            unsigned level = 0;
+            for (const auto& part : relative.parent_path()) {
+                if (level++ == options.depth) {
+                    break;
+                }
+                directory /= part;
+            }
+            name = (root.filename() / relative).generic_string();
+            break;
+        }
+        const std::string key = directory.empty() ? "." : directory.generic_string();
+        input.directory = directoryIds.emplace(key, directoryIds.size()).first->second;
+        input.nameLength = static_cast<uint32_t>(name.size());
+    }
+    parallelFor(inputs.size(), options.threads, [&](size_t i) {
+        std::error_code ec;
+        const uint64_t size = fs::file_size(inputs[i].path, ec);
+        inputs[i].size = ec ? 0 : size;
+    });
+
+    // Strata in a fixed order, so the same tree always gets the same samples
+    std::map<std::pair<std::string, unsigned>, Stratum> byKey;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        std::string extension = lowercaseExtension(inputs[i].path);
+        Stratum& stratum = byKey[{extension, sizeClass(inputs[i].size)}];
+        stratum.extension = std::move(extension);
+        stratum.bytes += inputs[i].size;
+        stratum.files.push_back(i);
+    }
+    std::vector<Stratum> strata;
+    strata.reserve(byKey.size());
+    uint64_t totalBytes = 0;
+    for (auto& entry : byKey) {
+        totalBytes += entry.second.bytes;
+        strata.push_back(std::move(entry.second));
+    }
+
+    // Systematic sample over the bytes of all strata back to back: one
+    // point every step bytes, each widened to the block around it
+    const uint64_t blocks = std::max<uint64_t>(1, options.sampleBytes / options.blockSize);
+    const uint64_t step = std::max<uint64_t>(1, totalBytes / blocks);
+    std::vector<Sample> samples;
+    uint64_t point = step / 2;
+    uint64_t start = 0;
+    for (size_t s = 0; s < strata.size(); ++s) {
+        for (size_t file : strata[s].files) {
+            const uint64_t size = inputs[file].size;
+            for (; point < start + size; point += step) {
+                uint64_t offset = (point - start) / options.blockSize * options.blockSize;
+                const size_t length = static_cast<size_t>(std::min<uint64_t>(options.blockSize, size));
+                offset = std::min(offset, size - length);
+                if (samples.empty() || samples.back().file != file || samples.back().offset != offset) {
+                    samples.push_back(Sample{s, file, offset, length, 1, false, Rates()});
+                } else {
+                    ++samples.back().points;
+                }
+            }
+            start += size;
+        }
+    }
+
+    parallelFor(samples.size(), options.threads, [&](size_t i) {
+        Sample& sample = samples[i];
+        std::vector<char> data(sample.length);
+        try {
+            FileIO::InputFile(inputs[sample.file].path).readAt(sample.offset, data.data(), data.size());
+        } catch (const std::exception&) {
+            return; // Unreadable now, unreadable for create too
+        }
+        // Every point stands for the same number of input bytes, however
+        // large the block it fell into
+        sample.read = true;
+        const double points = static_cast<double>(sample.points);
+        const double perByte = points / static_cast<double>(data.size());
+        sample.rates.points = points;
+        for (size_t level = 0; level < LEVEL_COUNT; ++level) {
+            const auto begin = std::chrono::steady_clock::now();
+            const size_t output = Archive::compressData(data, LEVELS[level]).size();
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            sample.rates.output[level] = static_cast<double>(output) * perByte;
+            sample.rates.seconds[level] = seconds * perByte;
+        }
+    });
+
+    SizeEstimate result;
+    Rates overall;
+    std::map<std::string, Rates> byExtension;
+    for (const auto& sample : samples) {
+        if (sample.read) {
+            strata[sample.stratum].rates.add(sample.rates);
+            byExtension[strata[sample.stratum].extension].add(sample.rates);
+            overall.add(sample.rates);
+            ++result.samples;
+            result.sampledBytes += sample.length;
+        }
+    }
+
+    result.files = inputs.size();
+    result.inputBytes = totalBytes;
+    result.strata = strata.size();
+    result.directories.resize(directoryIds.size());
+    for (const auto& entry : directoryIds) {
+        result.directories[entry.second].directory = entry.first;
+        result.directories[entry.second].outputBytes.assign(LEVEL_COUNT, 0);
+    }
+    for (size_t level = 0; level < LEVEL_COUNT; ++level) {
+        LevelEstimate estimate;
+        estimate.compression = LEVELS[level];
+        estimate.outputBytes = ENTRY_PREFIX_SIZE + INDEX_HEADER_SIZE + INDEX_TRAILER_SIZE;
+        result.levels.push_back(estimate);
+    }
+
+    for (const auto& stratum : strata) {
+        const Rates* rates = &stratum.rates;
+        if (rates->points <= 0) {
+            const auto extension = byExtension.find(stratum.extension);
+            rates = extension != byExtension.end() ? &extension->second : &overall;
+        }
+        for (size_t level = 0; level < LEVEL_COUNT; ++level) {
+            const double ratio = rates->points > 0 ? rates->output[level] / rates->points : 1.0;
+            const double secondsPerByte = rates->points > 0 ? rates->seconds[level] / rates->points : 0.0;
+            result.levels[level].cpuSeconds += secondsPerByte * static_cast<double>(stratum.bytes);
+            for (size_t file : stratum.files) {
+                const Input& input = inputs[file];
+                const auto compressed = static_cast<uint64_t>(ratio * static_cast<double>(input.size) + 0.5);
+                const uint64_t bytes = compressed + entryOverhead(input, compressed);
+                result.levels[level].outputBytes += bytes;
+                result.directories[input.directory].outputBytes[level] += bytes;
+            }
+        }
+        for (size_t file : stratum.files) {
+            DirectoryEstimate& directory = result.directories[inputs[file].directory];
+            ++directory.files;
+            directory.inputBytes += inputs[file].size;
+        }
+    }
+
+    std::sort(result.directories.begin(), result.directories.end(),
+              [](const DirectoryEstimate& a, const DirectoryEstimate& b) { return a.directory < b.directory; });
+    return result;
+}
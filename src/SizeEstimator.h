@@ -0,0 +1,77 @@
+/**
+ * @file SizeEstimator.h
+ * @brief Predicts archive size and compression time from sampled input
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "CompressionTypes.h"
+
+struct EstimateOptions {
+    uint64_t sampleBytes = 32ull << 20; ///< Input read and compressed at each level
+    size_t blockSize = 64 << 10;        ///< Bytes per sample; smaller files are sampled whole
+    unsigned depth = 1;                 ///< Directory levels below each root in the breakdown
+    unsigned threads = 0;               ///< Sampling threads, 0 = one per core
+};
+
+/**
+ * @brief Predicted result of create at one compression level
+ */
+struct LevelEstimate {
+    CompressionType compression = CompressionType::Normal;
+    uint64_t outputBytes = 0; ///< Archive size including headers and index
+    double cpuSeconds = 0;    ///< Compression time on a single core
+};
+
+/**
+ * @brief Share of one directory in the estimate
+ */
+struct DirectoryEstimate {
+    std::string directory;
+    uint64_t files = 0;
+    uint64_t inputBytes = 0;
+    std::vector<uint64_t> outputBytes; ///< Per level, in SizeEstimate::levels order
+};
+
+struct SizeEstimate {
+    uint64_t files = 0;
+    uint64_t inputBytes = 0;
+    uint64_t samples = 0;       ///< Blocks read
+    uint64_t sampledBytes = 0;  ///< Input bytes in those blocks
+    size_t strata = 0;
+    std::vector<LevelEstimate> levels;
+    std::vector<DirectoryEstimate> directories; ///< Sorted by path
+};
+
+/**
+ * @brief Estimates what create would produce without reading all the input
+ *
+ * Files are grouped into strata by extension and size class. Sample blocks
+ * are spread evenly over the bytes of all files taken stratum by stratum,
+ * so every stratum gets samples in proportion to its size, and each block
+ * is compressed with Archive::compressData at every level. A stratum's
+ * measured ratio and time per byte are then applied to all of its files;
+ * strata too small to be sampled borrow from their extension, or from the
+ * whole sample. Only the directory walk and sampleBytes of reads depend on
+ * the input, so terabyte trees take seconds.
+ */
+class SizeEstimator {
+public:
+    static constexpr std::array<CompressionType, 4> LEVELS = {
+        CompressionType::Fastest, CompressionType::Fast, CompressionType::Normal, CompressionType::Best};
+
+    explicit SizeEstimator(const EstimateOptions& options = EstimateOptions());
+
+    /**
+     * @brief Walks @p roots like the console's create and estimates the result
+     */
+    SizeEstimate estimate(const std::vector<std::filesystem::path>& roots) const;
+
+private:
+    EstimateOptions options;
+};
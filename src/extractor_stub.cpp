@@ -1,345 +1,476 @@
 // extractor_stub.cpp - Self-extracting archive stub with auto-execution support
-// This gets compiled into a small executable that can extract embedded archive data
-// and optionally execute a command on the extracted files
+// This gets prepended to every self-extracting executable, so it stays small:
+// no iostreams or std::filesystem, only the inflate half of zlib, and it is
+// built with size optimization (see CMakeLists.txt). The archive is located
+// through the footer at the end of the executable's own image and unpacked
+// by the library's ExtractEngine.
 
-#include <iostream>
-#include <fstream>
-#include <filesystem>
-#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
-#include <zlib.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ArchiveFormat.h"
+#include "ExtractEngine.h"
 
 #ifdef _WIN32
 #include <windows.h>
-#include <shellapi.h>
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
 #else
-#include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <unistd.h>
+#endif
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
 #endif
 
-namespace fs = std::filesystem;
+namespace {
 
-// Magic marker to find where archive data starts
-const char ARCHIVE_MARKER[] = "ARCHIVE_DATA_START_MARKER_12345";
-const size_t MARKER_SIZE = sizeof(ARCHIVE_MARKER) - 1;
+bool silentMode = false;
 
-// Command configuration structure
-struct CommandConfig {
-    char command[512];      // Command to execute
-    char arguments[512];    // Command arguments
-    bool silent;            // Run silently
-    bool waitForCompletion; // Wait for command to complete
-    char workingDir[256];   // Working directory (empty = extraction dir)
-};
+void info(const char* format, ...) {
+    if (silentMode) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    std::vfprintf(stdout, format, args);
+    va_end(args);
+}
+
+void error(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    std::fputs("Error: ", stderr);
+    std::vfprintf(stderr, format, args);
+    std::fputc('\n', stderr);
+    va_end(args);
+}
+
+// Engine hooks for the stub: the progress line, the launch-set filter of
+// run-in-place executables and launch profiling
+class StubObserver : public ExtractObserver {
+public:
+    enum class Filter { All, LaunchSet, Rest };
+
+    StubObserver(uint64_t archiveSize, bool showProgress)
+        : archiveSize(archiveSize ? archiveSize : 1), showProgress(showProgress) {}
+
+    // launchSet must be sorted and outlive the extraction
+    void setFilter(Filter value, const std::vector<std::string>* launchSet) {
+        filter = value;
+        launch = launchSet;
+    }
 
-bool findArchiveData(std::ifstream& file, size_t& archiveOffset, size_t& archiveSize, CommandConfig& cmdConfig) {
-    // Get file size
-    file.seekg(0, std::ios::end);
-    size_t fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
-    
-    // Read the entire file into memory (for small executables this is fine)
-    std::vector<char> buffer(fileSize);
-    file.read(buffer.data(), fileSize);
-    
-    // Search for the marker from the end of the file
-    for (size_t i = fileSize - MARKER_SIZE; i > 0; --i) {
-        if (std::memcmp(buffer.data() + i, ARCHIVE_MARKER, MARKER_SIZE) == 0) {
-            // Read command config (stored right after marker)
-            std::memcpy(&cmdConfig, buffer.data() + i + MARKER_SIZE, sizeof(CommandConfig));
-            
-            // Read archive size (stored after command config)
-            std::memcpy(&archiveSize, buffer.data() + i + MARKER_SIZE + sizeof(CommandConfig), sizeof(size_t));
-            
-            // Archive data starts after size field
-            archiveOffset = i + MARKER_SIZE + sizeof(CommandConfig) + sizeof(size_t);
+    // Records extracted names and resets their access times so the ones the
+    // command reads can be found afterwards
+    void setProfiling(bool enabled) { profiling = enabled; }
+
+    bool shouldExtract(const ExtractItem& item) override {
+        if (filter == Filter::All) {
             return true;
         }
+        bool inSet = std::binary_search(launch->begin(), launch->end(), item.name);
+        return filter == Filter::LaunchSet ? inSet : !inSet;
     }
-    return false;
-}
 
-bool executeCommand(const CommandConfig& cmdConfig, const std::string& extractDir) {
-    if (strlen(cmdConfig.command) == 0) {
-        return true; // No command to execute
+    void entryExtracted(const ExtractItem& item, const ExtractTimings& timings) override {
+        (void)timings;
+        if (profiling) {
+            resetAccessTime(item.path);
+            std::lock_guard<std::mutex> lock(namesMutex);
+            names.push_back(item.name);
+        }
+        uint64_t files = filesDone.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint64_t bytes = bytesDone.fetch_add(item.header.compressedSize, std::memory_order_relaxed) +
+                         item.header.compressedSize;
+        if (!showProgress || !printMutex.try_lock()) {
+            return; // Another worker is printing
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastPrint >= std::chrono::milliseconds(100)) {
+            lastPrint = now;
+            std::printf("\rExtracting... %3u%%  %llu files",
+                        static_cast<unsigned>(std::min<uint64_t>(100, bytes * 100 / archiveSize)),
+                        static_cast<unsigned long long>(files));
+            std::fflush(stdout);
+            printed = true;
+        }
+        printMutex.unlock();
+    }
+
+    void endProgressLine() {
+        if (printed) {
+            std::printf("\n");
+            printed = false;
+        }
+    }
+
+    const std::vector<std::string>& extractedNames() const { return names; }
+
+private:
+    static void resetAccessTime(const std::string& path) {
+#ifndef _WIN32
+        struct timespec times[2];
+        times[0].tv_sec = 0;
+        times[0].tv_nsec = 0;
+        times[1].tv_sec = 0;
+        times[1].tv_nsec = UTIME_OMIT;
+        utimensat(AT_FDCWD, path.c_str(), times, 0);
+#else
+        (void)path;
+#endif
     }
-    
-    std::string workDir = strlen(cmdConfig.workingDir) > 0 ? cmdConfig.workingDir : extractDir;
+
+    uint64_t archiveSize;
+    bool showProgress;
+    Filter filter = Filter::All;
+    const std::vector<std::string>* launch = nullptr;
+    bool profiling = false;
+    std::mutex namesMutex;
+    std::vector<std::string> names;
+    std::atomic<uint64_t> filesDone{0};
+    std::atomic<uint64_t> bytesDone{0};
+    std::mutex printMutex;
+    std::chrono::steady_clock::time_point lastPrint;
+    bool printed = false;
+};
+
+struct RunningCommand {
+#ifdef _WIN32
+    HANDLE process = NULL;
+#else
+    pid_t pid = -1;
+#endif
+};
+
+bool startCommand(const SfxCommandConfig& cmdConfig, const std::string& extractDir, RunningCommand& running) {
+    std::string workDir = cmdConfig.workingDir[0] != '\0' ? cmdConfig.workingDir : extractDir;
     std::string fullCommand = cmdConfig.command;
-    
-    if (strlen(cmdConfig.arguments) > 0) {
+    if (cmdConfig.arguments[0] != '\0') {
         fullCommand += " ";
         fullCommand += cmdConfig.arguments;
     }
-    
-    std::cout << "Executing: " << fullCommand << std::endl;
-    std::cout << "Working directory: " << workDir << std::endl;
-    
+
+    info("Executing: %s\nWorking directory: %s\n", fullCommand.c_str(), workDir.c_str());
+
 #ifdef _WIN32
     STARTUPINFOA si = {};
     PROCESS_INFORMATION pi = {};
     si.cb = sizeof(si);
-    
-    // Set working directory
-    const char* workingDir = workDir.c_str();
-    
-    // Create process
+
     BOOL success = CreateProcessA(
-        NULL,                           // No module name (use command line)
-        const_cast<char*>(fullCommand.c_str()), // Command line
-        NULL,                           // Process handle not inheritable
-        NULL,                           // Thread handle not inheritable
-        FALSE,                          // Set handle inheritance to FALSE
+        NULL,                                   // No module name (use command line)
+        &fullCommand[0],                        // Command line
+        NULL,                                   // Process handle not inheritable
+        NULL,                                   // Thread handle not inheritable
+        FALSE,                                  // Set handle inheritance to FALSE
         cmdConfig.silent ? CREATE_NO_WINDOW : 0, // Creation flags
-        NULL,                           // Use parent's environment block
-        workingDir,                     // Working directory
-        &si,                            // Pointer to STARTUPINFO structure
-        &pi                             // Pointer to PROCESS_INFORMATION structure
+        NULL,                                   // Use parent's environment block
+        workDir.c_str(),                        // Working directory
+        &si,                                    // Pointer to STARTUPINFO structure
+        &pi                                     // Pointer to PROCESS_INFORMATION structure
     );
-    
+
     if (!success) {
-        std::cerr << "Error: Failed to execute command. Error code: " << GetLastError() << std::endl;
+        error("Failed to execute command. Error code: %lu", GetLastError());
         return false;
     }
-    
-    if (cmdConfig.waitForCompletion) {
-        std::cout << "Waiting for command to complete..." << std::endl;
-        WaitForSingleObject(pi.hProcess, INFINITE);
-        
-        DWORD exitCode;
-        GetExitCodeProcess(pi.hProcess, &exitCode);
-        std::cout << "Command completed with exit code: " << exitCode << std::endl;
-    }
-    
-    CloseHandle(pi.hProcess);
     CloseHandle(pi.hThread);
-    
+    running.process = pi.hProcess;
 #else
-    // Unix/Linux implementation
     pid_t pid = fork();
     if (pid == 0) {
         // Child process
         if (chdir(workDir.c_str()) != 0) {
-            std::cerr << "Error: Failed to change directory to " << workDir << std::endl;
-            exit(1);
+            error("Failed to change directory to %s", workDir.c_str());
+            _exit(1);
         }
-        
-        // Execute command
-        execl("/bin/sh", "sh", "-c", fullCommand.c_str(), NULL);
-        std::cerr << "Error: Failed to execute command" << std::endl;
-        exit(1);
-    } else if (pid > 0) {
-        // Parent process
-        if (cmdConfig.waitForCompletion) {
-            int status;
-            waitpid(pid, &status, 0);
-            std::cout << "Command completed with status: " << WEXITSTATUS(status) << std::endl;
+        // Archives store no mode bits, so a command that is an extracted
+        // file gets execute permission wherever it is readable
+        std::string program = cmdConfig.command;
+        program = program.substr(0, program.find(' '));
+        struct stat status;
+        if (program.find('/') != std::string::npos && program[0] != '/' &&
+            ::stat(program.c_str(), &status) == 0 && S_ISREG(status.st_mode) && !(status.st_mode & 0111)) {
+            ::chmod(program.c_str(), (status.st_mode & 07777) | ((status.st_mode & 0444) >> 2));
         }
-    } else {
-        std::cerr << "Error: Failed to fork process" << std::endl;
+        execl("/bin/sh", "sh", "-c", fullCommand.c_str(), static_cast<char*>(nullptr));
+        error("Failed to execute command");
+        _exit(1);
+    } else if (pid < 0) {
+        error("Failed to fork process");
         return false;
     }
+    running.pid = pid;
 #endif
-    
     return true;
 }
 
-bool extractArchive(const std::string& executablePath, const std::string& outputDir) {
-    std::ifstream file(executablePath, std::ios::binary);
-    if (!file) {
-        std::cerr << "Error: Cannot open executable file" << std::endl;
+// Waits for the command if asked to, and releases it either way. Returns
+// the command's exit code, or 0 when it was not waited for; a command
+// killed by a signal reports 128 plus the signal number, as shells do.
+int finishCommand(RunningCommand& running, bool wait) {
+    int exitCode = 0;
+#ifdef _WIN32
+    if (wait) {
+        info("Waiting for command to complete...\n");
+        WaitForSingleObject(running.process, INFINITE);
+
+        DWORD code = 0;
+        GetExitCodeProcess(running.process, &code);
+        info("Command completed with exit code: %lu\n", code);
+        exitCode = static_cast<int>(code);
+    }
+    CloseHandle(running.process);
+#else
+    if (wait) {
+        int status = 0;
+        if (waitpid(running.pid, &status, 0) < 0) {
+            error("Failed to wait for the command");
+            return 1;
+        }
+        exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + (WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+        info("Command completed with status: %d\n", exitCode);
+    }
+#endif
+    return exitCode;
+}
+
+// Archive paths a run-in-place executable extracts before the command
+// starts: the recorded launch list plus the command itself when it is
+// one of the entries. Sorted for StubObserver.
+std::vector<std::string> launchSet(const SfxCommandConfig& cmdConfig, std::vector<std::string> names) {
+    std::string program = cmdConfig.command;
+    program = program.substr(0, program.find(' '));
+    if (program.compare(0, 2, "./") == 0) {
+        program.erase(0, 2);
+    }
+    if (!program.empty()) {
+        names.push_back(program);
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    return names;
+}
+
+// Lists the extracted entries whose access time moved since extraction
+bool writeLaunchProfile(const StubObserver& observer, const std::string& root, const std::string& profilePath) {
+#ifdef _WIN32
+    (void)observer;
+    (void)root;
+    (void)profilePath;
+    error("Launch profiling is not supported on Windows");
+    return false;
+#else
+    std::vector<std::string> used;
+    for (const auto& name : observer.extractedNames()) {
+        struct stat status;
+        if (::stat((root + name).c_str(), &status) == 0 && status.st_atime > 0) {
+            used.push_back(name);
+        }
+    }
+    std::sort(used.begin(), used.end());
+
+    FILE* out = std::fopen(profilePath.c_str(), "w");
+    if (!out) {
+        error("Cannot write launch profile: %s", profilePath.c_str());
         return false;
     }
-    
-    size_t archiveOffset, archiveSize;
-    CommandConfig cmdConfig = {};
-    if (!findArchiveData(file, archiveOffset, archiveSize, cmdConfig)) {
-        std::cerr << "Error: No archive data found in executable" << std::endl;
+    for (const auto& name : used) {
+        std::fprintf(out, "%s\n", name.c_str());
+    }
+    std::fclose(out);
+    info("Recorded %llu launch entries in %s\n", static_cast<unsigned long long>(used.size()),
+         profilePath.c_str());
+    if (used.empty()) {
+        info("No access times changed; the filesystem may be mounted noatime\n");
+    }
+    return true;
+#endif
+}
+
+// commandStatus receives the exit code of a command that was waited for
+bool extractArchive(const std::string& executablePath, const std::string& outputDir, bool skipExecution,
+                    const std::string& profilePath, int& commandStatus) {
+    int fd = ExtractIO::openForReading(executablePath.c_str());
+    if (fd < 0) {
+        error("Cannot open executable file");
         return false;
     }
-    
-    // Create output directory
-    if (!fs::exists(outputDir)) {
-        fs::create_directories(outputDir);
+
+    // The footer says where the archive and the command configuration are
+    const uint64_t imageSize = ExtractIO::fileSize(fd);
+    uint8_t footerBytes[SFX_FOOTER_SIZE];
+    SfxFooter footer;
+    if (imageSize < SFX_FOOTER_SIZE ||
+        !ExtractIO::readAt(fd, imageSize - SFX_FOOTER_SIZE, footerBytes, SFX_FOOTER_SIZE) ||
+        !ArchiveFormat::decodeSfxFooter(footerBytes, imageSize, footer)) {
+        error("No archive data found in executable");
+        ExtractIO::closeFile(fd);
+        return false;
     }
-    
-    // Extract archive data to temporary file
-    fs::path tempArchive = fs::temp_directory_path() / "temp_extract.arc";
-    {
-        std::ofstream tempFile(tempArchive, std::ios::binary);
-        if (!tempFile) {
-            std::cerr << "Error: Cannot create temporary file" << std::endl;
-            return false;
-        }
-        
-        file.seekg(archiveOffset);
-        std::vector<char> archiveData(archiveSize);
-        file.read(archiveData.data(), archiveSize);
-        tempFile.write(archiveData.data(), archiveSize);
+    std::vector<uint8_t> configData(footer.configSize);
+    bool configRead = ExtractIO::readAt(fd, footer.archiveOffset + footer.archiveSize, configData.data(),
+                                        configData.size());
+    ExtractIO::closeFile(fd);
+    SfxCommandConfig cmdConfig = {};
+    std::vector<std::string> launchNames;
+    size_t configSize = configData.size() < sizeof(cmdConfig) ? configData.size() : sizeof(cmdConfig);
+    if (configRead) {
+        std::memcpy(&cmdConfig, configData.data(), configSize);
+        configRead = ArchiveFormat::decodeLaunchList(configData.data() + configSize,
+                                                     configData.size() - configSize, launchNames);
     }
-    
-    // Now extract using the Archive class logic (simplified version)
-    // This is a minimal implementation - you'd want to include the full Archive extraction logic
-    std::ifstream archive(tempArchive, std::ios::binary);
-    if (!archive) {
-        std::cerr << "Error: Cannot read extracted archive data" << std::endl;
+    if (!configRead) {
+        error("Cannot read command configuration");
         return false;
     }
-    
-    // Read archive format (simplified - this should match your Archive.cpp format)
-    struct FileHeader {
-        uint32_t signature;
-        uint16_t version; 
-        uint32_t nameLength;
-        uint64_t compressedSize;
-        uint64_t originalSize;
-        int64_t timestamp;
+    cmdConfig.command[sizeof(cmdConfig.command) - 1] = '\0';
+    cmdConfig.arguments[sizeof(cmdConfig.arguments) - 1] = '\0';
+    cmdConfig.workingDir[sizeof(cmdConfig.workingDir) - 1] = '\0';
+
+    const bool runCommand = !skipExecution && cmdConfig.command[0] != '\0';
+    const bool profiling = !profilePath.empty();
+    if (profiling && cmdConfig.command[0] == '\0') {
+        error("This executable has no command to profile");
+        return false;
+    }
+
+    // Same engine as Archive::extract: one inflate worker per core,
+    // streaming writes and CRC-32 checks
+    StubObserver observer(footer.archiveSize, !silentMode && isatty(fileno(stdout)));
+    observer.setProfiling(profiling);
+    ExtractOptions options;
+    options.observer = &observer;
+    ExtractEngine engine(options);
+    uint64_t filesExtracted = 0;
+    auto extractPass = [&](StubObserver::Filter filter, const std::vector<std::string>* names) {
+        observer.setFilter(filter, names);
+        ExtractResult result = engine.run(executablePath, outputDir, footer.archiveOffset, footer.archiveSize);
+        observer.endProgressLine();
+        if (result != ExtractResult::Success) {
+            error("%s", engine.errorMessage().c_str());
+            return false;
+        }
+        filesExtracted += engine.filesExtracted();
+        return true;
     };
-    
-    const uint32_t SIGNATURE = 0x4E415649; // "IVAN"
-    
-    // Skip the first header (archive header)
-    FileHeader header;
-    archive.read(reinterpret_cast<char*>(&header), sizeof(header));
-    
-    int filesExtracted = 0;
-    while (archive) {
-        if (!archive.read(reinterpret_cast<char*>(&header), sizeof(header)))
-            break;
-            
-        if (header.signature != SIGNATURE)
-            break;
-            
-        // Read filename
-        std::string fileName(header.nameLength, '\0');
-        if (!archive.read(&fileName[0], header.nameLength))
-            break;
-            
-        // Create output file path
-        fs::path outputPath = fs::path(outputDir) / fileName;
-        fs::create_directories(outputPath.parent_path());
-        
-        // Read compressed data
-        std::vector<char> compressedData(header.compressedSize);
-        if (!archive.read(compressedData.data(), header.compressedSize))
-            break;
-            
-        // Decompress data using zlib
-        std::vector<char> decompressedData;
-        
-        if (header.originalSize == header.compressedSize) {
-            // Data is not compressed
-            decompressedData = compressedData;
-        } else {
-            // Decompress using zlib
-            decompressedData.resize(header.originalSize);
-            z_stream strm = {};
-            
-            if (inflateInit(&strm) != Z_OK) {
-                std::cerr << "Error: Failed to initialize decompression for " << fileName << std::endl;
-                continue;
-            }
-            
-            strm.next_in = reinterpret_cast<Bytef*>(compressedData.data());
-            strm.avail_in = static_cast<uInt>(header.compressedSize);
-            strm.next_out = reinterpret_cast<Bytef*>(decompressedData.data());
-            strm.avail_out = static_cast<uInt>(header.originalSize);
-            
-            if (inflate(&strm, Z_FINISH) != Z_STREAM_END) {
-                inflateEnd(&strm);
-                std::cerr << "Error: Decompression failed for " << fileName << std::endl;
-                continue;
-            }
-            inflateEnd(&strm);
+
+    // Run in place: extract what the command needs to start, start it, and
+    // extract the rest while it runs. Profiling always extracts everything
+    // first so the launch set is measured against a complete tree.
+    RunningCommand running;
+    if (runCommand && cmdConfig.runInPlace && !profiling) {
+        const std::vector<std::string> launch = launchSet(cmdConfig, launchNames);
+        if (!extractPass(StubObserver::Filter::LaunchSet, &launch)) {
+            return false;
         }
-        
-        // Write decompressed data
-        std::ofstream outFile(outputPath, std::ios::binary);
-        if (!outFile) {
-            std::cerr << "Error: Cannot create output file: " << outputPath << std::endl;
-            continue;
+        info("Extracted %llu launch files, starting the command\n",
+             static_cast<unsigned long long>(filesExtracted));
+        if (!startCommand(cmdConfig, outputDir, running)) {
+            error("Command execution failed");
+            return false;
         }
-        
-        outFile.write(decompressedData.data(), header.originalSize);
-        
-        filesExtracted++;
+        bool ok = extractPass(StubObserver::Filter::Rest, &launch);
+        info("Successfully extracted %llu files to %s\n", static_cast<unsigned long long>(filesExtracted),
+             outputDir.c_str());
+        commandStatus = finishCommand(running, cmdConfig.waitForCompletion != 0);
+        return ok;
     }
-    
-    // Clean up temporary file
-    fs::remove(tempArchive);
-    
-    std::cout << "Successfully extracted " << filesExtracted << " files to " << outputDir << std::endl;
-    
+
+    if (!extractPass(StubObserver::Filter::All, nullptr)) {
+        return false;
+    }
+    info("Successfully extracted %llu files to %s\n", static_cast<unsigned long long>(filesExtracted),
+         outputDir.c_str());
+
     // Execute command if specified
-    if (strlen(cmdConfig.command) > 0) {
-        std::cout << std::endl;
-        if (!executeCommand(cmdConfig, outputDir)) {
-            std::cerr << "Warning: Command execution failed" << std::endl;
+    if (runCommand || profiling) {
+        info("\n");
+        if (!startCommand(cmdConfig, outputDir, running)) {
+            error("Command execution failed");
             return false;
         }
+        commandStatus = finishCommand(running, cmdConfig.waitForCompletion != 0 || profiling);
+    }
+    if (profiling) {
+        std::string root = outputDir;
+        if (root.empty() || root.back() != '/') {
+            root += '/';
+        }
+        return writeLaunchProfile(observer, root, profilePath);
     }
-    
+
     return true;
 }
 
+std::string executablePath(const char* argv0) {
+#ifdef _WIN32
+    char buffer[MAX_PATH];
+    DWORD length = GetModuleFileNameA(NULL, buffer, MAX_PATH);
+    return length > 0 && length < MAX_PATH ? std::string(buffer, length) : std::string(argv0);
+#elif defined(__APPLE__)
+    char buffer[4096];
+    uint32_t size = sizeof(buffer);
+    return _NSGetExecutablePath(buffer, &size) == 0 ? std::string(buffer) : std::string(argv0);
+#elif defined(__linux__)
+    (void)argv0;
+    return "/proc/self/exe";
+#else
+    return argv0;
+#endif
+}
+
+} // namespace
+
 int main(int argc, char* argv[]) {
-    std::cout << "ModernArchive Self-Extractor" << std::endl;
-    
     std::string outputDir = ".";
-    bool silentMode = false;
     bool skipExecution = false;
-    
+    std::string profilePath;
+
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
-        std::string arg = argv[i];
-        if (arg == "--silent" || arg == "-s") {
+        const char* arg = argv[i];
+        if (std::strcmp(arg, "--silent") == 0 || std::strcmp(arg, "-s") == 0) {
             silentMode = true;
-        } else if (arg == "--skip-exec" || arg == "-n") {
+        } else if (std::strcmp(arg, "--skip-exec") == 0 || std::strcmp(arg, "-n") == 0) {
             skipExecution = true;
-        } else if (arg == "--help" || arg == "-h") {
-            std::cout << "Usage: " << argv[0] << " [options] [output_directory]" << std::endl;
-            std::cout << "Options:" << std::endl;
-            std::cout << "  --silent, -s     Run in silent mode (minimal output)" << std::endl;
-            std::cout << "  --skip-exec, -n  Skip automatic command execution" << std::endl;
-            std::cout << "  --help, -h       Show this help message" << std::endl;
+        } else if (std::strcmp(arg, "--profile-launch") == 0 && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0) {
+            std::printf("ModernArchive Self-Extractor\n"
+                        "Usage: %s [options] [output_directory]\n"
+                        "Options:\n"
+                        "  --silent, -s     Run in silent mode (minimal output)\n"
+                        "  --skip-exec, -n  Skip automatic command execution\n"
+                        "  --profile-launch <file>\n"
+                        "                   Extract everything, run the command to completion and\n"
+                        "                   write the entries it read (for selfext --launch-list)\n"
+                        "  --help, -h       Show this help message\n", argv[0]);
             return 0;
-        } else if (!arg.empty() && arg[0] != '-') {
+        } else if (arg[0] != '-') {
             outputDir = arg;
         }
     }
-    
-    if (!silentMode) {
-        std::cout << "Extracting to: " << outputDir << std::endl;
-    }
-    // Get path to current executable
-    std::string executablePath;
-#ifdef _WIN32
-    char buffer[MAX_PATH];
-    GetModuleFileNameA(NULL, buffer, MAX_PATH);
-    executablePath = buffer;
-#else
-    char buffer[1024];
-    ssize_t len = readlink("/proc/self/exe", buffer, sizeof(buffer) - 1);
-    if (len != -1) {
-        buffer[len] = '\0';
-        executablePath = buffer;
-    }
-#endif
-    
-    if (executablePath.empty()) {
-        std::cerr << "Error: Cannot determine executable path" << std::endl;
-        return 1;
-    }
-    
-    if (!extractArchive(executablePath, outputDir)) {
-        std::cerr << "Extraction failed" << std::endl;
+
+    info("ModernArchive Self-Extractor\nExtracting to: %s\n", outputDir.c_str());
+
+    int commandStatus = 0;
+    if (!extractArchive(executablePath(argv[0]), outputDir, skipExecution, profilePath, commandStatus)) {
+        error("Extraction failed");
         return 1;
     }
-    
-    if (!silentMode) {
-        std::cout << "Extraction completed successfully!" << std::endl;
-    }
-    
-    return 0;
-}
\ No newline at end of file
+
+    info("Extraction completed successfully!\n");
+    return commandStatus; // The command's exit code, so scripts can check it
+}
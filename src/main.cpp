@@ -1,9 +1,140 @@
+#include <csignal>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <string>
+#include <vector>
 #include "ArchiveConsole.h"
+#include "ArchiveStats.h"
+#include "CancellationToken.h"
+
+namespace {
+
+CancellationToken interruptToken;
+
+extern "C" void onInterrupt(int) {
+    interruptToken.cancel();
+}
+
+// "512M" and the like; K, M and G are powers of 1024
+bool parseSize(const std::string& text, uint64_t& size) {
+    size_t end = 0;
+    try {
+        size = std::stoull(text, &end);
+    } catch (const std::exception&) {
+        return false;
+    }
+    const std::string suffix = text.substr(end);
+    const std::string units = "KMG";
+    if (suffix.size() > 1 || (suffix.size() == 1 && units.find(suffix[0]) == std::string::npos)) {
+        return false;
+    }
+    if (suffix.size() == 1) {
+        const size_t shift = 10 * (units.find(suffix[0]) + 1);
+        if (size > (UINT64_MAX >> shift)) {
+            return false;
+        }
+        size <<= shift;
+    }
+    return true;
+}
+
+// A TCP port, 0 to 65535; larger values are rejected rather than wrapped
+bool parsePort(const std::string& text, uint16_t& port) {
+    size_t end = 0;
+    unsigned long value = 0;
+    try {
+        value = std::stoul(text, &end);
+    } catch (const std::exception&) {
+        return false;
+    }
+    if (end != text.size() || value > UINT16_MAX) {
+        return false;
+    }
+    port = static_cast<uint16_t>(value);
+    return true;
+}
+
+} // namespace
 
 int main(int argc, char* argv[]) {
     ArchiveConsole console;
+    ArchiveStats stats;
+
+    // Pull the global options out of argv so commands keep their positions
+    std::string statsFormat;
+    std::string statsFile;
+    VolumeOptions volumes;
+    std::string keyFile;
+    std::vector<char*> args;
+    for (int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--stats=", 0) == 0) {
+            statsFormat = arg.substr(8);
+        } else if (arg == "--fastest") {
+            console.setCompressionType(CompressionType::Fastest);
+        } else if (arg == "--fast") {
+            console.setCompressionType(CompressionType::Fast);
+        } else if (arg == "--normal") {
+            console.setCompressionType(CompressionType::Normal);
+        } else if (arg == "--best") {
+            console.setCompressionType(CompressionType::Best);
+        } else if (arg == "--adaptive") {
+            console.setCompressionType(CompressionType::Adaptive);
+        } else if (arg.rfind("--order=", 0) == 0) {
+            const std::string order = arg.substr(8);
+            if (order != "input" && order != "grouped") {
+                std::cerr << "Error: Unknown entry order '" << order << "'.\n";
+                return 1;
+            }
+            console.setEntryOrder(order == "grouped" ? EntryOrder::Grouped : EntryOrder::Input);
+        } else if (arg.rfind("--volume-size=", 0) == 0) {
+            if (!parseSize(arg.substr(14), volumes.volumeSize) || volumes.volumeSize == 0) {
+                std::cerr << "Error: Invalid volume size '" << arg.substr(14) << "'.\n";
+                return 1;
+            }
+        } else if (arg.rfind("--volume-dir=", 0) == 0) {
+            std::stringstream list(arg.substr(13));
+            for (std::string directory; std::getline(list, directory, ',');) {
+                if (!directory.empty()) {
+                    volumes.directories.push_back(directory);
+                }
+            }
+        } else if (arg == "--resume") {
+            console.setResumable(true);
+        } else if (arg == "--content-hash") {
+            console.setContentHashes(true);
+        } else if (arg.rfind("--key-file=", 0) == 0) {
+            keyFile = arg.substr(11);
+        } else if (arg.rfind("--cache-dir=", 0) == 0) {
+            console.setExtractCache(arg.substr(12));
+        } else if (arg == "--skip-unchanged") {
+            console.setSkipUnchanged(true);
+        } else if (arg.rfind("--stats-file=", 0) == 0) {
+            statsFile = arg.substr(13);
+            if (statsFormat.empty()) {
+                statsFormat = "json";
+            }
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (!statsFormat.empty() && statsFormat != "json") {
+        std::cerr << "Error: Unsupported stats format '" << statsFormat << "'.\n";
+        return 1;
+    }
+    argc = static_cast<int>(args.size());
+    args.push_back(nullptr);
+    argv = args.data();
+    if (!statsFormat.empty()) {
+        console.setStats(&stats);
+    }
+    console.setVolumes(volumes);
+
+    // Ctrl+C stops at the next entry so a --resume run can continue cleanly
+    console.setCancellation(&interruptToken);
+    std::signal(SIGINT, onInterrupt);
+    std::signal(SIGTERM, onInterrupt);
 
     if (argc < 2) {
         console.printUsage();
@@ -13,6 +144,9 @@ int main(int argc, char* argv[]) {
     std::string command = argv[1];
 
     try {
+        if (!keyFile.empty()) {
+            console.setEncryptionKey(EntryCipher::loadKey(keyFile));
+        }
         if (command == "create") {
             if (argc < 4) {
                 std::cerr << "Error: Please provide archive name and at least one file.\n";
@@ -45,21 +179,137 @@ int main(int argc, char* argv[]) {
                 return 1;
             }
             std::string archiveName = argv[2];
-            if (!console.listArchiveContents(archiveName)) {
+            std::string prefix = (argc >= 4) ? argv[3] : "";
+            if (!console.listArchiveContents(archiveName, prefix)) {
                 std::cerr << "Error: Failed to list archive contents.\n";
                 return 1;
             }
         }
+        else if (command == "convert") {
+            if (argc < 4) {
+                std::cerr << "Error: Please provide input and output paths.\n";
+                console.printUsage();
+                return 1;
+            }
+            if (!console.convertArchive(argv[2], argv[3])) {
+                std::cerr << "Error: Failed to convert archive.\n";
+                return 1;
+            }
+        }
+        else if (command == "diff-pack") {
+            if (argc < 5) {
+                std::cerr << "Error: Please provide the old archive, the new archive and the patch path.\n";
+                console.printUsage();
+                return 1;
+            }
+            if (!console.diffArchives(argv[2], argv[3], argv[4])) {
+                std::cerr << "Error: Failed to write patch.\n";
+                return 1;
+            }
+        }
+        else if (command == "apply-patch") {
+            if (argc < 5) {
+                std::cerr << "Error: Please provide the old archive, the patch and the new archive path.\n";
+                console.printUsage();
+                return 1;
+            }
+            if (!console.applyPatch(argv[2], argv[3], argv[4])) {
+                std::cerr << "Error: Failed to apply patch.\n";
+                return 1;
+            }
+        }
+        else if (command == "serve") {
+            if (argc < 3) {
+                std::cerr << "Error: Please provide archive name.\n";
+                console.printUsage();
+                return 1;
+            }
+            // Options take "--name=value" or "--name value"
+            ServeOptions options;
+            for (int i = 3; i < argc; ++i) {
+                std::string arg = argv[i];
+                std::string value;
+                const size_t equals = arg.find('=');
+                if (equals != std::string::npos) {
+                    value = arg.substr(equals + 1);
+                    arg.resize(equals);
+                } else if (i + 1 < argc) {
+                    value = argv[++i];
+                }
+                if (arg == "--port") {
+                    if (!parsePort(value, options.port)) {
+                        std::cerr << "Error: Invalid port '" << value << "'.\n";
+                        return 1;
+                    }
+                } else if (arg == "--bind") {
+                    options.address = value;
+                } else if (arg == "--threads") {
+                    options.threads = static_cast<unsigned>(std::stoul(value));
+                } else {
+                    std::cerr << "Error: Unknown serve option '" << arg << "'.\n";
+                    return 1;
+                }
+            }
+            if (!console.serveArchive(argv[2], options)) {
+                std::cerr << "Error: Failed to serve archive.\n";
+                return 1;
+            }
+        }
+        else if (command == "estimate") {
+            EstimateOptions options;
+            std::vector<std::filesystem::path> roots;
+            for (int i = 2; i < argc; ++i) {
+                std::string arg = argv[i];
+                if (arg.rfind("--sample=", 0) == 0) {
+                    if (!parseSize(arg.substr(9), options.sampleBytes) || options.sampleBytes == 0) {
+                        std::cerr << "Error: Invalid sample size '" << arg.substr(9) << "'.\n";
+                        return 1;
+                    }
+                } else if (arg.rfind("--depth=", 0) == 0) {
+                    options.depth = static_cast<unsigned>(std::stoul(arg.substr(8)));
+                } else {
+                    roots.push_back(arg);
+                }
+            }
+            if (roots.empty()) {
+                std::cerr << "Error: Please provide at least one file or directory.\n";
+                console.printUsage();
+                return 1;
+            }
+            if (!console.estimateArchive(roots, options)) {
+                std::cerr << "Error: Failed to estimate archive.\n";
+                return 1;
+            }
+        }
         else {
             std::cerr << "Error: Unknown command '" << command << "'.\n";
             console.printUsage();
             return 1;
         }
     }
+    catch (const OperationCancelled&) {
+        std::cerr << "\nInterrupted; run the same command with --resume to continue.\n";
+        return 130;
+    }
     catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << "\n";
         return 1;
     }
 
+    if (!statsFormat.empty()) {
+        if (statsFile.empty()) {
+            // An archive streamed to stdout must not be followed by the report
+            const bool streamed = command == "create" && std::string(argv[2]) == "-";
+            (streamed ? std::cerr : std::cout) << stats.toJson(command);
+        } else {
+            std::ofstream out(statsFile);
+            out << stats.toJson(command);
+            if (!out) {
+                std::cerr << "Error: Failed to write stats to '" << statsFile << "'.\n";
+                return 1;
+            }
+        }
+    }
+
     return 0;
-}
\ No newline at end of file
+}
@@ -1,8 +1,33 @@
 #include <gtest/gtest.h>
 #include "Archive.h"
 #include "ArchiveProgress.h"
+#include "ArchiveStats.h"
+#include "CancellationToken.h"
+#include "CompressionController.h"
+#include "EntryScheduler.h"
+#include "ArchiveFormat.h"
+#include "ArchiveServer.h"
+#include "BinaryDelta.h"
+#include "MemoryArchive.h"
+#include "Sha256.h"
+#include "SizeEstimator.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <filesystem>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 
 namespace fs = std::filesystem;
 
@@ -62,7 +87,7 @@ TEST_F(ArchiveTest, TestAddFileToArchive) {
     
     // Re-open the archive to read the updated file list
     auto updatedArchive = std::make_unique<Archive>(testArchiveName);
-    auto entries = updatedArchive->getFileList();
+    const auto& entries = updatedArchive->getEntries();
     EXPECT_EQ(entries.size(), 2);
 }
 
@@ -95,4 +120,1165 @@ TEST_F(ArchiveTest, TestInvalidArchive) {
     // Test adding non-existent file
     std::vector<fs::path> invalidFiles = {"nonexistent_file.txt"};
     EXPECT_THROW(archive->add(invalidFiles), std::runtime_error);
-}
\ No newline at end of file
+}
+TEST_F(ArchiveTest, TestSparseFileRoundTrip) {
+    // 8 MiB file with a little data in the middle and a zero tail
+    fs::path sparseFile = testDir / "sparse.img";
+    {
+        std::ofstream out(sparseFile, std::ios::binary);
+        out.seekp(4 * 1024 * 1024);
+        out << "payload in the middle of a hole";
+    }
+    fs::resize_file(sparseFile, 8 * 1024 * 1024);
+
+    archive->create({sparseFile});
+    EXPECT_LT(fs::file_size(testArchiveName), 64u * 1024u);
+
+    archive->extract(outputDir.string());
+    fs::path extracted = outputDir / sparseFile.filename();
+    ASSERT_EQ(fs::file_size(extracted), fs::file_size(sparseFile));
+
+    std::ifstream a(sparseFile, std::ios::binary), b(extracted, std::ios::binary);
+    std::string original((std::istreambuf_iterator<char>(a)), {});
+    std::string restored((std::istreambuf_iterator<char>(b)), {});
+    EXPECT_TRUE(original == restored);
+}
+
+TEST_F(ArchiveTest, TestAllHoleFileRoundTrip) {
+    // A file with no data at all, only a hole
+    fs::path holeFile = testDir / "hole.img";
+    std::ofstream(holeFile).close();
+    fs::resize_file(holeFile, 4 * 1024 * 1024);
+
+    archive->create({holeFile});
+    auto entry = archive->find("hole.img");
+    ASSERT_TRUE(entry.has_value());
+    EXPECT_EQ(entry->originalSize, 4u * 1024u * 1024u);
+
+    archive->extract(outputDir.string());
+    std::ifstream in(outputDir / "hole.img", std::ios::binary);
+    std::string restored((std::istreambuf_iterator<char>(in)), {});
+    EXPECT_TRUE(restored == std::string(4 * 1024 * 1024, '\0'));
+
+    std::ifstream raw(testArchiveName, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(raw)), std::istreambuf_iterator<char>());
+    MemoryArchiveReader reader(bytes);
+    std::vector<char> out = reader.read("hole.img");
+    EXPECT_TRUE(out == std::vector<char>(4 * 1024 * 1024, '\0'));
+}
+
+TEST_F(ArchiveTest, TestEmptyFileRoundTrip) {
+    fs::path emptyFile = testDir / "empty.txt";
+    std::ofstream(emptyFile).close();
+
+    archive->create({emptyFile});
+    archive->extract(outputDir.string());
+    ASSERT_TRUE(fs::exists(outputDir / "empty.txt"));
+    EXPECT_EQ(fs::file_size(outputDir / "empty.txt"), 0u);
+}
+
+TEST_F(ArchiveTest, TestArchivePathsRelativeToCommonBase) {
+    fs::create_directories(testDir / "tree" / "a" / "deep");
+    fs::create_directories(testDir / "tree" / "b");
+    std::ofstream(testDir / "tree" / "a" / "deep" / "one.txt") << "1";
+    std::ofstream(testDir / "tree" / "b" / "two.txt") << "2";
+    std::ofstream(testDir / "tree" / "three.txt") << "3";
+
+    archive->create({testDir / "tree" / "a" / "deep" / "one.txt",
+                     testDir / "tree" / "b" / ".." / "b" / "two.txt",
+                     testDir / "tree" / "three.txt"});
+
+    std::vector<std::string> names;
+    Archive reopened(testArchiveName);
+    for (const auto entry : reopened.getEntries()) {
+        names.emplace_back(entry.name);
+    }
+    EXPECT_EQ(names, (std::vector<std::string>{"a/deep/one.txt", "b/two.txt", "three.txt"}));
+}
+
+TEST_F(ArchiveTest, TestEntryTableViews) {
+    archive->create({testFile, exampleFile});
+
+    Archive reopened(testArchiveName);
+    const EntryTable& entries = reopened.getEntries();
+    ASSERT_EQ(entries.size(), 2u);
+    EXPECT_EQ(entries[0].name, "test.txt");
+    EXPECT_EQ(entries[1].name, "example.txt");
+    EXPECT_EQ(entries[0].originalSize, fs::file_size(testFile));
+    EXPECT_EQ(entries.offset(0), ENTRY_PREFIX_SIZE);
+    EXPECT_EQ(&reopened.getEntries(), &entries);
+}
+
+TEST_F(ArchiveTest, TestFindAndListPrefix) {
+    fs::path tree = testDir / "tree";
+    for (const char* name : {"docs/a.txt", "docs/sub/b.txt", "docs2/c.txt", "readme.txt"}) {
+        fs::create_directories((tree / name).parent_path());
+        std::ofstream(tree / name) << name;
+    }
+    archive->create({tree / "readme.txt", tree / "docs2" / "c.txt",
+                     tree / "docs" / "sub" / "b.txt", tree / "docs" / "a.txt"});
+
+    // Reopening loads the persisted index instead of scanning
+    Archive reopened(testArchiveName);
+    auto found = reopened.find("docs/sub/b.txt");
+    ASSERT_TRUE(found.has_value());
+    EXPECT_EQ(found->originalSize, std::string("docs/sub/b.txt").size());
+    EXPECT_FALSE(reopened.find("docs/sub").has_value());
+
+    std::vector<std::string> names;
+    for (const auto& entry : reopened.listPrefix("docs")) {
+        names.emplace_back(entry.name);
+    }
+    EXPECT_EQ(names, (std::vector<std::string>{"docs/a.txt", "docs/sub/b.txt"}));
+    EXPECT_EQ(reopened.listPrefix("").size(), 4u);
+
+    // Appending keeps the index valid and the extract path ignores it
+    reopened.add({testFile});
+    Archive appended(testArchiveName);
+    EXPECT_EQ(appended.getEntries().size(), 5u);
+    EXPECT_TRUE(appended.find("test.txt").has_value());
+    appended.extract(outputDir.string());
+    EXPECT_TRUE(fs::exists(outputDir / "docs" / "sub" / "b.txt"));
+    EXPECT_TRUE(fs::exists(outputDir / "test.txt"));
+}
+
+TEST_F(ArchiveTest, TestProgressSinkCountsBytesAndFiles) {
+    const uint64_t expectedBytes = fs::file_size(testFile) + fs::file_size(exampleFile);
+
+    progress.startTracking("Creating");
+    archive->setProgress(&progress);
+    archive->create({testFile, exampleFile});
+    EXPECT_EQ(progress.getBytesDone(), expectedBytes);
+    EXPECT_EQ(progress.getFilesDone(), 2u);
+    EXPECT_EQ(progress.getProgress(), 100);
+    EXPECT_GE(progress.getEtaSeconds(), 0.0);
+
+    progress.startTracking("Extracting");
+    archive->extract(outputDir.string());
+    EXPECT_EQ(progress.getBytesDone(), expectedBytes);
+    EXPECT_EQ(progress.getFilesDone(), 2u);
+    progress.finishTracking();
+
+    auto stages = progress.getStageTimings();
+    ASSERT_FALSE(stages.empty());
+    EXPECT_EQ(stages.front().first, "Extracting");
+}
+
+TEST_F(ArchiveTest, TestStatsCollectStagesAndFiles) {
+    ArchiveStats stats;
+    archive->setStats(&stats);
+    archive->create({testFile, exampleFile});
+
+    auto created = stats.totals();
+    EXPECT_EQ(created.files, 2u);
+    EXPECT_EQ(created.stages[static_cast<size_t>(StatStage::Read)].calls, 2u);
+    EXPECT_EQ(created.stages[static_cast<size_t>(StatStage::Compress)].calls, 2u);
+    // One write per entry plus the final sync
+    EXPECT_EQ(created.stages[static_cast<size_t>(StatStage::Write)].calls, 3u);
+
+    archive->extract(outputDir.string());
+    auto total = stats.totals();
+    EXPECT_EQ(total.files, 4u);
+    EXPECT_EQ(total.stages[static_cast<size_t>(StatStage::Inflate)].calls, 2u);
+
+    uint64_t latencyCount = 0;
+    for (auto count : total.fileLatency) {
+        latencyCount += count;
+    }
+    EXPECT_EQ(latencyCount, 4u);
+
+    std::string json = stats.toJson("create");
+    EXPECT_NE(json.find("\"stages\""), std::string::npos);
+    EXPECT_NE(json.find("\"inflate\""), std::string::npos);
+}
+
+TEST_F(ArchiveTest, TestCancelledCreateRemovesPartialArchive) {
+    CancellationToken token;
+    token.cancel();
+    archive->setCancellation(&token);
+    EXPECT_THROW(archive->create({testFile, exampleFile}), OperationCancelled);
+    EXPECT_FALSE(fs::exists(testArchiveName));
+}
+
+TEST_F(ArchiveTest, TestResumableCreateContinuesFromJournal) {
+    fs::path lateFile = testDir / "late.txt";
+    archive->setResumable(true);
+
+    // The missing file aborts the run after the first entry is journaled
+    EXPECT_THROW(archive->create({testFile, lateFile}), std::runtime_error);
+    ASSERT_TRUE(fs::exists(testArchiveName + ".journal"));
+    EXPECT_FALSE(fs::exists(testArchiveName));
+    std::ofstream(testArchiveName + ".tmp", std::ios::binary | std::ios::app) << "torn entry";
+
+    std::ofstream(lateFile) << "Written after the interruption\n";
+    archive->create({testFile, lateFile});
+    EXPECT_FALSE(fs::exists(testArchiveName + ".journal"));
+
+    Archive reopened(testArchiveName);
+    ASSERT_EQ(reopened.getEntries().size(), 2u);
+    EXPECT_TRUE(reopened.find("test.txt").has_value());
+    EXPECT_TRUE(reopened.find("late.txt").has_value());
+
+    reopened.extract(outputDir.string());
+    std::ifstream in(outputDir / "late.txt");
+    std::string line;
+    std::getline(in, line);
+    EXPECT_EQ(line, "Written after the interruption");
+}
+
+TEST_F(ArchiveTest, TestResumableExtractSkipsFinishedFiles) {
+    archive->create({testFile, exampleFile});
+    archive->extract(outputDir.string());
+
+    // Same size and timestamp: treated as already extracted
+    fs::path finished = outputDir / "test.txt";
+    auto time = fs::last_write_time(finished);
+    std::ofstream(finished) << "Tset content for archive\n";
+    fs::last_write_time(finished, time);
+    // Different size: extracted again
+    std::ofstream(outputDir / "example.txt") << "partial";
+
+    archive->setResumable(true);
+    archive->extract(outputDir.string());
+
+    std::string line;
+    std::ifstream finishedIn(finished);
+    std::getline(finishedIn, line);
+    EXPECT_EQ(line, "Tset content for archive");
+    std::ifstream redoneIn(outputDir / "example.txt");
+    std::getline(redoneIn, line);
+    EXPECT_EQ(line, "Example content for archive");
+}
+
+TEST_F(ArchiveTest, TestFailedCreateLeavesExistingArchive) {
+    archive->create({testFile});
+    EXPECT_THROW(archive->create({exampleFile, testDir / "missing.txt"}), std::runtime_error);
+    EXPECT_FALSE(fs::exists(testArchiveName + ".tmp"));
+
+    Archive reopened(testArchiveName);
+    ASSERT_EQ(reopened.getEntries().size(), 1u);
+    EXPECT_EQ(reopened.getEntries()[0].name, "test.txt");
+}
+
+TEST_F(ArchiveTest, TestAddKeepsArchiveOnFailure) {
+    archive->create({testFile});
+    for (bool journal : {false, true}) {
+        archive->setAppendJournal(journal);
+        EXPECT_THROW(archive->add({exampleFile, testDir / "missing.txt"}), std::runtime_error);
+        EXPECT_EQ(archive->getEntries().size(), 1u);
+        EXPECT_FALSE(fs::exists(testArchiveName + ".undo"));
+
+        Archive reopened(testArchiveName);
+        EXPECT_EQ(reopened.getEntries().size(), 1u);
+    }
+
+    archive->add({exampleFile});
+    Archive reopened(testArchiveName);
+    EXPECT_EQ(reopened.getEntries().size(), 2u);
+}
+
+TEST_F(ArchiveTest, TestAddRollsBackInterruptedAppend) {
+    SyncPolicy noSync;
+    noSync.enabled = false;
+    archive->setSyncPolicy(noSync);
+    archive->create({testFile});
+
+    // Recreate what a crash halfway through an in-place append leaves
+    IndexTrailer trailer{};
+    {
+        uint8_t encoded[INDEX_TRAILER_SIZE];
+        std::ifstream in(testArchiveName, std::ios::binary);
+        in.seekg(-static_cast<std::streamoff>(sizeof(encoded)), std::ios::end);
+        in.read(reinterpret_cast<char*>(encoded), sizeof(encoded));
+        trailer = ArchiveFormat::decodeIndexTrailer(encoded);
+    }
+    const uint64_t fileSize = fs::file_size(testArchiveName);
+    std::vector<char> index(fileSize - trailer.indexOffset);
+    {
+        std::ifstream in(testArchiveName, std::ios::binary);
+        in.seekg(static_cast<std::streamoff>(trailer.indexOffset));
+        in.read(index.data(), static_cast<std::streamsize>(index.size()));
+    }
+    uint8_t encoded[UNDO_HEADER_SIZE];
+    ArchiveFormat::encodeUndoHeader(UndoHeader{UNDO_SIGNATURE, 0, trailer.indexOffset, fileSize}, encoded);
+    {
+        std::ofstream out(testArchiveName + ".undo", std::ios::binary);
+        out.write(reinterpret_cast<const char*>(encoded), sizeof(encoded));
+        out.write(index.data(), static_cast<std::streamsize>(index.size()));
+    }
+    fs::resize_file(testArchiveName, trailer.indexOffset);
+    std::ofstream(testArchiveName, std::ios::binary | std::ios::app) << "half an entry";
+    const uint64_t interruptedSize = fs::file_size(testArchiveName);
+
+    // Reading leaves the archive alone but sees it as it was
+    {
+        Archive reopened(testArchiveName);
+        EXPECT_TRUE(fs::exists(testArchiveName + ".undo"));
+        EXPECT_EQ(fs::file_size(testArchiveName), interruptedSize);
+        ASSERT_EQ(reopened.getEntries().size(), 1u);
+        reopened.extract(outputDir.string());
+        EXPECT_TRUE(fs::exists(outputDir / "test.txt"));
+    }
+
+    // The next add rolls the append back before extending the archive
+    Archive reopened(testArchiveName);
+    reopened.setSyncPolicy(noSync);
+    reopened.add({exampleFile});
+    EXPECT_FALSE(fs::exists(testArchiveName + ".undo"));
+    ASSERT_EQ(reopened.getEntries().size(), 2u);
+    EXPECT_EQ(reopened.readEntry("test.txt").size(), fs::file_size(testFile));
+    EXPECT_EQ(Archive(testArchiveName).getEntries().size(), 2u);
+}
+
+TEST_F(ArchiveTest, TestEntryHeaderEncoding) {
+    EntryHeader header;
+    header.flags = ENTRY_FLAG_SPARSE;
+    header.nameLength = 9;
+    header.compressedSize = 17;
+    header.originalSize = 1ull << 40;
+    header.timestamp = -1234567890123;
+
+    uint8_t encoded[MAX_ENTRY_HEADER_SIZE];
+    size_t size = ArchiveFormat::encodeEntryHeader(header, encoded);
+    EXPECT_EQ(ArchiveFormat::loadLE(encoded, 4), SIGNATURE);
+    EXPECT_EQ(ArchiveFormat::loadLE(encoded + 4, 2), CURRENT_VERSION);
+
+    size_t position = 0;
+    auto reader = [&](void* data, size_t count) {
+        if (position + count > size) {
+            return false;
+        }
+        std::memcpy(data, encoded + position, count);
+        position += count;
+        return true;
+    };
+    EntryHeader decoded;
+    uint64_t decodedSize = 0;
+    ASSERT_TRUE(ArchiveFormat::readEntryHeader(reader, decoded, decodedSize));
+    EXPECT_EQ(decodedSize, size);
+    EXPECT_TRUE(decoded.isSparse());
+    EXPECT_EQ(decoded.codec, CODEC_ZLIB);
+    EXPECT_EQ(decoded.nameLength, 9u);
+    EXPECT_EQ(decoded.compressedSize, 17u);
+    EXPECT_EQ(decoded.originalSize, 1ull << 40);
+    EXPECT_EQ(decoded.timestamp, -1234567890123);
+
+    // A small file's sizes take one byte each
+    header.flags = 0;
+    header.originalSize = 100;
+    EXPECT_LE(ArchiveFormat::encodeEntryHeader(header, encoded), ENTRY_PREFIX_SIZE + 3 + MAX_VARINT_SIZE);
+}
+
+TEST_F(ArchiveTest, TestReadsVersion2Archives) {
+    // Hand-built version 2 archive: 40-byte padded headers, zlib payload
+    const std::string content = "Legacy content\n";
+    const std::string name = "legacy.txt";
+    auto payload = Archive::compressData(std::vector<char>(content.begin(), content.end()),
+                                         CompressionType::Normal);
+    auto legacyHeader = [](uint32_t nameLength, uint64_t compressedSize, uint64_t originalSize) {
+        std::vector<uint8_t> header(LEGACY_HEADER_SIZE, 0);
+        ArchiveFormat::storeLE(header.data(), SIGNATURE, 4);
+        ArchiveFormat::storeLE(header.data() + 4, LEGACY_VERSION, 2);
+        ArchiveFormat::storeLE(header.data() + 8, nameLength, 4);
+        ArchiveFormat::storeLE(header.data() + 16, compressedSize, 8);
+        ArchiveFormat::storeLE(header.data() + 24, originalSize, 8);
+        ArchiveFormat::storeLE(header.data() + 32, 0, 8);
+        return header;
+    };
+    {
+        std::ofstream out(testArchiveName, std::ios::binary);
+        auto archiveHeader = legacyHeader(0, 0, 0);
+        auto entryHeader = legacyHeader(static_cast<uint32_t>(name.size()), payload.size(), content.size());
+        out.write(reinterpret_cast<const char*>(archiveHeader.data()), archiveHeader.size());
+        out.write(reinterpret_cast<const char*>(entryHeader.data()), entryHeader.size());
+        out << name;
+        out.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+    }
+
+    Archive legacy(testArchiveName);
+    ASSERT_EQ(legacy.getEntries().size(), 1u);
+    EXPECT_EQ(legacy.getEntries().offset(0), LEGACY_HEADER_SIZE);
+
+    // New entries are appended in the current format next to the old ones
+    legacy.add({testFile});
+    Archive reopened(testArchiveName);
+    ASSERT_EQ(reopened.getEntries().size(), 2u);
+    reopened.extract(outputDir.string());
+
+    std::ifstream in(outputDir / name);
+    std::string line;
+    std::getline(in, line);
+    EXPECT_EQ(line, "Legacy content");
+    EXPECT_TRUE(fs::exists(outputDir / "test.txt"));
+}
+
+TEST_F(ArchiveTest, TestParallelExtractVerifiesChecksums) {
+    // Several files, one spanning many inflate chunks with a zero run inside
+    std::vector<fs::path> files;
+    std::vector<std::string> contents;
+    for (int i = 0; i < 12; ++i) {
+        std::string content(static_cast<size_t>(i) * 1000 + 1, static_cast<char>('a' + i));
+        if (i == 11) {
+            content.assign(3 * 1024 * 1024, '\0');
+            for (size_t j = 0; j < content.size(); j += 7) {
+                content[j] = static_cast<char>(j * 31);
+            }
+            std::fill(content.begin() + 1024 * 1024, content.begin() + 2 * 1024 * 1024, '\0');
+        }
+        files.push_back(testDir / ("file" + std::to_string(i) + ".bin"));
+        std::ofstream(files.back(), std::ios::binary) << content;
+        contents.push_back(content);
+    }
+    archive->create(files);
+
+    Archive parallel(testArchiveName);
+    parallel.setThreads(4);
+    parallel.extract(outputDir.string());
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::ifstream in(outputDir / files[i].filename(), std::ios::binary);
+        std::string extracted((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        EXPECT_EQ(extracted, contents[i]) << files[i];
+    }
+
+    // Corrupt the stored CRC-32 of the first entry, the last field of its header
+    std::fstream raw(testArchiveName, std::ios::binary | std::ios::in | std::ios::out);
+    raw.seekg(ENTRY_PREFIX_SIZE);
+    auto reader = [&](void* data, size_t count) {
+        return static_cast<bool>(raw.read(static_cast<char*>(data), static_cast<std::streamsize>(count)));
+    };
+    EntryHeader header;
+    uint64_t headerSize = 0;
+    ASSERT_TRUE(ArchiveFormat::readEntryHeader(reader, header, headerSize));
+    ASSERT_TRUE(header.hasCrc32());
+    raw.seekp(static_cast<std::streamoff>(ENTRY_PREFIX_SIZE + headerSize - 1));
+    raw.put(static_cast<char>((header.crc32 >> 24) ^ 0xFF));
+    raw.close();
+
+    Archive corrupted(testArchiveName);
+    try {
+        corrupted.extract((testDir / "corrupt_out").string());
+        FAIL() << "Expected a checksum error";
+    } catch (const std::runtime_error& e) {
+        EXPECT_NE(std::string(e.what()).find("Checksum mismatch"), std::string::npos) << e.what();
+    }
+}
+
+TEST_F(ArchiveTest, TestSha256KnownAnswers) {
+    EXPECT_EQ(Sha256::toHex(Sha256::hash("", 0)),
+              "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    EXPECT_EQ(Sha256::toHex(Sha256::hash("abc", 3)),
+              "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+    // Incremental updates across block boundaries match a one-shot hash
+    std::string text(1000, 'x');
+    Sha256 sha;
+    for (size_t i = 0; i < text.size(); i += 7) {
+        sha.update(text.data() + i, std::min<size_t>(7, text.size() - i));
+    }
+    EXPECT_EQ(sha.finish(), Sha256::hash(text.data(), text.size()));
+}
+
+TEST_F(ArchiveTest, TestExtractCacheAndSkipUnchanged) {
+    archive->setContentHashes(true);
+    archive->create({testFile, exampleFile});
+    const fs::path cache = testDir / "cache";
+    auto inflateCalls = [](const ArchiveStats& stats) {
+        return stats.totals().stages[static_cast<size_t>(StatStage::Inflate)].calls;
+    };
+
+    // The first extract fills the cache, the second links everything from it
+    {
+        Archive first(testArchiveName);
+        first.setExtractCache(cache.string());
+        first.extract((testDir / "deploy1").string());
+    }
+    ArchiveStats cachedStats;
+    Archive cached(testArchiveName);
+    cached.setExtractCache(cache.string());
+    cached.setStats(&cachedStats);
+    cached.extract((testDir / "deploy2").string());
+    EXPECT_EQ(inflateCalls(cachedStats), 0u);
+    std::ifstream linked(testDir / "deploy2" / "example.txt");
+    std::string line;
+    std::getline(linked, line);
+    EXPECT_EQ(line, "Example content for archive");
+    linked.close();
+
+    // A hard-linked output is read-only, and a cache entry modified in
+    // place anyway is detected and replaced
+    const std::string example = "Example content for archive\n";
+    const Sha256::Digest digest = Sha256::hash(example.data(), example.size());
+    const std::string hex = Sha256::toHex(digest);
+    const fs::path entry = cache / hex.substr(0, 2) / hex;
+    ASSERT_TRUE(fs::exists(entry));
+    EXPECT_EQ(fs::status(entry).permissions() & fs::perms::owner_write, fs::perms::none);
+    fs::permissions(entry, fs::perms::owner_write, fs::perm_options::add);
+    {
+        std::fstream tamper(entry, std::ios::in | std::ios::out | std::ios::binary);
+        tamper.write("EXAMPLE", 7);
+    }
+    cached.extract((testDir / "deploy3").string());
+    std::ifstream repaired(testDir / "deploy3" / "example.txt");
+    std::getline(repaired, line);
+    EXPECT_EQ(line, "Example content for archive");
+    std::ifstream recached(entry);
+    std::getline(recached, line);
+    EXPECT_EQ(line, "Example content for archive");
+
+    // Unchanged files are left alone; a same-size edit is detected and undone
+    ArchiveStats skipStats;
+    Archive redeploy(testArchiveName);
+    redeploy.setSkipUnchanged(true);
+    redeploy.setStats(&skipStats);
+    redeploy.extract(outputDir.string());
+    EXPECT_EQ(inflateCalls(skipStats), 2u);
+    redeploy.extract(outputDir.string());
+    EXPECT_EQ(inflateCalls(skipStats), 2u);
+
+    std::ofstream(outputDir / "test.txt") << "Tampered content, same!!\n";
+    ASSERT_EQ(fs::file_size(outputDir / "test.txt"), fs::file_size(testFile));
+    redeploy.extract(outputDir.string());
+    EXPECT_EQ(inflateCalls(skipStats), 3u);
+    std::ifstream restored(outputDir / "test.txt");
+    std::getline(restored, line);
+    EXPECT_EQ(line, "Test content for archive");
+}
+
+TEST_F(ArchiveTest, TestMemoryArchiveRoundTrip) {
+    std::string config = "key=value\n";
+    std::vector<char> blob(300000);
+    for (size_t i = 0; i < blob.size(); ++i) {
+        blob[i] = static_cast<char>(i % 251);
+    }
+
+    std::vector<char> bytes;
+    VectorSink sink(bytes);
+    MemoryArchiveWriter writer(sink);
+    writer.add("conf/app.ini", config);
+    writer.add("data/blob.bin", blob, 42);
+    writer.add("empty", ByteView());
+    writer.finish();
+
+    MemoryArchiveReader reader(bytes);
+    ASSERT_EQ(reader.getEntries().size(), 3u);
+    std::vector<char> out(blob.size());
+    EXPECT_EQ(reader.read("data/blob.bin", out.data(), out.size()), blob.size());
+    EXPECT_TRUE(out == blob);
+    std::vector<char> text = reader.read("conf/app.ini");
+    EXPECT_EQ(std::string(text.begin(), text.end()), config);
+    EXPECT_TRUE(reader.read("empty").empty());
+    EXPECT_THROW(reader.read("data/blob.bin", out.data(), out.size() - 1), std::runtime_error);
+    EXPECT_THROW(reader.read("missing"), std::runtime_error);
+
+    // The bytes are an ordinary archive, and ordinary archives read from memory
+    std::ofstream(testArchiveName, std::ios::binary).write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    Archive onDisk(testArchiveName);
+    EXPECT_EQ(onDisk.find("data/blob.bin")->timestamp, 42);
+    onDisk.add({testFile});
+    std::ifstream in(testArchiveName, std::ios::binary);
+    std::vector<char> updated((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    MemoryArchiveReader reread(updated);
+    text = reread.read("test.txt");
+    EXPECT_EQ(std::string(text.begin(), text.end()), "Test content for archive\n");
+
+    // A stored sparse entry whose extents claim more data than its payload holds
+    std::vector<uint8_t> corrupt(ENTRY_PREFIX_SIZE + MAX_ENTRY_HEADER_SIZE);
+    size_t size = ArchiveFormat::encodeArchiveHeader(corrupt.data());
+    EntryHeader header;
+    header.flags = ENTRY_FLAG_SPARSE;
+    header.codec = CODEC_STORED;
+    header.nameLength = 4;
+    header.compressedSize = 4;
+    header.originalSize = 2 << 20;
+    size += ArchiveFormat::encodeEntryHeader(header, corrupt.data() + size);
+    corrupt.resize(size);
+    corrupt.insert(corrupt.end(), {'h', 'o', 'l', 'e'});
+    ArchiveFormat::encodeSparseMap({SparseExtent{0, 1 << 20}}, corrupt);
+    corrupt.insert(corrupt.end(), {'d', 'a', 't', 'a'});
+    MemoryArchiveReader broken(ByteView(corrupt.data(), corrupt.size()));
+    ASSERT_TRUE(broken.find("hole").has_value());
+    EXPECT_THROW(broken.read("hole"), std::runtime_error);
+}
+
+TEST_F(ArchiveTest, TestAdaptiveCompressionLevel) {
+    // Each level compresses at 120/level MB/s to 40%; the sink writes at a fixed rate
+    CompressionController controller;
+    auto run = [&](double sinkBytesPerSecond, int blocks) {
+        const uint64_t block = CompressionController::BLOCK_SIZE;
+        for (int i = 0; i < blocks; ++i) {
+            const int level = controller.level();
+            const uint64_t output = block * 4 / 10;
+            controller.recordWrite(output, std::chrono::duration_cast<CompressionController::Duration>(
+                                               std::chrono::duration<double>(output / sinkBytesPerSecond)));
+            controller.recordCompression(level, block, output,
+                                         std::chrono::duration_cast<CompressionController::Duration>(
+                                             std::chrono::duration<double>(block * level / 120e6)));
+        }
+    };
+    run(1e6, 20);
+    EXPECT_EQ(controller.level(), CompressionController::MAX_LEVEL); // Slow share: best ratio
+    run(1e9, 40);
+    EXPECT_EQ(controller.level(), CompressionController::MIN_LEVEL); // Fast disk: CPU bound
+    run(10e6, 40);
+    EXPECT_GT(controller.level(), 2);                                // In between
+    EXPECT_LT(controller.level(), 6);
+
+    // Levels change between blocks of one entry without breaking the stream
+    const fs::path large = testDir / "mixed.bin";
+    std::string content(3 * CompressionController::BLOCK_SIZE + 777, '\0');
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<char>((i * 7919) % 61 + (i / 65536));
+    }
+    std::ofstream(large, std::ios::binary) << content;
+    archive->create({large, testFile}, CompressionType::Adaptive);
+
+    Archive reader(testArchiveName);
+    reader.extract(outputDir.string());
+    std::ifstream in(outputDir / "mixed.bin", std::ios::binary);
+    std::string extracted((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    EXPECT_TRUE(extracted == content);
+    EXPECT_TRUE(fs::exists(outputDir / "test.txt"));
+}
+
+TEST_F(ArchiveTest, TestParallelCreateOrdering) {
+    // The largest job starts first, results are consumed in order, and a
+    // failing job surfaces when its turn comes
+    EntryScheduler scheduler(2);
+    std::mutex mutex;
+    std::vector<size_t> started;
+    std::vector<size_t> consumed;
+    scheduler.run({1, 1, 100, 1},
+                  [&](size_t i) {
+                      std::lock_guard<std::mutex> lock(mutex);
+                      started.push_back(i);
+                  },
+                  [&](size_t i) { consumed.push_back(i); });
+    ASSERT_EQ(started.size(), 4u);
+    EXPECT_EQ(started[0], 2u);
+    EXPECT_EQ(consumed, (std::vector<size_t>{0, 1, 2, 3}));
+    consumed.clear();
+    EXPECT_THROW(scheduler.run({5, 1, 1},
+                               [&](size_t i) {
+                                   if (i == 1) {
+                                       throw std::runtime_error("job failed");
+                                   }
+                               },
+                               [&](size_t i) { consumed.push_back(i); }),
+                 std::runtime_error);
+    EXPECT_EQ(consumed, std::vector<size_t>{0});
+
+    // The archive does not depend on the thread count
+    for (const char* name : {"d1/b.txt", "d1/c.log", "d2/a.txt", "d2/e.log"}) {
+        fs::create_directories((testDir / "in" / name).parent_path());
+        std::ofstream(testDir / "in" / name) << std::string(std::strlen(name) * 5000, name[3]);
+    }
+    std::vector<fs::path> files;
+    for (const char* name : {"d1/b.txt", "d1/c.log", "d2/a.txt", "d2/e.log"}) {
+        files.push_back(testDir / "in" / name);
+    }
+    auto build = [&](unsigned threads, EntryOrder order) {
+        Archive writer(testArchiveName);
+        writer.setThreads(threads);
+        writer.setEntryOrder(order);
+        writer.create(files);
+        std::ifstream in(testArchiveName, std::ios::binary);
+        return std::vector<char>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    };
+    const std::vector<char> serial = build(1, EntryOrder::Input);
+    EXPECT_TRUE(build(4, EntryOrder::Input) == serial);
+
+    // Grouped order puts the .log files first, then the .txt files
+    const std::vector<char> grouped = build(4, EntryOrder::Grouped);
+    MemoryArchiveReader reader(grouped);
+    const EntryTable& table = reader.getEntries();
+    auto offsetOf = [&](const char* name) { return table.offset(table.find(name)); };
+    EXPECT_LT(offsetOf("d1/c.log"), offsetOf("d2/e.log"));
+    EXPECT_LT(offsetOf("d2/e.log"), offsetOf("d1/b.txt"));
+    EXPECT_LT(offsetOf("d1/b.txt"), offsetOf("d2/a.txt"));
+    std::vector<char> text = reader.read("d2/a.txt");
+    EXPECT_EQ(std::string(text.begin(), text.end()), std::string(8 * 5000, 'a'));
+}
+
+TEST_F(ArchiveTest, TestMultiVolumeArchive) {
+    // Incompressible files, so they fill the volumes
+    std::mt19937 random(7);
+    std::vector<fs::path> files;
+    for (int i = 0; i < 12; ++i) {
+        std::string data(20000 + i * 1500, '\0');
+        for (auto& c : data) {
+            c = static_cast<char>(random());
+        }
+        files.push_back(testDir / "in" / ("f" + std::to_string(i) + ".bin"));
+        fs::create_directories(files.back().parent_path());
+        std::ofstream(files.back(), std::ios::binary) << data;
+    }
+
+    const uint64_t volumeSize = 64 * 1024;
+    VolumeOptions options;
+    options.volumeSize = volumeSize;
+    options.directories = {(testDir / "disk1").string(), (testDir / "disk2").string()};
+    {
+        Archive writer(testArchiveName);
+        writer.setThreads(4);
+        writer.setVolumes(options);
+        writer.create(files);
+    }
+
+    // Reopened, the catalog lists volumes on both disks, none too large
+    Archive reader(testArchiveName);
+    const std::vector<std::string>& volumes = reader.getVolumes();
+    ASSERT_GE(volumes.size(), 4u);
+    std::set<fs::path> directories;
+    for (const auto& volume : volumes) {
+        EXPECT_LE(fs::file_size(volume), volumeSize);
+        directories.insert(fs::path(volume).parent_path());
+    }
+    EXPECT_EQ(directories.size(), 2u);
+    EXPECT_EQ(reader.getEntries().size(), files.size());
+
+    std::ifstream original(files[5], std::ios::binary);
+    std::vector<char> expected((std::istreambuf_iterator<char>(original)), std::istreambuf_iterator<char>());
+    EXPECT_TRUE(reader.readEntry("f5.bin") == expected);
+    EXPECT_THROW(reader.readEntry("missing.bin"), std::runtime_error);
+    EXPECT_THROW(reader.add({testFile}), std::runtime_error);
+
+    reader.extract(outputDir.string());
+    for (const auto& file : files) {
+        std::ifstream a(file, std::ios::binary);
+        std::ifstream b(outputDir / file.filename(), std::ios::binary);
+        EXPECT_TRUE(std::equal(std::istreambuf_iterator<char>(a), std::istreambuf_iterator<char>(),
+                               std::istreambuf_iterator<char>(b), std::istreambuf_iterator<char>()))
+            << file;
+    }
+}
+
+TEST_F(ArchiveTest, TestSizeEstimateMatchesCreate) {
+    // Text that compresses well in one directory, noise in the other
+    std::mt19937 random(11);
+    std::vector<fs::path> files;
+    for (int i = 0; i < 40; ++i) {
+        const bool text = i % 2 == 0;
+        std::string data;
+        while (data.size() < static_cast<size_t>(2000 + i * 3000)) {
+            data += text ? "line " + std::to_string(random() % 100) + " of some text\n"
+                         : std::string(1, static_cast<char>(random()));
+        }
+        files.push_back(testDir / "in" / (text ? "text" : "noise") /
+                        ("f" + std::to_string(i) + (text ? ".txt" : ".bin")));
+        fs::create_directories(files.back().parent_path());
+        std::ofstream(files.back(), std::ios::binary) << data;
+    }
+
+    EstimateOptions options;
+    options.sampleBytes = 256 * 1024;
+    options.blockSize = 16 * 1024;
+    const SizeEstimate estimate = SizeEstimator(options).estimate({testDir / "in"});
+    EXPECT_EQ(estimate.files, files.size());
+    EXPECT_LT(estimate.sampledBytes, estimate.inputBytes);
+    ASSERT_EQ(estimate.levels.size(), SizeEstimator::LEVELS.size());
+    EXPECT_LE(estimate.levels.back().outputBytes, estimate.levels.front().outputBytes);
+    ASSERT_EQ(estimate.directories.size(), 2u);
+    EXPECT_EQ(estimate.directories[0].directory, (testDir / "in" / "noise").generic_string());
+    EXPECT_GT(estimate.directories[0].outputBytes[2], estimate.directories[1].outputBytes[2]);
+
+    archive->create(files, CompressionType::Normal);
+    const double actual = static_cast<double>(fs::file_size(testArchiveName));
+    EXPECT_NEAR(static_cast<double>(estimate.levels[2].outputBytes), actual, actual * 0.1);
+}
+
+TEST_F(ArchiveTest, TestEncryptedEntries) {
+    EntryCipher::Key key{};
+    for (size_t i = 0; i < key.size(); ++i) {
+        key[i] = static_cast<uint8_t>(i * 7 + 1);
+    }
+    const std::string secret = "confidential payroll figures";
+    std::string text;
+    while (text.size() < 200000) {
+        text += secret + " " + std::to_string(text.size()) + "\n";
+    }
+    const fs::path small = testDir / "secret.txt";
+    std::ofstream(small, std::ios::binary) << text;
+    {
+        Archive writer(testArchiveName);
+        writer.setEncryptionKey(key);
+        writer.setThreads(2);
+        writer.create({small, testFile});
+    }
+
+    // Names stay listable, the data does not appear in the file
+    std::ifstream raw(testArchiveName, std::ios::binary);
+    const std::string bytes((std::istreambuf_iterator<char>(raw)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(bytes.find(secret), std::string::npos);
+    Archive reader(testArchiveName);
+    ASSERT_TRUE(reader.find("secret.txt").has_value());
+    EXPECT_THROW(reader.readEntry("secret.txt"), std::runtime_error);
+
+    reader.setEncryptionKey(key);
+    const std::vector<char> data = reader.readEntry("secret.txt");
+    EXPECT_EQ(std::string(data.begin(), data.end()), text);
+    reader.extract(outputDir.string());
+    std::ifstream extracted(outputDir / "secret.txt", std::ios::binary);
+    EXPECT_EQ(std::string((std::istreambuf_iterator<char>(extracted)), std::istreambuf_iterator<char>()), text);
+
+    EntryCipher::Key wrongKey = key;
+    wrongKey[0] ^= 1;
+    Archive wrong(testArchiveName);
+    wrong.setEncryptionKey(wrongKey);
+    EXPECT_THROW(wrong.readEntry("secret.txt"), std::runtime_error);
+    // The tag is checked before anything is written
+    try {
+        wrong.extract((testDir / "wrong").string());
+        ADD_FAILURE() << "extract with the wrong key succeeded";
+    } catch (const std::runtime_error& e) {
+        EXPECT_NE(std::string(e.what()).find("Authentication failed"), std::string::npos) << e.what();
+    }
+    EXPECT_FALSE(fs::exists(testDir / "wrong" / "secret.txt"));
+
+    // A streamed entry is sealed chunk by chunk ahead of its descriptor
+    const fs::path large = testDir / "large.bin";
+    std::string content(static_cast<size_t>(Archive::STREAMED_ENTRY_THRESHOLD) + 12345, '\0');
+    for (size_t i = 0; i < content.size(); i += 3) {
+        content[i] = static_cast<char>(i / 4096);
+    }
+    std::ofstream(large, std::ios::binary) << content;
+    std::ostringstream streamed;
+    {
+        Archive writer("-");
+        writer.setEncryptionKey(key);
+        writer.createStream(streamed, {small, large});
+    }
+    const std::string stream = streamed.str();
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::thread feeder([&] {
+        for (size_t done = 0; done < stream.size();) {
+            ssize_t n = write(fds[1], stream.data() + done, stream.size() - done);
+            if (n <= 0) {
+                break;
+            }
+            done += static_cast<size_t>(n);
+        }
+        close(fds[1]);
+    });
+    Archive piped("-");
+    piped.setEncryptionKey(key);
+    piped.extractStream(fds[0], (testDir / "piped").string());
+    feeder.join();
+    close(fds[0]);
+    std::ifstream in(testDir / "piped" / "large.bin", std::ios::binary);
+    EXPECT_TRUE(std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()) == content);
+
+    std::ofstream(testArchiveName, std::ios::binary) << stream;
+    Archive stored(testArchiveName);
+    stored.setEncryptionKey(key);
+    const std::vector<char> largeData = stored.readEntry("large.bin");
+    EXPECT_TRUE(std::string(largeData.begin(), largeData.end()) == content);
+}
+
+TEST_F(ArchiveTest, TestPatchBetweenArchiveVersions) {
+    static const char* words[] = {"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel"};
+    std::mt19937 random(7);
+    std::string log;
+    while (log.size() < 400000) {
+        log += std::to_string(random()) + " " + words[random() % 8] + "\n";
+    }
+    const fs::path logFile = testDir / "log.txt";
+    const fs::path removed = testDir / "removed.txt";
+    std::ofstream(logFile, std::ios::binary) << log;
+    std::ofstream(removed, std::ios::binary) << "only in the old version\n";
+    const std::string oldArchive = (testDir / "old.arc").string();
+    const std::string newArchive = (testDir / "new.arc").string();
+    Archive(oldArchive).create({exampleFile, logFile, removed, testFile});
+
+    // Edit the large file in a few places and add a file
+    log.replace(1000, 5, "EDITED");
+    log.insert(200000, "inserted line\n");
+    log += "appended line\n";
+    std::ofstream(logFile, std::ios::binary) << log;
+    const fs::path added = testDir / "added.txt";
+    std::ofstream(added, std::ios::binary) << "only in the new version\n";
+    Archive(newArchive).create({added, exampleFile, logFile, testFile});
+
+    const std::string patchPath = (testDir / "update.patch").string();
+    const PatchSummary summary = Archive(newArchive).writePatch(oldArchive, patchPath);
+    EXPECT_EQ(summary.copiedEntries, 2u);
+    EXPECT_EQ(summary.deltaEntries, 1u);
+    EXPECT_EQ(summary.literalEntries, 1u);
+    EXPECT_EQ(summary.patchBytes, fs::file_size(patchPath));
+    EXPECT_LT(summary.patchBytes * 20, fs::file_size(newArchive));
+
+    const std::string rebuilt = (testDir / "rebuilt.arc").string();
+    Archive target(rebuilt);
+    target.applyPatch(oldArchive, patchPath);
+    auto contents = [](const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    };
+    EXPECT_TRUE(contents(rebuilt) == contents(newArchive));
+    EXPECT_EQ(target.getEntries().size(), 4u);
+    const std::vector<char> data = target.readEntry("log.txt");
+    EXPECT_TRUE(std::string(data.begin(), data.end()) == log);
+
+    // The patch only applies to the archive it was made from
+    const std::string other = (testDir / "other.arc").string();
+    Archive(other).applyPatch(oldArchive, patchPath);
+    EXPECT_THROW(Archive(other).applyPatch(newArchive, patchPath), std::runtime_error);
+    EXPECT_TRUE(contents(other) == contents(newArchive));
+
+    // Sizes a delta claims are checked before they are allocated
+    std::vector<uint8_t> forged(2 * MAX_VARINT_SIZE + 4);
+    size_t forgedSize = ArchiveFormat::putVarint(forged.data(), uint64_t{1} << 50);
+    forgedSize += ArchiveFormat::putVarint(forged.data() + forgedSize, uint64_t{1} << 50);
+    const std::vector<char> baseData(16, 'x');
+    EXPECT_THROW(BinaryDelta::apply(baseData, reinterpret_cast<const char*>(forged.data()), forgedSize + 4, 1 << 20),
+                 std::runtime_error);
+    EXPECT_THROW(BinaryDelta::apply(baseData, reinterpret_cast<const char*>(forged.data()), forgedSize + 4,
+                                    UINT64_MAX),
+                 std::runtime_error);
+}
+
+TEST_F(ArchiveTest, TestZipAndTarConversion) {
+    fs::path sparseFile = testDir / "sparse.img";
+    {
+        std::ofstream out(sparseFile, std::ios::binary);
+        out.seekp(1 << 20);
+        out << "tail";
+    }
+    archive->create({testFile, exampleFile, sparseFile});
+    const fs::path zipPath = testDir / "export.zip";
+    archive->exportZip(zipPath.string());
+
+    // Deflate data moves between the formats without being recompressed
+    const std::string imported = (testDir / "imported.arc").string();
+    Archive fromZip(imported);
+    fromZip.importZip(zipPath.string());
+    ASSERT_EQ(fromZip.getEntries().size(), 3u);
+    EXPECT_EQ(fromZip.find("test.txt")->compressedSize, archive->find("test.txt")->compressedSize - 6);
+    EXPECT_EQ(fromZip.find("sparse.img")->originalSize, (1u << 20) + 4);
+    fromZip.extract(outputDir.string());
+    std::ifstream tail(outputDir / "sparse.img", std::ios::binary);
+    tail.seekg(1 << 20);
+    std::string text;
+    tail >> text;
+    EXPECT_EQ(text, "tail");
+    std::ifstream example(outputDir / "example.txt");
+    std::getline(example, text);
+    EXPECT_EQ(text, "Example content for archive");
+
+    // A single-entry ustar file: header block, data block, end marker
+    std::string tar(4 * 512, '\0');
+    const std::string content = "from tar\n";
+    tar.replace(0, 12, "dir/tar.txt");
+    tar.replace(100, 7, "0000644");
+    tar.replace(124, 11, "00000000011");
+    tar.replace(136, 11, "14000000000");
+    tar.replace(148, 8, "        ");
+    tar[156] = '0';
+    tar.replace(257, 6, std::string("ustar\0", 6));
+    unsigned sum = 0;
+    for (size_t i = 0; i < 512; ++i) {
+        sum += static_cast<unsigned char>(tar[i]);
+    }
+    char checksum[8];
+    std::snprintf(checksum, sizeof(checksum), "%06o", sum);
+    tar.replace(148, 7, checksum, 7);
+    tar.replace(512, content.size(), content);
+    const fs::path tarPath = testDir / "input.tar";
+    std::ofstream(tarPath, std::ios::binary) << tar;
+
+    Archive fromTar(imported);
+    fromTar.importTar(tarPath.string());
+    ASSERT_EQ(fromTar.getEntries().size(), 1u);
+    EXPECT_EQ(fromTar.find("dir/tar.txt")->originalSize, content.size());
+    fromTar.extract(outputDir.string());
+    std::ifstream extracted(outputDir / "dir" / "tar.txt");
+    std::getline(extracted, text);
+    EXPECT_EQ(text, "from tar");
+}
+
+#ifndef _WIN32
+TEST_F(ArchiveTest, TestSelfExtractingUsesEmbeddedStub) {
+    const fs::path sfx = testDir / "installer.bin";
+    archive->createSelfExtracting({testFile, exampleFile}, sfx.string());
+    ASSERT_TRUE(fs::exists(sfx));
+    EXPECT_FALSE(fs::exists(sfx.string() + ".tmp"));
+
+    const fs::path target = testDir / "sfx_out";
+    std::string command = "\"" + sfx.string() + "\" --silent --skip-exec \"" + target.string() + "\"";
+    ASSERT_EQ(std::system(command.c_str()), 0);
+
+    std::ifstream in(target / "example.txt");
+    std::string line;
+    std::getline(in, line);
+    EXPECT_EQ(line, "Example content for archive");
+    EXPECT_TRUE(fs::exists(target / "test.txt"));
+}
+
+TEST_F(ArchiveTest, TestStreamedArchiveThroughPipe) {
+    // One file large enough to get a trailing descriptor
+    const fs::path large = testDir / "large.bin";
+    std::string content(static_cast<size_t>(Archive::STREAMED_ENTRY_THRESHOLD) + 12345, '\0');
+    for (size_t i = 0; i < content.size(); i += 3) {
+        content[i] = static_cast<char>(i / 4096);
+    }
+    std::ofstream(large, std::ios::binary) << content;
+
+    std::ostringstream streamed;
+    archive->createStream(streamed, {testFile, large});
+    const std::string bytes = streamed.str();
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::thread writer([&] {
+        for (size_t done = 0; done < bytes.size();) {
+            ssize_t n = write(fds[1], bytes.data() + done, bytes.size() - done);
+            if (n <= 0) {
+                break;
+            }
+            done += static_cast<size_t>(n);
+        }
+        close(fds[1]);
+    });
+    Archive reader("-");
+    reader.setThreads(2);
+    reader.extractStream(fds[0], outputDir.string());
+    writer.join();
+    close(fds[0]);
+
+    std::ifstream in(outputDir / "large.bin", std::ios::binary);
+    std::string extracted((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    EXPECT_TRUE(extracted == content);
+    EXPECT_TRUE(fs::exists(outputDir / "test.txt"));
+
+    // The same bytes are a regular archive once stored in a file
+    std::ofstream(testArchiveName, std::ios::binary) << bytes;
+    Archive stored(testArchiveName);
+    auto entry = stored.find("large.bin");
+    ASSERT_TRUE(entry.has_value());
+    EXPECT_EQ(entry->originalSize, content.size());
+    stored.extract((testDir / "from_file").string());
+    EXPECT_EQ(fs::file_size(testDir / "from_file" / "large.bin"), content.size());
+}
+
+TEST_F(ArchiveTest, TestTruncatedArchiveFailsExtract) {
+    std::mt19937 random(7);
+    std::vector<fs::path> files;
+    for (int i = 0; i < 20; ++i) {
+        std::string content(8192, '\0');
+        for (auto& c : content) {
+            c = static_cast<char>(random());
+        }
+        files.push_back(testDir / ("file" + std::to_string(i) + ".bin"));
+        std::ofstream(files.back(), std::ios::binary) << content;
+    }
+    archive->create(files);
+    fs::resize_file(testArchiveName, fs::file_size(testArchiveName) / 2);
+
+    Archive truncated(testArchiveName);
+    EXPECT_THROW(truncated.extract((testDir / "from_file").string()), std::runtime_error);
+
+    std::FILE* in = std::fopen(testArchiveName.c_str(), "rb");
+    ASSERT_NE(in, nullptr);
+    Archive reader("-");
+    EXPECT_THROW(reader.extractStream(fileno(in), (testDir / "from_stream").string()), std::runtime_error);
+    std::fclose(in);
+}
+
+TEST_F(ArchiveTest, TestRunInPlaceStartsCommandAfterLaunchSet) {
+    const fs::path sfx = testDir / "tool.bin";
+    AutoExecConfig autoExec;
+    autoExec.command = "cat test.txt > launched.txt";
+    autoExec.runInPlace = true;
+    autoExec.launchEntries = {"test.txt"};
+    archive->createSelfExtracting({testFile, exampleFile}, sfx.string(), CompressionType::Normal, autoExec);
+
+    const fs::path target = testDir / "in_place";
+    std::string command = "\"" + sfx.string() + "\" --silent \"" + target.string() + "\"";
+    ASSERT_EQ(std::system(command.c_str()), 0);
+
+    // The launch entry was there when the command ran; the rest followed
+    std::ifstream in(target / "launched.txt");
+    std::string line;
+    std::getline(in, line);
+    EXPECT_EQ(line, "Test content for archive");
+    EXPECT_TRUE(fs::exists(target / "example.txt"));
+}
+TEST_F(ArchiveTest, TestServeEntriesOverHttp) {
+    // One zlib and one stored entry, without an index
+    const std::string text = "Test content for archive\n";
+    const std::string stored = "0123456789abcdef";
+    const std::vector<char> zlibPayload = Archive::compressData(text.data(), text.size(), CompressionType::Normal);
+    std::string bytes(ENTRY_PREFIX_SIZE, '\0');
+    ArchiveFormat::encodeArchiveHeader(reinterpret_cast<uint8_t*>(&bytes[0]));
+    auto addEntry = [&](const std::string& name, uint8_t codec, const std::string& data, const std::string& payload) {
+        EntryHeader header;
+        header.flags = ENTRY_FLAG_CRC32;
+        header.codec = codec;
+        header.crc32 = static_cast<uint32_t>(crc32(0L, reinterpret_cast<const Bytef*>(data.data()),
+                                                   static_cast<uInt>(data.size())));
+        header.nameLength = static_cast<uint32_t>(name.size());
+        header.compressedSize = payload.size();
+        header.originalSize = data.size();
+        uint8_t encoded[MAX_ENTRY_HEADER_SIZE];
+        bytes.append(reinterpret_cast<const char*>(encoded), ArchiveFormat::encodeEntryHeader(header, encoded));
+        bytes += name + payload;
+    };
+    addEntry("test.txt", CODEC_ZLIB, text, std::string(zlibPayload.begin(), zlibPayload.end()));
+    addEntry("stored.bin", CODEC_STORED, stored, stored);
+    const std::string mixed = (testDir / "mixed.arc").string();
+    std::ofstream(mixed, std::ios::binary) << bytes;
+
+    ServeOptions options;
+    options.port = 0;
+    options.threads = 2;
+    ArchiveServer server(mixed, options);
+    EXPECT_EQ(server.entryCount(), 2u);
+    const uint16_t port = server.listen();
+    std::thread serving([&] { server.serve(); });
+
+    auto get = [&](const std::string& path, const std::string& headers) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        std::string response;
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+            const std::string request = "GET " + path + " HTTP/1.1\r\nConnection: close\r\n" + headers + "\r\n";
+            EXPECT_EQ(send(fd, request.data(), request.size(), 0), static_cast<ssize_t>(request.size()));
+            char chunk[4096];
+            for (ssize_t n; (n = recv(fd, chunk, sizeof(chunk), 0)) > 0;) {
+                response.append(chunk, static_cast<size_t>(n));
+            }
+        }
+        close(fd);
+        return response;
+    };
+    auto body = [](const std::string& response) { return response.substr(response.find("\r\n\r\n") + 4); };
+
+    // zlib data goes out untouched to clients that take deflate
+    std::string response = get("/test.txt", "Accept-Encoding: gzip, deflate\r\n");
+    EXPECT_EQ(response.rfind("HTTP/1.1 200 OK\r\n", 0), 0u);
+    EXPECT_NE(response.find("Content-Encoding: deflate\r\n"), std::string::npos);
+    const std::string compressed = body(response);
+    EXPECT_EQ(compressed.size(), zlibPayload.size());
+    std::vector<char> inflated(64);
+    uLongf inflatedSize = static_cast<uLongf>(inflated.size());
+    ASSERT_EQ(uncompress(reinterpret_cast<Bytef*>(inflated.data()), &inflatedSize,
+                         reinterpret_cast<const Bytef*>(compressed.data()), static_cast<uLong>(compressed.size())),
+              Z_OK);
+    EXPECT_EQ(std::string(inflated.data(), inflatedSize), text);
+
+    EXPECT_EQ(body(get("/test.txt", "")), text);
+    response = get("/stored.bin", "Range: bytes=4-7\r\n");
+    EXPECT_EQ(response.rfind("HTTP/1.1 206 Partial Content\r\n", 0), 0u);
+    EXPECT_NE(response.find("Content-Range: bytes 4-7/16\r\n"), std::string::npos);
+    EXPECT_EQ(body(response), "4567");
+    EXPECT_EQ(body(get("/stored.bin", "Range: bytes=-3\r\n")), "def");
+    EXPECT_EQ(get("/stored.bin", "Range: bytes=99-\r\n").rfind("HTTP/1.1 416", 0), 0u);
+    EXPECT_EQ(get("/missing", "").rfind("HTTP/1.1 404", 0), 0u);
+
+    server.stop();
+    serving.join();
+}
+#endif
@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+#include "DirectoryScanner.h"
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+class DirectoryScannerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        rootDir = fs::temp_directory_path() / "archive_scanner_test";
+        fs::remove_all(rootDir);
+        for (int d = 0; d < 5; ++d) {
+            fs::path dir = rootDir / ("dir" + std::to_string(d)) / "nested";
+            fs::create_directories(dir);
+            for (int f = 0; f < 20; ++f) {
+                std::ofstream(dir / ("file" + std::to_string(f) + ".txt")) << f;
+                std::ofstream(dir.parent_path() / ("top" + std::to_string(f) + ".txt")) << f;
+            }
+        }
+        fs::create_directories(rootDir / "empty");
+    }
+
+    void TearDown() override {
+        try {
+            fs::remove_all(rootDir);
+        } catch (const std::exception& e) {
+            std::cerr << "Warning: Failed to clean up test files: " << e.what() << std::endl;
+        }
+    }
+
+    fs::path rootDir;
+};
+
+TEST_F(DirectoryScannerTest, MatchesRecursiveIterator) {
+    std::vector<fs::path> expected;
+    for (const auto& entry : fs::recursive_directory_iterator(rootDir)) {
+        if (fs::is_regular_file(entry)) {
+            expected.push_back(entry.path());
+        }
+    }
+    std::sort(expected.begin(), expected.end());
+
+    DirectoryScanner scanner(3);
+    auto files = scanner.scan({rootDir});
+    std::sort(files.begin(), files.end());
+    EXPECT_EQ(files, expected);
+}
+
+TEST_F(DirectoryScannerTest, DeduplicatesOverlappingRoots) {
+    DirectoryScanner scanner(2);
+    fs::path single = rootDir / "dir0" / "top0.txt";
+    auto files = scanner.scan({rootDir, rootDir / "dir0", single});
+    EXPECT_EQ(files.size(), 200u);
+    EXPECT_TRUE(std::is_sorted(files.begin(), files.end(),
+                               [](const fs::path& a, const fs::path& b) { return a.string() < b.string(); }));
+    EXPECT_EQ(std::adjacent_find(files.begin(), files.end()), files.end());
+}